@@ -1,6 +1,10 @@
 #pragma once
 
+#ifdef GRIDTILES_HEADLESS
+#include "graphics/opengl/headlessGL.h"
+#else
 #include <GL/glew.h>
+#endif
 #include <vector>
 #include <string>
 
@@ -15,6 +19,12 @@ typedef unsigned int GLID;
 #include "math/utils.h"
 
 
+#define ASSERT(x) if (!(x)) throw std::logic_error("Assert failed")
+
+#ifdef GRIDTILES_HEADLESS
+// Headless builds have no OpenGL context, all GL calls are compiled out
+#define glCall(x) {}
+#else
 inline bool glLogCall(const char* func, const char* file, int line) {
 	bool response = true;
 	unsigned int error = glGetError();
@@ -25,5 +35,5 @@ inline bool glLogCall(const char* func, const char* file, int line) {
 	}
 	return response;
 }
-#define ASSERT(x) if (!(x)) throw std::logic_error("Assert failed")
-#define glCall(x) {while (glGetError() != GL_NO_ERROR); x; ASSERT(glLogCall(#x, __FILE__, __LINE__));}
\ No newline at end of file
+#define glCall(x) {while (glGetError() != GL_NO_ERROR); x; ASSERT(glLogCall(#x, __FILE__, __LINE__));}
+#endif
\ No newline at end of file
@@ -4,9 +4,11 @@
 #include "SSPG_Random.h"
 #include "SSPG_TemplateMatch.h"
 #include "SSPG_Sift.h"
+#include "SSPG_PatchMatch.h"
 
 std::unordered_map<SSPGIndex, SRef<SSPG>> SSPG::get = {
 	{ SSPG_Random::ID, std::make_shared<SSPG_Random>() },
 	{ SSPG_TemplateMatch::ID, std::make_shared<SSPG_TemplateMatch>() },
-	{ SSPG_Sift::ID, std::make_shared<SSPG_Sift>() }
+	{ SSPG_Sift::ID, std::make_shared<SSPG_Sift>() },
+	{ SSPG_PatchMatch::ID, std::make_shared<SSPG_PatchMatch>() }
 };
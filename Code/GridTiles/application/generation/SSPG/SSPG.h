@@ -7,7 +7,8 @@ typedef int SSPGIndex;
 enum SSPGIndex_ {
 	SSPGIndex_Random,
 	SSPGIndex_TemplateMatch,
-	SSPGIndex_Sift
+	SSPGIndex_Sift,
+	SSPGIndex_PatchMatch
 };
 
 struct SSPG {
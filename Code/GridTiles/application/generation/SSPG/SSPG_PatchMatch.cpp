@@ -0,0 +1,43 @@
+#include <core.h>
+#include "SSPG_PatchMatch.h"
+
+#include "main.h"
+#include "matching/patchMatcher.h"
+
+void SSPG_PatchMatch::renderSettings(Canvas& source, Canvas& target) {
+	static std::array<const char*, 6> metrics = {
+		"SQDIFF",
+		"SQDIFF_NORMED",
+		"CCORR",
+		"CCORR_NORMED",
+		"CCOEFF",
+		"CCOEFF_NORMED",
+	};
+	ImGui::Combo("Distance metric", &metric, metrics.data(), metrics.size());
+	ImGui::SliderInt("Iterations", &settings.patchMatchIterations, 1, 32);
+	ImGui::InputInt("Seed", &seed);
+}
+
+void SSPG_PatchMatch::mutate(std::vector<MondriaanPatch>& patches) {
+	settings.source.clearReservations();
+
+	// All patches are searched at once
+	std::vector<cv::Rect> patchBounds;
+	for (MondriaanPatch& patch : patches)
+		patchBounds.push_back(patch.targetBounds().cv());
+
+	PatchMatcher::Parameters parameters;
+	parameters.iterations = settings.patchMatchIterations;
+	parameters.candidates = settings.placementCandidates;
+	parameters.seed = static_cast<std::uint32_t>(seed);
+	std::vector<MatchCandidate> placements = PatchMatcher::match(patchBounds, static_cast<cv::TemplateMatchModes>(metric), parameters);
+
+	for (std::size_t patchIndex = 0; patchIndex < patches.size(); patchIndex++) {
+		const MatchCandidate& placement = placements[patchIndex];
+		if (!placement.valid())
+			continue;
+
+		patches[patchIndex].sourceOffset = placement.position;
+		patches[patchIndex].rotationIndex = placement.rotationIndex;
+	}
+}
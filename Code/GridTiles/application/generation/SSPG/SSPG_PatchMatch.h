@@ -0,0 +1,15 @@
+#pragma once
+#include "SSPG.h"
+
+struct SSPG_PatchMatch : public SSPG {
+	inline static SSPGIndex ID = SSPGIndex_PatchMatch;
+
+	int metric = 1;
+	int seed = 0;
+
+	SSPG_PatchMatch() = default;
+
+	void renderSettings(Canvas& source, Canvas& target) override;
+
+	void mutate(std::vector<MondriaanPatch>& patches) override;
+};
@@ -1,11 +1,11 @@
 #include <core.h>
 #include "SSPG_TemplateMatch.h"
 
-#include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
 #include "thread_pool/thread_pool.hpp"
 
 #include "main.h"
+#include "graphics/opencv/sobel.h"
 
 void SSPG_TemplateMatch::renderSettings(Canvas& source, Canvas& target) {
 	ImGui::SliderInt("Interdistance##Source", &interdistance, 10, 500);
@@ -22,16 +22,29 @@ void SSPG_TemplateMatch::renderSettings(Canvas& source, Canvas& target) {
 }
 
 void SSPG_TemplateMatch::mutate(std::vector<MondriaanPatch>& patches) {
-	float distribution[2];
+	std::vector<float> distribution(2);
 	distribution[FeatureIndex_Intensity] = settings.intensityWeight;
 	distribution[FeatureIndex_Edge] = settings.edgeWeight;
 
+	// Every searched rotation reads the stored features and placements of the source, with rotated templates only the
+	// unrotated features are stored
+	if (settings.source.rotateTemplates) {
+		Log::error("Template match seeding needs the rotated source features, disable rotated templates");
+		return;
+	}
+	int searchedRotations = std::min(rotations, settings.source.featureRotations());
+
 	// Reset global mask
 	settings.mask.data = cv::Mat(settings.source->rows(), settings.source->cols(), CV_8UC1, cv::Scalar(255));
+	settings.source.clearReservations();
 
 	// Target feature mask array
-	cv::Mat* rotatedTargetFeatureMasks = new cv::Mat[rotations];
-	cv::Mat* patchFeatureResponses = new cv::Mat[patches.size()];
+	std::vector<cv::Mat> rotatedTargetFeatureMasks(rotations);
+
+	// Weighted response and best offset of every rotation, the responses are reused by all patches
+	std::vector<cv::Mat> weightedResponses(rotations);
+	std::vector<double> rotationValues(rotations);
+	std::vector<cv::Point> rotationPoints(rotations);
 
 	// Thread pool
 	thread_pool threadPool;
@@ -43,17 +56,14 @@ void SSPG_TemplateMatch::mutate(std::vector<MondriaanPatch>& patches) {
 		cv::Mat originalTargetFeatureMask = cv::Mat(targetBounds.height(), targetBounds.width(), CV_8UC1, cv::Scalar(255));
 		//cv::imshow("Original feature mask", originalTargetFeatureMask);
 
-		cv::Point bestPoint;
-		int bestRotationIndex;
-		double bestValue = (metric == cv::TM_SQDIFF || metric == cv::TM_SQDIFF_NORMED) ? std::numeric_limits<double>::infinity() : 0;
-
 		std::size_t featureCount = settings.target.features.size();
 
 		//threadPool.parallelize_loop(0, rotations, [&] (const int& start, const int& end) {
 #pragma omp parallel for
-			for (int rotationIndex = /*start*/0; rotationIndex < /*end*/rotations; rotationIndex++) {
+			for (int rotationIndex = /*start*/0; rotationIndex < /*end*/searchedRotations; rotationIndex++) {
 				cv::Size rotatedBounds;
 				cv::Mat transformationMatrix;
+				rotationPoints[rotationIndex] = cv::Point(-1, -1);
 
 				// Create rotated version of mask and bounds
 				if (rotationIndex == 0) {
@@ -68,77 +78,70 @@ void SSPG_TemplateMatch::mutate(std::vector<MondriaanPatch>& patches) {
 					//cv::waitKey();
 				}
 
-				// Collect feature responses
-				int featureCols = settings.source->cols() - rotatedBounds.width + 1;
-				int featureRows = settings.source->rows() - rotatedBounds.height + 1;
-				cv::Mat weightedResponse(featureRows, featureCols, CV_32F, cv::Scalar(0.0));
+				// Offsets where the rotated patch lies within unreserved material
+				cv::Mat filteredMaskRegion = settings.source.placement(rotationIndex).mask(rotatedBounds);
+				if (filteredMaskRegion.empty())
+					continue;
 
-				#pragma omp parallel for
-				for (int featureIndex = 0; featureIndex < featureCount; featureIndex++) {
-					cv::Mat sourceFeature = settings.source.features[rotationIndex][featureIndex].data;
-					//assert(sourceFeature.cols == settings.source->cols());
-					//assert(sourceFeature.rows == settings.source->rows());
-					
-					cv::Mat targetFeaturePatch = settings.target[featureIndex].data(targetBounds.cv());
+				// Material that is still available in this rotation, offsets covering reserved material are aborted
+				cv::Mat availableMaterial = settings.source.placement(rotationIndex).available();
 
-					// Calculate rotated feature patch
-					cv::Mat rotatedTargetFeaturePatch;
-					if (rotationIndex == 0)
-						rotatedTargetFeaturePatch = targetFeaturePatch;
-					else
-						cv::warpAffine(targetFeaturePatch, rotatedTargetFeaturePatch, transformationMatrix, rotatedBounds);
-
-					// Find best match
-					cv::Mat response;
-					cv::matchTemplate(sourceFeature, rotatedTargetFeaturePatch, response, this->metric, rotatedTargetFeatureMasks[rotationIndex].clone());
-
-					//cv::imshow("response", response);
-					//cv::imshow("source feature", sourceFeature);
-					//cv::imshow("rotated target feature patch", rotatedTargetFeaturePatch);
-					//cv::imshow("rotated target feature mask", rotatedTargetFeatureMasks[rotationIndex]);
-					//cv::waitKey();
+				// Rotated target feature patches
+				std::vector<cv::Mat> sourceFeatures(featureCount);
+				std::vector<cv::Mat> rotatedTargetFeaturePatches(featureCount);
+				for (int featureIndex = 0; featureIndex < featureCount; featureIndex++) {
+					sourceFeatures[featureIndex] = settings.source.features[rotationIndex][featureIndex].data;
 
-					// Add weighted response to total
-					cv::addWeighted(weightedResponse, 1.0, response, distribution[featureIndex], 0.0, weightedResponse);
+					cv::Mat targetFeaturePatch = settings.target[featureIndex].data(targetBounds.cv());
+					if (rotationIndex == 0) {
+						rotatedTargetFeaturePatches[featureIndex] = targetFeaturePatch;
+					} else {
+						cv::warpAffine(targetFeaturePatch, rotatedTargetFeaturePatches[featureIndex], transformationMatrix, rotatedBounds);
+
+						// Gradient fields turn along with the pixels
+						if (rotatedTargetFeaturePatches[featureIndex].channels() == 2)
+							rotatedTargetFeaturePatches[featureIndex] = Sobel::steer(rotatedTargetFeaturePatches[featureIndex], transformationMatrix);
+					}
 				}
 
+				// All features are weighted and summed in a single pass into the response of this rotation
+				cv::Mat& weightedResponse = weightedResponses[rotationIndex];
+				Utils::matchTemplate(sourceFeatures,
+				                     rotatedTargetFeaturePatches,
+				                     std::vector<float>(distribution.begin(), distribution.begin() + featureCount),
+				                     weightedResponse,
+				                     this->metric,
+				                     rotatedTargetFeatureMasks[rotationIndex],
+				                     availableMaterial);
+
 				// Find min or max value
-				double value;
-				cv::Point point;
-
-				cv::Mat filteredMaskRegion;
-				cv::boxFilter(settings.mask.data, filteredMaskRegion, -1, cv::Size(rotatedBounds.width, rotatedBounds.height), cv::Point(0, 0), true, cv::BORDER_ISOLATED);
-				cv::threshold(filteredMaskRegion, filteredMaskRegion, 254, 255, cv::THRESH_BINARY);
-				/*cv::imshow("Mask", filteredMaskRegion);
-				cv::waitKey();*/
-				if (metric == cv::TM_SQDIFF || metric == cv::TM_SQDIFF_NORMED) {
-					//cv::imshow("Response", weightedResponse);
-					//cv::waitKey();
-					cv::minMaxLoc(weightedResponse, &value, nullptr, &point, nullptr, filteredMaskRegion(cv::Rect(0, 0, weightedResponse.cols, weightedResponse.rows)));
-					if (value < bestValue) {
-						bestValue = value;
-						bestPoint = point;
-						bestRotationIndex = rotationIndex;
-					}
-				} else {
-					cv::minMaxLoc(weightedResponse, nullptr, &value, nullptr, &point, filteredMaskRegion(cv::Rect(0, 0, weightedResponse.cols, weightedResponse.rows)));
-					if (value > bestValue) {
-						bestValue = value;
-						bestPoint = point;
-						bestRotationIndex = rotationIndex;
-					}
-				}
+				cv::Mat responseMask = filteredMaskRegion(cv::Rect(0, 0, weightedResponse.cols, weightedResponse.rows));
+				if (metric == cv::TM_SQDIFF || metric == cv::TM_SQDIFF_NORMED)
+					cv::minMaxLoc(weightedResponse, &rotationValues[rotationIndex], nullptr, &rotationPoints[rotationIndex], nullptr, responseMask);
+				else
+					cv::minMaxLoc(weightedResponse, nullptr, &rotationValues[rotationIndex], nullptr, &rotationPoints[rotationIndex], responseMask);
 			}
 		//});
 
+		// Reduce the rotations in order, so ties always resolve to the lowest rotation
+		cv::Point bestPoint(-1, -1);
+		int bestRotationIndex = 0;
+		double bestValue = 0.0;
+		for (int rotationIndex = 0; rotationIndex < searchedRotations; rotationIndex++) {
+			if (rotationPoints[rotationIndex].x == -1)
+				continue;
+
+			double value = rotationValues[rotationIndex];
+			bool better = metric == cv::TM_SQDIFF || metric == cv::TM_SQDIFF_NORMED ? value < bestValue : value > bestValue;
+			if (bestPoint.x == -1 || better) {
+				bestValue = value;
+				bestPoint = rotationPoints[rotationIndex];
+				bestRotationIndex = rotationIndex;
+			}
+		}
+
 		if (bestPoint.x == -1 && bestPoint.y == -1) {
 			Log::error("No patches available");
-			cv::imshow("Mask", settings.mask.data);
-			cv::Mat filteredMaskRegion;
-			cv::boxFilter(settings.mask.data, filteredMaskRegion, -1, cv::Size(targetBounds.dimension().x, targetBounds.dimension().y), cv::Point(0, 0), true, cv::BORDER_ISOLATED);
-			cv::threshold(filteredMaskRegion, filteredMaskRegion, 254, 255, cv::THRESH_BINARY);
-			cv::imshow("Filtered mask", filteredMaskRegion);
-			cv::waitKey();
 			return;
 		}
 
@@ -149,6 +152,18 @@ void SSPG_TemplateMatch::mutate(std::vector<MondriaanPatch>& patches) {
 		cv::Rect roi = cv::Rect(bestPoint.x, bestPoint.y, bestRotatedMaskInverse.cols, bestRotatedMaskInverse.rows);
 		cv::bitwise_and(settings.mask.data(roi), bestRotatedMaskInverse, settings.mask.data(roi));
 
+		// Reserve the rotated patch in all rotations of the source
+		float width = static_cast<float>(targetBounds.width() - 1);
+		float height = static_cast<float>(targetBounds.height() - 1);
+		std::vector<cv::Point2f> reservedPolygon = { cv::Point2f(0, 0), cv::Point2f(width, 0), cv::Point2f(width, height), cv::Point2f(0, height) };
+		if (bestRotationIndex != 0) {
+			float degrees = 360.0f * static_cast<float>(bestRotationIndex) / static_cast<float>(rotations);
+			cv::transform(reservedPolygon, reservedPolygon, RotatedTexture::computeTransformationMatrix(targetBounds.dimension().cv(), degrees));
+		}
+		for (cv::Point2f& point : reservedPolygon)
+			point += cv::Point2f(bestPoint.x, bestPoint.y);
+		settings.source.reserve(bestRotationIndex, reservedPolygon);
+
 		// Move seedpoint
 		patch.sourceOffset = Vec2(bestPoint.x, bestPoint.y);
 		//patch.sourceRotation = 360.0f * static_cast<float>(bestRotationIndex) / static_cast<float>(rotations);
@@ -96,11 +96,11 @@ Vec2 MondriaanPatch::targetDimension() const {
 }
 
 Bounds MondriaanPatch::sourceUV() const {
-	return settings.source.textures[rotationIndex].bounds().subBoundsUV(sourceBounds());
+	return settings.source.bounds(rotationIndex).subBoundsUV(sourceBounds());
 }
 
 Bounds MondriaanPatch::sourceRotatedUV() const {
-	return settings.source.textures[rotationIndex].bounds().subBoundsUV(sourceRotatedBounds());
+	return settings.source.bounds(rotationIndex).subBoundsUV(sourceRotatedBounds());
 }
 
 Bounds MondriaanPatch::targetUV() const {
@@ -292,6 +292,14 @@ std::vector<Vec2> MondriaanPatch::sourceRotatedPoints(bool invert) const {
 	return std::vector{rotated(sourceBounds[0]), rotated(sourceBounds[1]), rotated(sourceBounds[2]), rotated(sourceBounds[3])};
 }
 
+Obb MondriaanPatch::sourceRotatedObb(bool invert) const {
+	Vec2 axis = settings.source.axes[rotationIndex];
+	if (invert)
+		axis.y = -axis.y;
+
+	return Obb { this->sourceRotatedBounds().center(), axis, this->sourceBounds().dimension() / 2.0 };
+}
+
 std::vector<Vec2> MondriaanPatch::sourceRotatedPointsRelative2f(bool invert) const {
 	Bounds sourceBounds = this->sourceBoundsRelative();
 	Vec2 sourceBoundsCenter = sourceBounds.center();
@@ -2,6 +2,7 @@
 #include <opencv2/imgproc.hpp>
 
 #include "patch.h"
+#include "util/sat.h"
 
 struct MondriaanPatch {
 public:
@@ -15,6 +16,10 @@ public:
 	Vec2i dimension_px;
 	// Rotation index
 	int rotationIndex;
+	// Whether the source offset and rotation are a placement found by matching, only those are reserved
+	bool matched = false;
+	// Board of the material library the placement is cut from, -1 for the source
+	int boardIndex = -1;
 
 
 	// Last computed match
@@ -49,6 +54,8 @@ public:
 
 	std::vector<Vec2> sourcePoints() const;
 	std::vector<Vec2> sourceRotatedPoints(bool invert = false) const;
+	// Oriented box with the same corners as sourceRotatedPoints, without allocating
+	Obb sourceRotatedObb(bool invert = false) const;
 	std::vector<Vec2> sourceRotatedPointsRelative2f(bool invert = false) const;
 	std::vector<Vec2> targetPoints() const;
 };
\ No newline at end of file
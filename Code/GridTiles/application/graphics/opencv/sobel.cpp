@@ -25,6 +25,23 @@ cv::Mat Sobel::computeSobel(const cv::Mat& source, const SobelType& type, int de
 		return sobelMagnitude;
 	}
 
+	if (type == SobelType::GRADIENT) {
+		// Derivatives of 8 bit planes in fixed point with 3 fractional bits, 255 * 8 stays within Utils::quantizedMaximum
+		cv::Mat derivativeKernel;
+		cv::Mat smoothingKernel;
+		cv::getDerivKernels(derivativeKernel, smoothingKernel, 1, 0, size, false, CV_32F);
+		double gain = 0.5 * cv::norm(derivativeKernel, cv::NORM_L1) * cv::norm(smoothingKernel, cv::NORM_L1);
+
+		cv::Mat sobelX;
+		cv::Mat sobelY;
+		cv::Sobel(source, sobelX, CV_16S, 1, 0, size, 8.0 / gain);
+		cv::Sobel(source, sobelY, CV_16S, 0, 1, size, 8.0 / gain);
+
+		cv::merge(std::vector { sobelX, sobelY }, result);
+
+		return result;
+	}
+
 	int dx = type == SobelType::X || type == SobelType::XY ? derivative : 0;
 	int dy = type == SobelType::Y || type == SobelType::XY ? derivative : 0;
 	cv::Sobel(source, result, CV_16U, dx, dy, size);
@@ -33,6 +50,22 @@ cv::Mat Sobel::computeSobel(const cv::Mat& source, const SobelType& type, int de
 	return result;
 }
 
+cv::Mat Sobel::steer(const cv::Mat& gradient, const cv::Mat& transformation) {
+	cv::Mat steered;
+	gradient.convertTo(steered, CV_32F);
+	cv::transform(steered, steered, transformation(cv::Rect(0, 0, 2, 2)));
+
+	// A rotation stays within steeredMaximum, transformations that also scale are clamped to the range of the integer kernels
+	cv::Mat components = steered.reshape(1);
+	cv::max(components, -Utils::steeredMaximum, components);
+	cv::min(components, Utils::steeredMaximum, components);
+
+	cv::Mat result;
+	steered.convertTo(result, gradient.type());
+
+	return result;
+}
+
 Sobel::Sobel(const cv::Mat& texture, const SobelType& type, int derivative, int size) {
 	this->type = type;
 	this->sobel = computeSobel(texture, type, derivative, size);
@@ -6,7 +6,9 @@ enum class SobelType {
 	X,
 	Y,
 	XY,
-	MAGNITUDE
+	MAGNITUDE,
+	// Both first derivatives as the channels of a quantized 16 bit plane, a steerable basis of the derivative in any direction
+	GRADIENT
 };
 
 class Sobel {
@@ -17,4 +19,9 @@ public:
 	Sobel(const cv::Mat& texture, const SobelType& type, int derivative = 1, int size = 3);
 
 	static cv::Mat computeSobel(const cv::Mat& source, const SobelType& type, int derivative, int size);
+
+	// Gradient field after transforming the image by the given affine transformation, evaluated at the untransformed pixels.
+	// The gradients of a rotated image are the rotated gradients, so every pixel is a linear combination of its two channels.
+	// The components of the result stay within Utils::steeredMaximum
+	static cv::Mat steer(const cv::Mat& gradient, const cv::Mat& transformation);
 };
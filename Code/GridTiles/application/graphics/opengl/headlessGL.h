@@ -0,0 +1,13 @@
+#pragma once
+
+// Headless builds do not depend on OpenGL, only the constants textures store as their upload settings are defined.
+// The values are those of the OpenGL specification, so both builds store the same settings
+#define GL_UNSIGNED_BYTE 0x1401
+#define GL_FLOAT 0x1406
+#define GL_TEXTURE_2D 0x0DE1
+#define GL_RGBA 0x1908
+#define GL_LUMINANCE 0x1909
+#define GL_BGR 0x80E0
+#define GL_LINEAR 0x2601
+#define GL_LINEAR_MIPMAP_LINEAR 0x2703
+#define GL_REPEAT 0x2901
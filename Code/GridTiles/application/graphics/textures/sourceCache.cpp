@@ -0,0 +1,195 @@
+#include "core.h"
+#include "sourceCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+
+// Planes start at a multiple of the cache line size
+static constexpr std::size_t alignment = 64;
+static constexpr char magic[4] = { 'G', 'T', 'S', 'C' };
+
+struct CacheHeader {
+	char magic[4];
+	std::uint32_t version;
+	std::uint64_t sourceHash;
+	std::uint64_t featureHash;
+	std::int32_t rotations;
+	std::int32_t featureCount;
+};
+
+// Every rotation stores its transformation, texture, mask and features in this order
+struct CachePlane {
+	std::int32_t rows;
+	std::int32_t cols;
+	std::int32_t type;
+	std::int32_t padding;
+	std::uint64_t offset;
+};
+
+static std::size_t align(std::size_t offset) {
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+std::uint64_t SourceCache::hash(const std::vector<cv::Mat>& planes, std::uint64_t seed) {
+	std::uint64_t result = 0xcbf29ce484222325ull ^ seed;
+	auto mix = [&result](std::uint64_t value) {
+		result = ((result << 5 | result >> 59) ^ value) * 0x9e3779b97f4a7c15ull;
+	};
+
+	for (const cv::Mat& plane : planes) {
+		mix(plane.rows);
+		mix(plane.cols);
+		mix(plane.type());
+
+		std::size_t rowSize = plane.cols * plane.elemSize();
+		for (int row = 0; row < plane.rows; row++) {
+			const uchar* data = plane.ptr<uchar>(row);
+
+			std::size_t index = 0;
+			for (; index + sizeof(std::uint64_t) <= rowSize; index += sizeof(std::uint64_t)) {
+				std::uint64_t word;
+				std::memcpy(&word, data + index, sizeof(std::uint64_t));
+				mix(word);
+			}
+
+			for (; index < rowSize; index++)
+				mix(data[index]);
+		}
+	}
+
+	return result;
+}
+
+std::string SourceCache::path(const std::string& directory, std::uint64_t sourceHash, int rotations) {
+	char name[64];
+	std::snprintf(name, sizeof(name), "source_%016llx_%d.cache", static_cast<unsigned long long>(sourceHash), rotations);
+
+	return (std::filesystem::path(directory) / name).string();
+}
+
+bool SourceCache::load(const std::string& path, std::uint64_t sourceHash, int rotations, Stack& stack) {
+	URef<MappedFile> mapping = MappedFile::open(path);
+	if (mapping == nullptr || mapping->size() < sizeof(CacheHeader))
+		return false;
+
+	CacheHeader header;
+	std::memcpy(&header, mapping->data(), sizeof(CacheHeader));
+	if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version)
+		return false;
+	if (header.sourceHash != sourceHash || header.rotations != rotations || header.featureCount < 0)
+		return false;
+
+	std::size_t planesPerRotation = 3 + header.featureCount;
+	std::size_t planeCount = rotations * planesPerRotation;
+	if (mapping->size() < sizeof(CacheHeader) + planeCount * sizeof(CachePlane))
+		return false;
+
+	std::vector<cv::Mat> planes;
+	for (std::size_t planeIndex = 0; planeIndex < planeCount; planeIndex++) {
+		CachePlane plane;
+		std::memcpy(&plane, mapping->data() + sizeof(CacheHeader) + planeIndex * sizeof(CachePlane), sizeof(CachePlane));
+
+		if (plane.rows <= 0 || plane.cols <= 0 || plane.type != CV_MAT_TYPE(plane.type))
+			return false;
+
+		std::size_t planeSize = static_cast<std::size_t>(plane.rows) * plane.cols * CV_ELEM_SIZE(plane.type);
+		if (plane.offset % alignment != 0 || plane.offset + planeSize > mapping->size())
+			return false;
+
+		planes.emplace_back(plane.rows, plane.cols, plane.type, mapping->data() + plane.offset);
+	}
+
+	stack = Stack();
+	for (int rotationIndex = 0; rotationIndex < rotations; rotationIndex++) {
+		auto first = planes.begin() + rotationIndex * planesPerRotation;
+
+		stack.transformations.push_back(first[0]);
+		stack.textures.push_back(first[1]);
+		stack.masks.push_back(first[2]);
+		if (header.featureCount > 0)
+			stack.features.emplace_back(first + 3, first + planesPerRotation);
+	}
+	stack.featureHash = header.featureHash;
+	stack.mapping = std::move(mapping);
+
+	return true;
+}
+
+bool SourceCache::store(const std::string& path, std::uint64_t sourceHash, int rotations, const Stack& stack) {
+	std::size_t featureCount = stack.features.empty() ? 0 : stack.features.front().size();
+	if (stack.textures.size() != rotations || stack.masks.size() != rotations || stack.transformations.size() != rotations)
+		return false;
+	if (!stack.features.empty() && stack.features.size() != rotations)
+		return false;
+
+	std::vector<cv::Mat> planes;
+	for (int rotationIndex = 0; rotationIndex < rotations; rotationIndex++) {
+		planes.push_back(stack.transformations[rotationIndex]);
+		planes.push_back(stack.textures[rotationIndex]);
+		planes.push_back(stack.masks[rotationIndex]);
+		if (featureCount > 0) {
+			if (stack.features[rotationIndex].size() != featureCount)
+				return false;
+
+			planes.insert(planes.end(), stack.features[rotationIndex].begin(), stack.features[rotationIndex].end());
+		}
+	}
+
+	CacheHeader header;
+	std::memcpy(header.magic, magic, sizeof(magic));
+	header.version = version;
+	header.sourceHash = sourceHash;
+	header.featureHash = stack.featureHash;
+	header.rotations = rotations;
+	header.featureCount = static_cast<std::int32_t>(featureCount);
+
+	std::vector<CachePlane> table(planes.size());
+	std::size_t offset = align(sizeof(CacheHeader) + planes.size() * sizeof(CachePlane));
+	for (std::size_t planeIndex = 0; planeIndex < planes.size(); planeIndex++) {
+		const cv::Mat& plane = planes[planeIndex];
+		table[planeIndex] = { plane.rows, plane.cols, plane.type(), 0, offset };
+		offset = align(offset + plane.total() * plane.elemSize());
+	}
+
+	// Other processes may map the cache file at the same time, so it is never written in place
+	std::error_code error;
+	std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+	std::string temporaryPath = path + "." + std::to_string(std::random_device()()) + ".tmp";
+
+	{
+		std::ofstream file(temporaryPath, std::ios::binary);
+		if (!file.is_open())
+			return false;
+
+		file.write(reinterpret_cast<const char*>(&header), sizeof(CacheHeader));
+		file.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(CachePlane));
+
+		static const char zeros[alignment] = {};
+		for (std::size_t planeIndex = 0; planeIndex < planes.size(); planeIndex++) {
+			file.write(zeros, table[planeIndex].offset - static_cast<std::size_t>(file.tellp()));
+
+			const cv::Mat& plane = planes[planeIndex];
+			for (int row = 0; row < plane.rows; row++)
+				file.write(plane.ptr<char>(row), plane.cols * plane.elemSize());
+		}
+
+		if (!file.good()) {
+			file.close();
+			std::filesystem::remove(temporaryPath, error);
+
+			return false;
+		}
+	}
+
+	std::filesystem::rename(temporaryPath, path, error);
+	if (error) {
+		std::filesystem::remove(temporaryPath, error);
+
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "util/mappedFile.h"
+
+// On disk cache of the rotated textures, masks and features of a source texture.
+// A cache file belongs to a single prescaled source and rotation count and holds the features it was last stored with,
+// loading maps the file so every plane is a view into the page cache.
+class SourceCache {
+public:
+	// Increase whenever the layout of the file changes
+	static constexpr std::uint32_t version = 1;
+
+	// Planes of every rotation, the features are empty if none were stored
+	struct Stack {
+		std::vector<cv::Mat> textures;
+		std::vector<cv::Mat> masks;
+		std::vector<cv::Mat> transformations;
+		std::vector<std::vector<cv::Mat>> features;
+
+		// Hash of the unrotated features the stack was stored with
+		std::uint64_t featureHash = 0;
+
+		// Keeps the views of the planes alive
+		SRef<MappedFile> mapping;
+	};
+
+	// Hash of the dimension, type and pixels of the given planes
+	static std::uint64_t hash(const std::vector<cv::Mat>& planes, std::uint64_t seed = 0);
+
+	// Path of the cache file of the given source in the given directory
+	static std::string path(const std::string& directory, std::uint64_t sourceHash, int rotations);
+
+	// Maps the cache file, returns false if it does not exist or belongs to another source or version
+	static bool load(const std::string& path, std::uint64_t sourceHash, int rotations, Stack& stack);
+
+	// Writes the stack to a temporary file which atomically replaces the cache file
+	static bool store(const std::string& path, std::uint64_t sourceHash, int rotations, const Stack& stack);
+};
@@ -1,45 +1,83 @@
 #include "core.h"
 #include "sourceTexture.h"
 
+#include <atomic>
+
+#include "graphics/bounds.h"
+#include "graphics/opencv/sobel.h"
+
+// Versions are unique over all source textures, so a replaced source never reuses the version of its predecessor
+static std::uint64_t nextVersion() {
+	static std::atomic<std::uint64_t> counter = 0;
+
+	return ++counter;
+}
+
 SourceTexture::SourceTexture() {
 	this->rotations = 0;
 }
 
-SourceTexture::SourceTexture(cv::Mat texture, int rotations) {
+SourceTexture::SourceTexture(cv::Mat texture, int rotations, const std::string& cacheDirectory, bool rotateTemplates, bool upload) {
 	this->rotations = rotations;
+	this->axes = Sat::rotationAxes(rotations);
+	this->cacheDirectory = cacheDirectory;
+	this->rotateTemplates = rotateTemplates;
+	this->upload = upload;
 
-	cv::Size originalSize(texture.cols, texture.rows);
-	cv::Mat originalMask(originalSize, CV_8UC1, cv::Scalar(255));
+	// Map the rotated planes of a previous run, only the full rotated stacks are cached
+	if (!cacheDirectory.empty() && !rotateTemplates) {
+		this->sourceHash = SourceCache::hash({ texture });
 
-	for (int rotation = 0; rotation < rotations; rotation++) {
-		double angle = 360.0 / rotations * rotation;
+		SourceCache::Stack stack;
+		if (SourceCache::load(SourceCache::path(cacheDirectory, sourceHash, rotations), sourceHash, rotations, stack)) {
+			map(stack);
+			reloadTextures();
 
-		cv::Size rotatedSize = Utils::computeRotatedRect(originalSize, angle).size();
-		cv::Mat transformation = Utils::computeTransformationMatrix(originalSize, rotatedSize, angle);
+			return;
+		}
+	}
 
-		cv::Mat inverseTransformation;
-		cv::invertAffineTransform(transformation, inverseTransformation);
+	computeTransformations(cv::Size(texture.cols, texture.rows));
+	rotate(texture);
 
-		cv::Mat rotatedMask;
-		cv::warpAffine(originalMask, rotatedMask, transformation, rotatedSize);
+	reloadTextures();
+}
 
-		cv::Mat rotatedTexture;
-		cv::warpAffine(texture, rotatedTexture, transformation, rotatedSize);
+SourceTexture::SourceTexture(cv::Mat texture, const FeatureVector& features, int rotations) {
+	this->rotations = rotations;
+	this->axes = Sat::rotationAxes(rotations);
+
+	computeTransformations(cv::Size(texture.cols, texture.rows));
+	rotate(texture);
+
+	for (int rotationIndex = 0; rotationIndex < rotations; rotationIndex++) {
+		const cv::Mat& transformation = transformations[rotationIndex];
+
+		FeatureVector rotatedFeatureVector;
+		for (const Texture& feature : features) {
+			cv::Mat rotatedFeature;
+			cv::warpAffine(feature.data, rotatedFeature, transformation, sizes[rotationIndex]);
+			if (rotatedFeature.channels() == 2)
+				rotatedFeature = Sobel::steer(rotatedFeature, transformation);
+
+			rotatedFeatureVector.add(rotatedFeature);
+		}
 
-		this->masks.push_back(rotatedMask);
-		this->textures.push_back(rotatedTexture);
-		this->transformations.push_back(transformation);
-		this->inverseTransformations.push_back(inverseTransformation);
+		this->features.push_back(rotatedFeatureVector);
 	}
 
+	version = nextVersion();
+	matcher.reset(rotations);
+	pyramid.reset(rotations);
+	index.reset();
+
 	reloadTextures();
 }
 
-SourceTexture::SourceTexture(cv::Mat texture, const FeatureVector& features, int rotations) {
-	this->rotations = rotations;
-
-	cv::Size originalSize(texture.cols, texture.rows);
-	cv::Mat originalMask(originalSize, CV_8UC1, cv::Scalar(255));
+void SourceTexture::computeTransformations(const cv::Size& originalSize) {
+	transformations.clear();
+	inverseTransformations.clear();
+	sizes.clear();
 
 	for (int rotation = 0; rotation < rotations; rotation++) {
 		double angle = 360.0 / rotations * rotation;
@@ -50,35 +88,80 @@ SourceTexture::SourceTexture(cv::Mat texture, const FeatureVector& features, int
 		cv::Mat inverseTransformation;
 		cv::invertAffineTransform(transformation, inverseTransformation);
 
+		transformations.push_back(transformation);
+		inverseTransformations.push_back(inverseTransformation);
+		sizes.push_back(rotatedSize);
+	}
+}
+
+void SourceTexture::rotate(const cv::Mat& texture) {
+	textures.clear();
+	masks.clear();
+	placements.clear();
+	viewRotation = -1;
+
+	// Textures are filled directly, they are uploaded by reloadTextures
+	cv::Mat originalMask(texture.rows, texture.cols, CV_8UC1, cv::Scalar(255));
+	for (int rotationIndex = 0; rotationIndex < featureRotations(); rotationIndex++) {
 		cv::Mat rotatedMask;
-		cv::warpAffine(originalMask, rotatedMask, transformation, rotatedSize);
+		cv::warpAffine(originalMask, rotatedMask, transformations[rotationIndex], sizes[rotationIndex]);
 
 		cv::Mat rotatedTexture;
-		cv::warpAffine(texture, rotatedTexture, transformation, rotatedSize);
+		cv::warpAffine(texture, rotatedTexture, transformations[rotationIndex], sizes[rotationIndex]);
 
-		FeatureVector rotatedFeatureVector;
-		for (const Texture& feature : features) {
-			cv::Mat rotatedFeature;
-			cv::warpAffine(feature.data, rotatedFeature, transformation, rotatedSize);
+		masks.emplace_back().data = rotatedMask;
+		placements.push_back(std::make_unique<PlacementMask>(rotatedMask));
+		textures.emplace_back().data = rotatedTexture;
+	}
 
-			rotatedFeatureVector.add(rotatedFeature);
-		}
+	// The other rotations answer their placements from the first one
+	for (int rotationIndex = featureRotations(); rotationIndex < rotations; rotationIndex++)
+		placements.push_back(std::make_unique<PlacementMask>(*placements.front(), relativeTransformation(rotationIndex), sizes[rotationIndex]));
+}
 
-		this->masks.emplace_back(rotatedMask);
-		this->textures.emplace_back(rotatedTexture);
-		this->features.push_back(rotatedFeatureVector);
-		this->transformations.push_back(transformation);
-		this->transformations.push_back(inverseTransformation);
+cv::Mat SourceTexture::relativeTransformation(int rotationIndex) const {
+	cv::Mat result(2, 3, CV_64F);
+	const cv::Mat& transformation = transformations[rotationIndex];
+	const cv::Mat& firstInverse = inverseTransformations.front();
+	for (int row = 0; row < 2; row++) {
+		for (int col = 0; col < 3; col++) {
+			double value = col == 2 ? transformation.at<double>(row, 2) : 0.0;
+			for (int index = 0; index < 2; index++)
+				value += transformation.at<double>(row, index) * firstInverse.at<double>(index, col);
+
+			result.at<double>(row, col) = value;
+		}
 	}
 
-	reloadTextures();
+	return result;
 }
 
 void SourceTexture::setFeatures(const FeatureVector& features) {
+	// Only the full rotated stacks are cached
+	bool caching = !cacheDirectory.empty() && !rotateTemplates && textures.size() == static_cast<std::size_t>(rotations);
+
+	std::uint64_t featureHash = 0;
+	if (caching) {
+		std::vector<cv::Mat> planes;
+		for (const Texture& feature : features)
+			planes.push_back(feature.data);
+		featureHash = SourceCache::hash(planes, sourceHash);
+
+		// The mapped features were computed with the same source and feature settings
+		if (mapping != nullptr && this->featureHash == featureHash && this->features.size() == static_cast<std::size_t>(rotations)) {
+			matcher.reset(rotations);
+			pyramid.reset(rotations);
+			index.reset();
+			reloadTextures();
+
+			return;
+		}
+	}
+
 	this->features.clear();
 
-	for (int rotationIndex = 0; rotationIndex < rotations; rotationIndex++) {
-		cv::Size rotatedSize = cv::Size(masks[rotationIndex].data.cols, masks[rotationIndex].data.rows);
+	for (int rotationIndex = 0; rotationIndex < featureRotations(); rotationIndex++) {
+		cv::Size rotatedSize = sizes[rotationIndex];
 		cv::Mat transformation = transformations[rotationIndex];
 
 		FeatureVector rotatedFeatureVector;
@@ -87,15 +170,248 @@ void SourceTexture::setFeatures(const FeatureVector& features) {
 			cv::Mat rotatedFeature;
 			cv::warpAffine(feature.data, rotatedFeature, transformation, rotatedSize);
 
-			this->features[rotationIndex].add(rotatedFeature);
+			// Two channel features are gradient fields, their vectors turn along with the pixels
+			if (rotatedFeature.channels() == 2)
+				rotatedFeature = Sobel::steer(rotatedFeature, transformation);
+
+			// The masked correlation of rotated templates needs 8 bit or float planes, only a single rotation is stored
+			if (rotateTemplates && rotatedFeature.depth() == CV_16S)
+				rotatedFeature.convertTo(rotatedFeature, CV_32F);
+
+			this->features[rotationIndex].features.emplace_back().data = rotatedFeature;
 		}
 	}
 
+	version = nextVersion();
+	matcher.reset(rotations);
+	pyramid.reset(rotations);
+	index.reset();
+
+	if (caching) {
+		this->featureHash = featureHash;
+		store();
+	}
+
 	reloadTextures();
 }
 
-void SourceTexture::reloadTextures() {
+void SourceTexture::map(SourceCache::Stack& stack) {
+	// The mapped planes show the same material, the reservations carry over to the new placements
+	std::vector<cv::Mat> reservations;
+	if (reservationVersion != 0)
+		for (std::size_t rotationIndex = 0; rotationIndex < textures.size(); rotationIndex++)
+			reservations.push_back(placements[rotationIndex]->reservedMask());
+
+	textures.clear();
+	masks.clear();
+	features.clear();
+	transformations.clear();
+	inverseTransformations.clear();
+	sizes.clear();
+	placements.clear();
+	viewRotation = -1;
+
+	// Textures are filled directly, constructing them from a cv::Mat would copy the plane
 	for (int rotationIndex = 0; rotationIndex < rotations; rotationIndex++) {
+		textures.emplace_back().data = stack.textures[rotationIndex];
+		masks.emplace_back().data = stack.masks[rotationIndex];
+		placements.push_back(std::make_unique<PlacementMask>(stack.masks[rotationIndex]));
+		transformations.push_back(stack.transformations[rotationIndex]);
+		sizes.push_back(stack.textures[rotationIndex].size());
+
+		cv::Mat inverseTransformation;
+		cv::invertAffineTransform(stack.transformations[rotationIndex], inverseTransformation);
+		inverseTransformations.push_back(inverseTransformation);
+
+		if (stack.features.size() > static_cast<std::size_t>(rotationIndex)) {
+			FeatureVector& featureVector = features.emplace_back();
+			for (const cv::Mat& feature : stack.features[rotationIndex])
+				featureVector.features.emplace_back().data = feature;
+		}
+	}
+
+	featureHash = stack.featureHash;
+	mapping = stack.mapping;
+
+	for (std::size_t rotationIndex = 0; rotationIndex < reservations.size() && rotationIndex < placements.size(); rotationIndex++)
+		if (reservations[rotationIndex].size() == sizes[rotationIndex])
+			placements[rotationIndex]->reserve(reservations[rotationIndex]);
+	if (!reservations.empty())
+		reservationVersion = nextVersion();
+
+	version = nextVersion();
+	matcher.reset(rotations);
+	pyramid.reset(rotations);
+	index.reset();
+}
+
+void SourceTexture::store() {
+	SourceCache::Stack stack;
+	stack.featureHash = featureHash;
+	for (int rotationIndex = 0; rotationIndex < rotations; rotationIndex++) {
+		stack.textures.push_back(textures[rotationIndex].data);
+		stack.masks.push_back(masks[rotationIndex].data);
+		stack.transformations.push_back(transformations[rotationIndex]);
+
+		if (features.size() > static_cast<std::size_t>(rotationIndex)) {
+			std::vector<cv::Mat>& planes = stack.features.emplace_back();
+			for (const Texture& feature : features[rotationIndex])
+				planes.push_back(feature.data);
+		}
+	}
+
+	std::string path = SourceCache::path(cacheDirectory, sourceHash, rotations);
+	if (!SourceCache::store(path, sourceHash, rotations, stack) || !SourceCache::load(path, sourceHash, rotations, stack)) {
+		Log::warn("Failed to cache the source rotations in %s", path.c_str());
+
+		return;
+	}
+
+	map(stack);
+}
+
+void SourceTexture::reserve(int rotationIndex, const std::vector<cv::Point2f>& polygon) {
+	// Back to the original orientation
+	std::vector<cv::Point2f> originalPolygon;
+	cv::transform(polygon, originalPolygon, inverseTransformations[rotationIndex]);
+
+	// The rotations that are not stored derive their placements from the first one
+	for (int otherRotationIndex = 0; otherRotationIndex < static_cast<int>(textures.size()); otherRotationIndex++) {
+		std::vector<cv::Point2f> rotatedPolygon;
+		cv::transform(originalPolygon, rotatedPolygon, transformations[otherRotationIndex]);
+
+		std::vector<cv::Point> points;
+		for (const cv::Point2f& point : rotatedPolygon)
+			points.emplace_back(cvRound(point.x), cvRound(point.y));
+
+		placements[otherRotationIndex]->reserve(points);
+	}
+
+	reservationVersion = nextVersion();
+}
+
+void SourceTexture::reserve(int rotationIndex, const cv::Rect& rect) {
+	std::vector<cv::Point2f> polygon = {
+		cv::Point2f(rect.x, rect.y),
+		cv::Point2f(rect.x + rect.width - 1, rect.y),
+		cv::Point2f(rect.x + rect.width - 1, rect.y + rect.height - 1),
+		cv::Point2f(rect.x, rect.y + rect.height - 1)
+	};
+
+	reserve(rotationIndex, polygon);
+}
+
+void SourceTexture::clearReservations() {
+	for (std::size_t rotationIndex = 0; rotationIndex < textures.size(); rotationIndex++)
+		placements[rotationIndex]->clear();
+
+	reservationVersion = 0;
+}
+
+PlacementMask& SourceTexture::placement(int rotationIndex) {
+	return *placements[rotationIndex];
+}
+
+int SourceTexture::featureRotations() const {
+	return rotateTemplates ? std::min(rotations, 1) : rotations;
+}
+
+void SourceTexture::matchTemplate(int rotationIndex,
+                                  const std::vector<cv::Mat>& templates,
+                                  const std::vector<float>& weights,
+                                  cv::TemplateMatchModes metric,
+                                  cv::Mat& response) {
+	if (rotateTemplates && !features.empty()) {
+		matchRotatedTemplate(rotationIndex, templates, weights, metric, response);
+
+		return;
+	}
+
+	if (features.size() <= static_cast<std::size_t>(rotationIndex)) {
+		response = cv::Mat();
+
+		return;
+	}
+
+	matcher.matchTemplate(features[rotationIndex], rotationIndex, templates, weights, metric, response);
+}
+
+void SourceTexture::matchRotatedTemplate(int rotationIndex,
+                                         const std::vector<cv::Mat>& templates,
+                                         const std::vector<float>& weights,
+                                         cv::TemplateMatchModes metric,
+                                         cv::Mat& response) {
+	response = cv::Mat();
+
+	const FeatureVector& unrotatedFeatures = features.front();
+	std::size_t featureCount = std::min(std::min(templates.size(), weights.size()), unrotatedFeatures.size());
+	if (featureCount == 0)
+		return;
+
+	cv::Size templateSize = templates.front().size();
+	cv::Size rotatedSize = sizes[rotationIndex];
+	cv::Size responseSize(rotatedSize.width - templateSize.width + 1, rotatedSize.height - templateSize.height + 1);
+	if (responseSize.width <= 0 || responseSize.height <= 0)
+		return;
+
+	// The template in the orientation of the unrotated source, the corners outside the patch are masked
+	double angle = -360.0 / rotations * rotationIndex;
+	cv::Size boundsSize = Utils::computeRotatedRect(templateSize, angle).size();
+	cv::Mat templateTransformation = Utils::computeTransformationMatrix(templateSize, boundsSize, angle);
+
+	const cv::Mat& source = unrotatedFeatures[0].data;
+	if (boundsSize.width > source.cols || boundsSize.height > source.rows)
+		return;
+
+	cv::Mat templateMask;
+	cv::warpAffine(cv::Mat(templateSize, CV_8UC1, cv::Scalar(255)), templateMask, templateTransformation, boundsSize, cv::INTER_NEAREST);
+
+	cv::Mat unrotatedResponse;
+	for (std::size_t featureIndex = 0; featureIndex < featureCount; featureIndex++) {
+		cv::Mat rotatedTemplate;
+		cv::warpAffine(templates[featureIndex], rotatedTemplate, templateTransformation, boundsSize, cv::INTER_LINEAR);
+		if (rotatedTemplate.channels() == 2)
+			rotatedTemplate = Sobel::steer(rotatedTemplate, templateTransformation);
+		if (rotatedTemplate.depth() != unrotatedFeatures[featureIndex].data.depth())
+			rotatedTemplate.convertTo(rotatedTemplate, unrotatedFeatures[featureIndex].data.depth());
+
+		cv::Mat mask;
+		templateMask.convertTo(mask, rotatedTemplate.depth(), rotatedTemplate.depth() == CV_8U ? 1.0 : 1.0 / 255.0);
+
+		cv::Mat featureResponse;
+		cv::matchTemplate(unrotatedFeatures[featureIndex].data, rotatedTemplate, featureResponse, metric, mask);
+
+		if (unrotatedResponse.empty())
+			unrotatedResponse = featureResponse * weights[featureIndex];
+		else
+			cv::scaleAdd(featureResponse, weights[featureIndex], unrotatedResponse, unrotatedResponse);
+	}
+
+	// The center of a patch at offset p in the rotated source lies at the center of the rotated template in the unrotated source,
+	// so the offset of the rotated template is an affine function of p
+	// The unrotated features are those of the first rotation
+	cv::Mat inverseTransformation;
+	cv::invertAffineTransform(relativeTransformation(rotationIndex), inverseTransformation);
+	cv::Point2d templateCenter(0.5 * (templateSize.width - 1), 0.5 * (templateSize.height - 1));
+	cv::Point2d boundsCenter(0.5 * (boundsSize.width - 1), 0.5 * (boundsSize.height - 1));
+
+	cv::Mat offsetTransformation = inverseTransformation.clone();
+	for (int row = 0; row < 2; row++) {
+		const double* transformation = inverseTransformation.ptr<double>(row);
+		offsetTransformation.at<double>(row, 2) += transformation[0] * templateCenter.x + transformation[1] * templateCenter.y - (row == 0 ? boundsCenter.x : boundsCenter.y);
+	}
+
+	// Offsets outside the unrotated source are outside the material and get the worst score
+	float worst = metric == cv::TM_SQDIFF || metric == cv::TM_SQDIFF_NORMED ? std::numeric_limits<float>::max() : std::numeric_limits<float>::lowest();
+	cv::warpAffine(unrotatedResponse, response, offsetTransformation, responseSize, cv::INTER_NEAREST | cv::WARP_INVERSE_MAP, cv::BORDER_CONSTANT, cv::Scalar(worst));
+}
+
+void SourceTexture::reloadTextures() {
+	viewRotation = -1;
+	if (!upload)
+		return;
+
+	for (std::size_t rotationIndex = 0; rotationIndex < textures.size(); rotationIndex++) {
 		textures[rotationIndex].reloadGL();
 		masks[rotationIndex].reloadGL();
 
@@ -104,6 +420,53 @@ void SourceTexture::reloadTextures() {
 	}
 }
 
+Texture& SourceTexture::texture(int rotationIndex) {
+	if (rotationIndex < static_cast<int>(textures.size()))
+		return textures[rotationIndex];
+
+	if (viewRotation != rotationIndex) {
+		cv::Mat rotatedTexture;
+		cv::warpAffine(textures.front().data, rotatedTexture, relativeTransformation(rotationIndex), sizes[rotationIndex]);
+
+		view = Texture();
+		view.data = rotatedTexture;
+		if (upload)
+			view.reloadGL();
+		viewRotation = rotationIndex;
+	}
+
+	return view;
+}
+
+cv::Mat SourceTexture::patch(int rotationIndex, const cv::Rect& rect) {
+	if (rotationIndex < static_cast<int>(textures.size()))
+		return textures[rotationIndex].data(rect);
+
+	// Rotated straight into the rectangle
+	cv::Mat transformation = relativeTransformation(rotationIndex);
+	transformation.at<double>(0, 2) -= rect.x;
+	transformation.at<double>(1, 2) -= rect.y;
+
+	cv::Mat result;
+	cv::warpAffine(textures.front().data, result, transformation, rect.size());
+
+	return result;
+}
+
+cv::Mat SourceTexture::materialMask(int rotationIndex) const {
+	if (rotationIndex < static_cast<int>(masks.size()))
+		return masks[rotationIndex].data;
+
+	cv::Mat result;
+	cv::warpAffine(masks.front().data, result, relativeTransformation(rotationIndex), sizes[rotationIndex]);
+
+	return result;
+}
+
+Bounds SourceTexture::bounds(int rotationIndex) const {
+	return Bounds(0, 0, sizes[rotationIndex].width, sizes[rotationIndex].height);
+}
+
 SourceTexture::SourceTexture(SourceTexture&& other) noexcept {
 	this->rotations = other.rotations;  
 	this->textures = std::move(other.textures);
@@ -111,6 +474,22 @@ SourceTexture::SourceTexture(SourceTexture&& other) noexcept {
 	this->masks = std::move(other.masks);
 	this->transformations = std::move(other.transformations);
 	this->inverseTransformations = std::move(other.inverseTransformations);
+	this->sizes = std::move(other.sizes);
+	this->axes = std::move(other.axes);
+	this->placements = std::move(other.placements);
+	this->rotateTemplates = other.rotateTemplates;
+	this->upload = other.upload;
+	this->version = other.version;
+	this->reservationVersion = other.reservationVersion;
+	this->cacheDirectory = std::move(other.cacheDirectory);
+	this->sourceHash = other.sourceHash;
+	this->featureHash = other.featureHash;
+	this->mapping = std::move(other.mapping);
+	this->matcher = std::move(other.matcher);
+	this->pyramid = std::move(other.pyramid);
+	this->index = std::move(other.index);
+	this->view = std::move(other.view);
+	this->viewRotation = other.viewRotation;
 }
 
 SourceTexture& SourceTexture::operator=(SourceTexture&& other) noexcept {
@@ -120,6 +499,22 @@ SourceTexture& SourceTexture::operator=(SourceTexture&& other) noexcept {
 	this->masks = std::move(other.masks);
 	this->transformations = std::move(other.transformations);
 	this->inverseTransformations = std::move(other.inverseTransformations);
+	this->sizes = std::move(other.sizes);
+	this->axes = std::move(other.axes);
+	this->placements = std::move(other.placements);
+	this->rotateTemplates = other.rotateTemplates;
+	this->upload = other.upload;
+	this->version = other.version;
+	this->reservationVersion = other.reservationVersion;
+	this->cacheDirectory = std::move(other.cacheDirectory);
+	this->sourceHash = other.sourceHash;
+	this->featureHash = other.featureHash;
+	this->mapping = std::move(other.mapping);
+	this->matcher = std::move(other.matcher);
+	this->pyramid = std::move(other.pyramid);
+	this->index = std::move(other.index);
+	this->view = std::move(other.view);
+	this->viewRotation = other.viewRotation;
 
 	return *this;
 }
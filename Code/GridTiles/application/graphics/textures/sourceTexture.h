@@ -3,18 +3,63 @@
 #include <vector>
 #include "texture.h"
 #include "graphics/features/Feature.h"
+#include "matching/descriptorIndex.h"
+#include "matching/fftMatcher.h"
+#include "matching/placementMask.h"
+#include "matching/pyramidMatcher.h"
+#include "sourceCache.h"
+#include "util/sat.h"
 
 class SourceTexture {
 public:
 	int rotations;
+	// Planes of the stored rotations, see featureRotations
 	std::vector<Texture> textures;
 	std::vector<FeatureVector> features;
 	std::vector<Texture> masks;
+	// Geometry of every rotation, also of those whose planes are not stored
 	std::vector<cv::Mat> transformations;
 	std::vector<cv::Mat> inverseTransformations;
+	std::vector<cv::Size> sizes;
+	// Unit axis of every rotation for the oriented overlap tests
+	std::vector<Vec2> axes;
+
+	// Valid placements per rotation, including the reserved material. Rotations whose planes are not stored derive them
+	// from the unrotated material
+	std::vector<URef<PlacementMask>> placements;
+
+	// Cached spectra of the rotated features, invalidated whenever the features change
+	FFTMatcher matcher;
+
+	// Downsampled features of the rotations for the coarse to fine search
+	PyramidMatcher pyramid;
+
+	// Descriptors of the placements of the rotations for the approximate nearest neighbour search
+	DescriptorIndex index;
+
+	// Rotations are matched by rotating the target patches instead of the source, so only the planes of the unrotated
+	// source are stored. Placements keep their offsets in the rotated orientations. The features follow a change at once,
+	// the other planes once the source is constructed again
+	bool rotateTemplates = false;
+
+	// Changes whenever the features are replaced, placements matched against other features are stale
+	std::uint64_t version = 0;
+	// Changes with every reservation, 0 while nothing is reserved
+	std::uint64_t reservationVersion = 0;
+
+	// Whether the planes are uploaded to OpenGL, sources that are never shown or too large to show keep them in memory only
+	bool upload = true;
+
+	// Directory of the on disk cache of the rotated planes, caching is disabled if empty
+	std::string cacheDirectory;
+	// Hash of the prescaled source and the features of the mapped cache
+	std::uint64_t sourceHash = 0;
+	std::uint64_t featureHash = 0;
+	// Mapped cache file the planes are views of, nullptr if the planes live on the heap
+	SRef<MappedFile> mapping;
 
 	SourceTexture();
-	SourceTexture(cv::Mat texture, int rotations);
+	SourceTexture(cv::Mat texture, int rotations, const std::string& cacheDirectory = "", bool rotateTemplates = false, bool upload = true);
 	SourceTexture(cv::Mat texture, const FeatureVector& features, int rotations);
 
 	~SourceTexture() = default;
@@ -28,6 +73,57 @@ public:
 
 	void reloadTextures();
 
+	// Reserves a polygon of the given rotation in all rotations
+	void reserve(int rotationIndex, const std::vector<cv::Point2f>& polygon);
+	void reserve(int rotationIndex, const cv::Rect& rect);
+	void clearReservations();
+
+	PlacementMask& placement(int rotationIndex);
+
+	// Number of rotations whose planes and features are stored
+	int featureRotations() const;
+
+	// Texture of the given rotation, rotations that are not stored share a texture that is rotated whenever another one
+	// of them is requested. Only for the UI thread
+	Texture& texture(int rotationIndex);
+	// Material of the rectangle of the given rotation, only that rectangle is rotated if the rotation is not stored
+	cv::Mat patch(int rotationIndex, const cv::Rect& rect);
+	// Mask of the material in the given rotation, independent of the reservations
+	cv::Mat materialMask(int rotationIndex) const;
+	BoundsTemplate<double> bounds(int rotationIndex) const;
+
+	// Weighted response of the given target feature patches against the features of the given rotation.
+	// The response is indexed by the offset in the rotated source, also when the templates are rotated
+	void matchTemplate(int rotationIndex,
+	                   const std::vector<cv::Mat>& templates,
+	                   const std::vector<float>& weights,
+	                   cv::TemplateMatchModes metric,
+	                   cv::Mat& response);
+
 	Texture* operator->();
 	Texture* operator*();
+
+private:
+	// Correlates the templates rotated to the unrotated source and resamples the response at the offsets of the given rotation
+	void matchRotatedTemplate(int rotationIndex,
+	                          const std::vector<cv::Mat>& templates,
+	                          const std::vector<float>& weights,
+	                          cv::TemplateMatchModes metric,
+	                          cv::Mat& response);
+
+	// Texture of the last requested rotation that is not stored
+	Texture view;
+	int viewRotation = -1;
+
+	// Transformations and sizes of all rotations of a source of the given size
+	void computeTransformations(const cv::Size& originalSize);
+	// Rotates the texture and its mask into the stored rotations and creates the placement masks of all rotations
+	void rotate(const cv::Mat& texture);
+	// From the first rotation to the given one
+	cv::Mat relativeTransformation(int rotationIndex) const;
+
+	// Replaces all planes by views of the given mapped cache
+	void map(SourceCache::Stack& stack);
+	// Stores the planes in the cache and maps them, the heap copies are released
+	void store();
 };
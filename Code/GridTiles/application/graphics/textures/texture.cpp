@@ -36,7 +36,11 @@ Texture::Texture(Texture&& other) noexcept {
 }
 
 Texture::Texture(const Texture& other) noexcept {
+#ifdef _MSC_VER
 	__debugbreak();
+#else
+	__builtin_trap();
+#endif
 };
 
 Texture& Texture::operator=(Texture&& other) noexcept {
@@ -57,14 +61,17 @@ Texture& Texture::operator=(Texture&& other) noexcept {
 Texture::~Texture() {
 	if (id == 0)
 		return;
+#ifndef GRIDTILES_HEADLESS
 	unbind();
 	Log::error("Deleted texure %d", id);
 	glDeleteTextures(1, &id);
+#endif
 	this->id = 0;
 }
 
 void Texture::setData(int width, int height, const void* data, int internalFormat,
                       unsigned externalFormat, unsigned dataType, unsigned target, bool linear) {
+#ifndef GRIDTILES_HEADLESS
 	if (data) {
 		if (this->id == 0)
 			this->id = generate(target, GL_REPEAT, GL_REPEAT, linear ? GL_LINEAR_MIPMAP_LINEAR : GL_NEAREST_MIPMAP_NEAREST, linear ? GL_LINEAR : GL_NEAREST);
@@ -81,33 +88,41 @@ void Texture::setData(int width, int height, const void* data, int internalForma
 	} else {
 		Log::error("Texture data is null");
 	}
+#endif
 }
 
 void Texture::bind() {
+#ifndef GRIDTILES_HEADLESS
 	glBindTexture(target, id);
+#endif
 }
 
 void Texture::unbind() {
+#ifndef GRIDTILES_HEADLESS
 	glBindTexture(target, 0);
+#endif
 }
 
 void Texture::reloadGL(bool linear, int internalFormat, int extenalFormat, int dataType) {
+#ifndef GRIDTILES_HEADLESS
 	if (data.dims != 2 || data.size[0] == 0 || data.size[1] == 0)
 		return;
 
-	auto internalFormat_ = internalFormat != 0 ? internalFormat : data.channels() == 1 ? GL_LUMINANCE : data.channels() == 3 ? GL_RGB : GL_RGBA;
-	auto externalFormat_ = extenalFormat != 0 ? extenalFormat : data.channels() == 1 ? GL_LUMINANCE : data.channels() == 3 ? GL_BGR : GL_BGRA;
-	auto dataType_ = dataType != 0 ? dataType : GL_UNSIGNED_BYTE;
+	auto internalFormat_ = internalFormat != 0 ? internalFormat : data.channels() == 1 ? GL_LUMINANCE : data.channels() == 2 ? GL_LUMINANCE_ALPHA : data.channels() == 3 ? GL_RGB : GL_RGBA;
+	auto externalFormat_ = extenalFormat != 0 ? extenalFormat : data.channels() == 1 ? GL_LUMINANCE : data.channels() == 2 ? GL_LUMINANCE_ALPHA : data.channels() == 3 ? GL_BGR : GL_BGRA;
+	auto dataType_ = dataType != 0 ? dataType : data.depth() == CV_32F ? GL_FLOAT : data.depth() == CV_16S ? GL_SHORT : GL_UNSIGNED_BYTE;
 	auto target = GL_TEXTURE_2D;
 
 	glDeleteTextures(1, &id);
 	this->id = 0;
 
 	setData(data.size[1], data.size[0], data.data, internalFormat_, externalFormat_, dataType_, target, linear);
+#endif
 }
 
 GLID Texture::generate(int target, int wrapS, int wrapT, int minFilter, int magFilter) {
 	GLID id = 0;
+#ifndef GRIDTILES_HEADLESS
 	glGenTextures(1, &id);
 	Log::debug("Created texure %d", id);
 	glBindTexture(target, id);
@@ -115,6 +130,7 @@ GLID Texture::generate(int target, int wrapS, int wrapT, int minFilter, int magF
 	glTexParameteri(target, GL_TEXTURE_WRAP_T, wrapT);
 	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, minFilter);
 	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, magFilter);
+#endif
 
 	return id;
 }
@@ -1,5 +1,9 @@
 #pragma once
+#ifdef GRIDTILES_HEADLESS
+#include "graphics/opengl/headlessGL.h"
+#else
 #include <GL/glew.h>
+#endif
 #include <opencv2/core/mat.hpp>
 
 #include "../opengl/bindable.h"
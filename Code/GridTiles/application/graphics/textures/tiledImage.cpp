@@ -0,0 +1,356 @@
+#include "core.h"
+#include "tiledImage.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+static constexpr char magic[4] = { 'G', 'T', 'T', 'I' };
+static constexpr const char* extension = ".gtti";
+
+struct TiledImageHeader {
+	char magic[4];
+	std::uint32_t version;
+	std::int32_t cols;
+	std::int32_t rows;
+	std::int32_t type;
+	std::int32_t tileSize;
+	std::int32_t levelCount;
+	std::int32_t padding;
+};
+
+// Dimensions of every level, the tile grid follows from the tile size
+static std::vector<TiledImage::Level> computeLevels(int cols, int rows, int tileSize) {
+	std::vector<TiledImage::Level> levels;
+
+	std::size_t firstTile = 0;
+	while (true) {
+		TiledImage::Level& level = levels.emplace_back();
+		level.cols = cols;
+		level.rows = rows;
+		level.tileCols = (cols + tileSize - 1) / tileSize;
+		level.tileRows = (rows + tileSize - 1) / tileSize;
+		level.firstTile = firstTile;
+		firstTile += static_cast<std::size_t>(level.tileCols) * level.tileRows;
+
+		if (cols <= tileSize && rows <= tileSize)
+			break;
+
+		cols = std::max((cols + 1) / 2, 1);
+		rows = std::max((rows + 1) / 2, 1);
+	}
+
+	return levels;
+}
+
+TiledImage::TiledImage(std::size_t capacity)
+	: capacity(capacity) {}
+
+bool TiledImage::is(const std::string& path) {
+	return std::filesystem::path(path).extension() == extension;
+}
+
+URef<TiledImage> TiledImage::open(const std::string& path, std::size_t capacity) {
+	URef<MappedFile> mapping = MappedFile::open(path);
+	if (mapping == nullptr || mapping->size() < sizeof(TiledImageHeader))
+		return nullptr;
+
+	TiledImageHeader header;
+	std::memcpy(&header, mapping->data(), sizeof(TiledImageHeader));
+	if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != version)
+		return nullptr;
+	if (header.cols <= 0 || header.rows <= 0 || header.tileSize <= 0)
+		return nullptr;
+
+	URef<TiledImage> image(new TiledImage(capacity));
+	image->type = header.type;
+	image->tileSize = header.tileSize;
+	image->levels = computeLevels(header.cols, header.rows, header.tileSize);
+	if (image->levels.size() != static_cast<std::size_t>(header.levelCount))
+		return nullptr;
+
+	const Level& last = image->levels.back();
+	std::size_t tileCount = last.firstTile + static_cast<std::size_t>(last.tileCols) * last.tileRows;
+	if (mapping->size() < sizeof(TiledImageHeader) + tileCount * sizeof(TileLocation))
+		return nullptr;
+
+	image->tiles.resize(tileCount);
+	std::memcpy(image->tiles.data(), mapping->data() + sizeof(TiledImageHeader), tileCount * sizeof(TileLocation));
+	for (const TileLocation& location : image->tiles)
+		if (location.offset + location.size > mapping->size())
+			return nullptr;
+
+	image->mapping = std::move(mapping);
+
+	return image;
+}
+
+bool TiledImage::build(const cv::Mat& image, const std::string& path, int tileSize) {
+	int depth = image.depth();
+	int channels = image.channels();
+	if (image.empty() || tileSize <= 0 || (depth != CV_8U && depth != CV_16U) || (channels != 1 && channels != 3 && channels != 4))
+		return false;
+
+	std::vector<Level> levels = computeLevels(image.cols, image.rows, tileSize);
+	const Level& last = levels.back();
+	std::vector<TileLocation> tiles(last.firstTile + static_cast<std::size_t>(last.tileCols) * last.tileRows);
+
+	TiledImageHeader header;
+	std::memcpy(header.magic, magic, sizeof(magic));
+	header.version = version;
+	header.cols = image.cols;
+	header.rows = image.rows;
+	header.type = image.type();
+	header.tileSize = tileSize;
+	header.levelCount = static_cast<std::int32_t>(levels.size());
+	header.padding = 0;
+
+	// Readers may map the file at the same time, so it is never written in place
+	std::error_code error;
+	std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+	std::string temporaryPath = path + "." + std::to_string(std::random_device()()) + ".tmp";
+
+	{
+		std::ofstream file(temporaryPath, std::ios::binary);
+		if (!file.is_open())
+			return false;
+
+		// The tile table is written once all tiles are encoded
+		file.write(reinterpret_cast<const char*>(&header), sizeof(TiledImageHeader));
+		file.write(reinterpret_cast<const char*>(tiles.data()), tiles.size() * sizeof(TileLocation));
+
+		// Only the current level is held besides the image itself
+		cv::Mat current = image;
+		std::vector<uchar> encoded;
+		for (std::size_t levelIndex = 0; levelIndex < levels.size() && file.good(); levelIndex++) {
+			const Level& level = levels[levelIndex];
+			if (levelIndex > 0) {
+				cv::Mat downsampled;
+				cv::resize(current, downsampled, cv::Size(level.cols, level.rows), 0.0, 0.0, cv::INTER_AREA);
+				current = downsampled;
+			}
+
+			for (int tileRow = 0; tileRow < level.tileRows; tileRow++) {
+				for (int tileCol = 0; tileCol < level.tileCols; tileCol++) {
+					cv::Rect region(tileCol * tileSize, tileRow * tileSize, tileSize, tileSize);
+					region &= cv::Rect(0, 0, level.cols, level.rows);
+
+					encoded.clear();
+					if (!cv::imencode(".png", current(region), encoded))
+						break;
+
+					TileLocation& location = tiles[level.firstTile + static_cast<std::size_t>(tileRow) * level.tileCols + tileCol];
+					location.offset = static_cast<std::uint64_t>(file.tellp());
+					location.size = encoded.size();
+					file.write(reinterpret_cast<const char*>(encoded.data()), encoded.size());
+				}
+			}
+		}
+
+		file.seekp(sizeof(TiledImageHeader));
+		file.write(reinterpret_cast<const char*>(tiles.data()), tiles.size() * sizeof(TileLocation));
+
+		bool complete = std::ranges::all_of(tiles, [](const TileLocation& location) {
+			return location.size > 0;
+		});
+		if (!file.good() || !complete) {
+			file.close();
+			std::filesystem::remove(temporaryPath, error);
+
+			return false;
+		}
+	}
+
+	std::filesystem::rename(temporaryPath, path, error);
+	if (error) {
+		std::filesystem::remove(temporaryPath, error);
+
+		return false;
+	}
+
+	return true;
+}
+
+int TiledImage::cols() const {
+	return levels.front().cols;
+}
+
+int TiledImage::rows() const {
+	return levels.front().rows;
+}
+
+int TiledImage::imageType() const {
+	return type;
+}
+
+int TiledImage::levelCount() const {
+	return static_cast<int>(levels.size());
+}
+
+const TiledImage::Level& TiledImage::level(int levelIndex) const {
+	return levels[levelIndex];
+}
+
+int TiledImage::levelIndex(const cv::Size& size) const {
+	int result = 0;
+	for (int levelIndex = 1; levelIndex < static_cast<int>(levels.size()); levelIndex++) {
+		if (levels[levelIndex].cols < size.width || levels[levelIndex].rows < size.height)
+			break;
+
+		result = levelIndex;
+	}
+
+	return result;
+}
+
+cv::Mat TiledImage::tile(std::size_t index) {
+	{
+		std::scoped_lock lock(mutex);
+
+		auto iterator = lookup.find(index);
+		if (iterator != lookup.end()) {
+			cache.splice(cache.begin(), cache, iterator->second);
+
+			return iterator->second->tile;
+		}
+	}
+
+	// Decoded outside the lock, a tile decoded twice by concurrent readers is only cached once
+	const TileLocation& location = tiles[index];
+	cv::Mat encoded(1, static_cast<int>(location.size), CV_8UC1, mapping->data() + location.offset);
+	cv::Mat decoded = cv::imdecode(encoded, cv::IMREAD_UNCHANGED);
+	if (decoded.type() != type)
+		return cv::Mat();
+
+	std::size_t bytes = decoded.total() * decoded.elemSize();
+
+	std::scoped_lock lock(mutex);
+
+	if (lookup.contains(index) || bytes > capacity)
+		return decoded;
+
+	cache.push_front(CachedTile { index, decoded });
+	lookup.emplace(index, cache.begin());
+	cachedBytes += bytes;
+
+	while (cachedBytes > capacity) {
+		const cv::Mat& evicted = cache.back().tile;
+		cachedBytes -= evicted.total() * evicted.elemSize();
+		lookup.erase(cache.back().index);
+		cache.pop_back();
+	}
+
+	return decoded;
+}
+
+cv::Mat TiledImage::read(int levelIndex, const cv::Rect& region) {
+	const Level& level = levels[levelIndex];
+	cv::Rect bounds = region & cv::Rect(0, 0, level.cols, level.rows);
+	if (bounds.empty() || bounds != region)
+		return cv::Mat();
+
+	cv::Mat result(region.size(), type);
+	for (int tileRow = region.y / tileSize; tileRow <= (region.br().y - 1) / tileSize; tileRow++) {
+		for (int tileCol = region.x / tileSize; tileCol <= (region.br().x - 1) / tileSize; tileCol++) {
+			cv::Mat decoded = tile(level.firstTile + static_cast<std::size_t>(tileRow) * level.tileCols + tileCol);
+			if (decoded.empty())
+				return cv::Mat();
+
+			cv::Rect tileRegion(tileCol * tileSize, tileRow * tileSize, decoded.cols, decoded.rows);
+			cv::Rect overlap = tileRegion & region;
+			decoded(overlap - tileRegion.tl()).copyTo(result(overlap - region.tl()));
+		}
+	}
+
+	return result;
+}
+
+cv::Mat TiledImage::warped(const cv::Mat& transformation, const cv::Size& size) {
+	if (size.width <= 0 || size.height <= 0)
+		return cv::Mat();
+
+	// The level is at least as large as the image scaled along both axes of the transformation
+	const double* first = transformation.ptr<double>(0);
+	const double* second = transformation.ptr<double>(1);
+	cv::Size scaledSize(static_cast<int>(std::lround(cols() * std::hypot(first[0], second[0]))),
+	                    static_cast<int>(std::lround(rows() * std::hypot(first[1], second[1]))));
+	int levelIndex = this->levelIndex(scaledSize);
+	const Level& level = levels[levelIndex];
+
+	// From the result to the level, the pixel centers of the levels are aligned like cv::resize does
+	cv::Mat inverseTransformation;
+	cv::invertAffineTransform(transformation, inverseTransformation);
+	double levelScale[2] = { static_cast<double>(level.cols) / cols(), static_cast<double>(level.rows) / rows() };
+
+	cv::Mat levelTransformation(2, 3, CV_64F);
+	for (int row = 0; row < 2; row++) {
+		const double* inverse = inverseTransformation.ptr<double>(row);
+		double* scaled = levelTransformation.ptr<double>(row);
+		scaled[0] = levelScale[row] * inverse[0];
+		scaled[1] = levelScale[row] * inverse[1];
+		scaled[2] = levelScale[row] * inverse[2] + 0.5 * levelScale[row] - 0.5;
+	}
+
+	std::vector<cv::Rect> blocks;
+	for (int y = 0; y < size.height; y += tileSize)
+		for (int x = 0; x < size.width; x += tileSize)
+			blocks.emplace_back(x, y, std::min(tileSize, size.width - x), std::min(tileSize, size.height - y));
+
+	cv::Mat result(size, type, cv::Scalar::all(0));
+	std::atomic<bool> failed = false;
+#pragma omp parallel for schedule(dynamic)
+	for (int blockIndex = 0; blockIndex < static_cast<int>(blocks.size()); blockIndex++) {
+		const cv::Rect& block = blocks[blockIndex];
+
+		// Region of the level the block covers, with a border for the interpolation
+		std::vector<cv::Point2f> corners = {
+			cv::Point2f(block.x, block.y),
+			cv::Point2f(block.x + block.width - 1, block.y),
+			cv::Point2f(block.x, block.y + block.height - 1),
+			cv::Point2f(block.x + block.width - 1, block.y + block.height - 1)
+		};
+		std::vector<cv::Point2f> levelCorners;
+		cv::transform(corners, levelCorners, levelTransformation);
+
+		cv::Rect region = cv::boundingRect(levelCorners);
+		region = cv::Rect(region.x - 1, region.y - 1, region.width + 3, region.height + 3) & cv::Rect(0, 0, level.cols, level.rows);
+		if (region.empty())
+			continue;
+
+		cv::Mat source = read(levelIndex, region);
+		if (source.empty()) {
+			failed = true;
+
+			continue;
+		}
+
+		// Within the level the result is never downsampled by more than half, so bilinear interpolation suffices
+		cv::Mat blockTransformation = levelTransformation.clone();
+		for (int row = 0; row < 2; row++) {
+			double* shifted = blockTransformation.ptr<double>(row);
+			shifted[2] += shifted[0] * block.x + shifted[1] * block.y - (row == 0 ? region.x : region.y);
+		}
+
+		cv::Mat destination = result(block);
+		cv::warpAffine(source, destination, blockTransformation, block.size(), cv::INTER_LINEAR | cv::WARP_INVERSE_MAP);
+	}
+
+	if (failed)
+		return cv::Mat();
+
+	return result;
+}
+
+cv::Mat TiledImage::resized(const cv::Size& size) {
+	double scaleX = static_cast<double>(size.width) / cols();
+	double scaleY = static_cast<double>(size.height) / rows();
+	cv::Mat transformation = (cv::Mat_<double>(2, 3) << scaleX, 0.0, 0.5 * scaleX - 0.5, 0.0, scaleY, 0.5 * scaleY - 0.5);
+
+	return warped(transformation, size);
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <opencv2/core.hpp>
+
+#include "util/mappedFile.h"
+
+// Pyramid of a large image stored on disk in square tiles, every level halves the previous one until it fits in a tile.
+// Tiles are encoded losslessly and decoded on demand into a least recently used cache bounded in bytes, so reading or
+// resampling a region never holds more of the image in memory than the result, the cache and the tiles of a block.
+class TiledImage {
+public:
+	// Increase whenever the layout of the file changes
+	static constexpr std::uint32_t version = 1;
+
+	struct Level {
+		int cols;
+		int rows;
+		int tileCols;
+		int tileRows;
+		// Index of the first tile of the level in the tile table
+		std::size_t firstTile;
+	};
+
+private:
+	struct TileLocation {
+		std::uint64_t offset;
+		std::uint64_t size;
+	};
+
+	struct CachedTile {
+		std::size_t index;
+		cv::Mat tile;
+	};
+
+	// Encoded tiles are read through the page cache
+	URef<MappedFile> mapping;
+	int type = 0;
+	int tileSize = 0;
+	std::vector<Level> levels;
+	std::vector<TileLocation> tiles;
+
+	std::mutex mutex;
+	// Most recently used first
+	std::list<CachedTile> cache;
+	std::unordered_map<std::size_t, std::list<CachedTile>::iterator> lookup;
+	std::size_t cachedBytes = 0;
+	std::size_t capacity;
+
+	explicit TiledImage(std::size_t capacity);
+
+public:
+	TiledImage(const TiledImage& other) = delete;
+	TiledImage& operator=(const TiledImage& other) = delete;
+
+	// Whether the path names a tiled image, by its extension
+	static bool is(const std::string& path);
+
+	// Maps the file, returns nullptr if it does not exist or is not a tiled image of this version.
+	// The capacity bounds the bytes of the decoded tiles that are kept
+	static URef<TiledImage> open(const std::string& path, std::size_t capacity = std::size_t(256) << 20);
+
+	// Writes the pyramid of the image to a temporary file which atomically replaces the given path. Only 8 and 16 bit
+	// images with 1, 3 or 4 channels can be stored
+	static bool build(const cv::Mat& image, const std::string& path, int tileSize = 512);
+
+	int cols() const;
+	int rows() const;
+	int imageType() const;
+	int levelCount() const;
+	const Level& level(int levelIndex) const;
+
+	// Smallest level that is at least as large as the given size, so resampling it never upsamples
+	int levelIndex(const cv::Size& size) const;
+
+	// Region of the given level
+	cv::Mat read(int levelIndex, const cv::Rect& region);
+
+	// The image under the affine transformation from the pixels of level 0 to those of the result, resampled from the
+	// smallest level that is not upsampled. The result is filled in blocks of a tile, every block only decodes the tiles
+	// it covers. Pixels outside the image are black
+	cv::Mat warped(const cv::Mat& transformation, const cv::Size& size);
+
+	// The whole image resampled to the given size from the smallest sufficient level, see warped
+	cv::Mat resized(const cv::Size& size);
+
+private:
+	cv::Mat tile(std::size_t index);
+};
@@ -1,7 +1,9 @@
 #pragma once
 
+#ifndef GRIDTILES_HEADLESS
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#endif
 
 #include "view/screen.h"
 #include "view/settings.h"
@@ -9,9 +11,12 @@
 extern std::mutex MUTEX_RENDER;
 extern Settings settings;
 extern Screen screen;
+
+#ifndef GRIDTILES_HEADLESS
 extern GLFWwindow* window;
 
 bool init();
 void update();
 void render();
-void close();
\ No newline at end of file
+void close();
+#endif
\ No newline at end of file
@@ -0,0 +1,195 @@
+#include "core.h"
+#include "assignmentSolver.h"
+
+#include <algorithm>
+
+#include "util/looseQuadtree.h"
+
+// Bid increment relative to the range of the scores, the total score is within this fraction per patch of the optimum
+static constexpr double epsilonFraction = 0.01;
+// Safety net against slow convergence, patches still bidding after this many rounds give up
+static constexpr int maximumRounds = 10000;
+
+// Axis aligned bounds of an oriented box
+static Bounds computeBounds(const Obb& obb) {
+	double halfWidth = std::abs(obb.axis.x) * obb.extents.x + std::abs(obb.axis.y) * obb.extents.y;
+	double halfHeight = std::abs(obb.axis.y) * obb.extents.x + std::abs(obb.axis.x) * obb.extents.y;
+
+	return Bounds(obb.center.x - halfWidth, obb.center.y - halfHeight, 2.0 * halfWidth, 2.0 * halfHeight);
+}
+
+std::vector<std::vector<std::size_t>> AssignmentSolver::computeConflicts(const std::vector<Obb>& obbs, const std::vector<std::size_t>& owners) {
+	std::vector<std::vector<std::size_t>> conflicts(obbs.size());
+	if (obbs.empty())
+		return conflicts;
+
+	std::vector<Bounds> bounds(obbs.size());
+	double minX = std::numeric_limits<double>::max();
+	double minY = std::numeric_limits<double>::max();
+	double maxX = std::numeric_limits<double>::lowest();
+	double maxY = std::numeric_limits<double>::lowest();
+	for (std::size_t node = 0; node < obbs.size(); node++) {
+		bounds[node] = computeBounds(obbs[node]);
+		minX = std::min(minX, bounds[node].minX());
+		minY = std::min(minY, bounds[node].minY());
+		maxX = std::max(maxX, bounds[node].emaxX());
+		maxY = std::max(maxY, bounds[node].emaxY());
+	}
+
+	LooseQuadtree tree(Bounds(minX, minY, maxX - minX, maxY - minY));
+	for (std::size_t node = 0; node < obbs.size(); node++)
+		tree.insert(node, bounds[node]);
+
+	// Queries do not modify the tree
+#pragma omp parallel for schedule(dynamic, 64)
+	for (int node = 0; node < static_cast<int>(obbs.size()); node++) {
+		tree.query(bounds[node], [&](std::size_t other) {
+			if (owners[other] != owners[node] && Sat::intersect(obbs[node], obbs[other]))
+				conflicts[node].push_back(other);
+
+			return false;
+		});
+
+		std::sort(conflicts[node].begin(), conflicts[node].end());
+	}
+
+	return conflicts;
+}
+
+std::vector<int> AssignmentSolver::solve(const std::vector<std::vector<MatchCandidate>>& candidates,
+                                         const std::vector<cv::Size>& patchSizes,
+                                         cv::TemplateMatchModes metric) {
+	std::size_t patchCount = candidates.size();
+	std::vector<int> result(patchCount, -1);
+
+	// Flatten the candidates, the benefit of a candidate is higher for better scores regardless of the metric
+	bool minimize = metric == cv::TM_SQDIFF || metric == cv::TM_SQDIFF_NORMED;
+	std::vector<std::size_t> firstNodes(patchCount + 1, 0);
+	std::vector<std::size_t> owners;
+	std::vector<double> benefits;
+	std::vector<Obb> obbs;
+	for (std::size_t patchIndex = 0; patchIndex < patchCount; patchIndex++) {
+		firstNodes[patchIndex] = owners.size();
+		for (const MatchCandidate& candidate : candidates[patchIndex]) {
+			owners.push_back(patchIndex);
+			benefits.push_back(minimize ? -candidate.score : candidate.score);
+			obbs.push_back(Utils::computeCandidateObb(candidate, patchSizes[patchIndex]));
+		}
+	}
+	firstNodes[patchCount] = owners.size();
+
+	if (owners.empty())
+		return result;
+
+	auto [minimumBenefit, maximumBenefit] = std::minmax_element(benefits.begin(), benefits.end());
+	double range = std::max(*maximumBenefit - *minimumBenefit, 1e-9);
+	double epsilon = epsilonFraction * range;
+	// A patch prefers no placement over a candidate whose price exceeds the range of the scores
+	double dropValue = *minimumBenefit - range;
+
+	std::vector<std::vector<std::size_t>> conflicts = computeConflicts(obbs, owners);
+
+	std::vector<double> prices(owners.size(), 0.0);
+	std::vector<bool> held(owners.size(), false);
+
+	// A candidate costs at least the price of every held candidate it conflicts with
+	auto effectivePrice = [&](std::size_t node) {
+		double price = prices[node];
+		for (std::size_t other : conflicts[node])
+			if (held[other])
+				price = std::max(price, prices[other]);
+
+		return price;
+	};
+
+	struct Bid {
+		std::size_t node = 0;
+		double amount = 0.0;
+		bool valid = false;
+	};
+
+	std::vector<std::size_t> bidders;
+	for (std::size_t patchIndex = 0; patchIndex < patchCount; patchIndex++)
+		if (firstNodes[patchIndex] != firstNodes[patchIndex + 1])
+			bidders.push_back(patchIndex);
+
+	int rounds = 0;
+	std::vector<Bid> bids;
+	while (!bidders.empty() && rounds < maximumRounds) {
+		rounds++;
+
+		// Every unassigned patch bids on its most valuable candidate against the prices of the previous round
+		bids.assign(bidders.size(), Bid());
+#pragma omp parallel for schedule(dynamic, 16)
+		for (int bidderIndex = 0; bidderIndex < static_cast<int>(bidders.size()); bidderIndex++) {
+			std::size_t patchIndex = bidders[bidderIndex];
+
+			double bestValue = dropValue;
+			double secondValue = dropValue;
+			std::size_t bestNode = 0;
+			bool found = false;
+			for (std::size_t node = firstNodes[patchIndex]; node < firstNodes[patchIndex + 1]; node++) {
+				double value = benefits[node] - effectivePrice(node);
+				if (!found || value > bestValue) {
+					if (found)
+						secondValue = std::max(secondValue, bestValue);
+					bestValue = value;
+					bestNode = node;
+					found = true;
+				} else {
+					secondValue = std::max(secondValue, value);
+				}
+			}
+
+			if (bestValue < dropValue)
+				continue;
+
+			bids[bidderIndex] = Bid { bestNode, benefits[bestNode] - bestValue + (bestValue - secondValue) + epsilon, true };
+		}
+
+		// Accept the bids in patch order, a bid is rejected when an earlier bid of this round raised its price
+		std::vector<std::size_t> nextBidders;
+		for (std::size_t bidderIndex = 0; bidderIndex < bidders.size(); bidderIndex++) {
+			std::size_t patchIndex = bidders[bidderIndex];
+			const Bid& bid = bids[bidderIndex];
+
+			// Every candidate is more expensive than leaving the patch unassigned
+			if (!bid.valid)
+				continue;
+
+			if (bid.amount < effectivePrice(bid.node) + epsilon) {
+				nextBidders.push_back(patchIndex);
+
+				continue;
+			}
+
+			// Evict the patches holding a conflicting candidate
+			for (std::size_t other : conflicts[bid.node]) {
+				if (!held[other])
+					continue;
+
+				held[other] = false;
+				result[owners[other]] = -1;
+				nextBidders.push_back(owners[other]);
+			}
+
+			prices[bid.node] = bid.amount;
+			held[bid.node] = true;
+			result[patchIndex] = static_cast<int>(bid.node - firstNodes[patchIndex]);
+		}
+
+		std::sort(nextBidders.begin(), nextBidders.end());
+		nextBidders.erase(std::unique(nextBidders.begin(), nextBidders.end()), nextBidders.end());
+		bidders = std::move(nextBidders);
+	}
+
+	if (!bidders.empty())
+		Log::warn("Assignment stopped after %d rounds with %d patches unassigned", rounds, static_cast<int>(bidders.size()));
+
+	Log::debug("Assigned %d candidates of %d patches in %d rounds",
+	           static_cast<int>(std::count_if(result.begin(), result.end(), [](int index) { return index != -1; })),
+	           static_cast<int>(patchCount),
+	           rounds);
+
+	return result;
+}
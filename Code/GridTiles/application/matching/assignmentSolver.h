@@ -0,0 +1,25 @@
+#pragma once
+
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "matchCandidate.h"
+#include "util/sat.h"
+
+// Assigns one of its candidate placements to every patch such that no two assigned placements overlap in the source.
+// Candidates of different patches whose oriented boxes intersect form a conflict graph, which is solved with an auction:
+// unassigned patches bid on the candidate with the highest score minus price and raise its price by their margin over
+// the second best candidate, evicting the patches that hold a conflicting candidate. Bids are computed in parallel
+// and accepted in patch order, so the result does not depend on the number of threads.
+class AssignmentSolver {
+public:
+	// Index of the assigned candidate of every patch, -1 when the patch gave up because every candidate became too expensive
+	static std::vector<int> solve(const std::vector<std::vector<MatchCandidate>>& candidates,
+	                              const std::vector<cv::Size>& patchSizes,
+	                              cv::TemplateMatchModes metric);
+
+private:
+	// Candidates of other patches that intersect every candidate, indexed by flattened candidate
+	static std::vector<std::vector<std::size_t>> computeConflicts(const std::vector<Obb>& obbs, const std::vector<std::size_t>& owners);
+};
@@ -0,0 +1,243 @@
+#include "core.h"
+#include "descriptorIndex.h"
+
+#include <algorithm>
+
+#include "graphics/textures/sourceTexture.h"
+#include "pyramidMatcher.h"
+
+// Descriptors used to fit the principal components
+static constexpr int trainingSamples = 20000;
+
+void DescriptorIndex::reset() {
+	std::scoped_lock lock(cache->mutex);
+	cache->entries.clear();
+}
+
+bool DescriptorIndex::supports(const cv::Size& patchSize) {
+	return patchSize.width >= footprint && patchSize.height >= footprint;
+}
+
+int DescriptorIndex::descriptorSize(const std::vector<cv::Mat>& integrals) {
+	int size = 0;
+	for (const cv::Mat& integral : integrals)
+		size += footprint * footprint * integral.channels();
+
+	return size;
+}
+
+void DescriptorIndex::describe(const std::vector<cv::Mat>& integrals,
+                               const std::vector<float>& weights,
+                               const cv::Size& patchSize,
+                               const cv::Point& offset,
+                               float* descriptor) {
+	for (std::size_t featureIndex = 0; featureIndex < integrals.size(); featureIndex++) {
+		const cv::Mat& integral = integrals[featureIndex];
+		int channels = integral.channels();
+
+		// Squared distances of the descriptors are weighted like the responses
+		double scale = std::sqrt(std::max(weights[featureIndex], 0.0f));
+
+		for (int cellRow = 0; cellRow < footprint; cellRow++) {
+			int minY = offset.y + cellRow * patchSize.height / footprint;
+			int maxY = offset.y + (cellRow + 1) * patchSize.height / footprint;
+			const double* top = integral.ptr<double>(minY);
+			const double* bottom = integral.ptr<double>(maxY);
+
+			for (int cellCol = 0; cellCol < footprint; cellCol++) {
+				int minX = offset.x + cellCol * patchSize.width / footprint;
+				int maxX = offset.x + (cellCol + 1) * patchSize.width / footprint;
+				double factor = scale / ((maxX - minX) * (maxY - minY));
+
+				for (int channel = 0; channel < channels; channel++) {
+					double sum = bottom[maxX * channels + channel] - bottom[minX * channels + channel] - top[maxX * channels + channel] + top[minX * channels + channel];
+					*descriptor++ = static_cast<float>(sum * factor);
+				}
+			}
+		}
+	}
+}
+
+SRef<DescriptorIndex::Entry> DescriptorIndex::build(SourceTexture& source, const cv::Size& patchSize, const std::vector<float>& weights) {
+	SRef<Entry> entry = std::make_shared<Entry>();
+	entry->patchSize = patchSize;
+	entry->weights = weights;
+	entry->stride = std::max(1, std::min(patchSize.width, patchSize.height) / footprint);
+
+	std::size_t featureCount = std::min(weights.size(), source.features.empty() ? 0 : source.features.front().size());
+	if (featureCount == 0)
+		return entry;
+
+	// Integral images of the features and of the invalid material of every rotation
+	std::vector<std::vector<cv::Mat>> integrals(source.rotations);
+	std::vector<cv::Mat> invalidIntegrals(source.rotations);
+#pragma omp parallel for
+	for (int rotationIndex = 0; rotationIndex < source.rotations; rotationIndex++) {
+		for (std::size_t featureIndex = 0; featureIndex < featureCount; featureIndex++)
+			cv::integral(source.features[rotationIndex][featureIndex].data, integrals[rotationIndex].emplace_back(), CV_64F);
+
+		cv::Mat invalid = source.materialMask(rotationIndex) == 0;
+		cv::integral(invalid, invalidIntegrals[rotationIndex], CV_32S);
+	}
+
+	// Placements on the stride grid that lie within the material, independent of the reservations
+	for (int rotationIndex = 0; rotationIndex < source.rotations; rotationIndex++) {
+		const cv::Mat& invalidIntegral = invalidIntegrals[rotationIndex];
+		for (int y = 0; y + patchSize.height < invalidIntegral.rows; y += entry->stride) {
+			const int* top = invalidIntegral.ptr<int>(y);
+			const int* bottom = invalidIntegral.ptr<int>(y + patchSize.height);
+			for (int x = 0; x + patchSize.width < invalidIntegral.cols; x += entry->stride)
+				if (bottom[x + patchSize.width] - bottom[x] - top[x + patchSize.width] + top[x] == 0)
+					entry->locations.emplace_back(x, y, rotationIndex);
+		}
+	}
+
+	if (entry->locations.empty())
+		return entry;
+
+	int size = descriptorSize(integrals.front());
+	std::vector<float> featureWeights(weights.begin(), weights.begin() + featureCount);
+
+	// Fit the principal components on evenly spaced placements
+	int samples = static_cast<int>(std::min<std::size_t>(trainingSamples, entry->locations.size()));
+	cv::Mat training(samples, size, CV_32FC1);
+	for (int sample = 0; sample < samples; sample++) {
+		const cv::Point3i& location = entry->locations[sample * entry->locations.size() / samples];
+		describe(integrals[location.z], featureWeights, patchSize, cv::Point(location.x, location.y), training.ptr<float>(sample));
+	}
+	entry->pca = cv::PCA(training, cv::noArray(), cv::PCA::DATA_AS_ROW, std::min(dimensions, std::min(size, samples)));
+
+	// Project all placements in blocks, the full descriptors are never stored
+	constexpr int blockSize = 4096;
+	int locationCount = static_cast<int>(entry->locations.size());
+	entry->descriptors.create(locationCount, entry->pca.eigenvectors.rows, CV_32FC1);
+#pragma omp parallel for schedule(dynamic)
+	for (int blockStart = 0; blockStart < locationCount; blockStart += blockSize) {
+		int blockEnd = std::min(blockStart + blockSize, locationCount);
+
+		cv::Mat block(blockEnd - blockStart, size, CV_32FC1);
+		for (int locationIndex = blockStart; locationIndex < blockEnd; locationIndex++) {
+			const cv::Point3i& location = entry->locations[locationIndex];
+			describe(integrals[location.z], featureWeights, patchSize, cv::Point(location.x, location.y), block.ptr<float>(locationIndex - blockStart));
+		}
+
+		cv::Mat projected = entry->descriptors.rowRange(blockStart, blockEnd);
+		entry->pca.project(block, projected);
+	}
+
+	entry->index = std::make_unique<cv::flann::Index>(entry->descriptors, cv::flann::KDTreeIndexParams(trees), cvflann::FLANN_DIST_L2);
+
+	Log::debug("Indexed %d placements of %dx%d patches with stride %d", locationCount, patchSize.width, patchSize.height, entry->stride);
+
+	return entry;
+}
+
+SRef<DescriptorIndex::Entry> DescriptorIndex::entry(SourceTexture& source, const cv::Size& patchSize, const std::vector<float>& weights) {
+	// Building blocks the other queries, they would all need the same index anyway
+	std::scoped_lock lock(cache->mutex);
+
+	std::vector<SRef<Entry>>& entries = cache->entries;
+	auto iterator = std::find_if(entries.begin(), entries.end(), [&](const SRef<Entry>& entry) {
+		return entry->patchSize == patchSize && entry->weights == weights;
+	});
+
+	SRef<Entry> result;
+	if (iterator != entries.end()) {
+		result = *iterator;
+		entries.erase(iterator);
+	} else {
+		result = build(source, patchSize, weights);
+		if (entries.size() >= maximumEntries)
+			entries.erase(entries.begin());
+	}
+	entries.push_back(result);
+
+	return result;
+}
+
+std::vector<MatchCandidate> DescriptorIndex::match(SourceTexture& source,
+                                                   const std::vector<cv::Mat>& templates,
+                                                   const std::vector<float>& weights,
+                                                   cv::TemplateMatchModes metric,
+                                                   int checks,
+                                                   int candidates) {
+	if (templates.empty() || source.features.size() < source.rotations || !supports(templates.front().size()))
+		return {};
+
+	cv::Size templateSize = templates.front().size();
+	std::size_t featureCount = std::min(templates.size(), weights.size());
+	SRef<Entry> entry = this->entry(source, templateSize, std::vector<float>(weights.begin(), weights.begin() + featureCount));
+	if (entry->index == nullptr)
+		return {};
+
+	// Descriptor of the target patch
+	std::vector<cv::Mat> integrals(featureCount);
+	for (std::size_t featureIndex = 0; featureIndex < featureCount; featureIndex++)
+		cv::integral(templates[featureIndex], integrals[featureIndex], CV_64F);
+
+	cv::Mat descriptor(1, descriptorSize(integrals), CV_32FC1);
+	describe(integrals, entry->weights, templateSize, cv::Point(0, 0), descriptor.ptr<float>());
+	cv::Mat query = entry->pca.project(descriptor);
+
+	// Some of the nearest placements are reserved, so more neighbours than candidates are searched
+	int neighbours = std::min(static_cast<int>(entry->locations.size()), 4 * std::max(candidates, 1));
+	cv::Mat indices;
+	cv::Mat distances;
+	entry->index->knnSearch(query, indices, distances, neighbours, cv::flann::SearchParams(checks));
+
+	// Verify every neighbour with the exact metric in a window of one stride around it
+	std::vector<cv::Mat> placementMasks(source.rotations);
+	std::vector<MatchCandidate> result;
+	for (int neighbour = 0; neighbour < indices.cols; neighbour++) {
+		int locationIndex = indices.at<int>(0, neighbour);
+		if (locationIndex < 0 || locationIndex >= static_cast<int>(entry->locations.size()))
+			continue;
+
+		const cv::Point3i& location = entry->locations[locationIndex];
+		int rotationIndex = location.z;
+
+		cv::Mat& placementMask = placementMasks[rotationIndex];
+		if (placementMask.empty())
+			placementMask = source.placement(rotationIndex).mask(templateSize);
+		if (placementMask.empty())
+			continue;
+
+		int stride = entry->stride;
+		cv::Rect window = cv::Rect(location.x - stride, location.y - stride, 2 * stride + 1, 2 * stride + 1) & cv::Rect(0, 0, placementMask.cols, placementMask.rows);
+		if (window.empty() || cv::countNonZero(placementMask(window)) == 0)
+			continue;
+
+		std::vector<cv::Mat> sources;
+		cv::Rect sourceWindow(window.x, window.y, window.width + templateSize.width - 1, window.height + templateSize.height - 1);
+		for (std::size_t featureIndex = 0; featureIndex < featureCount; featureIndex++)
+			sources.push_back(source.features[rotationIndex][featureIndex].data(sourceWindow));
+
+		cv::Mat windowResponse = PyramidMatcher::response(sources, templates, entry->weights, metric);
+
+		double value;
+		cv::Point point;
+		if (metric == cv::TM_SQDIFF || metric == cv::TM_SQDIFF_NORMED)
+			cv::minMaxLoc(windowResponse, &value, nullptr, &point, nullptr, placementMask(window));
+		else
+			cv::minMaxLoc(windowResponse, nullptr, &value, nullptr, &point, placementMask(window));
+
+		if (point.x == -1)
+			continue;
+
+		// Windows of neighbouring placements overlap and may verify the same offset
+		MatchCandidate candidate(rotationIndex, Vec2(window.x + point.x, window.y + point.y), value);
+		bool duplicate = std::ranges::any_of(result, [&candidate](const MatchCandidate& other) {
+			return other.rotationIndex == candidate.rotationIndex && other.position == candidate.position;
+		});
+		if (!duplicate)
+			result.push_back(candidate);
+	}
+
+	std::sort(result.begin(), result.end(), [metric](const MatchCandidate& a, const MatchCandidate& b) {
+		return MatchCandidate::better(metric, a.score, b.score);
+	});
+	if (result.size() > static_cast<std::size_t>(candidates))
+		result.resize(candidates);
+
+	return result;
+}
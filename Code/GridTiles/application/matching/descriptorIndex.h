@@ -0,0 +1,85 @@
+#pragma once
+
+#include <mutex>
+#include <opencv2/core.hpp>
+#include <opencv2/flann.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "matchCandidate.h"
+
+class SourceTexture;
+
+// Approximate nearest neighbour search over descriptors of source placements. Every placement on a stride grid of every
+// rotation is described by the weighted cell means of its features over a fixed footprint, projected on the principal
+// components and stored in a forest of randomized kd-trees. Target patches query the forest for their nearest placements,
+// which are then verified with the exact metric in a window of one stride around them.
+// The descriptors depend on the patch dimension, so an index is built on the first query of every patch dimension.
+class DescriptorIndex {
+public:
+	// Features are reduced to footprint x footprint cell means, smaller patches are not supported
+	static constexpr int footprint = 8;
+	// Principal components kept of the cell means
+	static constexpr int dimensions = 24;
+	// Randomized kd-trees of the forest
+	static constexpr int trees = 4;
+	// Indices kept for the most recently queried patch dimensions
+	static constexpr std::size_t maximumEntries = 8;
+
+	// Index of a single patch dimension and feature weighting
+	struct Entry {
+		cv::Size patchSize;
+		std::vector<float> weights;
+		int stride = 1;
+
+		cv::PCA pca;
+		cv::Mat descriptors;
+		// Rotation in z and offset in x and y of every descriptor
+		std::vector<cv::Point3i> locations;
+		URef<cv::flann::Index> index;
+	};
+
+private:
+	struct Cache {
+		std::mutex mutex;
+		// Most recently used last
+		std::vector<SRef<Entry>> entries;
+	};
+
+	URef<Cache> cache = std::make_unique<Cache>();
+
+public:
+	DescriptorIndex() = default;
+
+	DescriptorIndex(DescriptorIndex&& other) noexcept = default;
+	DescriptorIndex& operator=(DescriptorIndex&& other) noexcept = default;
+	DescriptorIndex(const DescriptorIndex& other) = delete;
+	DescriptorIndex& operator=(const DescriptorIndex& other) = delete;
+
+	// Invalidates all indices
+	void reset();
+
+	static bool supports(const cv::Size& patchSize);
+
+	// Returns the verified candidates, best first. Checks is the number of leafs visited per query,
+	// higher values find the exact nearest placements more often at the cost of a slower query
+	std::vector<MatchCandidate> match(SourceTexture& source,
+	                                  const std::vector<cv::Mat>& templates,
+	                                  const std::vector<float>& weights,
+	                                  cv::TemplateMatchModes metric,
+	                                  int checks,
+	                                  int candidates);
+
+private:
+	// Returns the index of the given patch dimension and weights, building it if needed
+	SRef<Entry> entry(SourceTexture& source, const cv::Size& patchSize, const std::vector<float>& weights);
+
+	static SRef<Entry> build(SourceTexture& source, const cv::Size& patchSize, const std::vector<float>& weights);
+
+	// Weighted cell means of the placement at the given offset, computed from the integral images of the features
+	static void describe(const std::vector<cv::Mat>& integrals,
+	                     const std::vector<float>& weights,
+	                     const cv::Size& patchSize,
+	                     const cv::Point& offset,
+	                     float* descriptor);
+	static int descriptorSize(const std::vector<cv::Mat>& integrals);
+};
@@ -0,0 +1,382 @@
+#include "core.h"
+#include "fftMatcher.h"
+
+#include <opencv2/imgproc.hpp>
+
+void FFTMatcher::reset(int rotations) {
+	if (cache == nullptr)
+		cache = std::make_unique<Cache>();
+
+	std::scoped_lock lock(cache->mutex);
+	cache->bytes = 0;
+
+	this->rotations.clear();
+	for (int rotationIndex = 0; rotationIndex < rotations; rotationIndex++)
+		this->rotations.push_back(std::make_unique<Rotation>());
+}
+
+void FFTMatcher::setCapacity(std::size_t capacity) {
+	if (cache == nullptr)
+		cache = std::make_unique<Cache>();
+
+	std::scoped_lock lock(cache->mutex);
+	cache->capacity = capacity;
+	evict();
+}
+
+void FFTMatcher::evict() {
+	while (cache->bytes > cache->capacity) {
+		Rotation* victim = nullptr;
+		for (const URef<Rotation>& rotation : rotations)
+			if (rotation->cachedBytes > 0 && (victim == nullptr || rotation->lastUse < victim->lastUse))
+				victim = rotation.get();
+
+		if (victim == nullptr)
+			break;
+
+		// Matches still holding the spectra keep them alive
+		std::scoped_lock lock(victim->mutex);
+		victim->spectra = nullptr;
+		cache->bytes -= victim->cachedBytes;
+		victim->cachedBytes = 0;
+	}
+}
+
+SRef<const FFTMatcher::Spectra> FFTMatcher::spectra(const FeatureVector& source, int rotationIndex) {
+	Rotation& rotation = *rotations[rotationIndex];
+
+	SRef<const Spectra> spectra;
+	{
+		std::scoped_lock lock(rotation.mutex);
+		if (rotation.spectra == nullptr)
+			rotation.spectra = computeSpectra(source);
+
+		spectra = rotation.spectra;
+	}
+
+	std::scoped_lock lock(cache->mutex);
+	rotation.lastUse = ++cache->clock;
+	if (rotation.cachedBytes == 0) {
+		// The spectra may have been evicted by another match in between
+		std::scoped_lock rotationLock(rotation.mutex);
+		if (rotation.spectra == spectra) {
+			rotation.cachedBytes = spectra->bytes;
+			cache->bytes += spectra->bytes;
+		}
+	}
+	evict();
+
+	return spectra;
+}
+
+SRef<const FFTMatcher::Spectra> FFTMatcher::computeSpectra(const FeatureVector& source) {
+	SRef<Spectra> spectra = std::make_shared<Spectra>();
+	spectra->size = cv::Size(source.cols(), source.rows());
+	spectra->dftSize = cv::Size(cv::getOptimalDFTSize(spectra->size.width), cv::getOptimalDFTSize(spectra->size.height));
+
+	for (const Texture& feature : source) {
+		std::vector<cv::Mat> planes;
+		cv::split(feature.data, planes);
+
+		std::vector<cv::Mat>& channels = spectra->features.emplace_back();
+		for (const cv::Mat& plane : planes) {
+			// Zero padded spectrum
+			cv::Mat padded(spectra->dftSize, CV_32FC1, cv::Scalar(0.0));
+			cv::Mat paddedRegion = padded(cv::Rect(0, 0, plane.cols, plane.rows));
+			plane.convertTo(paddedRegion, CV_32FC1);
+
+			cv::Mat& spectrum = channels.emplace_back();
+			cv::dft(padded, spectrum, 0, plane.rows);
+			spectra->bytes += spectrum.total() * spectrum.elemSize();
+		}
+	}
+
+	return spectra;
+}
+
+// Sums of the values or their squares of every channel over the template window at every offset of the response
+static std::vector<cv::Mat> computeWindowSums(const cv::Mat& feature, const cv::Size& templateSize, const cv::Size& responseSize, bool squared) {
+	std::vector<cv::Mat> planes;
+	cv::split(feature, planes);
+
+	cv::Rect responseRegion(cv::Point(0, 0), responseSize);
+	std::vector<cv::Mat> windows;
+	for (const cv::Mat& plane : planes) {
+		cv::Mat window;
+		if (squared)
+			cv::sqrBoxFilter(plane, window, CV_64F, templateSize, cv::Point(0, 0), false);
+		else
+			cv::boxFilter(plane, window, CV_64F, templateSize, cv::Point(0, 0), false);
+
+		windows.push_back(window(responseRegion));
+	}
+
+	return windows;
+}
+
+FFTMatcher::TemplateStatistics FFTMatcher::computeTemplateStatistics(const cv::Mat& templ, cv::TemplateMatchModes metric) {
+	TemplateStatistics statistics;
+
+	cv::Scalar mean;
+	cv::Scalar deviation;
+	cv::meanStdDev(templ, mean, deviation);
+
+	double norm = 0.0;
+	double sum2 = 0.0;
+	for (int channel = 0; channel < templ.channels(); channel++) {
+		norm += deviation[channel] * deviation[channel];
+		sum2 += mean[channel] * mean[channel];
+	}
+	sum2 += norm;
+
+	// Only the correlation coefficient metrics subtract the template mean
+	if (metric != cv::TM_CCOEFF && metric != cv::TM_CCOEFF_NORMED) {
+		mean = cv::Scalar::all(0.0);
+		norm = sum2;
+	}
+
+	double area = static_cast<double>(templ.rows) * static_cast<double>(templ.cols);
+	statistics.mean = mean;
+	statistics.sum2 = sum2 * area;
+	statistics.norm = std::sqrt(norm) * std::sqrt(area);
+
+	return statistics;
+}
+
+void FFTMatcher::correlate(const Spectra& spectra, const std::vector<cv::Mat>& channels, const cv::Mat& templ, float weight, cv::Mat& accumulator) {
+	std::vector<cv::Mat> planes;
+	cv::split(templ, planes);
+
+	cv::Mat padded(spectra.dftSize, CV_32FC1, cv::Scalar(0.0));
+	cv::Mat paddedRegion = padded(cv::Rect(0, 0, templ.cols, templ.rows));
+	cv::Mat spectrum;
+	cv::Mat product;
+	for (std::size_t channel = 0; channel < planes.size(); channel++) {
+		planes[channel].convertTo(paddedRegion, CV_32FC1);
+		cv::dft(padded, spectrum, 0, templ.rows);
+
+		// Correlation is the product with the conjugate template spectrum
+		cv::mulSpectrums(channels[channel], spectrum, product, 0, true);
+		cv::scaleAdd(product, weight, accumulator, accumulator);
+	}
+}
+
+void FFTMatcher::accumulateLinear(const cv::Mat& feature,
+                                  const cv::Size& templateSize,
+                                  const TemplateStatistics& statistics,
+                                  float weight,
+                                  cv::TemplateMatchModes metric,
+                                  cv::Mat& response) {
+	if (metric == cv::TM_CCORR)
+		return;
+
+	std::vector<cv::Mat> windows = computeWindowSums(feature, templateSize, response.size(), metric == cv::TM_SQDIFF);
+
+	for (int row = 0; row < response.rows; row++) {
+		float* responseRow = response.ptr<float>(row);
+
+		for (std::size_t channel = 0; channel < windows.size(); channel++) {
+			const double* window = windows[channel].ptr<double>(row);
+
+			double templateTerm = metric == cv::TM_SQDIFF ? (channel == 0 ? statistics.sum2 : 0.0) : statistics.mean[static_cast<int>(channel)];
+			for (int col = 0; col < response.cols; col++) {
+				if (metric == cv::TM_SQDIFF)
+					responseRow[col] += static_cast<float>(weight * (window[col] + templateTerm));
+				else
+					responseRow[col] -= static_cast<float>(weight * window[col] * templateTerm);
+			}
+		}
+	}
+}
+
+void FFTMatcher::accumulateNormed(const cv::Mat& feature,
+                                  const cv::Mat& correlation,
+                                  const cv::Size& templateSize,
+                                  const TemplateStatistics& statistics,
+                                  float weight,
+                                  cv::TemplateMatchModes metric,
+                                  cv::Mat& response) {
+	int w = templateSize.width;
+	int h = templateSize.height;
+	double inverseArea = 1.0 / (static_cast<double>(w) * static_cast<double>(h));
+
+	// Constant template, the correlation coefficient is defined as 1
+	if (metric == cv::TM_CCOEFF_NORMED && statistics.norm < DBL_EPSILON) {
+		response += cv::Scalar(weight);
+
+		return;
+	}
+
+	std::vector<cv::Mat> sums;
+	if (metric == cv::TM_CCOEFF_NORMED)
+		sums = computeWindowSums(feature, templateSize, response.size(), false);
+	std::vector<cv::Mat> sqsums = computeWindowSums(feature, templateSize, response.size(), true);
+
+	for (int row = 0; row < response.rows; row++) {
+		float* responseRow = response.ptr<float>(row);
+		const float* correlationRow = correlation.ptr<float>(row);
+
+		for (int col = 0; col < response.cols; col++) {
+			double numerator = correlationRow[col];
+			double windowMean2 = 0.0;
+			double windowSum2 = 0.0;
+
+			for (std::size_t channel = 0; channel < sqsums.size(); channel++) {
+				if (metric == cv::TM_CCOEFF_NORMED) {
+					double window = sums[channel].ptr<double>(row)[col];
+					windowMean2 += window * window;
+					numerator -= window * statistics.mean[static_cast<int>(channel)];
+				}
+
+				windowSum2 += sqsums[channel].ptr<double>(row)[col];
+			}
+			windowMean2 *= inverseArea;
+
+			if (metric == cv::TM_SQDIFF_NORMED)
+				numerator = std::max(windowSum2 - 2.0 * numerator + statistics.sum2, 0.0);
+
+			// Same normalization and clamping as cv::matchTemplate
+			double denominator = std::sqrt(std::max(windowSum2 - windowMean2, 0.0)) * statistics.norm;
+			if (std::abs(numerator) < denominator)
+				numerator /= denominator;
+			else if (std::abs(numerator) < denominator * 1.125)
+				numerator = numerator > 0.0 ? 1.0 : -1.0;
+			else
+				numerator = metric != cv::TM_SQDIFF_NORMED ? 0.0 : 1.0;
+
+			responseRow[col] += static_cast<float>(weight * numerator);
+		}
+	}
+}
+
+void FFTMatcher::matchTemplate(const FeatureVector& source,
+                               int rotationIndex,
+                               const std::vector<cv::Mat>& templates,
+                               const std::vector<float>& weights,
+                               cv::TemplateMatchModes metric,
+                               cv::Mat& response) {
+	if (source.empty() || templates.empty()) {
+		response = cv::Mat();
+
+		return;
+	}
+
+	SRef<const Spectra> spectra = this->spectra(source, rotationIndex);
+
+	cv::Size templateSize = templates.front().size();
+	int resultCols = spectra->size.width - templateSize.width + 1;
+	int resultRows = spectra->size.height - templateSize.height + 1;
+	if (resultCols <= 0 || resultRows <= 0) {
+		response = cv::Mat();
+
+		return;
+	}
+
+	cv::Rect resultRegion(0, 0, resultCols, resultRows);
+	response.create(resultRows, resultCols, CV_32FC1);
+
+	bool normed = metric == cv::TM_SQDIFF_NORMED || metric == cv::TM_CCORR_NORMED || metric == cv::TM_CCOEFF_NORMED;
+	std::size_t featureCount = std::min(templates.size(), spectra->features.size());
+
+	if (!normed) {
+		// Linear metrics, sum all weighted spectra and invert once
+		cv::Mat accumulator(spectra->dftSize, CV_32FC1, cv::Scalar(0.0));
+		for (std::size_t featureIndex = 0; featureIndex < featureCount; featureIndex++)
+			correlate(*spectra, spectra->features[featureIndex], templates[featureIndex], weights[featureIndex], accumulator);
+
+		cv::Mat correlation;
+		cv::dft(accumulator, correlation, cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT, resultRows);
+		if (metric == cv::TM_SQDIFF)
+			correlation(resultRegion).convertTo(response, CV_32FC1, -2.0);
+		else
+			correlation(resultRegion).copyTo(response);
+
+		for (std::size_t featureIndex = 0; featureIndex < featureCount; featureIndex++) {
+			TemplateStatistics statistics = computeTemplateStatistics(templates[featureIndex], metric);
+			accumulateLinear(source[static_cast<int>(featureIndex)].data, templateSize, statistics, weights[featureIndex], metric, response);
+		}
+
+		if (metric == cv::TM_SQDIFF)
+			cv::max(response, 0.0, response);
+
+		return;
+	}
+
+	// Normed metrics, every feature is normalized separately before it is weighted
+	response.setTo(cv::Scalar(0.0));
+	cv::Mat accumulator(spectra->dftSize, CV_32FC1);
+	cv::Mat correlation;
+	for (std::size_t featureIndex = 0; featureIndex < featureCount; featureIndex++) {
+		accumulator.setTo(cv::Scalar(0.0));
+		correlate(*spectra, spectra->features[featureIndex], templates[featureIndex], 1.0f, accumulator);
+		cv::dft(accumulator, correlation, cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT, resultRows);
+
+		TemplateStatistics statistics = computeTemplateStatistics(templates[featureIndex], metric);
+		accumulateNormed(source[static_cast<int>(featureIndex)].data, correlation(resultRegion), templateSize, statistics, weights[featureIndex], metric, response);
+	}
+}
+
+void FFTMatcher::computeCorrelations(const FeatureVector& source, int rotationIndex, const std::vector<cv::Mat>& templates, std::vector<cv::Mat>& correlations) {
+	correlations.clear();
+	if (source.empty() || templates.empty())
+		return;
+
+	SRef<const Spectra> spectra = this->spectra(source, rotationIndex);
+
+	cv::Size templateSize = templates.front().size();
+	int resultCols = spectra->size.width - templateSize.width + 1;
+	int resultRows = spectra->size.height - templateSize.height + 1;
+	if (resultCols <= 0 || resultRows <= 0)
+		return;
+
+	cv::Rect resultRegion(0, 0, resultCols, resultRows);
+	std::size_t featureCount = std::min(templates.size(), spectra->features.size());
+
+	cv::Mat accumulator(spectra->dftSize, CV_32FC1);
+	cv::Mat correlation;
+	for (std::size_t featureIndex = 0; featureIndex < featureCount; featureIndex++) {
+		accumulator.setTo(cv::Scalar(0.0));
+		correlate(*spectra, spectra->features[featureIndex], templates[featureIndex], 1.0f, accumulator);
+		cv::dft(accumulator, correlation, cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT, resultRows);
+
+		correlations.push_back(correlation(resultRegion).clone());
+	}
+}
+
+void FFTMatcher::combineCorrelations(const FeatureVector& source,
+                                     int rotationIndex,
+                                     const std::vector<cv::Mat>& templates,
+                                     const std::vector<cv::Mat>& correlations,
+                                     const std::vector<float>& weights,
+                                     cv::TemplateMatchModes metric,
+                                     cv::Mat& response) {
+	if (source.empty() || templates.empty() || correlations.empty()) {
+		response = cv::Mat();
+
+		return;
+	}
+
+	SRef<const Spectra> spectra = this->spectra(source, rotationIndex);
+
+	cv::Size templateSize = templates.front().size();
+	response.create(correlations.front().size(), CV_32FC1);
+	response.setTo(cv::Scalar(0.0));
+
+	bool normed = metric == cv::TM_SQDIFF_NORMED || metric == cv::TM_CCORR_NORMED || metric == cv::TM_CCOEFF_NORMED;
+	std::size_t featureCount = std::min(std::min(templates.size(), correlations.size()), spectra->features.size());
+
+	for (std::size_t featureIndex = 0; featureIndex < featureCount; featureIndex++) {
+		TemplateStatistics statistics = computeTemplateStatistics(templates[featureIndex], metric);
+
+		if (normed) {
+			accumulateNormed(source[static_cast<int>(featureIndex)].data, correlations[featureIndex], templateSize, statistics, weights[featureIndex], metric, response);
+		} else {
+			double scale = metric == cv::TM_SQDIFF ? -2.0 * weights[featureIndex] : weights[featureIndex];
+			cv::scaleAdd(correlations[featureIndex], scale, response, response);
+			accumulateLinear(source[static_cast<int>(featureIndex)].data, templateSize, statistics, weights[featureIndex], metric, response);
+		}
+	}
+
+	if (metric == cv::TM_SQDIFF)
+		cv::max(response, 0.0, response);
+}
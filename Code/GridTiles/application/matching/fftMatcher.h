@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cfloat>
+#include <cstdint>
+#include <mutex>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "graphics/features/Feature.h"
+
+// Template matcher that correlates target patches against cached spectra of the rotated source feature planes.
+// The results are equal to the weighted sum of cv::matchTemplate responses over all features.
+class FFTMatcher {
+public:
+	// Spectra of the channels of every feature plane of a single rotation. The window sums of the normed and linear metrics
+	// are computed per match from the feature planes, so only the spectra are cached
+	struct Spectra {
+		cv::Size size;
+		cv::Size dftSize;
+		std::vector<std::vector<cv::Mat>> features;
+		std::size_t bytes = 0;
+	};
+
+	// Statistics of a single template, computed once per match
+	struct TemplateStatistics {
+		cv::Scalar mean;
+		double sum2;
+		double norm;
+	};
+
+private:
+	struct Rotation {
+		// Guards the spectra, held while they are computed
+		std::mutex mutex;
+		SRef<const Spectra> spectra;
+
+		// Guarded by the mutex of the cache
+		std::uint64_t lastUse = 0;
+		std::size_t cachedBytes = 0;
+	};
+
+	// Bytes of the cached spectra of all rotations, least recently used rotations are evicted beyond the capacity.
+	// The cache mutex is never acquired while the mutex of a rotation is held
+	struct Cache {
+		std::mutex mutex;
+		std::size_t bytes = 0;
+		std::size_t capacity = std::size_t(4096) << 20;
+		std::uint64_t clock = 0;
+	};
+
+	std::vector<URef<Rotation>> rotations;
+	URef<Cache> cache = std::make_unique<Cache>();
+
+public:
+	FFTMatcher() = default;
+
+	FFTMatcher(FFTMatcher&& other) noexcept = default;
+	FFTMatcher& operator=(FFTMatcher&& other) noexcept = default;
+	FFTMatcher(const FFTMatcher& other) = delete;
+	FFTMatcher& operator=(const FFTMatcher& other) = delete;
+
+	// Invalidates all cached spectra, the spectra of a rotation are recomputed on its next match
+	void reset(int rotations);
+
+	// Bounds the bytes of the cached spectra of all rotations, evicting the least recently used rotations
+	void setCapacity(std::size_t capacity);
+
+	// Computes the weighted response of the target feature patches against the source features of the given rotation
+	void matchTemplate(const FeatureVector& source,
+	                   int rotationIndex,
+	                   const std::vector<cv::Mat>& templates,
+	                   const std::vector<float>& weights,
+	                   cv::TemplateMatchModes metric,
+	                   cv::Mat& response);
+
+	// Computes the raw, unweighted correlation of every target feature patch with the source features of the given rotation,
+	// empty if the patches do not fit in the rotation
+	void computeCorrelations(const FeatureVector& source, int rotationIndex, const std::vector<cv::Mat>& templates, std::vector<cv::Mat>& correlations);
+
+	// Computes the weighted response of the target feature patches from their raw correlations, equal to matchTemplate
+	void combineCorrelations(const FeatureVector& source,
+	                         int rotationIndex,
+	                         const std::vector<cv::Mat>& templates,
+	                         const std::vector<cv::Mat>& correlations,
+	                         const std::vector<float>& weights,
+	                         cv::TemplateMatchModes metric,
+	                         cv::Mat& response);
+
+	// Returns the spectra of the given rotation, computing them if they are not cached. The returned spectra stay valid
+	// when they are evicted
+	SRef<const Spectra> spectra(const FeatureVector& source, int rotationIndex);
+
+	static TemplateStatistics computeTemplateStatistics(const cv::Mat& templ, cv::TemplateMatchModes metric);
+
+private:
+	static SRef<const Spectra> computeSpectra(const FeatureVector& source);
+
+	// Evicts least recently used spectra until the cached spectra fit in the capacity, the cache mutex must be held
+	void evict();
+
+	// Adds the spectrum of the correlation between the source channels and the template to the accumulator
+	static void correlate(const Spectra& spectra, const std::vector<cv::Mat>& channels, const cv::Mat& templ, float weight, cv::Mat& accumulator);
+
+	// Adds the weighted window terms of the linear metrics to the response, the correlation itself is already in there
+	static void accumulateLinear(const cv::Mat& feature,
+	                             const cv::Size& templateSize,
+	                             const TemplateStatistics& statistics,
+	                             float weight,
+	                             cv::TemplateMatchModes metric,
+	                             cv::Mat& response);
+
+	// Adds the weighted, normalized response of a single feature to the response, given the raw correlation of that feature
+	static void accumulateNormed(const cv::Mat& feature,
+	                             const cv::Mat& correlation,
+	                             const cv::Size& templateSize,
+	                             const TemplateStatistics& statistics,
+	                             float weight,
+	                             cv::TemplateMatchModes metric,
+	                             cv::Mat& response);
+};
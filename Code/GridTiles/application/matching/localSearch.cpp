@@ -0,0 +1,99 @@
+#include "core.h"
+#include "localSearch.h"
+
+#include "main.h"
+
+LocalSearch::Statistics LocalSearch::statistics;
+
+bool LocalSearch::enabled() {
+	return settings.localSearch && !settings.source.rotateTemplates && settings.source.features.size() >= static_cast<std::size_t>(settings.source.rotations);
+}
+
+MatchCandidate LocalSearch::match(const cv::Rect& patch, cv::TemplateMatchModes metric, const MatchCandidate& seed) {
+	int rotations = settings.source.rotations;
+	if (!enabled() || !seed.valid() || seed.rotationIndex >= rotations || patch.empty())
+		return MatchCandidate();
+
+	std::vector<float> distribution(2);
+	distribution[FeatureIndex_Intensity] = settings.intensityWeight;
+	distribution[FeatureIndex_Edge] = settings.edgeWeight;
+
+	std::vector<cv::Mat> targetFeaturePatches;
+	for (FeatureIndex featureIndex = 0; featureIndex < settings.target.features.size(); featureIndex++)
+		targetFeaturePatches.push_back(settings.target[featureIndex].data(patch));
+
+	// Neighbouring rotations on both sides, every rotation once
+	std::vector<int> rotationIndices;
+	int rotationRadius = std::min(std::max(settings.localSearchRotations, 0), (rotations - 1) / 2);
+	for (int step = -rotationRadius; step <= rotationRadius; step++)
+		rotationIndices.push_back(((seed.rotationIndex + step) % rotations + rotations) % rotations);
+	if (rotations % 2 == 0 && settings.localSearchRotations >= rotations / 2)
+		rotationIndices.push_back((seed.rotationIndex + rotations / 2) % rotations);
+
+	// Center of the seed in the unrotated source, the same material is searched around it in every rotation
+	Obb obb = Utils::computeCandidateObb(seed, patch.size());
+	int radius = std::max(settings.localSearchRadius, 0);
+
+	std::vector<MatchCandidate> found(rotationIndices.size());
+#pragma omp parallel for if (rotationIndices.size() > 1)
+	for (int index = 0; index < static_cast<int>(rotationIndices.size()); index++) {
+		int rotationIndex = rotationIndices[index];
+
+		const double* first = settings.source.transformations[rotationIndex].ptr<double>(0);
+		const double* second = settings.source.transformations[rotationIndex].ptr<double>(1);
+		Vec2 center(first[0] * obb.center.x + first[1] * obb.center.y + first[2], second[0] * obb.center.x + second[1] * obb.center.y + second[2]);
+		cv::Point offset(static_cast<int>(std::lround(center.x - obb.extents.x)), static_cast<int>(std::lround(center.y - obb.extents.y)));
+
+		cv::Mat placementMask = settings.source.placement(rotationIndex).mask(patch.size());
+		cv::Rect window = cv::Rect(offset.x - radius, offset.y - radius, 2 * radius + 1, 2 * radius + 1) & cv::Rect(0, 0, placementMask.cols, placementMask.rows);
+		if (window.empty())
+			continue;
+
+		std::vector<cv::Mat> sources;
+		cv::Rect sourceWindow(window.x, window.y, window.width + patch.width - 1, window.height + patch.height - 1);
+		for (const Texture& feature : settings.source.features[rotationIndex])
+			sources.push_back(feature.data(sourceWindow));
+
+		cv::Mat windowResponse = PyramidMatcher::response(sources, targetFeaturePatches, distribution, metric);
+
+		double value;
+		cv::Point point;
+		if (metric == cv::TM_SQDIFF || metric == cv::TM_SQDIFF_NORMED)
+			cv::minMaxLoc(windowResponse, &value, nullptr, &point, nullptr, placementMask(window));
+		else
+			cv::minMaxLoc(windowResponse, nullptr, &value, nullptr, &point, placementMask(window));
+
+		if (point.x != -1)
+			found[index] = MatchCandidate(rotationIndex, Vec2(window.x + point.x, window.y + point.y), value);
+	}
+
+	MatchCandidate best;
+	for (const MatchCandidate& candidate : found)
+		if (candidate.valid() && (!best.valid() || MatchCandidate::better(metric, candidate.score, best.score)))
+			best = candidate;
+
+	return best;
+}
+
+bool LocalSearch::accept(const MatchCandidate& candidate, cv::TemplateMatchModes metric) {
+	statistics.searches++;
+
+	if (!candidate.valid() || MatchCandidate::better(metric, settings.localSearchThreshold, candidate.score))
+		return false;
+
+	statistics.accepted++;
+
+	return true;
+}
+
+void LocalSearch::report() {
+	std::uint64_t searches = statistics.searches.exchange(0);
+	std::uint64_t accepted = statistics.accepted.exchange(0);
+	if (searches == 0)
+		return;
+
+	Log::info("Local search accepted %llu of %llu placements (%.1f%%)",
+	          static_cast<unsigned long long>(accepted),
+	          static_cast<unsigned long long>(searches),
+	          100.0 * static_cast<double>(accepted) / static_cast<double>(searches));
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "matchCandidate.h"
+
+// Search of a split patch around the placement of the patch it was split from. The halves of a patch mostly fit the
+// material their parent covered, so they are first searched in a window around the parent placement shifted to the part
+// they cover, in the parent rotation and its neighbouring rotations. The global search only runs when the best local
+// placement is worse than the threshold of the settings.
+class LocalSearch {
+public:
+	// Searches since the last report
+	struct Statistics {
+		std::atomic<std::uint64_t> searches = 0;
+		std::atomic<std::uint64_t> accepted = 0;
+	};
+
+	// Whether the local search is enabled and can run, it needs the features of every rotation
+	static bool enabled();
+
+	// Best available placement within the radius of the settings around the seed, in the rotations within the rotation
+	// radius of the settings around the rotation of the seed. Invalid if no placement is available
+	static MatchCandidate match(const cv::Rect& patch, cv::TemplateMatchModes metric, const MatchCandidate& seed);
+
+	// Whether the placement is good enough to skip the global search, counted in the statistics
+	static bool accept(const MatchCandidate& candidate, cv::TemplateMatchModes metric);
+
+	// Logs the fraction of the searches that skipped the global search and starts counting anew
+	static void report();
+
+private:
+	static Statistics statistics;
+};
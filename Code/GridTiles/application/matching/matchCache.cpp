@@ -0,0 +1,295 @@
+#include "core.h"
+#include "matchCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+
+#include "main.h"
+
+static constexpr char magic[4] = { 'G', 'T', 'M', 'C' };
+
+struct MatchCacheHeader {
+	char magic[4];
+	std::uint32_t version;
+	std::uint64_t stateHash;
+	std::uint64_t entryCount;
+};
+
+// Key of an entry on disk, the versions only exist within a session
+struct MatchCacheEntry {
+	std::int32_t x;
+	std::int32_t y;
+	std::int32_t width;
+	std::int32_t height;
+	std::int32_t metric;
+	std::int32_t count;
+	std::int32_t rotations;
+	std::int32_t method;
+	float intensityWeight;
+	float edgeWeight;
+	std::uint64_t parameters;
+	std::uint64_t candidateCount;
+};
+
+struct MatchCacheCandidate {
+	std::int32_t rotationIndex;
+	std::int32_t padding;
+	double x;
+	double y;
+	double score;
+};
+
+static std::uint64_t mix(std::uint64_t hash, std::uint64_t value) {
+	return ((hash << 5 | hash >> 59) ^ value) * 0x9e3779b97f4a7c15ull;
+}
+
+std::size_t MatchCache::KeyHash::operator()(const Key& key) const {
+	std::uint64_t hash = 0xcbf29ce484222325ull;
+	hash = mix(hash, static_cast<std::uint32_t>(key.patch.x) | static_cast<std::uint64_t>(static_cast<std::uint32_t>(key.patch.y)) << 32);
+	hash = mix(hash, static_cast<std::uint32_t>(key.patch.width) | static_cast<std::uint64_t>(static_cast<std::uint32_t>(key.patch.height)) << 32);
+	hash = mix(hash, static_cast<std::uint32_t>(key.metric) | static_cast<std::uint64_t>(static_cast<std::uint32_t>(key.count)) << 32);
+	hash = mix(hash, static_cast<std::uint32_t>(key.rotations) | static_cast<std::uint64_t>(static_cast<std::uint32_t>(key.method)) << 32);
+
+	std::uint32_t intensityWeight;
+	std::uint32_t edgeWeight;
+	std::memcpy(&intensityWeight, &key.intensityWeight, sizeof(float));
+	std::memcpy(&edgeWeight, &key.edgeWeight, sizeof(float));
+	hash = mix(hash, intensityWeight | static_cast<std::uint64_t>(edgeWeight) << 32);
+
+	hash = mix(hash, key.parameters);
+	hash = mix(hash, key.sourceVersion);
+	hash = mix(hash, key.reservationVersion);
+
+	return static_cast<std::size_t>(hash);
+}
+
+MatchCache::MatchCache(std::size_t capacity)
+	: capacity(capacity) {}
+
+MatchCache::Key MatchCache::key(const cv::Rect& patch, cv::TemplateMatchModes metric, int count) {
+	Key key;
+	key.patch = patch;
+	key.metric = metric;
+	key.count = count;
+	key.rotations = settings.source.rotations;
+	key.method = settings.matchingMethod;
+	key.intensityWeight = settings.intensityWeight;
+	key.edgeWeight = settings.edgeWeight;
+	key.sourceVersion = settings.source.version;
+	key.reservationVersion = settings.source.reservationVersion;
+
+	// Parameters of every method, a change of an unused one only costs a few misses
+	std::uint64_t parameters = 0xcbf29ce484222325ull;
+	parameters = mix(parameters, settings.pyramidLevels);
+	parameters = mix(parameters, settings.pyramidCandidates);
+	parameters = mix(parameters, settings.indexChecks);
+	parameters = mix(parameters, settings.indexCandidates);
+	parameters = mix(parameters, settings.source.rotateTemplates);
+	key.parameters = parameters;
+
+	return key;
+}
+
+bool MatchCache::findLocked(const Key& key, std::vector<MatchCandidate>& candidates) {
+	auto iterator = lookup.find(key);
+	if (iterator == lookup.end())
+		return false;
+
+	entries.splice(entries.begin(), entries, iterator->second);
+	candidates = iterator->second->candidates;
+
+	return true;
+}
+
+void MatchCache::insertLocked(const Key& key, const std::vector<MatchCandidate>& candidates) {
+	auto iterator = lookup.find(key);
+	if (iterator != lookup.end()) {
+		iterator->second->candidates = candidates;
+		entries.splice(entries.begin(), entries, iterator->second);
+
+		return;
+	}
+
+	entries.push_front(Entry { key, candidates });
+	lookup.emplace(key, entries.begin());
+
+	while (entries.size() > capacity) {
+		lookup.erase(entries.back().key);
+		entries.pop_back();
+	}
+}
+
+bool MatchCache::find(const Key& key, std::vector<MatchCandidate>& candidates) {
+	std::scoped_lock lock(mutex);
+
+	Key unreservedKey = key;
+	unreservedKey.reservationVersion = 0;
+
+	// The best placements without reservations are still the best ones if none of them was reserved since
+	bool found = findLocked(unreservedKey, candidates) && std::ranges::all_of(candidates, [&key](const MatchCandidate& candidate) {
+		if (key.reservationVersion == 0)
+			return true;
+
+		cv::Rect bounds(static_cast<int>(candidate.position.x), static_cast<int>(candidate.position.y), key.patch.width, key.patch.height);
+
+		return settings.source.placement(candidate.rotationIndex).fits(bounds);
+	});
+
+	if (found)
+		hits++;
+	else
+		misses++;
+
+	return found;
+}
+
+void MatchCache::insert(const Key& key, const std::vector<MatchCandidate>& candidates) {
+	// Reservations of a matching round never recur, so only the placements found without reservations are kept
+	if (key.reservationVersion != 0)
+		return;
+
+	std::scoped_lock lock(mutex);
+
+	insertLocked(key, candidates);
+}
+
+void MatchCache::clear() {
+	std::scoped_lock lock(mutex);
+
+	entries.clear();
+	lookup.clear();
+}
+
+void MatchCache::report() {
+	std::uint64_t hits = this->hits.exchange(0);
+	std::uint64_t misses = this->misses.exchange(0);
+	if (hits + misses == 0)
+		return;
+
+	Log::info("Match cache hit %llu of %llu lookups", static_cast<unsigned long long>(hits), static_cast<unsigned long long>(hits + misses));
+}
+
+std::uint64_t MatchCache::stateHash() {
+	if (settings.source.featureHash == 0)
+		return 0;
+
+	std::vector<cv::Mat> planes;
+	for (const Texture& feature : settings.target.features)
+		planes.push_back(feature.data);
+
+	return SourceCache::hash(planes, settings.source.featureHash);
+}
+
+std::string MatchCache::path(const std::string& directory, std::uint64_t stateHash) {
+	char name[64];
+	std::snprintf(name, sizeof(name), "matches_%016llx.cache", static_cast<unsigned long long>(stateHash));
+
+	return (std::filesystem::path(directory) / name).string();
+}
+
+bool MatchCache::save(const std::string& path, std::uint64_t stateHash) {
+	std::scoped_lock lock(mutex);
+
+	// Least recently used first, so loading keeps the recency order. Entries of replaced features are stale
+	std::vector<const Entry*> saved;
+	for (auto iterator = entries.rbegin(); iterator != entries.rend(); ++iterator)
+		if (iterator->key.sourceVersion == settings.source.version)
+			saved.push_back(&*iterator);
+
+	MatchCacheHeader header;
+	std::memcpy(header.magic, magic, sizeof(magic));
+	header.version = fileVersion;
+	header.stateHash = stateHash;
+	header.entryCount = saved.size();
+
+	std::error_code error;
+	std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+	std::string temporaryPath = path + "." + std::to_string(std::random_device()()) + ".tmp";
+
+	{
+		std::ofstream file(temporaryPath, std::ios::binary);
+		if (!file.is_open())
+			return false;
+
+		file.write(reinterpret_cast<const char*>(&header), sizeof(MatchCacheHeader));
+		for (const Entry* entry : saved) {
+			const Key& key = entry->key;
+			MatchCacheEntry fileEntry = {
+				key.patch.x, key.patch.y, key.patch.width, key.patch.height,
+				key.metric, key.count, key.rotations, key.method,
+				key.intensityWeight, key.edgeWeight, key.parameters, entry->candidates.size()
+			};
+			file.write(reinterpret_cast<const char*>(&fileEntry), sizeof(MatchCacheEntry));
+
+			for (const MatchCandidate& candidate : entry->candidates) {
+				MatchCacheCandidate fileCandidate = { candidate.rotationIndex, 0, candidate.position.x, candidate.position.y, candidate.score };
+				file.write(reinterpret_cast<const char*>(&fileCandidate), sizeof(MatchCacheCandidate));
+			}
+		}
+
+		if (!file.good()) {
+			file.close();
+			std::filesystem::remove(temporaryPath, error);
+
+			return false;
+		}
+	}
+
+	std::filesystem::rename(temporaryPath, path, error);
+	if (error) {
+		std::filesystem::remove(temporaryPath, error);
+
+		return false;
+	}
+
+	return true;
+}
+
+bool MatchCache::load(const std::string& path, std::uint64_t stateHash) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	MatchCacheHeader header;
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(MatchCacheHeader)))
+		return false;
+	if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != fileVersion || header.stateHash != stateHash)
+		return false;
+
+	std::scoped_lock lock(mutex);
+
+	for (std::uint64_t entryIndex = 0; entryIndex < header.entryCount; entryIndex++) {
+		MatchCacheEntry fileEntry;
+		if (!file.read(reinterpret_cast<char*>(&fileEntry), sizeof(MatchCacheEntry)))
+			return false;
+
+		// The features are the same as when the entries were saved
+		Key key;
+		key.patch = cv::Rect(fileEntry.x, fileEntry.y, fileEntry.width, fileEntry.height);
+		key.metric = fileEntry.metric;
+		key.count = fileEntry.count;
+		key.rotations = fileEntry.rotations;
+		key.method = fileEntry.method;
+		key.intensityWeight = fileEntry.intensityWeight;
+		key.edgeWeight = fileEntry.edgeWeight;
+		key.parameters = fileEntry.parameters;
+		key.sourceVersion = settings.source.version;
+
+		std::vector<MatchCandidate> candidates;
+		for (std::uint64_t candidateIndex = 0; candidateIndex < fileEntry.candidateCount; candidateIndex++) {
+			MatchCacheCandidate fileCandidate;
+			if (!file.read(reinterpret_cast<char*>(&fileCandidate), sizeof(MatchCacheCandidate)))
+				return false;
+
+			if (fileCandidate.rotationIndex >= 0 && fileCandidate.rotationIndex < settings.source.rotations)
+				candidates.emplace_back(fileCandidate.rotationIndex, Vec2(fileCandidate.x, fileCandidate.y), fileCandidate.score);
+		}
+
+		insertLocked(key, candidates);
+	}
+
+	return true;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "matchCandidate.h"
+
+// Least recently used cache of the placements found for target patches. An entry is keyed by everything the search
+// depends on: the target rectangle, the metric, the number of placements, the matching method and its parameters,
+// the feature weights and the versions of the source features and reservations.
+class MatchCache {
+public:
+	// Increase whenever the layout of the file changes
+	static constexpr std::uint32_t fileVersion = 1;
+
+	struct Key {
+		cv::Rect patch;
+		int metric = 0;
+		int count = 0;
+		int rotations = 0;
+		int method = 0;
+		float intensityWeight = 0.0f;
+		float edgeWeight = 0.0f;
+		// Hash of the parameters of the matching method
+		std::uint64_t parameters = 0;
+		std::uint64_t sourceVersion = 0;
+		std::uint64_t reservationVersion = 0;
+
+		bool operator==(const Key& other) const = default;
+	};
+
+private:
+	struct KeyHash {
+		std::size_t operator()(const Key& key) const;
+	};
+
+	struct Entry {
+		Key key;
+		std::vector<MatchCandidate> candidates;
+	};
+
+	std::mutex mutex;
+	// Most recently used first
+	std::list<Entry> entries;
+	std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> lookup;
+	std::size_t capacity;
+
+	std::atomic<std::uint64_t> hits = 0;
+	std::atomic<std::uint64_t> misses = 0;
+
+public:
+	explicit MatchCache(std::size_t capacity = 4096);
+
+	MatchCache(const MatchCache& other) = delete;
+	MatchCache& operator=(const MatchCache& other) = delete;
+
+	// Key of the patch under the current settings and source
+	static Key key(const cv::Rect& patch, cv::TemplateMatchModes metric, int count);
+
+	// Placements of the key. While material is reserved, the placements found without reservations are reused
+	// as long as all of them are still available
+	bool find(const Key& key, std::vector<MatchCandidate>& candidates);
+	// Only placements found without reservations are kept
+	void insert(const Key& key, const std::vector<MatchCandidate>& candidates);
+
+	// Removes all entries, required whenever the target features change
+	void clear();
+
+	// Logs the hit rate and starts counting anew
+	void report();
+
+	// Hash of the source and target features the entries belong to, 0 if the source features are not cached on disk
+	static std::uint64_t stateHash();
+
+	// Path of the cache file of the given source and target state in the given directory
+	static std::string path(const std::string& directory, std::uint64_t stateHash);
+
+	// Writes all entries, they are only valid for the same source and target features
+	bool save(const std::string& path, std::uint64_t stateHash);
+	// Adds the entries of the file, returns false if it does not exist or belongs to another state or version
+	bool load(const std::string& path, std::uint64_t stateHash);
+
+private:
+	bool findLocked(const Key& key, std::vector<MatchCandidate>& candidates);
+	void insertLocked(const Key& key, const std::vector<MatchCandidate>& candidates);
+};
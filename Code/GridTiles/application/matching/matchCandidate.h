@@ -0,0 +1,33 @@
+#pragma once
+
+#include <opencv2/imgproc.hpp>
+
+#include "math/vec.h"
+
+// A placement of a target patch in one of the source rotations
+struct MatchCandidate {
+	// Index of the source rotation, -1 if no placement was found
+	int rotationIndex = -1;
+	// Offset in the rotated source
+	Vec2 position;
+	// Weighted response of the metric at this placement
+	double score = 0.0;
+
+	MatchCandidate() = default;
+	MatchCandidate(int rotationIndex, const Vec2& position, double score)
+		: rotationIndex(rotationIndex)
+		, position(position)
+		, score(score) {}
+
+	bool valid() const {
+		return rotationIndex != -1;
+	}
+
+	// Whether score a is a better match than score b for the given metric
+	static bool better(int metric, double a, double b) {
+		if (metric == cv::TM_SQDIFF || metric == cv::TM_SQDIFF_NORMED)
+			return a < b;
+
+		return a > b;
+	}
+};
@@ -0,0 +1,130 @@
+#include "core.h"
+#include "matchScheduler.h"
+
+#include "main.h"
+#include "assignmentSolver.h"
+
+// Seeds of a single patch for Utils::computeBestCandidates
+static std::vector<MatchCandidate> patchSeeds(const std::vector<MatchCandidate>& seeds, std::size_t patchIndex) {
+	if (patchIndex >= seeds.size() || !seeds[patchIndex].valid())
+		return {};
+
+	return { seeds[patchIndex] };
+}
+
+std::vector<MatchCandidate> MatchScheduler::match(const std::vector<cv::Rect>& patches, cv::TemplateMatchModes metric, const std::vector<MatchCandidate>& seeds) {
+	std::vector<MatchCandidate> placements(patches.size());
+
+	std::vector<std::size_t> pending;
+	for (std::size_t patchIndex = 0; patchIndex < patches.size(); patchIndex++)
+		if (!patches[patchIndex].empty())
+			pending.push_back(patchIndex);
+
+	// Non overlapping placements of every pending patch, best first
+	std::vector<std::vector<MatchCandidate>> candidates(patches.size());
+	int rounds = 0;
+	while (!pending.empty()) {
+		rounds++;
+
+		// Match against the reservations of the previous round, nothing is reserved while matching
+#pragma omp parallel for schedule(dynamic) if (pending.size() > 1)
+		for (int pendingIndex = 0; pendingIndex < static_cast<int>(pending.size()); pendingIndex++) {
+			std::size_t patchIndex = pending[pendingIndex];
+			candidates[patchIndex] = Utils::computeBestCandidates(patches[patchIndex], metric, settings.placementCandidates, patchSeeds(seeds, patchIndex));
+		}
+
+		// Commit in patch order. A patch whose placement was taken falls back to its next candidate and is only matched
+		// again when none are left
+		std::vector<std::size_t> conflicts;
+		int commits = 0;
+		for (std::size_t patchIndex : pending) {
+			const std::vector<MatchCandidate>& patchCandidates = candidates[patchIndex];
+			if (patchCandidates.empty())
+				continue;
+
+			std::size_t candidateIndex = 0;
+			for (; candidateIndex < patchCandidates.size(); candidateIndex++) {
+				const MatchCandidate& candidate = patchCandidates[candidateIndex];
+				cv::Rect placement(static_cast<int>(candidate.position.x), static_cast<int>(candidate.position.y), patches[patchIndex].width, patches[patchIndex].height);
+				if (!settings.source.placement(candidate.rotationIndex).fits(placement))
+					continue;
+
+				settings.source.reserve(candidate.rotationIndex, placement);
+				placements[patchIndex] = candidate;
+				commits++;
+
+				break;
+			}
+
+			if (candidateIndex == patchCandidates.size())
+				conflicts.push_back(patchIndex);
+		}
+
+		Log::debug("Match round %d committed %d patches, %d conflicts", rounds, commits, static_cast<int>(conflicts.size()));
+
+		// Candidates that never fit, like stale ones of the match cache, come back unchanged while nothing else is reserved,
+		// so the patches that are left after a round without commits are dropped
+		if (commits == 0) {
+			for (std::size_t patchIndex : conflicts)
+				Log::warn("Match round %d dropped patch %d without a placement that fits", rounds, static_cast<int>(patchIndex));
+
+			break;
+		}
+
+		pending = std::move(conflicts);
+	}
+
+	return placements;
+}
+
+std::vector<MatchCandidate> MatchScheduler::assign(const std::vector<cv::Rect>& patches, cv::TemplateMatchModes metric, const std::vector<MatchCandidate>& seeds) {
+	std::vector<std::vector<MatchCandidate>> candidates(patches.size());
+#pragma omp parallel for schedule(dynamic)
+	for (int patchIndex = 0; patchIndex < static_cast<int>(patches.size()); patchIndex++)
+		if (!patches[patchIndex].empty())
+			candidates[patchIndex] = Utils::computeBestCandidates(patches[patchIndex], metric, settings.placementCandidates, patchSeeds(seeds, patchIndex));
+
+	return assign(patches, candidates, metric, seeds);
+}
+
+std::vector<MatchCandidate> MatchScheduler::assign(const std::vector<cv::Rect>& patches,
+                                                   const std::vector<std::vector<MatchCandidate>>& candidates,
+                                                   cv::TemplateMatchModes metric,
+                                                   const std::vector<MatchCandidate>& seeds) {
+	std::vector<cv::Size> patchSizes(patches.size());
+	for (std::size_t patchIndex = 0; patchIndex < patches.size(); patchIndex++)
+		patchSizes[patchIndex] = patches[patchIndex].size();
+
+	std::vector<int> assignment = AssignmentSolver::solve(candidates, patchSizes, metric);
+
+	// Assigned placements do not overlap, only patches without one remain
+	std::vector<MatchCandidate> placements(patches.size());
+	std::vector<cv::Rect> remaining(patches.size());
+	for (std::size_t patchIndex = 0; patchIndex < patches.size(); patchIndex++) {
+		if (assignment[patchIndex] == -1) {
+			remaining[patchIndex] = patches[patchIndex];
+
+			continue;
+		}
+
+		const MatchCandidate& candidate = candidates[patchIndex][assignment[patchIndex]];
+		cv::Rect placement(static_cast<int>(candidate.position.x), static_cast<int>(candidate.position.y), patches[patchIndex].width, patches[patchIndex].height);
+
+		// Rasterized reservations of neighbouring placements may share a border pixel
+		if (!settings.source.placement(candidate.rotationIndex).fits(placement)) {
+			remaining[patchIndex] = patches[patchIndex];
+
+			continue;
+		}
+
+		settings.source.reserve(candidate.rotationIndex, placement);
+		placements[patchIndex] = candidate;
+	}
+
+	std::vector<MatchCandidate> remainingPlacements = match(remaining, metric, seeds);
+	for (std::size_t patchIndex = 0; patchIndex < patches.size(); patchIndex++)
+		if (!remaining[patchIndex].empty())
+			placements[patchIndex] = remainingPlacements[patchIndex];
+
+	return placements;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "matchCandidate.h"
+
+// Matches independent target patches in parallel while sharing the reserved source material.
+// Every round matches all pending patches against the same reservations, the placements are then committed
+// in patch order. A patch whose placement was taken by an earlier commit in the same round falls back to its next
+// non overlapping candidate, and is only matched again when all of its candidates were taken.
+// The result is therefore independent of the number of threads.
+class MatchScheduler {
+public:
+	// Committed placement of every patch, invalid for empty patches or when no material is left.
+	// The optional seed of a patch is the placement the local search starts from, invalid for none
+	static std::vector<MatchCandidate> match(const std::vector<cv::Rect>& patches, cv::TemplateMatchModes metric, const std::vector<MatchCandidate>& seeds = {});
+
+	// Like match, but the candidates of all patches are gathered first and assigned at once by the AssignmentSolver,
+	// so early patches do not take the best material from later ones. Patches left without a placement are matched greedily
+	static std::vector<MatchCandidate> assign(const std::vector<cv::Rect>& patches, cv::TemplateMatchModes metric, const std::vector<MatchCandidate>& seeds = {});
+
+	// Assigns the given candidates of every patch at once, patches left without a placement are matched greedily
+	static std::vector<MatchCandidate> assign(const std::vector<cv::Rect>& patches,
+	                                          const std::vector<std::vector<MatchCandidate>>& candidates,
+	                                          cv::TemplateMatchModes metric,
+	                                          const std::vector<MatchCandidate>& seeds = {});
+};
@@ -0,0 +1,365 @@
+#include "core.h"
+#include "materialLibrary.h"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <opencv2/imgcodecs.hpp>
+
+#include "main.h"
+#include "graphics/opencv/blur.h"
+#include "graphics/opencv/canny.h"
+#include "graphics/opencv/grayscale.h"
+#include "graphics/opencv/sobel.h"
+#include "graphics/textures/tiledImage.h"
+#include "util/pipelineGraph.h"
+
+// Settings the rotated boards depend on
+static std::uint64_t sourceKey() {
+	return PipelineGraph::key(settings.rotations, settings.rotateTemplates);
+}
+
+// Settings the board features depend on
+static std::uint64_t featureKey() {
+	return PipelineGraph::key(settings.useRGB,
+	                          settings.equalize,
+	                          settings.edgeMethod,
+	                          settings.sobelType,
+	                          settings.sobelDerivative,
+	                          settings.sobelSize,
+	                          settings.cannyThreshold1,
+	                          settings.cannyThreshold2,
+	                          settings.cannyAperture,
+	                          settings.cannyL2gradient);
+}
+
+// Intensity and edge features of a board, the same chain as the source stages of the pipeline
+static FeatureVector computeFeatures(const cv::Mat& image) {
+	auto equalize = [](cv::Mat texture) {
+		if (settings.equalize)
+			cv::normalize(texture, texture, 0, 255, cv::NORM_MINMAX);
+
+		return texture;
+	};
+
+	cv::Mat grayscale = equalize(Grayscale(image).grayscale);
+	cv::Mat blur = Blur(grayscale).blur;
+
+	cv::Mat edge;
+	if (settings.edgeMethod == Settings::EdgeMethod_Sobel) {
+		SobelType sobelTypes[] = { SobelType::X, SobelType::Y, SobelType::XY, SobelType::MAGNITUDE };
+		edge = equalize(Sobel(blur, sobelTypes[settings.sobelType], settings.sobelDerivative, settings.sobelSize).sobel);
+	} else if (settings.edgeMethod == Settings::EdgeMethod_Canny) {
+		edge = Canny(blur, settings.cannyThreshold1, settings.cannyThreshold2, settings.cannyAperture, settings.cannyL2gradient).canny;
+	} else {
+		edge = Sobel(blur, SobelType::GRADIENT, 1, settings.sobelSize).sobel;
+	}
+
+	FeatureVector features;
+	features.add(settings.useRGB ? image : grayscale);
+	features.add(edge);
+
+	return features;
+}
+
+// Single channel float plane with the mean of the channels of every pixel
+static cv::Mat channelMean(const cv::Mat& plane) {
+	cv::Mat converted;
+	plane.convertTo(converted, CV_32F);
+	if (converted.channels() == 1)
+		return converted;
+
+	cv::Mat result;
+	cv::transform(converted, result, cv::Mat(1, converted.channels(), CV_32F, cv::Scalar(1.0 / converted.channels())));
+
+	return result;
+}
+
+// Mean of every cell of the plane
+static cv::Mat cellMeans(const cv::Mat& plane) {
+	cv::Size gridSize((plane.cols + MaterialLibrary::cellSize - 1) / MaterialLibrary::cellSize,
+	                  (plane.rows + MaterialLibrary::cellSize - 1) / MaterialLibrary::cellSize);
+
+	cv::Mat result;
+	cv::resize(plane, result, gridSize, 0.0, 0.0, cv::INTER_AREA);
+
+	return result;
+}
+
+bool MaterialLibrary::add(const std::string& path) {
+	cv::Mat image;
+	Vec2 originalSourceDimension = settings.originalSourceDimension();
+	double scale = originalSourceDimension.x > 0 ? settings.source->cols() / originalSourceDimension.x : 1.0;
+
+	// Tiled boards only decode the level the prescaled board is resampled from
+	if (TiledImage::is(path)) {
+		URef<TiledImage> tiledImage = TiledImage::open(path);
+		if (tiledImage != nullptr) {
+			cv::Size size(std::max(static_cast<int>(std::lround(tiledImage->cols() * scale)), 1),
+			              std::max(static_cast<int>(std::lround(tiledImage->rows() * scale)), 1));
+			image = tiledImage->resized(size);
+		}
+	} else {
+		cv::Mat original = cv::imread(path);
+		if (!original.empty()) {
+			cv::Size size(std::max(static_cast<int>(std::lround(original.cols * scale)), 1),
+			              std::max(static_cast<int>(std::lround(original.rows * scale)), 1));
+			cv::resize(original, image, size);
+		}
+	}
+
+	if (image.empty() || image.type() != CV_8UC3) {
+		Log::error("Failed to load board %s", path.c_str());
+
+		return false;
+	}
+
+	URef<Board> board = std::make_unique<Board>();
+	board->path = path;
+	board->image = image;
+
+	cv::Mat color;
+	image.convertTo(color, CV_32FC3);
+	board->color = cellMeans(color);
+	boards.push_back(std::move(board));
+
+	refresh();
+
+	Log::info("Added board %s of %d x %d px", path.c_str(), image.cols, image.rows);
+
+	return true;
+}
+
+void MaterialLibrary::clear() {
+	boards.clear();
+}
+
+void MaterialLibrary::clearReservations() {
+	for (URef<Board>& board : boards)
+		board->source.clearReservations();
+}
+
+bool MaterialLibrary::empty() const {
+	return boards.empty();
+}
+
+void MaterialLibrary::setCapacity(std::size_t capacity) {
+	this->capacity = capacity;
+
+	int loadedBoards = 0;
+	for (const URef<Board>& board : boards)
+		if (board->source.rotations > 0)
+			loadedBoards++;
+
+	for (URef<Board>& board : boards)
+		if (board->source.rotations > 0)
+			board->source.matcher.setCapacity(capacity / loadedBoards);
+}
+
+void MaterialLibrary::refresh() {
+	std::uint64_t sourceKey = ::sourceKey();
+	std::uint64_t featureKey = ::featureKey();
+
+	for (URef<Board>& board : boards) {
+		if (board->sourceKey == sourceKey && board->featureKey == featureKey)
+			continue;
+
+		// The rotations are rebuilt once the board is searched again, they lose their reservations just like the source
+		board->source = SourceTexture();
+
+		if (board->featureKey != featureKey) {
+			FeatureVector features = computeFeatures(board->image);
+			board->intensity = cellMeans(channelMean(features[FeatureIndex_Intensity].data));
+			board->edge = cellMeans(channelMean(features[FeatureIndex_Edge].data));
+		}
+
+		board->sourceKey = sourceKey;
+		board->featureKey = featureKey;
+	}
+}
+
+void MaterialLibrary::load(Board& board) {
+	if (board.source.rotations > 0)
+		return;
+
+	// Boards are loaded by the match tasks and never shown, so nothing is uploaded
+	board.source = SourceTexture(board.image, settings.rotations, settings.cacheDirectory, settings.rotateTemplates, false);
+	board.source.setFeatures(computeFeatures(board.image));
+
+	setCapacity(capacity);
+}
+
+std::vector<double> MaterialLibrary::distances(const cv::Rect& patch) {
+	std::vector<double> result(boards.size(), std::numeric_limits<double>::infinity());
+
+	// Mean statistics of the target patch
+	cv::Scalar color = cv::mean(settings.target->data(patch));
+	double intensity = cv::mean(channelMean(settings.target[FeatureIndex_Intensity].data(patch)))[0];
+	double edge = cv::mean(channelMean(settings.target[FeatureIndex_Edge].data(patch)))[0];
+
+	for (std::size_t boardIndex = 0; boardIndex < boards.size(); boardIndex++) {
+		const Board& board = *boards[boardIndex];
+		// The patch may still fit the board in a quarter rotation
+		bool fits = patch.width <= board.image.cols && patch.height <= board.image.rows;
+		bool fitsQuarter = patch.width <= board.image.rows && patch.height <= board.image.cols;
+		if (!fits && !fitsQuarter)
+			continue;
+
+		// Mean statistics of every window of cells the size of the patch
+		cv::Size window(std::clamp(static_cast<int>(std::lround(static_cast<double>(patch.width) / cellSize)), 1, board.color.cols),
+		                std::clamp(static_cast<int>(std::lround(static_cast<double>(patch.height) / cellSize)), 1, board.color.rows));
+		cv::Rect valid(0, 0, board.color.cols - window.width + 1, board.color.rows - window.height + 1);
+
+		cv::Mat windowColor;
+		cv::Mat windowIntensity;
+		cv::Mat windowEdge;
+		cv::blur(board.color, windowColor, window, cv::Point(0, 0), cv::BORDER_REPLICATE);
+		cv::blur(board.intensity, windowIntensity, window, cv::Point(0, 0), cv::BORDER_REPLICATE);
+		cv::blur(board.edge, windowEdge, window, cv::Point(0, 0), cv::BORDER_REPLICATE);
+
+		// Intensity and color share the intensity weight, the distance is in the units of the features
+		cv::Mat colorDistance;
+		cv::absdiff(windowColor(valid), cv::Scalar(color[0], color[1], color[2]), colorDistance);
+		colorDistance = channelMean(colorDistance);
+
+		cv::Mat intensityDistance;
+		cv::Mat edgeDistance;
+		cv::absdiff(windowIntensity(valid), cv::Scalar(intensity), intensityDistance);
+		cv::absdiff(windowEdge(valid), cv::Scalar(edge), edgeDistance);
+
+		cv::Mat distance = (intensityDistance + colorDistance) * (0.5 * settings.intensityWeight) + edgeDistance * settings.edgeWeight;
+
+		double minimum;
+		cv::minMaxLoc(distance, &minimum);
+		result[boardIndex] = minimum;
+	}
+
+	return result;
+}
+
+MaterialLibrary::Placement MaterialLibrary::search(const cv::Rect& patch, cv::TemplateMatchModes metric, const std::vector<int>& boardIndices) {
+	std::vector<float> distribution(2);
+	distribution[FeatureIndex_Intensity] = settings.intensityWeight;
+	distribution[FeatureIndex_Edge] = settings.edgeWeight;
+
+	std::vector<cv::Mat> targetFeaturePatches;
+	for (FeatureIndex featureIndex = 0; featureIndex < settings.target.features.size(); featureIndex++)
+		targetFeaturePatches.push_back(settings.target[featureIndex].data(patch));
+
+	// Boards are loaded one at a time, only the parallel search below shares them
+	for (int boardIndex : boardIndices)
+		load(*boards[boardIndex]);
+
+	// Every rotation of every board is a separate task, only its best placement is kept
+	std::vector<std::pair<int, int>> tasks;
+	for (int boardIndex : boardIndices)
+		for (int rotationIndex = 0; rotationIndex < boards[boardIndex]->source.rotations; rotationIndex++)
+			tasks.emplace_back(boardIndex, rotationIndex);
+
+	std::vector<MatchCandidate> found(tasks.size());
+#pragma omp parallel for schedule(dynamic)
+	for (int taskIndex = 0; taskIndex < static_cast<int>(tasks.size()); taskIndex++) {
+		auto [boardIndex, rotationIndex] = tasks[taskIndex];
+		SourceTexture& source = boards[boardIndex]->source;
+
+		cv::Mat response;
+		source.matchTemplate(rotationIndex, targetFeaturePatches, distribution, metric, response);
+		if (response.empty())
+			continue;
+
+		// Offsets where the patch lies within unreserved material
+		cv::Mat mask = source.placement(rotationIndex).mask(patch.size());
+		if (mask.empty())
+			continue;
+
+		double value;
+		cv::Point point;
+		cv::Mat responseMask = mask(cv::Rect(0, 0, response.cols, response.rows));
+		if (metric == cv::TM_SQDIFF || metric == cv::TM_SQDIFF_NORMED)
+			cv::minMaxLoc(response, &value, nullptr, &point, nullptr, responseMask);
+		else
+			cv::minMaxLoc(response, nullptr, &value, nullptr, &point, responseMask);
+
+		if (point.x != -1)
+			found[taskIndex] = MatchCandidate(rotationIndex, Vec2(point.x, point.y), value);
+	}
+
+	Placement best;
+	for (std::size_t taskIndex = 0; taskIndex < tasks.size(); taskIndex++) {
+		const MatchCandidate& candidate = found[taskIndex];
+		if (candidate.valid() && (!best.valid() || MatchCandidate::better(metric, candidate.score, best.candidate.score))) {
+			best.boardIndex = tasks[taskIndex].first;
+			best.candidate = candidate;
+		}
+	}
+
+	return best;
+}
+
+MaterialLibrary::Placement MaterialLibrary::match(const cv::Rect& patch, cv::TemplateMatchModes metric) {
+	refresh();
+
+	std::vector<double> distances = this->distances(patch);
+
+	// Boards ordered by their distance in the index, boards the patch does not fit on are never searched
+	std::vector<int> order(boards.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::erase_if(order, [&distances](int boardIndex) {
+		return distances[boardIndex] == std::numeric_limits<double>::infinity();
+	});
+	std::stable_sort(order.begin(), order.end(), [&distances](int a, int b) {
+		return distances[a] < distances[b];
+	});
+
+	statistics.patches++;
+
+	int count = std::max(settings.libraryBoards, 1);
+	for (std::size_t first = 0; first < order.size(); first += count) {
+		std::vector<int> boardIndices(order.begin() + first, order.begin() + std::min(first + count, order.size()));
+		statistics.searchedBoards += boardIndices.size();
+
+		Placement placement = search(patch, metric, boardIndices);
+		if (placement.valid())
+			return placement;
+	}
+
+	return Placement();
+}
+
+std::vector<MaterialLibrary::Placement> MaterialLibrary::match(const std::vector<cv::Rect>& patches, cv::TemplateMatchModes metric) {
+	std::vector<Placement> placements(patches.size());
+
+	// Every placement is reserved before the next patch is matched, the boards and rotations of a patch run in parallel
+	for (std::size_t patchIndex = 0; patchIndex < patches.size(); patchIndex++) {
+		if (patches[patchIndex].empty())
+			continue;
+
+		Placement placement = match(patches[patchIndex], metric);
+		if (!placement.valid())
+			continue;
+
+		const MatchCandidate& candidate = placement.candidate;
+		cv::Rect rect(static_cast<int>(candidate.position.x), static_cast<int>(candidate.position.y), patches[patchIndex].width, patches[patchIndex].height);
+		boards[placement.boardIndex]->source.reserve(candidate.rotationIndex, rect);
+		placements[patchIndex] = placement;
+	}
+
+	return placements;
+}
+
+void MaterialLibrary::report() {
+	std::uint64_t patches = statistics.patches.exchange(0);
+	std::uint64_t searchedBoards = statistics.searchedBoards.exchange(0);
+	if (patches == 0)
+		return;
+
+	int loadedBoards = 0;
+	for (const URef<Board>& board : boards)
+		if (board->source.rotations > 0)
+			loadedBoards++;
+
+	Log::info("Material library searched %.2f of %d boards per patch, %d boards loaded",
+	          static_cast<double>(searchedBoards) / static_cast<double>(patches),
+	          static_cast<int>(boards.size()),
+	          loadedBoards);
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "matchCandidate.h"
+#include "graphics/textures/sourceTexture.h"
+
+// Inventory of source boards a target draws its material from. Every board keeps its own rotations, placement masks and
+// reservations, they are only built once the board is first searched. A coarse index of the mean color, intensity and edge strength of the cells of every board ranks the boards
+// per patch, only the closest boards are searched exactly and they are searched in parallel, so the cost of a patch does
+// not grow with the size of the inventory.
+class MaterialLibrary {
+public:
+	// Side in pixels of the cells of the coarse index
+	static constexpr int cellSize = 16;
+
+	struct Board {
+		std::string path;
+		// Board prescaled to the pixel density of the source
+		cv::Mat image;
+		// Rotations, features and reservations, empty until the board is first searched
+		SourceTexture source;
+
+		// Mean statistics of the cells of the unrotated board
+		cv::Mat color;
+		cv::Mat intensity;
+		cv::Mat edge;
+
+		// Settings the rotations and features were computed with
+		std::uint64_t sourceKey = 0;
+		std::uint64_t featureKey = 0;
+	};
+
+	// Placement of a target patch on one of the boards
+	struct Placement {
+		int boardIndex = -1;
+		MatchCandidate candidate;
+
+		bool valid() const {
+			return boardIndex != -1 && candidate.valid();
+		}
+	};
+
+	// Searches since the last report
+	struct Statistics {
+		std::atomic<std::uint64_t> patches = 0;
+		std::atomic<std::uint64_t> searchedBoards = 0;
+	};
+
+	std::vector<URef<Board>> boards;
+
+	MaterialLibrary() = default;
+
+	MaterialLibrary(const MaterialLibrary& other) = delete;
+	MaterialLibrary& operator=(const MaterialLibrary& other) = delete;
+
+	// Loads a board, tiled images included, and prescales it by the same factor as the source, so all boards are expected
+	// to be scanned at the resolution of the source. Returns false if the image can not be loaded
+	bool add(const std::string& path);
+
+	void clear();
+	void clearReservations();
+	bool empty() const;
+
+	// Response memory in bytes shared by the matchers of the loaded boards
+	void setCapacity(std::size_t capacity);
+
+	// Coarse distance of every board to the patch, the distance of the cells of the board closest to the patch in mean
+	// color, intensity and edge strength. Infinite for boards the patch does not fit on
+	std::vector<double> distances(const cv::Rect& patch);
+
+	// Best placement of the patch on the boards closest in the index, the next closest boards are only searched when
+	// none of them has room left for the patch
+	Placement match(const cv::Rect& patch, cv::TemplateMatchModes metric);
+
+	// Matches the patches in order and reserves every placement on its board
+	std::vector<Placement> match(const std::vector<cv::Rect>& patches, cv::TemplateMatchModes metric);
+
+	// Logs the mean number of boards searched per patch and the number of loaded boards, and starts counting anew
+	void report();
+
+private:
+	Statistics statistics;
+	std::size_t capacity = static_cast<std::size_t>(4096) << 20;
+
+	// Recomputes the index of the boards whose settings changed and releases their rotations
+	void refresh();
+	// Builds the rotations and features of the board if it has none yet and divides the response memory anew
+	void load(Board& board);
+	// Best placements of the patch on the given boards, every rotation of every board is searched in parallel
+	Placement search(const cv::Rect& patch, cv::TemplateMatchModes metric, const std::vector<int>& boardIndices);
+};
@@ -0,0 +1,287 @@
+#include "core.h"
+#include "patchMatcher.h"
+
+#include <random>
+
+#include "main.h"
+#include "matchScheduler.h"
+#include "util/looseQuadtree.h"
+
+// Random placements tried per patch before the patch starts without one
+static constexpr int initialAttempts = 32;
+
+// Feature planes of a target patch and their statistics, computed once per search
+struct PatchTemplate {
+	std::vector<cv::Mat> planes;
+	std::vector<double> squared;
+	std::vector<cv::Scalar> sums;
+	double pixels = 0.0;
+};
+
+// Placement of a patch and its score, the search state of a single patch
+struct PatchState {
+	int rotationIndex = -1;
+	cv::Point position;
+	double score = 0.0;
+
+	bool valid() const {
+		return rotationIndex != -1;
+	}
+};
+
+// Score of a single placement with the same definition as cv::matchTemplate, weighted over all features
+static double evaluate(const PatchTemplate& patch, const std::vector<float>& weights, cv::TemplateMatchModes metric, int rotationIndex, const cv::Point& position) {
+	const FeatureVector& features = settings.source.features[rotationIndex];
+
+	double result = 0.0;
+	for (std::size_t featureIndex = 0; featureIndex < patch.planes.size(); featureIndex++) {
+		const cv::Mat& templ = patch.planes[featureIndex];
+		cv::Mat window = features[featureIndex].data(cv::Rect(position, templ.size()));
+
+		double imageTemplate = window.dot(templ);
+		double imageSquared = window.dot(window);
+		double templateSquared = patch.squared[featureIndex];
+
+		double score;
+		if (metric == cv::TM_SQDIFF || metric == cv::TM_SQDIFF_NORMED) {
+			score = std::max(imageSquared - 2.0 * imageTemplate + templateSquared, 0.0);
+			if (metric == cv::TM_SQDIFF_NORMED) {
+				double norm = std::sqrt(imageSquared * templateSquared);
+				score = norm > DBL_EPSILON ? std::min(score / norm, 1.0) : 1.0;
+			}
+		} else if (metric == cv::TM_CCORR || metric == cv::TM_CCORR_NORMED) {
+			score = imageTemplate;
+			if (metric == cv::TM_CCORR_NORMED) {
+				double norm = std::sqrt(imageSquared * templateSquared);
+				score = norm > DBL_EPSILON ? score / norm : 0.0;
+			}
+		} else {
+			// Every channel subtracts its own mean
+			cv::Scalar imageSums = cv::sum(window);
+			const cv::Scalar& templateSums = patch.sums[featureIndex];
+
+			double imageMeanSquared = 0.0;
+			double templateMeanSquared = 0.0;
+			score = imageTemplate;
+			for (int channel = 0; channel < templ.channels(); channel++) {
+				score -= imageSums[channel] * templateSums[channel] / patch.pixels;
+				imageMeanSquared += imageSums[channel] * imageSums[channel] / patch.pixels;
+				templateMeanSquared += templateSums[channel] * templateSums[channel] / patch.pixels;
+			}
+
+			if (metric == cv::TM_CCOEFF_NORMED) {
+				double norm = std::sqrt(std::max(imageSquared - imageMeanSquared, 0.0) * std::max(templateSquared - templateMeanSquared, 0.0));
+				score = norm > DBL_EPSILON ? score / norm : 0.0;
+			}
+		}
+
+		result += weights[featureIndex] * score;
+	}
+
+	return result;
+}
+
+// Offset of the same material in another rotation
+static cv::Point transfer(const cv::Point& position, const cv::Size& patchSize, int rotationIndex, int otherRotationIndex) {
+	cv::Point center = position + cv::Point(patchSize.width / 2, patchSize.height / 2);
+	cv::Point original = Utils::warp(center, settings.source.inverseTransformations[rotationIndex]);
+	cv::Point rotated = Utils::warp(original, settings.source.transformations[otherRotationIndex]);
+
+	return rotated - cv::Point(patchSize.width / 2, patchSize.height / 2);
+}
+
+// Target patches whose bounds touch, found with a broad phase over the target
+static std::vector<std::vector<std::size_t>> computeNeighbours(const std::vector<cv::Rect>& patches) {
+	std::vector<std::vector<std::size_t>> neighbours(patches.size());
+
+	LooseQuadtree tree(Bounds(0, 0, settings.target->cols(), settings.target->rows()));
+	for (std::size_t patchIndex = 0; patchIndex < patches.size(); patchIndex++)
+		if (!patches[patchIndex].empty())
+			tree.insert(patchIndex, Bounds(patches[patchIndex].x, patches[patchIndex].y, patches[patchIndex].width, patches[patchIndex].height));
+
+#pragma omp parallel for schedule(dynamic, 64)
+	for (int patchIndex = 0; patchIndex < static_cast<int>(patches.size()); patchIndex++) {
+		const cv::Rect& patch = patches[patchIndex];
+		if (patch.empty())
+			continue;
+
+		tree.query(Bounds(patch.x - 1, patch.y - 1, patch.width + 2, patch.height + 2), [&](std::size_t other) {
+			if (other != static_cast<std::size_t>(patchIndex))
+				neighbours[patchIndex].push_back(other);
+
+			return false;
+		});
+
+		std::sort(neighbours[patchIndex].begin(), neighbours[patchIndex].end());
+	}
+
+	return neighbours;
+}
+
+std::vector<std::vector<MatchCandidate>> PatchMatcher::search(const std::vector<cv::Rect>& patches,
+                                                              cv::TemplateMatchModes metric,
+                                                              const Parameters& parameters,
+                                                              const std::vector<MatchCandidate>& seeds) {
+	std::vector<std::vector<MatchCandidate>> result(patches.size());
+
+	int rotations = settings.source.rotations;
+	std::size_t featureCount = std::min(settings.target.features.size(), settings.source.features.empty() ? 0 : settings.source.features.front().size());
+	if (patches.empty() || featureCount == 0 || settings.source.features.size() < static_cast<std::size_t>(rotations))
+		return result;
+
+	std::vector<float> distribution(2);
+	distribution[FeatureIndex_Intensity] = settings.intensityWeight;
+	distribution[FeatureIndex_Edge] = settings.edgeWeight;
+	distribution.resize(featureCount, 0.0f);
+
+	// Template statistics of every patch
+	std::vector<PatchTemplate> templates(patches.size());
+#pragma omp parallel for schedule(dynamic, 64)
+	for (int patchIndex = 0; patchIndex < static_cast<int>(patches.size()); patchIndex++) {
+		if (patches[patchIndex].empty())
+			continue;
+
+		PatchTemplate& patch = templates[patchIndex];
+		patch.pixels = patches[patchIndex].area();
+		for (std::size_t featureIndex = 0; featureIndex < featureCount; featureIndex++) {
+			cv::Mat plane = settings.target[featureIndex].data(patches[patchIndex]);
+			patch.planes.push_back(plane);
+			patch.squared.push_back(plane.dot(plane));
+			patch.sums.push_back(cv::sum(plane));
+		}
+	}
+
+	std::vector<std::vector<std::size_t>> neighbours = computeNeighbours(patches);
+
+	// Tries a placement and keeps it if it is valid and better
+	auto attempt = [&](std::size_t patchIndex, int rotationIndex, const cv::Point& position, PatchState& state, std::vector<MatchCandidate>& kept) {
+		const cv::Rect& patch = patches[patchIndex];
+		if (!settings.source.placement(rotationIndex).fits(cv::Rect(position, patch.size())))
+			return false;
+
+		// Placements are revisited often, only distinct ones are kept
+		bool visited = std::ranges::any_of(kept, [&](const MatchCandidate& candidate) {
+			return candidate.rotationIndex == rotationIndex && candidate.position == Vec2(position.x, position.y);
+		});
+		if (visited)
+			return false;
+
+		double score = evaluate(templates[patchIndex], distribution, metric, rotationIndex, position);
+
+		// Keep the best distinct placements sorted, best first
+		if (kept.size() < static_cast<std::size_t>(parameters.candidates) || MatchCandidate::better(metric, score, kept.back().score)) {
+			MatchCandidate candidate(rotationIndex, Vec2(position.x, position.y), score);
+			auto iterator = std::upper_bound(kept.begin(), kept.end(), candidate, [metric](const MatchCandidate& a, const MatchCandidate& b) {
+				return MatchCandidate::better(metric, a.score, b.score);
+			});
+			kept.insert(iterator, candidate);
+			if (kept.size() > static_cast<std::size_t>(parameters.candidates))
+				kept.pop_back();
+		}
+
+		if (state.valid() && !MatchCandidate::better(metric, score, state.score))
+			return false;
+
+		state = PatchState { rotationIndex, position, score };
+
+		return true;
+	};
+
+	auto generator = [&parameters](std::size_t patchIndex, int iteration) {
+		return std::minstd_rand(parameters.seed ^ static_cast<std::uint32_t>(patchIndex * 0x9e3779b1u + iteration * 0x85ebca6bu + 1));
+	};
+
+	// Seeded or random initial placements
+	std::vector<PatchState> states(patches.size());
+#pragma omp parallel for schedule(dynamic, 16)
+	for (int patchIndex = 0; patchIndex < static_cast<int>(patches.size()); patchIndex++) {
+		const cv::Rect& patch = patches[patchIndex];
+		if (patch.empty())
+			continue;
+
+		if (patchIndex < static_cast<int>(seeds.size()) && seeds[patchIndex].valid() && seeds[patchIndex].rotationIndex < rotations) {
+			const MatchCandidate& seed = seeds[patchIndex];
+			cv::Point position(static_cast<int>(seed.position.x), static_cast<int>(seed.position.y));
+			attempt(patchIndex, seed.rotationIndex, position, states[patchIndex], result[patchIndex]);
+		}
+
+		std::minstd_rand random = generator(patchIndex, -1);
+		for (int attemptIndex = 0; attemptIndex < initialAttempts && !states[patchIndex].valid(); attemptIndex++) {
+			int rotationIndex = static_cast<int>(random() % rotations);
+			const PlacementMask& placement = settings.source.placement(rotationIndex);
+			int cols = placement.cols() - patch.width + 1;
+			int rows = placement.rows() - patch.height + 1;
+			if (cols <= 0 || rows <= 0)
+				continue;
+
+			attempt(patchIndex, rotationIndex, cv::Point(random() % cols, random() % rows), states[patchIndex], result[patchIndex]);
+		}
+	}
+
+	int iteration = 0;
+	for (; iteration < parameters.iterations; iteration++) {
+		// Every patch improves against the placements of the previous iteration
+		std::vector<PatchState> previous = states;
+		int improved = 0;
+
+#pragma omp parallel for schedule(dynamic, 16) reduction(+:improved)
+		for (int patchIndex = 0; patchIndex < static_cast<int>(patches.size()); patchIndex++) {
+			const cv::Rect& patch = patches[patchIndex];
+			if (patch.empty())
+				continue;
+
+			PatchState& state = states[patchIndex];
+			std::vector<MatchCandidate>& kept = result[patchIndex];
+			bool better = false;
+
+			// Propagation, the neighbour placement shifted by the target offset between both patches
+			for (std::size_t neighbour : neighbours[patchIndex]) {
+				const PatchState& neighbourState = previous[neighbour];
+				if (!neighbourState.valid())
+					continue;
+
+				cv::Point offset = patch.tl() - patches[neighbour].tl();
+				better |= attempt(patchIndex, neighbourState.rotationIndex, neighbourState.position + offset, state, kept);
+			}
+
+			if (!state.valid())
+				continue;
+
+			std::minstd_rand random = generator(patchIndex, iteration);
+
+			// Random search in windows that halve around the current placement
+			const PlacementMask& placement = settings.source.placement(state.rotationIndex);
+			for (int radius = std::max(placement.cols(), placement.rows()); radius >= 1; radius /= 2) {
+				int x = state.position.x + static_cast<int>(random() % (2 * radius + 1)) - radius;
+				int y = state.position.y + static_cast<int>(random() % (2 * radius + 1)) - radius;
+				better |= attempt(patchIndex, state.rotationIndex, cv::Point(x, y), state, kept);
+			}
+
+			// The same material in another rotation
+			if (rotations > 1) {
+				int otherRotationIndex = (state.rotationIndex + 1 + static_cast<int>(random() % (rotations - 1))) % rotations;
+				better |= attempt(patchIndex, otherRotationIndex, transfer(state.position, patch.size(), state.rotationIndex, otherRotationIndex), state, kept);
+			}
+
+			if (better)
+				improved++;
+		}
+
+		if (improved < parameters.tolerance * patches.size()) {
+			iteration++;
+
+			break;
+		}
+	}
+
+	Log::debug("PatchMatch converged after %d iterations", iteration);
+
+	return result;
+}
+
+std::vector<MatchCandidate> PatchMatcher::match(const std::vector<cv::Rect>& patches,
+                                                cv::TemplateMatchModes metric,
+                                                const Parameters& parameters,
+                                                const std::vector<MatchCandidate>& seeds) {
+	return MatchScheduler::assign(patches, search(patches, metric, parameters, seeds), metric, seeds);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "matchCandidate.h"
+
+// Randomized correspondence search for many target patches at once, after PatchMatch. Neighbouring target patches tend to
+// have neighbouring source placements, so every iteration tries the placements of the neighbours of a patch shifted by their
+// offset in the target, random placements in shrinking windows around the current one and the same material in another rotation.
+// All patches improve in parallel against the placements of the previous iteration, so the result only depends on the seed.
+class PatchMatcher {
+public:
+	struct Parameters {
+		// Upper bound on the number of iterations
+		int iterations = 8;
+		// Search stops early once fewer than this fraction of the patches improved in an iteration
+		double tolerance = 0.01;
+		// Best distinct placements kept per patch
+		int candidates = 4;
+		std::uint32_t seed = 0;
+	};
+
+	// Best placements found for every patch, best first. Placements of different patches may overlap.
+	// Nothing is found when the source only stores the unrotated features. The optional seed of a patch is tried
+	// before the random initial placements, invalid for none
+	static std::vector<std::vector<MatchCandidate>> search(const std::vector<cv::Rect>& patches,
+	                                                       cv::TemplateMatchModes metric,
+	                                                       const Parameters& parameters,
+	                                                       const std::vector<MatchCandidate>& seeds = {});
+
+	// Searches all patches and assigns non overlapping placements, patches left without placement are matched greedily
+	static std::vector<MatchCandidate> match(const std::vector<cv::Rect>& patches,
+	                                         cv::TemplateMatchModes metric,
+	                                         const Parameters& parameters,
+	                                         const std::vector<MatchCandidate>& seeds = {});
+};
@@ -0,0 +1,401 @@
+#include "core.h"
+#include "placementMask.h"
+
+#include <opencv2/imgproc.hpp>
+
+PlacementMask::PlacementMask(const cv::Mat& material) {
+	this->material = material;
+	this->reserved = cv::Mat(material.rows, material.cols, CV_8UC1, cv::Scalar(0));
+}
+
+PlacementMask::PlacementMask(PlacementMask& base, const cv::Mat& transformation, const cv::Size& size) {
+	this->base = &base;
+	this->transformation = transformation;
+	this->size = size;
+	cv::invertAffineTransform(transformation, inverseTransformation);
+}
+
+void PlacementMask::reserve(const std::vector<cv::Point>& polygon) {
+	if (base != nullptr) {
+		std::vector<cv::Point2f> points(polygon.begin(), polygon.end());
+		std::vector<cv::Point2f> basePoints;
+		cv::transform(points, basePoints, inverseTransformation);
+
+		std::vector<cv::Point> rounded;
+		for (const cv::Point2f& point : basePoints)
+			rounded.emplace_back(cvRound(point.x), cvRound(point.y));
+		base->reserve(rounded);
+
+		return;
+	}
+
+	std::scoped_lock lock(mutex);
+
+	cv::fillConvexPoly(reserved, polygon, cv::Scalar(255));
+
+	dirty = true;
+	revision++;
+	masks.clear();
+}
+
+void PlacementMask::reserve(const cv::Rect& rect) {
+	if (base != nullptr) {
+		base->reserve(basePolygon(rect));
+
+		return;
+	}
+
+	std::scoped_lock lock(mutex);
+
+	cv::Rect clipped = rect & cv::Rect(0, 0, reserved.cols, reserved.rows);
+	if (clipped.empty())
+		return;
+
+	reserved(clipped).setTo(cv::Scalar(255));
+
+	dirty = true;
+	revision++;
+	masks.clear();
+}
+
+void PlacementMask::reserve(const cv::Mat& mask) {
+	if (base != nullptr) {
+		cv::Mat baseMask;
+		cv::warpAffine(mask, baseMask, inverseTransformation, base->material.size(), cv::INTER_NEAREST);
+		base->reserve(baseMask);
+
+		return;
+	}
+
+	std::scoped_lock lock(mutex);
+
+	CV_Assert(mask.size() == reserved.size());
+	reserved.setTo(cv::Scalar(255), mask);
+
+	dirty = true;
+	revision++;
+	masks.clear();
+}
+
+void PlacementMask::clear() {
+	if (base != nullptr) {
+		base->clear();
+
+		return;
+	}
+
+	std::scoped_lock lock(mutex);
+
+	reserved.setTo(cv::Scalar(0));
+
+	dirty = true;
+	revision++;
+	masks.clear();
+}
+
+bool PlacementMask::fits(const cv::Rect& rect) {
+	if (base != nullptr) {
+		if (rect.x < 0 || rect.y < 0 || rect.x + rect.width > size.width || rect.y + rect.height > size.height)
+			return false;
+
+		return base->fits(basePolygon(rect));
+	}
+
+	std::scoped_lock lock(mutex);
+
+	if (rect.x < 0 || rect.y < 0 || rect.x + rect.width > material.cols || rect.y + rect.height > material.rows)
+		return false;
+
+	update();
+
+	return unavailable(rect.x, rect.y, rect.width, rect.height) == 0;
+}
+
+bool PlacementMask::fits(const std::vector<cv::Point>& polygon) {
+	if (base != nullptr) {
+		std::vector<cv::Point2f> points(polygon.begin(), polygon.end());
+		std::vector<cv::Point2f> basePoints;
+		cv::transform(points, basePoints, inverseTransformation);
+
+		std::vector<cv::Point> rounded;
+		for (const cv::Point2f& point : basePoints)
+			rounded.emplace_back(cvRound(point.x), cvRound(point.y));
+
+		return base->fits(rounded);
+	}
+
+	std::scoped_lock lock(mutex);
+
+	cv::Rect bounds = cv::boundingRect(polygon);
+	if (bounds.empty() || (bounds & cv::Rect(0, 0, material.cols, material.rows)) != bounds)
+		return false;
+
+	update();
+
+	// Most polygons lie in free material, only those whose bounds touch unavailable pixels are rasterized
+	if (unavailable(bounds.x, bounds.y, bounds.width, bounds.height) == 0)
+		return true;
+
+	std::vector<cv::Point> shifted;
+	for (const cv::Point& point : polygon)
+		shifted.push_back(point - bounds.tl());
+
+	cv::Mat covered(bounds.size(), CV_8UC1, cv::Scalar(0));
+	cv::fillConvexPoly(covered, shifted, cv::Scalar(255));
+
+	cv::Mat available = material(bounds) == 255;
+	available.setTo(cv::Scalar(0), reserved(bounds));
+
+	return cv::countNonZero(covered & ~available) == 0;
+}
+
+cv::Mat PlacementMask::mask(const cv::Size& patchSize) {
+	if (base != nullptr) {
+		cv::Rect offsets(0, 0, size.width - patchSize.width + 1, size.height - patchSize.height + 1);
+		if (offsets.width <= 0 || offsets.height <= 0)
+			return cv::Mat();
+
+		std::pair<int, int> key(patchSize.width, patchSize.height);
+		{
+			std::scoped_lock lock(mutex);
+
+			auto iterator = masks.find(key);
+			if (iterator != masks.end() && masksRevision == base->currentRevision())
+				return iterator->second;
+		}
+
+		std::uint64_t maskRevision;
+		cv::Mat mask = derivedMask(patchSize, offsets, maskRevision);
+
+		// Only the masks of the latest reservations are kept, a few patch sizes at most so a rotation never holds as much
+		// as a stored plane
+		std::scoped_lock lock(mutex);
+		if (masksRevision != maskRevision || masks.size() >= 4) {
+			masks.clear();
+			masksRevision = maskRevision;
+		}
+		masks[key] = mask;
+
+		return mask;
+	}
+
+	std::scoped_lock lock(mutex);
+
+	int cols = material.cols - patchSize.width + 1;
+	int rows = material.rows - patchSize.height + 1;
+	if (cols <= 0 || rows <= 0)
+		return cv::Mat();
+
+	auto iterator = masks.find(std::make_pair(patchSize.width, patchSize.height));
+	if (iterator != masks.end())
+		return iterator->second;
+
+	update();
+
+	// Window sums of the unavailable pixels for every offset at once
+	cv::Mat windows = integral(cv::Rect(patchSize.width, patchSize.height, cols, rows))
+		- integral(cv::Rect(0, patchSize.height, cols, rows))
+		- integral(cv::Rect(patchSize.width, 0, cols, rows))
+		+ integral(cv::Rect(0, 0, cols, rows));
+
+	cv::Mat mask = windows == 0;
+
+	// Editing sessions produce many patch sizes, keep the cache bounded
+	if (masks.size() >= 64)
+		masks.clear();
+	masks.emplace(std::make_pair(patchSize.width, patchSize.height), mask);
+
+	return mask;
+}
+
+cv::Mat PlacementMask::mask(const cv::Size& patchSize, const cv::Rect& offsets) {
+	if (base != nullptr) {
+		cv::Rect valid = offsets & cv::Rect(0, 0, size.width - patchSize.width + 1, size.height - patchSize.height + 1);
+		if (valid.empty() || valid != offsets)
+			return cv::Mat();
+
+		std::uint64_t maskRevision;
+		return derivedMask(patchSize, offsets, maskRevision);
+	}
+
+	std::scoped_lock lock(mutex);
+
+	cv::Rect valid = offsets & cv::Rect(0, 0, material.cols - patchSize.width + 1, material.rows - patchSize.height + 1);
+	if (valid.empty() || valid != offsets)
+		return cv::Mat();
+
+	update();
+
+	cv::Mat windows = integral(cv::Rect(offsets.x + patchSize.width, offsets.y + patchSize.height, offsets.width, offsets.height))
+		- integral(cv::Rect(offsets.x, offsets.y + patchSize.height, offsets.width, offsets.height))
+		- integral(cv::Rect(offsets.x + patchSize.width, offsets.y, offsets.width, offsets.height))
+		+ integral(cv::Rect(offsets.x, offsets.y, offsets.width, offsets.height));
+
+	return windows == 0;
+}
+
+cv::Mat PlacementMask::reservedMask() {
+	if (base != nullptr) {
+		cv::Mat result;
+		cv::warpAffine(base->reservedMask(), result, transformation, size, cv::INTER_NEAREST);
+
+		return result;
+	}
+
+	std::scoped_lock lock(mutex);
+
+	return reserved.clone();
+}
+
+cv::Mat PlacementMask::available() {
+	if (base != nullptr) {
+		cv::Mat result;
+		cv::warpAffine(base->available(), result, transformation, size, cv::INTER_NEAREST);
+
+		return result;
+	}
+
+	std::scoped_lock lock(mutex);
+
+	cv::Mat available;
+	cv::bitwise_and(material, ~reserved, available);
+
+	return available;
+}
+
+int PlacementMask::rows() const {
+	return base != nullptr ? size.height : material.rows;
+}
+
+int PlacementMask::cols() const {
+	return base != nullptr ? size.width : material.cols;
+}
+
+void PlacementMask::update() {
+	if (!dirty)
+		return;
+
+	// Warped borders are interpolated, only fully covered pixels count as material
+	cv::Mat available = material == 255;
+	available.setTo(cv::Scalar(0), reserved);
+
+	cv::Mat unavailable;
+	cv::threshold(available, unavailable, 0, 1, cv::THRESH_BINARY_INV);
+	cv::integral(unavailable, integral, CV_32S);
+
+	dirty = false;
+}
+
+std::uint64_t PlacementMask::currentRevision() {
+	std::scoped_lock lock(mutex);
+
+	return revision;
+}
+
+int PlacementMask::unavailable(int x, int y, int width, int height) const {
+	return integral.at<int>(y + height, x + width)
+		- integral.at<int>(y + height, x)
+		- integral.at<int>(y, x + width)
+		+ integral.at<int>(y, x);
+}
+
+PlacementMask::Footprint PlacementMask::footprint(const cv::Size& patchSize) const {
+	// The patch turned into the orientation of the unrotated material, centered in its bounds
+	const double* row0 = inverseTransformation.ptr<double>(0);
+	const double* row1 = inverseTransformation.ptr<double>(1);
+	cv::Point2d patchCenter(0.5 * (patchSize.width - 1), 0.5 * (patchSize.height - 1));
+
+	std::vector<cv::Point2d> corners;
+	for (const cv::Point2d& corner : { cv::Point2d(0, 0), cv::Point2d(patchSize.width - 1, 0), cv::Point2d(patchSize.width - 1, patchSize.height - 1), cv::Point2d(0, patchSize.height - 1) }) {
+		cv::Point2d relative = corner - patchCenter;
+		corners.emplace_back(row0[0] * relative.x + row0[1] * relative.y, row1[0] * relative.x + row1[1] * relative.y);
+	}
+
+	cv::Point2d minimum = corners.front();
+	cv::Point2d maximum = corners.front();
+	for (const cv::Point2d& corner : corners) {
+		minimum = cv::Point2d(std::min(minimum.x, corner.x), std::min(minimum.y, corner.y));
+		maximum = cv::Point2d(std::max(maximum.x, corner.x), std::max(maximum.y, corner.y));
+	}
+
+	Footprint footprint;
+	footprint.bounds = cv::Size(cvRound(maximum.x - minimum.x) + 1, cvRound(maximum.y - minimum.y) + 1);
+	for (const cv::Point2d& corner : corners)
+		footprint.polygon.emplace_back(cvRound(corner.x - minimum.x), cvRound(corner.y - minimum.y));
+
+	// The center of the patch at offset p lies at the center of the turned patch, so the offset of its bounds in the
+	// unrotated material is an affine function of p
+	footprint.origin = cv::Point2d(row0[0] * patchCenter.x + row0[1] * patchCenter.y + row0[2] + minimum.x,
+	                               row1[0] * patchCenter.x + row1[1] * patchCenter.y + row1[2] + minimum.y);
+
+	return footprint;
+}
+
+cv::Point PlacementMask::baseOffset(const Footprint& footprint, const cv::Point& offset) const {
+	const double* row0 = inverseTransformation.ptr<double>(0);
+	const double* row1 = inverseTransformation.ptr<double>(1);
+
+	return cv::Point(cvRound(footprint.origin.x + row0[0] * offset.x + row0[1] * offset.y),
+	                 cvRound(footprint.origin.y + row1[0] * offset.x + row1[1] * offset.y));
+}
+
+std::vector<cv::Point> PlacementMask::basePolygon(const cv::Rect& rect) const {
+	Footprint footprint = this->footprint(rect.size());
+	cv::Point offset = baseOffset(footprint, rect.tl());
+
+	std::vector<cv::Point> polygon;
+	for (const cv::Point& point : footprint.polygon)
+		polygon.push_back(point + offset);
+
+	return polygon;
+}
+
+cv::Mat PlacementMask::derivedMask(const cv::Size& patchSize, const cv::Rect& offsets, std::uint64_t& maskRevision) {
+	Footprint footprint = this->footprint(patchSize);
+	cv::Mat result(offsets.size(), CV_8UC1, cv::Scalar(0));
+
+	// Offsets of the bounds in the unrotated material, the corners of the offsets span them
+	cv::Point minimum(std::numeric_limits<int>::max(), std::numeric_limits<int>::max());
+	cv::Point maximum(std::numeric_limits<int>::lowest(), std::numeric_limits<int>::lowest());
+	for (const cv::Point& corner : { offsets.tl(), cv::Point(offsets.x + offsets.width - 1, offsets.y), offsets.br() - cv::Point(1, 1), cv::Point(offsets.x, offsets.y + offsets.height - 1) }) {
+		cv::Point offset = baseOffset(footprint, corner);
+		minimum = cv::Point(std::min(minimum.x, offset.x), std::min(minimum.y, offset.y));
+		maximum = cv::Point(std::max(maximum.x, offset.x), std::max(maximum.y, offset.y));
+	}
+
+	// Unavailable pixels of the unrotated material under those bounds only
+	cv::Mat unavailable;
+	cv::Rect region;
+	{
+		std::scoped_lock lock(base->mutex);
+
+		maskRevision = base->revision;
+		region = cv::Rect(minimum, maximum + cv::Point(footprint.bounds.width, footprint.bounds.height)) & cv::Rect(0, 0, base->material.cols, base->material.rows);
+		if (region.width < footprint.bounds.width || region.height < footprint.bounds.height)
+			return result;
+
+		cv::Mat available = base->material(region) == 255;
+		available.setTo(cv::Scalar(0), base->reserved(region));
+		cv::threshold(available, unavailable, 0, 1, cv::THRESH_BINARY_INV);
+	}
+	unavailable.convertTo(unavailable, CV_32F);
+
+	cv::Mat patchMask(footprint.bounds, CV_32FC1, cv::Scalar(0));
+	cv::fillConvexPoly(patchMask, footprint.polygon, cv::Scalar(1));
+
+	cv::Mat counts;
+	cv::matchTemplate(unavailable, patchMask, counts, cv::TM_CCORR);
+
+	// Every offset reads the count at the offset basePolygon places it at, so the mask agrees with fits and reserve.
+	// Offsets outside the unrotated material do not fit
+	for (int row = 0; row < offsets.height; row++) {
+		uchar* mask = result.ptr<uchar>(row);
+		for (int col = 0; col < offsets.width; col++) {
+			cv::Point offset = baseOffset(footprint, cv::Point(offsets.x + col, offsets.y + row)) - region.tl();
+			if (offset.x >= 0 && offset.y >= 0 && offset.x < counts.cols && offset.y < counts.rows && counts.at<float>(offset) < 0.5f)
+				mask[col] = 255;
+		}
+	}
+
+	return result;
+}
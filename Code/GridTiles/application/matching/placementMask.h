@@ -0,0 +1,94 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <opencv2/core.hpp>
+
+// Valid placements of patches within a single rotation of the source material.
+// A pixel is available when it lies inside the material and is not reserved by a placed patch,
+// an integral image over the unavailable pixels answers whether a patch fits in constant time.
+class PlacementMask {
+private:
+	std::mutex mutex;
+
+	// 255 where the rotated source contains material
+	cv::Mat material;
+	// 255 where material has been reserved
+	cv::Mat reserved;
+
+	// Integral image of the unavailable pixels, rebuilt lazily after a reservation
+	cv::Mat integral;
+	bool dirty = true;
+
+	// Lazily computed minMaxLoc masks per patch size, cleared after a reservation
+	std::map<std::pair<int, int>, cv::Mat> masks;
+	// Changes with every reservation of the unrotated material, derived rotations keep their masks until it changes
+	std::uint64_t revision = 0;
+	std::uint64_t masksRevision = 0;
+
+	// Mask of the unrotated material a derived rotation is answered from, nullptr if the planes above are stored
+	PlacementMask* base = nullptr;
+	// From the unrotated material to the derived rotation and back
+	cv::Mat transformation;
+	cv::Mat inverseTransformation;
+	cv::Size size;
+
+public:
+	explicit PlacementMask(const cv::Mat& material);
+	// Placements within a rotation of the material of base, without storing a plane of the rotation. Every query is answered
+	// from the unrotated material and every reservation is made in it
+	PlacementMask(PlacementMask& base, const cv::Mat& transformation, const cv::Size& size);
+
+	PlacementMask(const PlacementMask& other) = delete;
+	PlacementMask& operator=(const PlacementMask& other) = delete;
+
+	// Reserves the given polygon, the polygon is clipped to the material
+	void reserve(const std::vector<cv::Point>& polygon);
+	void reserve(const cv::Rect& rect);
+	// Reserves every nonzero pixel of a mask of the size of the material
+	void reserve(const cv::Mat& mask);
+
+	// Removes all reservations
+	void clear();
+
+	// Whether a patch of the given dimension fits at the given offset, in constant time unless the rotation is derived
+	bool fits(const cv::Rect& rect);
+	// Whether every pixel of the convex polygon is available material
+	bool fits(const std::vector<cv::Point>& polygon);
+
+	// Mask of all offsets where a patch of the given dimension fits, the size is equal to the matchTemplate response
+	cv::Mat mask(const cv::Size& patchSize);
+	// Mask of the given offsets only, without caching it, for searches that never hold the response of all offsets
+	cv::Mat mask(const cv::Size& patchSize, const cv::Rect& offsets);
+
+	// Copy of the reserved material
+	cv::Mat reservedMask();
+
+	// 255 where the material is not reserved, usable as global mask of Utils::matchTemplate
+	cv::Mat available();
+
+	int rows() const;
+	int cols() const;
+
+private:
+	void update();
+	std::uint64_t currentRevision();
+	int unavailable(int x, int y, int width, int height) const;
+
+	// A patch of a derived rotation turned into the orientation of the unrotated material. The polygon is rasterized relative
+	// to its bounds, and a patch at offset p covers it at the rounded offset origin + p of the unrotated material
+	struct Footprint {
+		std::vector<cv::Point> polygon;
+		cv::Size bounds;
+		cv::Point2d origin;
+	};
+
+	Footprint footprint(const cv::Size& patchSize) const;
+	cv::Point baseOffset(const Footprint& footprint, const cv::Point& offset) const;
+
+	// Polygon in the unrotated material covered by the given rectangle of a derived rotation
+	std::vector<cv::Point> basePolygon(const cv::Rect& rect) const;
+	// Placement mask of the given offsets of a derived rotation, only the unrotated material under them is correlated.
+	// Returns the revision of the unrotated material it was computed from
+	cv::Mat derivedMask(const cv::Size& patchSize, const cv::Rect& offsets, std::uint64_t& maskRevision);
+};
@@ -0,0 +1,219 @@
+#include "core.h"
+#include "pyramidMatcher.h"
+
+#include <algorithm>
+
+#include "graphics/textures/sourceTexture.h"
+
+// Templates are not downsampled below this dimension
+static constexpr int minimumTemplateDimension = 4;
+// Larger templates are correlated in the frequency domain by OpenCV
+static constexpr int directTemplateArea = 1024;
+
+void PyramidMatcher::reset(int rotations) {
+	this->rotations.clear();
+	for (int rotationIndex = 0; rotationIndex < rotations; rotationIndex++)
+		this->rotations.push_back(std::make_unique<Rotation>());
+}
+
+std::vector<cv::Mat> PyramidMatcher::level(const FeatureVector& source, int rotationIndex, int level) {
+	Rotation& rotation = *rotations[rotationIndex];
+
+	std::scoped_lock lock(rotation.mutex);
+	if (rotation.levels.empty()) {
+		std::vector<cv::Mat>& features = rotation.levels.emplace_back();
+		for (const Texture& feature : source)
+			features.push_back(feature.data);
+	}
+
+	while (rotation.levels.size() <= static_cast<std::size_t>(level)) {
+		const std::vector<cv::Mat>& previous = rotation.levels.back();
+
+		std::vector<cv::Mat> downsampled(previous.size());
+		for (std::size_t featureIndex = 0; featureIndex < previous.size(); featureIndex++)
+			cv::pyrDown(previous[featureIndex], downsampled[featureIndex]);
+
+		rotation.levels.push_back(std::move(downsampled));
+	}
+
+	return rotation.levels[level];
+}
+
+cv::Mat PyramidMatcher::response(const std::vector<cv::Mat>& sources,
+                                 const std::vector<cv::Mat>& templates,
+                                 const std::vector<float>& weights,
+                                 cv::TemplateMatchModes metric) {
+	cv::Mat weightedResponse;
+
+	std::size_t featureCount = std::min(sources.size(), templates.size());
+	if (featureCount == 0)
+		return weightedResponse;
+
+	// Small single channel templates are correlated directly, integer planes with integer arithmetic
+	bool direct = templates.front().size().area() <= directTemplateArea;
+	for (std::size_t featureIndex = 0; featureIndex < featureCount && direct; featureIndex++) {
+		int type = sources[featureIndex].type();
+		direct = type == templates[featureIndex].type() && (type == CV_8UC1 || type == CV_16SC1 || type == CV_32FC1);
+	}
+
+	if (direct) {
+		Utils::matchTemplate(std::vector<cv::Mat>(sources.begin(), sources.begin() + featureCount),
+		                     std::vector<cv::Mat>(templates.begin(), templates.begin() + featureCount),
+		                     std::vector<float>(weights.begin(), weights.begin() + featureCount),
+		                     weightedResponse,
+		                     metric,
+		                     cv::Mat(),
+		                     cv::Mat());
+
+		return weightedResponse;
+	}
+
+	for (std::size_t featureIndex = 0; featureIndex < featureCount; featureIndex++) {
+		cv::Mat response;
+		if (sources[featureIndex].depth() == CV_16S) {
+			// OpenCV only correlates 8 bit and float planes
+			cv::Mat source;
+			cv::Mat templ;
+			sources[featureIndex].convertTo(source, CV_32F);
+			templates[featureIndex].convertTo(templ, CV_32F);
+			cv::matchTemplate(source, templ, response, metric);
+		} else {
+			cv::matchTemplate(sources[featureIndex], templates[featureIndex], response, metric);
+		}
+
+		if (weightedResponse.empty())
+			weightedResponse = cv::Mat(response.rows, response.cols, CV_32FC1, cv::Scalar(0.0));
+		cv::scaleAdd(response, weights[featureIndex], weightedResponse, weightedResponse);
+	}
+
+	return weightedResponse;
+}
+
+void PyramidMatcher::collect(const cv::Mat& response,
+                             cv::Mat mask,
+                             const cv::Size& templateSize,
+                             int rotationIndex,
+                             cv::TemplateMatchModes metric,
+                             int candidates,
+                             std::vector<MatchCandidate>& result) {
+	cv::Size suppression(std::max(1, templateSize.width / 2), std::max(1, templateSize.height / 2));
+
+	for (int candidate = 0; candidate < candidates; candidate++) {
+		double value;
+		cv::Point point;
+		if (metric == cv::TM_SQDIFF || metric == cv::TM_SQDIFF_NORMED)
+			cv::minMaxLoc(response, &value, nullptr, &point, nullptr, mask);
+		else
+			cv::minMaxLoc(response, nullptr, &value, nullptr, &point, mask);
+
+		if (point.x == -1)
+			return;
+
+		result.emplace_back(rotationIndex, Vec2(point.x, point.y), value);
+
+		// Suppress the neighbourhood of the candidate
+		cv::Rect neighbourhood(point.x - suppression.width, point.y - suppression.height, 2 * suppression.width + 1, 2 * suppression.height + 1);
+		mask(neighbourhood & cv::Rect(0, 0, mask.cols, mask.rows)).setTo(cv::Scalar(0));
+	}
+}
+
+std::vector<MatchCandidate> PyramidMatcher::match(SourceTexture& source,
+                                                  const std::vector<cv::Mat>& templates,
+                                                  const std::vector<float>& weights,
+                                                  cv::TemplateMatchModes metric,
+                                                  int levels,
+                                                  int candidates) {
+	if (templates.empty() || source.features.size() < static_cast<std::size_t>(source.rotations))
+		return {};
+
+	// Keep the coarsest template large enough to be meaningful
+	cv::Size templateSize = templates.front().size();
+	int level = 0;
+	while (level < levels && std::min(templateSize.width, templateSize.height) >> (level + 1) >= minimumTemplateDimension)
+		level++;
+
+	int scale = 1 << level;
+
+	// Downsampled templates
+	std::vector<cv::Mat> coarseTemplates = templates;
+	for (int index = 0; index < level; index++)
+		for (cv::Mat& coarseTemplate : coarseTemplates)
+			cv::pyrDown(coarseTemplate, coarseTemplate);
+	cv::Size coarseTemplateSize = coarseTemplates.front().size();
+
+	// Coarse candidates of every rotation
+	std::vector<std::vector<MatchCandidate>> coarseCandidates(source.rotations);
+#pragma omp parallel for
+	for (int rotationIndex = 0; rotationIndex < source.rotations; rotationIndex++) {
+		std::vector<cv::Mat> coarseSources = this->level(source.features[rotationIndex], rotationIndex, level);
+		if (coarseSources.empty() || coarseSources.front().cols < coarseTemplateSize.width || coarseSources.front().rows < coarseTemplateSize.height)
+			continue;
+
+		cv::Mat placementMask = source.placement(rotationIndex).mask(templateSize);
+		if (placementMask.empty())
+			continue;
+
+		cv::Mat coarseResponse = response(coarseSources, coarseTemplates, weights, metric);
+
+		// Sample the full resolution placements at the coarse offsets
+		cv::Mat coarseMask(coarseResponse.rows, coarseResponse.cols, CV_8UC1);
+		for (int row = 0; row < coarseMask.rows; row++) {
+			uchar* coarseMaskRow = coarseMask.ptr<uchar>(row);
+			const uchar* placementMaskRow = placementMask.ptr<uchar>(std::min(row * scale, placementMask.rows - 1));
+			for (int col = 0; col < coarseMask.cols; col++)
+				coarseMaskRow[col] = placementMaskRow[std::min(col * scale, placementMask.cols - 1)];
+		}
+
+		collect(coarseResponse, coarseMask, coarseTemplateSize, rotationIndex, metric, candidates, coarseCandidates[rotationIndex]);
+	}
+
+	// Best candidates over all rotations
+	std::vector<MatchCandidate> selected;
+	for (const std::vector<MatchCandidate>& rotationCandidates : coarseCandidates)
+		selected.insert(selected.end(), rotationCandidates.begin(), rotationCandidates.end());
+
+	auto compare = [metric](const MatchCandidate& a, const MatchCandidate& b) {
+		return MatchCandidate::better(metric, a.score, b.score);
+	};
+	std::sort(selected.begin(), selected.end(), compare);
+	if (selected.size() > static_cast<std::size_t>(candidates))
+		selected.resize(candidates);
+
+	// Refine every candidate in a window of one coarse pixel around its full resolution offset
+	std::vector<MatchCandidate> refined(selected.size());
+#pragma omp parallel for
+	for (int candidateIndex = 0; candidateIndex < static_cast<int>(selected.size()); candidateIndex++) {
+		const MatchCandidate& candidate = selected[candidateIndex];
+		int rotationIndex = candidate.rotationIndex;
+
+		cv::Mat placementMask = source.placement(rotationIndex).mask(templateSize);
+		cv::Point center(static_cast<int>(candidate.position.x) * scale, static_cast<int>(candidate.position.y) * scale);
+		cv::Rect window = cv::Rect(center.x - scale, center.y - scale, 2 * scale + 1, 2 * scale + 1) & cv::Rect(0, 0, placementMask.cols, placementMask.rows);
+		if (window.empty())
+			continue;
+
+		std::vector<cv::Mat> sources;
+		cv::Rect sourceWindow(window.x, window.y, window.width + templateSize.width - 1, window.height + templateSize.height - 1);
+		for (const Texture& feature : source.features[rotationIndex])
+			sources.push_back(feature.data(sourceWindow));
+
+		cv::Mat windowResponse = response(sources, templates, weights, metric);
+
+		double value;
+		cv::Point point;
+		if (metric == cv::TM_SQDIFF || metric == cv::TM_SQDIFF_NORMED)
+			cv::minMaxLoc(windowResponse, &value, nullptr, &point, nullptr, placementMask(window));
+		else
+			cv::minMaxLoc(windowResponse, nullptr, &value, nullptr, &point, placementMask(window));
+
+		if (point.x != -1)
+			refined[candidateIndex] = MatchCandidate(rotationIndex, Vec2(window.x + point.x, window.y + point.y), value);
+	}
+
+	std::erase_if(refined, [](const MatchCandidate& candidate) {
+		return !candidate.valid();
+	});
+	std::sort(refined.begin(), refined.end(), compare);
+
+	return refined;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <mutex>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "matchCandidate.h"
+#include "graphics/features/Feature.h"
+
+class SourceTexture;
+
+// Coarse to fine placement search, candidates are found on downsampled features of all rotations
+// and only the best candidates are refined at full resolution
+class PyramidMatcher {
+public:
+	// Downsampled feature planes of a single rotation, level 0 is the full resolution
+	struct Rotation {
+		std::mutex mutex;
+		std::vector<std::vector<cv::Mat>> levels;
+	};
+
+private:
+	std::vector<URef<Rotation>> rotations;
+
+public:
+	PyramidMatcher() = default;
+
+	PyramidMatcher(PyramidMatcher&& other) noexcept = default;
+	PyramidMatcher& operator=(PyramidMatcher&& other) noexcept = default;
+	PyramidMatcher(const PyramidMatcher& other) = delete;
+	PyramidMatcher& operator=(const PyramidMatcher& other) = delete;
+
+	// Invalidates all downsampled features
+	void reset(int rotations);
+
+	// Returns the refined candidates, best first. The amount of levels is lowered for small templates
+	std::vector<MatchCandidate> match(SourceTexture& source,
+	                                  const std::vector<cv::Mat>& templates,
+	                                  const std::vector<float>& weights,
+	                                  cv::TemplateMatchModes metric,
+	                                  int levels,
+	                                  int candidates);
+
+	// Returns the features of the given rotation downsampled to the given level
+	std::vector<cv::Mat> level(const FeatureVector& source, int rotationIndex, int level);
+
+	// Weighted sum of the responses of every feature
+	static cv::Mat response(const std::vector<cv::Mat>& sources,
+	                        const std::vector<cv::Mat>& templates,
+	                        const std::vector<float>& weights,
+	                        cv::TemplateMatchModes metric);
+
+private:
+	// Best responses of a single rotation, neighbouring responses within half a template are suppressed
+	static void collect(const cv::Mat& response,
+	                    cv::Mat mask,
+	                    const cv::Size& templateSize,
+	                    int rotationIndex,
+	                    cv::TemplateMatchModes metric,
+	                    int candidates,
+	                    std::vector<MatchCandidate>& result);
+};
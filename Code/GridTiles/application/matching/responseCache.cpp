@@ -0,0 +1,259 @@
+#include "core.h"
+#include "responseCache.h"
+
+#include <array>
+#include <opencv2/imgproc.hpp>
+
+#include "main.h"
+
+ResponseCache::ResponseCache(std::size_t capacity)
+	: capacity(capacity) {}
+
+bool ResponseCache::complement(const cv::Rect& parent, const cv::Rect& patch, cv::Rect& sibling) {
+	if (patch == parent)
+		return false;
+
+	if (patch.x == parent.x && patch.width == parent.width) {
+		if (patch.y == parent.y && patch.height < parent.height) {
+			sibling = cv::Rect(parent.x, parent.y + patch.height, parent.width, parent.height - patch.height);
+
+			return true;
+		}
+
+		if (patch.y > parent.y && patch.br().y == parent.br().y) {
+			sibling = cv::Rect(parent.x, parent.y, parent.width, parent.height - patch.height);
+
+			return true;
+		}
+	}
+
+	if (patch.y == parent.y && patch.height == parent.height) {
+		if (patch.x == parent.x && patch.width < parent.width) {
+			sibling = cv::Rect(parent.x + patch.width, parent.y, parent.width - patch.width, parent.height);
+
+			return true;
+		}
+
+		if (patch.x > parent.x && patch.br().x == parent.br().x) {
+			sibling = cv::Rect(parent.x, parent.y, parent.width - patch.width, parent.height);
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+SRef<const ResponseCache::Correlations> ResponseCache::compute(const cv::Rect& patch) {
+	std::vector<cv::Mat> targetFeaturePatches;
+	for (FeatureIndex featureIndex = 0; featureIndex < settings.target.features.size(); featureIndex++)
+		targetFeaturePatches.push_back(settings.target[featureIndex].data(patch));
+
+	SRef<Correlations> correlations = std::make_shared<Correlations>(settings.source.rotations);
+
+#pragma omp parallel for
+	for (int rotationIndex = 0; rotationIndex < settings.source.rotations; rotationIndex++)
+		settings.source.matcher.computeCorrelations(settings.source.features[rotationIndex], rotationIndex, targetFeaturePatches, (*correlations)[rotationIndex]);
+
+	return correlations;
+}
+
+SRef<const ResponseCache::Correlations> ResponseCache::derive(const cv::Rect& patch,
+                                                              const cv::Rect& parentPatch,
+                                                              const Correlations& parent,
+                                                              const cv::Rect& siblingPatch,
+                                                              const Correlations& sibling) {
+	std::vector<cv::Mat> targetFeaturePatches;
+	for (FeatureIndex featureIndex = 0; featureIndex < settings.target.features.size(); featureIndex++)
+		targetFeaturePatches.push_back(settings.target[featureIndex].data(patch));
+
+	SRef<Correlations> correlations = std::make_shared<Correlations>(settings.source.rotations);
+
+	cv::Point patchOffset = patch.tl() - parentPatch.tl();
+	cv::Point siblingOffset = siblingPatch.tl() - parentPatch.tl();
+
+#pragma omp parallel for
+	for (int rotationIndex = 0; rotationIndex < settings.source.rotations; rotationIndex++) {
+		const FeatureVector& source = settings.source.features[rotationIndex];
+		const std::vector<cv::Mat>& parentCorrelations = parent[rotationIndex];
+		const std::vector<cv::Mat>& siblingCorrelations = sibling[rotationIndex];
+		std::vector<cv::Mat>& patchCorrelations = (*correlations)[rotationIndex];
+
+		// The parent does not fit in this rotation, but the patch may
+		std::size_t featureCount = std::min(std::min(parentCorrelations.size(), siblingCorrelations.size()), targetFeaturePatches.size());
+		if (featureCount == 0 || source.size() < featureCount) {
+			settings.source.matcher.computeCorrelations(source, rotationIndex, targetFeaturePatches, patchCorrelations);
+
+			continue;
+		}
+
+		cv::Size sourceSize(source[0].cols(), source[0].rows());
+		cv::Size size(sourceSize.width - patch.width + 1, sourceSize.height - patch.height + 1);
+
+		// Offsets of the patch that the parent covers, the others are where the parent sticks out of the source
+		cv::Rect covered(patchOffset, parentCorrelations.front().size());
+		std::array<cv::Rect, 4> strips = {
+			cv::Rect(0, 0, size.width, covered.y),
+			cv::Rect(0, covered.br().y, size.width, size.height - covered.br().y),
+			cv::Rect(0, covered.y, covered.x, covered.height),
+			cv::Rect(covered.br().x, covered.y, size.width - covered.br().x, covered.height)
+		};
+
+		for (std::size_t featureIndex = 0; featureIndex < featureCount; featureIndex++) {
+			cv::Mat& correlation = patchCorrelations.emplace_back(size, CV_32FC1);
+
+			const cv::Mat& siblingCorrelation = siblingCorrelations[featureIndex](cv::Rect(siblingOffset, covered.size()));
+			cv::subtract(parentCorrelations[featureIndex], siblingCorrelation, correlation(covered));
+
+			const cv::Mat& image = source[featureIndex].data;
+			cv::Mat templ = targetFeaturePatches[featureIndex];
+			for (const cv::Rect& strip : strips) {
+				if (strip.empty())
+					continue;
+
+				// cv::matchTemplate sums the correlations of all channels, like the spectra
+				cv::Mat window = image(cv::Rect(strip.x, strip.y, strip.width + patch.width - 1, strip.height + patch.height - 1));
+				cv::Mat stripCorrelation;
+				if (image.depth() == CV_8U) {
+					cv::matchTemplate(window, templ, stripCorrelation, cv::TM_CCORR);
+				} else {
+					cv::Mat floatWindow;
+					cv::Mat floatTemplate;
+					window.convertTo(floatWindow, CV_32F);
+					templ.convertTo(floatTemplate, CV_32F);
+					cv::matchTemplate(floatWindow, floatTemplate, stripCorrelation, cv::TM_CCORR);
+				}
+
+				stripCorrelation.copyTo(correlation(strip));
+			}
+		}
+	}
+
+	return correlations;
+}
+
+SRef<const ResponseCache::Correlations> ResponseCache::findLocked(const cv::Rect& patch, std::uint64_t sourceVersion) {
+	for (auto iterator = entries.begin(); iterator != entries.end(); ++iterator) {
+		if (iterator->patch == patch && iterator->sourceVersion == sourceVersion) {
+			entries.splice(entries.begin(), entries, iterator);
+
+			return iterator->correlations;
+		}
+	}
+
+	return nullptr;
+}
+
+void ResponseCache::insert(const cv::Rect& patch, std::uint64_t sourceVersion, const SRef<const Correlations>& correlations) {
+	std::size_t entryBytes = 0;
+	for (const std::vector<cv::Mat>& rotation : *correlations)
+		for (const cv::Mat& correlation : rotation)
+			entryBytes += correlation.total() * correlation.elemSize();
+
+	std::scoped_lock lock(mutex);
+
+	// Another thread computed the same patch
+	if (entryBytes > capacity || findLocked(patch, sourceVersion) != nullptr)
+		return;
+
+	entries.push_front(Entry { patch, sourceVersion, correlations, entryBytes });
+	bytes += entryBytes;
+
+	while (bytes > capacity) {
+		bytes -= entries.back().bytes;
+		entries.pop_back();
+	}
+}
+
+SRef<const ResponseCache::Correlations> ResponseCache::correlations(const cv::Rect& patch) {
+	std::uint64_t sourceVersion = settings.source.version;
+
+	SRef<const Correlations> parent;
+	SRef<const Correlations> sibling;
+	cv::Rect parentPatch;
+	cv::Rect siblingPatch;
+	{
+		std::scoped_lock lock(mutex);
+
+		// Entries of replaced source features are never used again
+		std::erase_if(entries, [this, sourceVersion](const Entry& entry) {
+			if (entry.sourceVersion == sourceVersion)
+				return false;
+
+			bytes -= entry.bytes;
+
+			return true;
+		});
+
+		if (SRef<const Correlations> cached = findLocked(patch, sourceVersion)) {
+			reused++;
+
+			return cached;
+		}
+
+		// Prefer a parent whose other half is cached too
+		for (const Entry& entry : entries) {
+			cv::Rect complementPatch;
+			if (!complement(entry.patch, patch, complementPatch))
+				continue;
+
+			parent = entry.correlations;
+			parentPatch = entry.patch;
+			siblingPatch = complementPatch;
+
+			sibling = findLocked(siblingPatch, sourceVersion);
+			if (sibling != nullptr)
+				break;
+		}
+	}
+
+	if (parent != nullptr && sibling != nullptr) {
+		SRef<const Correlations> correlations = derive(patch, parentPatch, *parent, siblingPatch, *sibling);
+		insert(patch, sourceVersion, correlations);
+		derived++;
+
+		return correlations;
+	}
+
+	SRef<const Correlations> correlations = compute(patch);
+	insert(patch, sourceVersion, correlations);
+	computed++;
+
+	// The other half is matched next, derive it while the parent is at hand
+	if (parent != nullptr) {
+		insert(siblingPatch, sourceVersion, derive(siblingPatch, parentPatch, *parent, patch, *correlations));
+		derived++;
+	}
+
+	return correlations;
+}
+
+void ResponseCache::setCapacity(std::size_t capacity) {
+	std::scoped_lock lock(mutex);
+
+	this->capacity = capacity;
+	while (bytes > capacity) {
+		bytes -= entries.back().bytes;
+		entries.pop_back();
+	}
+}
+
+void ResponseCache::clear() {
+	std::scoped_lock lock(mutex);
+
+	entries.clear();
+	bytes = 0;
+}
+
+void ResponseCache::report() {
+	std::uint64_t reused = this->reused.exchange(0);
+	std::uint64_t derived = this->derived.exchange(0);
+	std::uint64_t computed = this->computed.exchange(0);
+	if (reused + derived + computed == 0)
+		return;
+
+	Log::info("Response cache reused %llu, derived %llu and computed %llu correlations",
+	          static_cast<unsigned long long>(reused),
+	          static_cast<unsigned long long>(derived),
+	          static_cast<unsigned long long>(computed));
+}
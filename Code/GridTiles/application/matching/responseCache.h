@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <vector>
+#include <opencv2/core.hpp>
+
+// Least recently used cache of the raw feature correlations of matched target patches against every rotation of the source,
+// bounded by the memory they take. The correlation of a patch is the sum of the correlations of its two halves, so once a
+// patch is split the correlation of a half is the correlation of the patch minus the shifted correlation of the other half.
+// Only the offsets where the half fits but the whole patch did not are correlated again.
+class ResponseCache {
+public:
+	// Raw correlation of every feature per rotation, a rotation is empty if the patch does not fit in it
+	typedef std::vector<std::vector<cv::Mat>> Correlations;
+
+private:
+	struct Entry {
+		cv::Rect patch;
+		std::uint64_t sourceVersion;
+		SRef<const Correlations> correlations;
+		std::size_t bytes;
+	};
+
+	std::mutex mutex;
+	// Most recently used first
+	std::list<Entry> entries;
+	std::size_t bytes = 0;
+	std::size_t capacity;
+
+	std::atomic<std::uint64_t> reused = 0;
+	std::atomic<std::uint64_t> derived = 0;
+	std::atomic<std::uint64_t> computed = 0;
+
+public:
+	// Capacity in bytes
+	explicit ResponseCache(std::size_t capacity = std::size_t(1024) << 20);
+
+	ResponseCache(const ResponseCache& other) = delete;
+	ResponseCache& operator=(const ResponseCache& other) = delete;
+
+	// Correlations of the target patch against the current source features, derived from a cached patch it is half of
+	// when possible. The other half is derived as well when only the patch it is half of is cached
+	SRef<const Correlations> correlations(const cv::Rect& patch);
+
+	// Evicts the least recently used entries until the cache fits in the given number of bytes
+	void setCapacity(std::size_t capacity);
+
+	// Removes all entries, required whenever the target features change
+	void clear();
+
+	// Logs how many correlations were reused, derived and computed and starts counting anew
+	void report();
+
+private:
+	// The other half of the parent if the patch is one of its halves
+	static bool complement(const cv::Rect& parent, const cv::Rect& patch, cv::Rect& sibling);
+
+	static SRef<const Correlations> compute(const cv::Rect& patch);
+	static SRef<const Correlations> derive(const cv::Rect& patch,
+	                                       const cv::Rect& parentPatch,
+	                                       const Correlations& parent,
+	                                       const cv::Rect& siblingPatch,
+	                                       const Correlations& sibling);
+
+	SRef<const Correlations> findLocked(const cv::Rect& patch, std::uint64_t sourceVersion);
+	void insert(const cv::Rect& patch, std::uint64_t sourceVersion, const SRef<const Correlations>& correlations);
+};
@@ -0,0 +1,304 @@
+#include "core.h"
+#include "ssdaMatcher.h"
+
+#include <cfloat>
+#include <numeric>
+#include <type_traits>
+
+#include "graphics/textures/sourceTexture.h"
+
+// Template rows that are summed between two checks of the bound
+static constexpr int blockRows = 4;
+
+SsdaMatcher::Statistics SsdaMatcher::statistics;
+
+using RowDifference = double (*)(const void* image, const void* templ, int count);
+
+// Squared difference of a row of values, 8 bit rows fit in 32 bit sums as long as they are shorter than 33025 values
+template <typename T>
+static double rowDifference(const void* image, const void* templ, int count) {
+	const T* imageRow = static_cast<const T*>(image);
+	const T* templRow = static_cast<const T*>(templ);
+
+	using Accumulator = std::conditional_t<std::is_same_v<T, float>, float, std::conditional_t<std::is_same_v<T, uchar>, int, std::int64_t>>;
+	Accumulator sum = 0;
+	for (int index = 0; index < count; index++) {
+		Accumulator difference = static_cast<Accumulator>(imageRow[index]) - static_cast<Accumulator>(templRow[index]);
+		sum += difference * difference;
+	}
+
+	return static_cast<double>(sum);
+}
+
+static RowDifference selectRowDifference(int depth) {
+	if (depth == CV_8U)
+		return rowDifference<uchar>;
+	if (depth == CV_16S)
+		return rowDifference<short>;
+
+	return rowDifference<float>;
+}
+
+// Sum of the squares of every window of the given size summed over the channels, indexed by the offset of the window
+static cv::Mat computeWindowEnergy(const cv::Mat& plane, const cv::Size& size) {
+	cv::Mat energy;
+	cv::sqrBoxFilter(plane, energy, CV_64F, size, cv::Point(0, 0), false, cv::BORDER_CONSTANT);
+	if (energy.channels() > 1)
+		cv::transform(energy, energy, cv::Mat::ones(1, energy.channels(), CV_64F));
+
+	return energy(cv::Rect(0, 0, plane.cols - size.width + 1, plane.rows - size.height + 1));
+}
+
+// A feature of the template and the matching feature of a rotation
+struct SsdaPlane {
+	cv::Mat image;
+	cv::Mat templ;
+	cv::Mat windowEnergy;
+	double templateEnergy = 0.0;
+	float weight = 0.0f;
+	RowDifference difference = nullptr;
+};
+
+// Score of the placement, or DBL_MAX as soon as the partial score is no better than the bound.
+// The normed score of every feature is clamped to 1 like cv::matchTemplate, which keeps the partial score a lower bound
+static double evaluate(const std::vector<SsdaPlane>& planes,
+                       const std::vector<int>& order,
+                       const cv::Point& position,
+                       bool normed,
+                       double bound,
+                       std::vector<double>& scales,
+                       std::vector<double>& partials,
+                       std::uint64_t& summedRows) {
+	double constant = 0.0;
+	for (std::size_t planeIndex = 0; planeIndex < planes.size(); planeIndex++) {
+		const SsdaPlane& plane = planes[planeIndex];
+		partials[planeIndex] = 0.0;
+		scales[planeIndex] = plane.weight;
+
+		if (normed) {
+			double norm = std::sqrt(plane.windowEnergy.at<double>(position) * plane.templateEnergy);
+			if (norm > DBL_EPSILON) {
+				scales[planeIndex] = plane.weight / norm;
+			} else {
+				// Planes without energy have the worst score
+				constant += plane.weight;
+				scales[planeIndex] = 0.0;
+			}
+		}
+	}
+
+	auto score = [&]() {
+		double result = constant;
+		for (std::size_t planeIndex = 0; planeIndex < planes.size(); planeIndex++)
+			result += normed ? std::min(partials[planeIndex] * scales[planeIndex], static_cast<double>(planes[planeIndex].weight)) : partials[planeIndex] * scales[planeIndex];
+
+		return result;
+	};
+
+	int rows = static_cast<int>(order.size());
+	for (int blockStart = 0; blockStart < rows; blockStart += blockRows) {
+		int blockEnd = std::min(blockStart + blockRows, rows);
+		for (int orderIndex = blockStart; orderIndex < blockEnd; orderIndex++) {
+			int row = order[orderIndex];
+			for (std::size_t planeIndex = 0; planeIndex < planes.size(); planeIndex++) {
+				if (scales[planeIndex] == 0.0)
+					continue;
+
+				const SsdaPlane& plane = planes[planeIndex];
+				partials[planeIndex] += plane.difference(plane.image.ptr(position.y + row) + position.x * plane.image.elemSize(),
+				                                         plane.templ.ptr(row),
+				                                         plane.templ.cols * plane.templ.channels());
+			}
+		}
+
+		summedRows += blockEnd - blockStart;
+		if (blockEnd < rows && score() >= bound)
+			return DBL_MAX;
+	}
+
+	return score();
+}
+
+// Keeps the placement if it is better than the worst kept one and than every kept placement it overlaps in the source
+static void keep(std::vector<MatchCandidate>& kept, std::vector<Obb>& keptObbs, const MatchCandidate& candidate, const cv::Size& patchSize, cv::TemplateMatchModes metric, int count) {
+	if (kept.size() == static_cast<std::size_t>(count) && !MatchCandidate::better(metric, candidate.score, kept.back().score))
+		return;
+
+	Obb obb = Utils::computeCandidateObb(candidate, patchSize);
+	for (std::size_t index = 0; index < kept.size(); index++)
+		if (Sat::intersect(obb, keptObbs[index]) && !MatchCandidate::better(metric, candidate.score, kept[index].score))
+			return;
+
+	// Worse placements it overlaps are replaced
+	for (std::size_t index = kept.size(); index-- > 0;) {
+		if (Sat::intersect(obb, keptObbs[index])) {
+			kept.erase(kept.begin() + index);
+			keptObbs.erase(keptObbs.begin() + index);
+		}
+	}
+
+	std::size_t position = 0;
+	while (position < kept.size() && !MatchCandidate::better(metric, candidate.score, kept[position].score))
+		position++;
+	kept.insert(kept.begin() + position, candidate);
+	keptObbs.insert(keptObbs.begin() + position, obb);
+
+	if (kept.size() > static_cast<std::size_t>(count)) {
+		kept.pop_back();
+		keptObbs.pop_back();
+	}
+}
+
+bool SsdaMatcher::supports(cv::TemplateMatchModes metric) {
+	return metric == cv::TM_SQDIFF || metric == cv::TM_SQDIFF_NORMED;
+}
+
+std::vector<MatchCandidate> SsdaMatcher::match(SourceTexture& source,
+                                               const std::vector<cv::Mat>& templates,
+                                               const std::vector<float>& weights,
+                                               cv::TemplateMatchModes metric,
+                                               int count,
+                                               const std::vector<MatchCandidate>& seeds) {
+	if (templates.empty() || count <= 0 || !supports(metric) || source.features.size() < source.rotations)
+		return {};
+
+	bool normed = metric == cv::TM_SQDIFF_NORMED;
+	cv::Size templateSize = templates.front().size();
+	std::size_t featureCount = std::min({ templates.size(), weights.size(), source.features.front().size() });
+
+	// Template planes in the depth of the source features, features without weight are skipped
+	std::vector<SsdaPlane> templatePlanes;
+	std::vector<std::size_t> featureIndices;
+	for (std::size_t featureIndex = 0; featureIndex < featureCount; featureIndex++) {
+		const cv::Mat& feature = source.features.front()[featureIndex].data;
+		if (weights[featureIndex] <= 0.0f || feature.channels() != templates[featureIndex].channels())
+			continue;
+
+		SsdaPlane& plane = templatePlanes.emplace_back();
+		templates[featureIndex].convertTo(plane.templ, feature.depth());
+		plane.templateEnergy = plane.templ.dot(plane.templ);
+		plane.weight = weights[featureIndex];
+		plane.difference = selectRowDifference(feature.depth());
+		featureIndices.push_back(featureIndex);
+	}
+
+	if (templatePlanes.empty())
+		return {};
+
+	// Rows with the most variation are summed first, they are the most likely to exceed the bound
+	std::vector<double> rowEnergy(templateSize.height, 0.0);
+	for (const SsdaPlane& plane : templatePlanes) {
+		double scale = normed && plane.templateEnergy > DBL_EPSILON ? plane.weight / std::sqrt(plane.templateEnergy) : plane.weight;
+		for (int row = 0; row < templateSize.height; row++) {
+			cv::Scalar mean;
+			cv::Scalar deviation;
+			cv::meanStdDev(plane.templ.row(row), mean, deviation);
+			for (int channel = 0; channel < plane.templ.channels(); channel++)
+				rowEnergy[row] += scale * deviation[channel] * deviation[channel] * templateSize.width;
+		}
+	}
+
+	std::vector<int> order(templateSize.height);
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&rowEnergy](int a, int b) {
+		return rowEnergy[a] > rowEnergy[b];
+	});
+
+	// The best score of all rotations bounds every rotation when only the best placement is kept
+	std::atomic<double> sharedBound = DBL_MAX;
+
+	std::vector<std::vector<MatchCandidate>> rotationCandidates(source.rotations);
+#pragma omp parallel for schedule(dynamic)
+	for (int rotationIndex = 0; rotationIndex < source.rotations; rotationIndex++) {
+		const FeatureVector& features = source.features[rotationIndex];
+		if (features.size() < featureCount || features.cols() < templateSize.width || features.rows() < templateSize.height)
+			continue;
+
+		cv::Mat mask = source.placement(rotationIndex).mask(templateSize);
+		if (mask.empty())
+			continue;
+
+		cv::Size offsets(std::min(mask.cols, features.cols() - templateSize.width + 1), std::min(mask.rows, features.rows() - templateSize.height + 1));
+
+		std::vector<SsdaPlane> planes = templatePlanes;
+		for (std::size_t planeIndex = 0; planeIndex < planes.size(); planeIndex++) {
+			planes[planeIndex].image = features[featureIndices[planeIndex]].data;
+			if (normed)
+				planes[planeIndex].windowEnergy = computeWindowEnergy(planes[planeIndex].image, templateSize);
+		}
+
+		std::vector<double> scales(planes.size());
+		std::vector<double> partials(planes.size());
+		std::vector<MatchCandidate> kept;
+		std::vector<Obb> keptObbs;
+		std::uint64_t positions = 0;
+		std::uint64_t aborted = 0;
+		std::uint64_t summedRows = 0;
+
+		auto visit = [&](const cv::Point& position) {
+			double bound = kept.size() == static_cast<std::size_t>(count) ? kept.back().score : DBL_MAX;
+			if (count == 1)
+				bound = std::min(bound, sharedBound.load(std::memory_order_relaxed));
+
+			positions++;
+			double score = evaluate(planes, order, position, normed, bound, scales, partials, summedRows);
+			if (score == DBL_MAX) {
+				aborted++;
+
+				return;
+			}
+
+			keep(kept, keptObbs, MatchCandidate(rotationIndex, Vec2(position.x, position.y), score), templateSize, metric, count);
+
+			if (count == 1 && !kept.empty()) {
+				double current = sharedBound.load(std::memory_order_relaxed);
+				while (kept.front().score < current && !sharedBound.compare_exchange_weak(current, kept.front().score, std::memory_order_relaxed));
+			}
+		};
+
+		// Seeds first, for a tight bound from the start
+		for (const MatchCandidate& seed : seeds) {
+			cv::Point position(static_cast<int>(seed.position.x), static_cast<int>(seed.position.y));
+			if (seed.rotationIndex == rotationIndex && position.x >= 0 && position.y >= 0 && position.x < offsets.width && position.y < offsets.height && mask.at<uchar>(position) != 0)
+				visit(position);
+		}
+
+		for (int row = 0; row < offsets.height; row++) {
+			const uchar* maskRow = mask.ptr<uchar>(row);
+			for (int col = 0; col < offsets.width; col++)
+				if (maskRow[col] != 0)
+					visit(cv::Point(col, row));
+		}
+
+		rotationCandidates[rotationIndex] = std::move(kept);
+
+		statistics.positions += positions;
+		statistics.aborted += aborted;
+		statistics.rows += positions * templateSize.height;
+		statistics.summedRows += summedRows;
+	}
+
+	std::vector<MatchCandidate> result;
+	for (const std::vector<MatchCandidate>& candidates : rotationCandidates)
+		result.insert(result.end(), candidates.begin(), candidates.end());
+
+	std::stable_sort(result.begin(), result.end(), [metric](const MatchCandidate& a, const MatchCandidate& b) {
+		return MatchCandidate::better(metric, a.score, b.score);
+	});
+
+	return result;
+}
+
+void SsdaMatcher::report() {
+	std::uint64_t positions = statistics.positions.exchange(0);
+	std::uint64_t aborted = statistics.aborted.exchange(0);
+	std::uint64_t rows = statistics.rows.exchange(0);
+	std::uint64_t summedRows = statistics.summedRows.exchange(0);
+	if (positions == 0 || rows == 0)
+		return;
+
+	Log::info("SSDA aborted %.1f%% of %llu placements and skipped %.1f%% of their rows",
+	          100.0 * aborted / positions,
+	          static_cast<unsigned long long>(positions),
+	          100.0 * (rows - summedRows) / rows);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "matchCandidate.h"
+
+class SourceTexture;
+
+// Sequential similarity detection for the squared difference metrics. The squared difference of a placement only grows
+// while its rows are summed, so a placement is abandoned as soon as its partial score is worse than the placements kept
+// so far. Seeds are evaluated first to start from a tight bound, and the template rows with the most energy are summed
+// first so the partial score grows quickly. The best placement equals the one of the exhaustive search.
+class SsdaMatcher {
+public:
+	// Work of all searches since the last report
+	struct Statistics {
+		std::atomic<std::uint64_t> positions = 0;
+		std::atomic<std::uint64_t> aborted = 0;
+		std::atomic<std::uint64_t> rows = 0;
+		std::atomic<std::uint64_t> summedRows = 0;
+	};
+
+	// Whether the metric has a partial score that only gets worse
+	static bool supports(cv::TemplateMatchModes metric);
+
+	// At most count placements over all rotations, best first. The placements kept within a rotation do not overlap
+	// in the source, placements of different rotations may. Seeds are placements that are likely to be good
+	static std::vector<MatchCandidate> match(SourceTexture& source,
+	                                         const std::vector<cv::Mat>& templates,
+	                                         const std::vector<float>& weights,
+	                                         cv::TemplateMatchModes metric,
+	                                         int count,
+	                                         const std::vector<MatchCandidate>& seeds);
+
+	// Logs the fraction of the rows and placements that were pruned and starts counting anew
+	static void report();
+
+private:
+	static Statistics statistics;
+};
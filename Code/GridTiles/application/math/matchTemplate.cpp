@@ -0,0 +1,601 @@
+#include "core.h"
+
+#include "utils.h"
+
+#include <cfloat>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include <opencv2/core/utility.hpp>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define GRIDTILES_X86
+#include <immintrin.h>
+#endif
+
+// GCC and Clang only emit vector instructions in functions that target them, MSVC always does
+#if defined(GRIDTILES_X86) && !defined(_MSC_VER)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#else
+#define TARGET_AVX2
+#define TARGET_SSE41
+#endif
+
+// Number of result columns processed at once, the accumulators of a chunk stay in the L1 cache
+static constexpr int chunkSize = 64;
+
+// Weighted sums over a single template row for `count` neighbouring offsets:
+// imageTemplate += value * image, imageSquared += image * image, image += image
+template <typename T>
+using RowKernel = void (*)(const T* image, float value, int count, float* imageTemplate, float* imageSquared, float* imageSum);
+
+template <typename T>
+static void accumulateScalar(const T* image, float value, int count, float* imageTemplate, float* imageSquared, float* imageSum) {
+	for (int index = 0; index < count; index++) {
+		float pixel = static_cast<float>(image[index]);
+		imageTemplate[index] += value * pixel;
+		imageSquared[index] += pixel * pixel;
+		imageSum[index] += pixel;
+	}
+}
+
+#ifdef GRIDTILES_X86
+TARGET_AVX2 static __m256 load8(const float* image) {
+	return _mm256_loadu_ps(image);
+}
+
+template <typename T>
+TARGET_AVX2 static void accumulateAVX2(const T* image, float value, int count, float* imageTemplate, float* imageSquared, float* imageSum) {
+	__m256 broadcast = _mm256_set1_ps(value);
+
+	int index = 0;
+	for (; index + 8 <= count; index += 8) {
+		__m256 pixels = load8(image + index);
+		_mm256_storeu_ps(imageTemplate + index, _mm256_add_ps(_mm256_loadu_ps(imageTemplate + index), _mm256_mul_ps(broadcast, pixels)));
+		_mm256_storeu_ps(imageSquared + index, _mm256_add_ps(_mm256_loadu_ps(imageSquared + index), _mm256_mul_ps(pixels, pixels)));
+		_mm256_storeu_ps(imageSum + index, _mm256_add_ps(_mm256_loadu_ps(imageSum + index), pixels));
+	}
+
+	accumulateScalar(image + index, value, count - index, imageTemplate + index, imageSquared + index, imageSum + index);
+}
+
+TARGET_SSE41 static __m128 load4(const float* image) {
+	return _mm_loadu_ps(image);
+}
+
+template <typename T>
+TARGET_SSE41 static void accumulateSSE41(const T* image, float value, int count, float* imageTemplate, float* imageSquared, float* imageSum) {
+	__m128 broadcast = _mm_set1_ps(value);
+
+	int index = 0;
+	for (; index + 4 <= count; index += 4) {
+		__m128 pixels = load4(image + index);
+		_mm_storeu_ps(imageTemplate + index, _mm_add_ps(_mm_loadu_ps(imageTemplate + index), _mm_mul_ps(broadcast, pixels)));
+		_mm_storeu_ps(imageSquared + index, _mm_add_ps(_mm_loadu_ps(imageSquared + index), _mm_mul_ps(pixels, pixels)));
+		_mm_storeu_ps(imageSum + index, _mm_add_ps(_mm_loadu_ps(imageSum + index), pixels));
+	}
+
+	accumulateScalar(image + index, value, count - index, imageTemplate + index, imageSquared + index, imageSum + index);
+}
+#endif
+
+// Fastest row kernel supported by the processor, selected once
+template <typename T>
+static RowKernel<T> selectKernel() {
+#ifdef GRIDTILES_X86
+	if (cv::checkHardwareSupport(CV_CPU_AVX2))
+		return accumulateAVX2<T>;
+	if (cv::checkHardwareSupport(CV_CPU_SSE4_1))
+		return accumulateSSE41<T>;
+#endif
+
+	return accumulateScalar<T>;
+}
+
+// Integer planes are correlated two template pixels at a time with 16 bit multiply-accumulates into 32 bit sums:
+// imageTemplate += valueA * imageA + valueB * imageB, imageSquared += imageA * imageA + imageB * imageB, imageSum += imageA + imageB
+template <typename T>
+using PairKernel = void (*)(const T* imageA, const T* imageB, int valueA, int valueB, int count, int* imageTemplate, int* imageSquared, int* imageSum);
+
+template <typename T>
+static void accumulatePairScalar(const T* imageA, const T* imageB, int valueA, int valueB, int count, int* imageTemplate, int* imageSquared, int* imageSum) {
+	for (int index = 0; index < count; index++) {
+		int pixelA = imageA[index];
+		int pixelB = imageB[index];
+		imageTemplate[index] += valueA * pixelA + valueB * pixelB;
+		imageSquared[index] += pixelA * pixelA + pixelB * pixelB;
+		imageSum[index] += pixelA + pixelB;
+	}
+}
+
+#ifdef GRIDTILES_X86
+TARGET_AVX2 static __m256i load16(const uchar* image) {
+	return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(image)));
+}
+
+TARGET_AVX2 static __m256i load16(const short* image) {
+	return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(image));
+}
+
+// Adds the pairwise products of the interleaved pixels, the unpacks interleave within 128 bit lanes
+TARGET_AVX2 static void add16(int* target, __m256i low, __m256i high) {
+	__m256i first = _mm256_permute2x128_si256(low, high, 0x20);
+	__m256i second = _mm256_permute2x128_si256(low, high, 0x31);
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(target), _mm256_add_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(target)), first));
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(target + 8), _mm256_add_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(target + 8)), second));
+}
+
+template <typename T>
+TARGET_AVX2 static void accumulatePairAVX2(const T* imageA, const T* imageB, int valueA, int valueB, int count, int* imageTemplate, int* imageSquared, int* imageSum) {
+	__m256i values = _mm256_set1_epi32(static_cast<int>(static_cast<unsigned>(valueB) << 16 | static_cast<unsigned short>(valueA)));
+	__m256i ones = _mm256_set1_epi16(1);
+
+	int index = 0;
+	for (; index + 16 <= count; index += 16) {
+		__m256i pixelsA = load16(imageA + index);
+		__m256i pixelsB = load16(imageB + index);
+		__m256i low = _mm256_unpacklo_epi16(pixelsA, pixelsB);
+		__m256i high = _mm256_unpackhi_epi16(pixelsA, pixelsB);
+
+		add16(imageTemplate + index, _mm256_madd_epi16(low, values), _mm256_madd_epi16(high, values));
+		add16(imageSquared + index, _mm256_madd_epi16(low, low), _mm256_madd_epi16(high, high));
+		add16(imageSum + index, _mm256_madd_epi16(low, ones), _mm256_madd_epi16(high, ones));
+	}
+
+	accumulatePairScalar(imageA + index, imageB + index, valueA, valueB, count - index, imageTemplate + index, imageSquared + index, imageSum + index);
+}
+
+TARGET_SSE41 static __m128i load8i(const uchar* image) {
+	return _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(image)));
+}
+
+TARGET_SSE41 static __m128i load8i(const short* image) {
+	return _mm_loadu_si128(reinterpret_cast<const __m128i*>(image));
+}
+
+TARGET_SSE41 static void add8(int* target, __m128i low, __m128i high) {
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(target), _mm_add_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(target)), low));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(target + 4), _mm_add_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(target + 4)), high));
+}
+
+template <typename T>
+TARGET_SSE41 static void accumulatePairSSE41(const T* imageA, const T* imageB, int valueA, int valueB, int count, int* imageTemplate, int* imageSquared, int* imageSum) {
+	__m128i values = _mm_set1_epi32(static_cast<int>(static_cast<unsigned>(valueB) << 16 | static_cast<unsigned short>(valueA)));
+	__m128i ones = _mm_set1_epi16(1);
+
+	int index = 0;
+	for (; index + 8 <= count; index += 8) {
+		__m128i pixelsA = load8i(imageA + index);
+		__m128i pixelsB = load8i(imageB + index);
+		__m128i low = _mm_unpacklo_epi16(pixelsA, pixelsB);
+		__m128i high = _mm_unpackhi_epi16(pixelsA, pixelsB);
+
+		add8(imageTemplate + index, _mm_madd_epi16(low, values), _mm_madd_epi16(high, values));
+		add8(imageSquared + index, _mm_madd_epi16(low, low), _mm_madd_epi16(high, high));
+		add8(imageSum + index, _mm_madd_epi16(low, ones), _mm_madd_epi16(high, ones));
+	}
+
+	accumulatePairScalar(imageA + index, imageB + index, valueA, valueB, count - index, imageTemplate + index, imageSquared + index, imageSum + index);
+}
+#endif
+
+template <typename T>
+static PairKernel<T> selectPairKernel() {
+#ifdef GRIDTILES_X86
+	if (cv::checkHardwareSupport(CV_CPU_AVX2))
+		return accumulatePairAVX2<T>;
+	if (cv::checkHardwareSupport(CV_CPU_SSE4_1))
+		return accumulatePairSSE41<T>;
+#endif
+
+	return accumulatePairScalar<T>;
+}
+
+// Marks offsets where a used template pixel covers unavailable material
+static void block(const uchar* available, int count, uchar* blocked) {
+	int index = 0;
+#ifdef GRIDTILES_X86
+	__m128i zero = _mm_setzero_si128();
+	for (; index + 16 <= count; index += 16) {
+		__m128i unavailable = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(available + index)), zero);
+		__m128i previous = _mm_loadu_si128(reinterpret_cast<const __m128i*>(blocked + index));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(blocked + index), _mm_or_si128(previous, unavailable));
+	}
+#endif
+
+	for (; index < count; index++)
+		blocked[index] |= available[index] == 0 ? 0xFF : 0x00;
+}
+
+static bool blockedChunk(const uchar* blocked, int count) {
+	for (int index = 0; index < count; index++)
+		if (blocked[index] == 0)
+			return false;
+
+	return true;
+}
+
+// Score of an offset given the masked sums of the template and the image window
+static float score(int method, double imageTemplate, double imageSquared, double imageSum, double templateSquared, double templateSum, double pixels) {
+	switch (method) {
+		case cv::TM_SQDIFF:
+			return static_cast<float>(std::max(0.0, imageSquared - 2.0 * imageTemplate + templateSquared));
+		case cv::TM_SQDIFF_NORMED: {
+			double denominator = std::sqrt(imageSquared * templateSquared);
+			double difference = std::max(0.0, imageSquared - 2.0 * imageTemplate + templateSquared);
+
+			return denominator > DBL_EPSILON ? static_cast<float>(difference / denominator) : 1.0f;
+		}
+		case cv::TM_CCORR:
+			return static_cast<float>(imageTemplate);
+		case cv::TM_CCORR_NORMED: {
+			double denominator = std::sqrt(imageSquared * templateSquared);
+
+			return denominator > DBL_EPSILON ? static_cast<float>(imageTemplate / denominator) : 0.0f;
+		}
+		case cv::TM_CCOEFF:
+			return static_cast<float>(imageTemplate - imageSum * templateSum / pixels);
+		case cv::TM_CCOEFF_NORMED: {
+			double covariance = imageTemplate - imageSum * templateSum / pixels;
+			double imageVariance = std::max(0.0, imageSquared - imageSum * imageSum / pixels);
+			double templateVariance = std::max(0.0, templateSquared - templateSum * templateSum / pixels);
+			double denominator = std::sqrt(imageVariance * templateVariance);
+
+			return denominator > DBL_EPSILON ? static_cast<float>(covariance / denominator) : 0.0f;
+		}
+		default:
+			return 0.0f;
+	}
+}
+
+// Used pixels of a single template row
+struct TemplateRow {
+	std::vector<int> cols;
+	std::vector<float> values;
+};
+
+// Masked sums of the image windows of one chunk of offsets
+struct ChunkSums {
+	double imageTemplate[chunkSize];
+	double imageSquared[chunkSize];
+	double imageSum[chunkSize];
+};
+
+// Used pixels and statistics of the template of a single channel of a feature
+struct FeatureTemplate {
+	std::vector<TemplateRow> rows;
+	double templateSquared = 0.0;
+	double templateSum = 0.0;
+	double pixels = 0.0;
+	float weight = 1.0f;
+	// Whether this is the last channel of its feature, the feature is scored once the sums of all its channels are known
+	bool lastChannel = true;
+	// Template statistics of all channels of the feature, centered per channel for the coefficient methods
+	double featureTemplateSquared = 0.0;
+	double featureTemplateSum = 0.0;
+
+	const cv::Mat* image = nullptr;
+	void (*accumulate)(const cv::Mat& image, const std::vector<TemplateRow>& rows, int resultRow, int chunkStart, int count, ChunkSums& sums) = nullptr;
+};
+
+template <typename T>
+static void accumulateChunk(const cv::Mat& image, const std::vector<TemplateRow>& rows, int resultRow, int chunkStart, int count, ChunkSums& sums) {
+	static const RowKernel<T> kernel = selectKernel<T>();
+
+	// Row sums are accumulated in single precision before they are added to the double precision sums
+	float rowImageTemplate[chunkSize], rowImageSquared[chunkSize], rowImageSum[chunkSize];
+
+	std::fill_n(sums.imageTemplate, count, 0.0);
+	std::fill_n(sums.imageSquared, count, 0.0);
+	std::fill_n(sums.imageSum, count, 0.0);
+
+	for (int templRow = 0; templRow < static_cast<int>(rows.size()); templRow++) {
+		const TemplateRow& templateRow = rows[templRow];
+		if (templateRow.cols.empty())
+			continue;
+
+		const T* imageRow = image.ptr<T>(resultRow + templRow) + chunkStart;
+
+		std::fill_n(rowImageTemplate, count, 0.0f);
+		std::fill_n(rowImageSquared, count, 0.0f);
+		std::fill_n(rowImageSum, count, 0.0f);
+
+		for (std::size_t index = 0; index < templateRow.cols.size(); index++)
+			kernel(imageRow + templateRow.cols[index], templateRow.values[index], count, rowImageTemplate, rowImageSquared, rowImageSum);
+
+		for (int col = 0; col < count; col++) {
+			sums.imageTemplate[col] += rowImageTemplate[col];
+			sums.imageSquared[col] += rowImageSquared[col];
+			sums.imageSum[col] += rowImageSum[col];
+		}
+	}
+}
+
+// Template pixels whose 32 bit sums cannot overflow, 8 bit planes never overflow a template row. 16 bit planes may hold
+// steered gradients, which exceed quantizedMaximum
+template <typename T>
+static constexpr int integerPixels = std::is_same_v<T, uchar> ? std::numeric_limits<int>::max() / (255 * 255) : std::numeric_limits<int>::max() / (Utils::steeredMaximum * Utils::steeredMaximum);
+
+template <typename T>
+static void accumulateIntegerChunk(const cv::Mat& image, const std::vector<TemplateRow>& rows, int resultRow, int chunkStart, int count, ChunkSums& sums) {
+	static const PairKernel<T> kernel = selectPairKernel<T>();
+	// The partner of the last pixel of an odd row
+	static const T zeros[chunkSize] = {};
+
+	int rowImageTemplate[chunkSize], rowImageSquared[chunkSize], rowImageSum[chunkSize];
+
+	std::fill_n(sums.imageTemplate, count, 0.0);
+	std::fill_n(sums.imageSquared, count, 0.0);
+	std::fill_n(sums.imageSum, count, 0.0);
+
+	auto flush = [&] {
+		for (int col = 0; col < count; col++) {
+			sums.imageTemplate[col] += rowImageTemplate[col];
+			sums.imageSquared[col] += rowImageSquared[col];
+			sums.imageSum[col] += rowImageSum[col];
+		}
+
+		std::fill_n(rowImageTemplate, count, 0);
+		std::fill_n(rowImageSquared, count, 0);
+		std::fill_n(rowImageSum, count, 0);
+	};
+
+	std::fill_n(rowImageTemplate, count, 0);
+	std::fill_n(rowImageSquared, count, 0);
+	std::fill_n(rowImageSum, count, 0);
+
+	int accumulated = 0;
+	for (int templRow = 0; templRow < static_cast<int>(rows.size()); templRow++) {
+		const TemplateRow& templateRow = rows[templRow];
+		const T* imageRow = image.ptr<T>(resultRow + templRow) + chunkStart;
+
+		std::size_t pixels = templateRow.cols.size();
+		for (std::size_t index = 0; index < pixels; index += 2) {
+			if (accumulated + 2 > integerPixels<T>) {
+				flush();
+				accumulated = 0;
+			}
+
+			const T* imageA = imageRow + templateRow.cols[index];
+			int valueA = static_cast<int>(templateRow.values[index]);
+			if (index + 1 < pixels)
+				kernel(imageA, imageRow + templateRow.cols[index + 1], valueA, static_cast<int>(templateRow.values[index + 1]), count, rowImageTemplate, rowImageSquared, rowImageSum);
+			else
+				kernel(imageA, zeros, valueA, 0, count, rowImageTemplate, rowImageSquared, rowImageSum);
+			accumulated += 2;
+		}
+	}
+
+	flush();
+}
+
+template <typename T>
+static void collectTemplate(const cv::Mat& templ, const cv::Mat& templMask, FeatureTemplate& feature) {
+	feature.rows.resize(templ.rows);
+	if constexpr (std::is_same_v<T, float>)
+		feature.accumulate = accumulateChunk<T>;
+	else
+		feature.accumulate = accumulateIntegerChunk<T>;
+
+	for (int row = 0; row < templ.rows; row++) {
+		const T* templRow = templ.ptr<T>(row);
+		const uchar* templMaskRow = templMask.empty() ? nullptr : templMask.ptr<uchar>(row);
+		for (int col = 0; col < templ.cols; col++) {
+			if (templMaskRow != nullptr && templMaskRow[col] == 0)
+				continue;
+
+			float value = static_cast<float>(templRow[col]);
+			feature.rows[row].cols.push_back(col);
+			feature.rows[row].values.push_back(value);
+			feature.templateSquared += static_cast<double>(value) * value;
+			feature.templateSum += value;
+			feature.pixels += 1.0;
+		}
+	}
+}
+
+// Marks the offsets of a chunk where a used template pixel covers unavailable material, returns whether all of them are blocked
+static bool blockChunk(const cv::Mat& globalMask, const std::vector<TemplateRow>& rows, int resultRow, int chunkStart, int count, uchar* blocked) {
+	std::fill_n(blocked, count, 0);
+
+	for (int templRow = 0; templRow < static_cast<int>(rows.size()); templRow++) {
+		const TemplateRow& templateRow = rows[templRow];
+		if (templateRow.cols.empty())
+			continue;
+
+		const uchar* availableRow = globalMask.ptr<uchar>(resultRow + templRow) + chunkStart;
+		for (int templCol : templateRow.cols)
+			block(availableRow + templCol, count, blocked);
+
+		// Skip the rest of the template when every offset of the chunk is blocked
+		if (blockedChunk(blocked, count))
+			return true;
+	}
+
+	return false;
+}
+
+// Weighted sum of the scores of all features, every feature is folded into the chunk as soon as the sums of its channels are
+// known. The channels of a feature are combined like cv::matchTemplate does, the coefficient methods center every channel
+// on its own mean
+static void fusedMatch(const std::vector<FeatureTemplate>& features, cv::Mat& result, int method, const cv::Mat& globalMask) {
+	// Every feature uses the same template pixels, so the blocked offsets follow from the first one
+	const std::vector<TemplateRow>& rows = features.front().rows;
+	int resultCols = result.cols;
+	int resultRows = result.rows;
+	bool hasGlobalMask = !globalMask.empty();
+	bool centered = method == cv::TM_CCOEFF || method == cv::TM_CCOEFF_NORMED;
+
+	// Aborted offsets get the worst score of the metric
+	float worst = method == cv::TM_SQDIFF || method == cv::TM_SQDIFF_NORMED ? FLT_MAX : -FLT_MAX;
+
+#pragma omp parallel for schedule(dynamic)
+	for (int resultRow = 0; resultRow < resultRows; resultRow++) {
+		float* resultValues = result.ptr<float>(resultRow);
+
+		ChunkSums sums;
+		ChunkSums channelSums;
+		double fused[chunkSize];
+		uchar blocked[chunkSize];
+
+		for (int chunkStart = 0; chunkStart < resultCols; chunkStart += chunkSize) {
+			int count = std::min(chunkSize, resultCols - chunkStart);
+
+			if (hasGlobalMask) {
+				if (blockChunk(globalMask, rows, resultRow, chunkStart, count, blocked)) {
+					std::fill_n(resultValues + chunkStart, count, worst);
+
+					continue;
+				}
+			} else {
+				std::fill_n(blocked, count, 0);
+			}
+
+			std::fill_n(fused, count, 0.0);
+			std::fill_n(sums.imageTemplate, count, 0.0);
+			std::fill_n(sums.imageSquared, count, 0.0);
+			std::fill_n(sums.imageSum, count, 0.0);
+			for (const FeatureTemplate& feature : features) {
+				feature.accumulate(*feature.image, feature.rows, resultRow, chunkStart, count, channelSums);
+
+				for (int col = 0; col < count; col++) {
+					if (centered) {
+						double imageSum = channelSums.imageSum[col];
+						sums.imageTemplate[col] += channelSums.imageTemplate[col] - imageSum * feature.templateSum / feature.pixels;
+						sums.imageSquared[col] += std::max(0.0, channelSums.imageSquared[col] - imageSum * imageSum / feature.pixels);
+					} else {
+						sums.imageTemplate[col] += channelSums.imageTemplate[col];
+						sums.imageSquared[col] += channelSums.imageSquared[col];
+						sums.imageSum[col] += channelSums.imageSum[col];
+					}
+				}
+
+				if (!feature.lastChannel)
+					continue;
+
+				// Centered sums keep a zero image sum, so the coefficient methods take them as they are
+				for (int col = 0; col < count; col++)
+					fused[col] += feature.weight * score(method, sums.imageTemplate[col], sums.imageSquared[col], sums.imageSum[col], feature.featureTemplateSquared, feature.featureTemplateSum, feature.pixels);
+
+				std::fill_n(sums.imageTemplate, count, 0.0);
+				std::fill_n(sums.imageSquared, count, 0.0);
+				std::fill_n(sums.imageSum, count, 0.0);
+			}
+
+			for (int col = 0; col < count; col++)
+				resultValues[chunkStart + col] = blocked[col] ? worst : static_cast<float>(fused[col]);
+		}
+	}
+}
+
+double Utils::quantize(const cv::Mat& plane, cv::Mat& quantized) {
+	double minimum;
+	double maximum;
+	cv::minMaxLoc(plane.reshape(1), &minimum, &maximum);
+
+	double magnitude = std::max(std::abs(minimum), std::abs(maximum));
+	double scale = magnitude > 0.0 ? quantizedMaximum / magnitude : 1.0;
+	plane.convertTo(quantized, CV_MAKETYPE(CV_16S, plane.channels()), scale);
+
+	return scale;
+}
+
+void Utils::matchTemplate(const cv::Mat& image,
+                          const cv::Mat& templ,
+                          cv::Mat& result,
+                          int method,
+                          const cv::Mat& templMask,
+                          const cv::Mat& globalMask) {
+	matchTemplate(std::vector<cv::Mat> { image }, std::vector<cv::Mat> { templ }, std::vector<float> { 1.0f }, result, method, templMask, globalMask);
+}
+
+void Utils::matchTemplate(const std::vector<cv::Mat>& images,
+                          const std::vector<cv::Mat>& templs,
+                          const std::vector<float>& weights,
+                          cv::Mat& result,
+                          int method,
+                          const cv::Mat& templMask,
+                          const cv::Mat& globalMask) {
+	CV_Assert(!images.empty() && images.size() == templs.size() && images.size() == weights.size());
+
+	cv::Size imageSize = images.front().size();
+	cv::Size templSize = templs.front().size();
+	CV_Assert(templSize.width <= imageSize.width && templSize.height <= imageSize.height);
+	CV_Assert(templMask.empty() || (templMask.type() == CV_8UC1 && templMask.size() == templSize));
+	CV_Assert(globalMask.empty() || (globalMask.type() == CV_8UC1 && globalMask.size() == imageSize));
+
+	// Multi channel planes, like color intensities, are split into single channel planes with the weight of their feature
+	std::vector<cv::Mat> channelImages;
+	std::vector<cv::Mat> channelTempls;
+	std::vector<std::size_t> channelFeatures;
+	for (std::size_t featureIndex = 0; featureIndex < images.size(); featureIndex++) {
+		const cv::Mat& image = images[featureIndex];
+		const cv::Mat& templ = templs[featureIndex];
+		int depth = image.depth();
+		CV_Assert(image.type() == templ.type() && (depth == CV_8U || depth == CV_16S || depth == CV_32F));
+		CV_Assert(image.size() == imageSize && templ.size() == templSize);
+
+		if (image.channels() == 1) {
+			channelImages.push_back(image);
+			channelTempls.push_back(templ);
+		} else {
+			std::vector<cv::Mat> imageChannels;
+			std::vector<cv::Mat> templChannels;
+			cv::split(image, imageChannels);
+			cv::split(templ, templChannels);
+			channelImages.insert(channelImages.end(), imageChannels.begin(), imageChannels.end());
+			channelTempls.insert(channelTempls.end(), templChannels.begin(), templChannels.end());
+		}
+		channelFeatures.resize(channelImages.size(), featureIndex);
+	}
+
+	std::vector<FeatureTemplate> features(channelImages.size());
+	for (std::size_t channelIndex = 0; channelIndex < channelImages.size(); channelIndex++) {
+		const cv::Mat& image = channelImages[channelIndex];
+		const cv::Mat& templ = channelTempls[channelIndex];
+
+		FeatureTemplate& feature = features[channelIndex];
+		feature.image = &image;
+		feature.weight = weights[channelFeatures[channelIndex]];
+		if (image.depth() == CV_8U)
+			collectTemplate<uchar>(templ, templMask, feature);
+		else if (image.depth() == CV_16S)
+			collectTemplate<short>(templ, templMask, feature);
+		else
+			collectTemplate<float>(templ, templMask, feature);
+	}
+
+	// The last channel of a feature keeps the template statistics of all its channels
+	bool centered = method == cv::TM_CCOEFF || method == cv::TM_CCOEFF_NORMED;
+	double featureTemplateSquared = 0.0;
+	double featureTemplateSum = 0.0;
+	for (std::size_t channelIndex = 0; channelIndex < features.size(); channelIndex++) {
+		FeatureTemplate& feature = features[channelIndex];
+		if (centered && feature.pixels > 0.0) {
+			featureTemplateSquared += std::max(0.0, feature.templateSquared - feature.templateSum * feature.templateSum / feature.pixels);
+		} else {
+			featureTemplateSquared += feature.templateSquared;
+			featureTemplateSum += feature.templateSum;
+		}
+
+		feature.lastChannel = channelIndex + 1 == features.size() || channelFeatures[channelIndex + 1] != channelFeatures[channelIndex];
+		if (feature.lastChannel) {
+			feature.featureTemplateSquared = featureTemplateSquared;
+			feature.featureTemplateSum = featureTemplateSum;
+			featureTemplateSquared = 0.0;
+			featureTemplateSum = 0.0;
+		}
+	}
+
+	// Reuses the memory of the result if it already has the right size
+	result.create(imageSize.height - templSize.height + 1, imageSize.width - templSize.width + 1, CV_32FC1);
+
+	if (features.front().pixels == 0.0) {
+		result.setTo(cv::Scalar(method == cv::TM_SQDIFF || method == cv::TM_SQDIFF_NORMED ? FLT_MAX : -FLT_MAX));
+
+		return;
+	}
+
+	fusedMatch(features, result, method, globalMask);
+}
@@ -10,57 +10,9 @@
 #include <opencv2/core/mat.hpp>
 #include "main.h"
 #include "graphics/features/Feature.h"
-
-void Utils::matchTemplate(const cv::Mat& image,
-                          const cv::Mat& templ,
-                          cv::Mat& result,
-                          int method,
-                          const cv::Mat& templMask,
-                          const cv::Mat& globalMask) {
-	int templCols = templ.cols;
-	int templRows = templ.rows;
-	int resultCols = image.cols - templ.cols + 1;
-	int resultRows = image.rows - templ.rows + 1;
-
-	bool hasTemplMask = templMask.data != nullptr;
-	bool hasGlobalMask = globalMask.data != nullptr;
-
-	result.create(resultRows, resultCols, CV_32FC1);
-
-#pragma omp parallel for
-	for (int colStart = 0; colStart < resultCols; ++colStart) {
-#pragma omp parallel for
-		for (int rowStart = 0; rowStart < resultRows; ++rowStart) {
-			float totalPixels = 0.0;
-			float resultValue = 0.0;
-			for (int colDelta = 0; colDelta < templCols; colDelta++) {
-				for (int rowDelta = 0; rowDelta < templRows; rowDelta++) {
-					int globalCol = colStart + colDelta;
-					int globalRow = rowStart + rowDelta;
-					int templIndex = colDelta + rowDelta * templCols;
-					int globalIndex = globalCol + globalRow * resultCols;
-
-					if (hasTemplMask && templMask.at<unsigned char>(templIndex) == 0)
-						continue;
-
-					if (hasGlobalMask && globalMask.at<unsigned char>(globalIndex) == 0)
-						goto abort;
-
-					int globalValue = image.at<unsigned char>(globalIndex);
-					int templValue = templ.at<unsigned char>(templIndex);
-
-					resultValue += static_cast<float>(globalValue * templValue);
-					totalPixels += 1.0;
-				}
-			}
-
-			result.at<float>(colStart + rowStart * resultRows) = resultValue / totalPixels;
-
-			continue;
-		abort: result.at<float>(colStart + rowStart * resultRows) = 0;
-		}
-	}
-}
+#include "matching/localSearch.h"
+#include "matching/ssdaMatcher.h"
+#include "util/sat.h"
 
 std::vector<std::size_t> Utils::nUniqueRandomSizeTypesInRange(std::mt19937& generator, std::size_t n, std::size_t start, std::size_t end) {
 	assert(n <= end - start);
@@ -151,37 +103,464 @@ float Utils::randomSignedFloatInRange(std::mt19937& generator, float start, floa
 }
 
 std::pair<int, Vec2> Utils::computeBestMatch(const cv::Rect& targetPatch, cv::TemplateMatchModes metric) {
-	float distribution[2];
+	MatchCandidate candidate = computeBestCandidate(targetPatch, metric);
+
+	if (!candidate.valid()) {
+		Log::error("No patches available");
+
+		return std::make_pair(0, Vec2(0, 0));
+	}
+
+	return std::make_pair(candidate.rotationIndex, candidate.position);
+}
+
+// Placement around the first seed, valid only if it is good enough to skip the global search. Local placements are not the
+// best ones, so they are never cached
+static MatchCandidate computeLocalCandidate(const cv::Rect& targetPatch, cv::TemplateMatchModes metric, std::vector<MatchCandidate>& seeds) {
+	if (seeds.empty() || !seeds.front().valid() || !LocalSearch::enabled())
+		return MatchCandidate();
+
+	MatchCandidate candidate = LocalSearch::match(targetPatch, metric, seeds.front());
+	if (LocalSearch::accept(candidate, metric))
+		return candidate;
+
+	// Still a good start for the early terminated search
+	if (candidate.valid())
+		seeds.push_back(candidate);
+
+	return MatchCandidate();
+}
+
+MatchCandidate Utils::computeBestCandidate(const cv::Rect& targetPatch, cv::TemplateMatchModes metric, const std::vector<MatchCandidate>& seeds) {
+	// The best of the non overlapping placements is the best placement, so both share their entries
+	MatchCache::Key key = MatchCache::key(targetPatch, metric, 1);
+	std::vector<MatchCandidate> candidates;
+	if (settings.cacheMatches && settings.matchCache.find(key, candidates))
+		return candidates.empty() ? MatchCandidate() : candidates.front();
+
+	std::vector<MatchCandidate> allSeeds = seeds;
+	MatchCandidate local = computeLocalCandidate(targetPatch, metric, allSeeds);
+	if (local.valid())
+		return local;
+
+	MatchCandidate candidate = searchBestCandidate(targetPatch, metric, allSeeds);
+	if (settings.cacheMatches) {
+		candidates.clear();
+		if (candidate.valid())
+			candidates.push_back(candidate);
+
+		settings.matchCache.insert(key, candidates);
+	}
+
+	return candidate;
+}
+
+MatchCandidate Utils::searchBestCandidate(const cv::Rect& targetPatch, cv::TemplateMatchModes metric, const std::vector<MatchCandidate>& seeds) {
+	// The pyramid, the index and the early terminated search need the features of every rotation
+	if (settings.source.rotateTemplates)
+		return computeExhaustiveMatch(targetPatch, metric);
+
+	if (settings.matchingMethod == Settings::MatchingMethod_Ssda && SsdaMatcher::supports(metric))
+		return computeSsdaMatch(targetPatch, metric, seeds);
+	if (settings.matchingMethod == Settings::MatchingMethod_Pyramid)
+		return computePyramidMatch(targetPatch, metric);
+	if (settings.matchingMethod == Settings::MatchingMethod_Index)
+		return computeIndexMatch(targetPatch, metric);
+
+	return computeExhaustiveMatch(targetPatch, metric);
+}
+
+MatchCandidate Utils::computePyramidMatch(const cv::Rect& targetPatch, cv::TemplateMatchModes metric) {
+	std::vector<float> distribution(2);
 	distribution[FeatureIndex_Intensity] = settings.intensityWeight;
 	distribution[FeatureIndex_Edge] = settings.edgeWeight;
 
+	std::vector<cv::Mat> targetFeaturePatches;
+	for (FeatureIndex featureIndex = 0; featureIndex < settings.target.features.size(); featureIndex++)
+		targetFeaturePatches.push_back(settings.target[featureIndex].data(targetPatch));
+
+	std::vector<MatchCandidate> candidates = settings.source.pyramid.match(settings.source,
+	                                                                       targetFeaturePatches,
+	                                                                       distribution,
+	                                                                       metric,
+	                                                                       settings.pyramidLevels,
+	                                                                       settings.pyramidCandidates);
+
+	if (candidates.empty())
+		return MatchCandidate();
+
+	return candidates.front();
+}
+
+// Weighted response of the target patch in every rotation, empty if the patch does not fit in the rotation
+static std::vector<cv::Mat> computeExhaustiveResponses(const cv::Rect& targetPatch, cv::TemplateMatchModes metric) {
+	std::vector<float> distribution(2);
+	distribution[FeatureIndex_Intensity] = settings.intensityWeight;
+	distribution[FeatureIndex_Edge] = settings.edgeWeight;
+
+	// Target feature patches, shared by all rotations
+	std::vector<cv::Mat> targetFeaturePatches;
+	for (FeatureIndex featureIndex = 0; featureIndex < settings.target.features.size(); featureIndex++)
+		targetFeaturePatches.push_back(settings.target[featureIndex].data(targetPatch));
+
 	std::vector responses(settings.source.rotations, cv::Mat());
 
+	// Derive the correlations from the halves of split patches, only the weighting and normalization remain per match
+	if (settings.responseCacheSize > 0 && !settings.source.rotateTemplates && !settings.source.features.empty()) {
+		SRef<const ResponseCache::Correlations> correlations = settings.responseCache.correlations(targetPatch);
+
 #pragma omp parallel for
-	for (int rotationIndex = 0; rotationIndex < settings.source.rotations; rotationIndex++) {
+		for (int rotationIndex = 0; rotationIndex < settings.source.rotations; rotationIndex++)
+			settings.source.matcher.combineCorrelations(settings.source.features[rotationIndex],
+			                                            rotationIndex,
+			                                            targetFeaturePatches,
+			                                            (*correlations)[rotationIndex],
+			                                            distribution,
+			                                            metric,
+			                                            responses[rotationIndex]);
+
+		return responses;
+	}
 
-		// Collect feature responses
-		int featureCols = settings.source.textures[rotationIndex].cols() - targetPatch.width + 1;
-		int featureRows = settings.source.textures[rotationIndex].rows() - targetPatch.height + 1;
-		cv::Mat weightedResponse(featureRows, featureCols, CV_32FC1, cv::Scalar(0.0));
+	// Correlate against the cached source spectra, all features of a rotation share a single inverse transform
 #pragma omp parallel for
-		for (FeatureIndex featureIndex = 0; featureIndex < settings.source.features[rotationIndex].size(); featureIndex++) {
-			// Get source and target feature patches
-			cv::Mat sourceFeature = settings.source.features[rotationIndex][featureIndex].data;
-			cv::Mat targetFeaturePatch = settings.target[featureIndex].data(targetPatch);
-
-			// Find best match
-			cv::Mat response;
-			cv::matchTemplate(sourceFeature, targetFeaturePatch, response, metric);
-
-			// Add weighted response to total
-#pragma omp critical
-			cv::addWeighted(weightedResponse, 1.0, response, distribution[featureIndex], 0.0, weightedResponse);
+	for (int rotationIndex = 0; rotationIndex < settings.source.rotations; rotationIndex++)
+		settings.source.matchTemplate(rotationIndex, targetFeaturePatches, distribution, metric, responses[rotationIndex]);
+
+	return responses;
+}
+
+// Whether the responses of the patch in all rotations fit in the response memory of the settings
+static bool fitsResponseMemory(const cv::Rect& targetPatch) {
+	if (settings.source.rotateTemplates || settings.source.features.empty() || settings.source.features.front().empty())
+		return true;
+
+	// Tiled sources are always searched in tiles, so only the windows of a tile of the mapped planes are paged in at once
+	if (settings.tiledSource != nullptr)
+		return false;
+
+	const Texture& feature = settings.source.features.front().front();
+	double cols = std::max(feature.cols() - targetPatch.width + 1, 0);
+	double rows = std::max(feature.rows() - targetPatch.height + 1, 0);
+	double bytes = cols * rows * sizeof(float) * settings.source.rotations;
+
+	return bytes <= settings.responseMemory * 1024.0 * 1024.0;
+}
+
+Obb Utils::computeCandidateObb(const MatchCandidate& candidate, const cv::Size& patchSize) {
+	const cv::Mat& inverseTransformation = settings.source.inverseTransformations[candidate.rotationIndex];
+	Vec2 extents((patchSize.width - 1) / 2.0, (patchSize.height - 1) / 2.0);
+	Vec2 center = candidate.position + extents;
+
+	const double* first = inverseTransformation.ptr<double>(0);
+	const double* second = inverseTransformation.ptr<double>(1);
+	Vec2 sourceCenter(first[0] * center.x + first[1] * center.y + first[2], second[0] * center.x + second[1] * center.y + second[2]);
+	Vec2 axis(first[0], second[0]);
+
+	return Obb { sourceCenter, axis, extents };
+}
+
+// Offsets that are at least as good as every available neighbour, the best offset of a response is always one of them
+static void collectLocalOptima(const cv::Mat& response, const cv::Mat& mask, int rotationIndex, cv::TemplateMatchModes metric, std::vector<MatchCandidate>& result) {
+	for (int row = 0; row < response.rows; row++) {
+		const float* responseRow = response.ptr<float>(row);
+		const uchar* maskRow = mask.ptr<uchar>(row);
+
+		for (int col = 0; col < response.cols; col++) {
+			if (maskRow[col] == 0)
+				continue;
+
+			float value = responseRow[col];
+			bool optimum = true;
+			for (int neighbourRow = std::max(row - 1, 0); neighbourRow <= std::min(row + 1, response.rows - 1) && optimum; neighbourRow++) {
+				const float* neighbourResponseRow = response.ptr<float>(neighbourRow);
+				const uchar* neighbourMaskRow = mask.ptr<uchar>(neighbourRow);
+				for (int neighbourCol = std::max(col - 1, 0); neighbourCol <= std::min(col + 1, response.cols - 1); neighbourCol++) {
+					if (neighbourMaskRow[neighbourCol] != 0 && MatchCandidate::better(metric, neighbourResponseRow[neighbourCol], value)) {
+						optimum = false;
+
+						break;
+					}
+				}
+			}
+
+			if (optimum)
+				result.emplace_back(rotationIndex, Vec2(col, row), value);
+		}
+	}
+}
+
+// Keeps the best candidates that do not overlap a better kept candidate in the unrotated source, best first.
+// Ties are broken by rotation and offset so the result does not depend on the order of the input
+static void suppressOverlappingCandidates(std::vector<MatchCandidate>& candidates, const cv::Size& patchSize, cv::TemplateMatchModes metric, int count) {
+	auto compare = [metric](const MatchCandidate& a, const MatchCandidate& b) {
+		if (a.score != b.score)
+			return MatchCandidate::better(metric, a.score, b.score);
+		if (a.rotationIndex != b.rotationIndex)
+			return a.rotationIndex < b.rotationIndex;
+		if (a.position.y != b.position.y)
+			return a.position.y < b.position.y;
+
+		return a.position.x < b.position.x;
+	};
+
+	// Only the candidates that are popped are ordered
+	auto heapCompare = [&compare](const MatchCandidate& a, const MatchCandidate& b) {
+		return compare(b, a);
+	};
+	std::make_heap(candidates.begin(), candidates.end(), heapCompare);
+
+	std::vector<MatchCandidate> kept;
+	std::vector<Obb> keptObbs;
+	for (auto end = candidates.end(); end != candidates.begin() && kept.size() < static_cast<std::size_t>(count); --end) {
+		std::pop_heap(candidates.begin(), end, heapCompare);
+		const MatchCandidate& candidate = *(end - 1);
+
+		Obb obb = computeCandidateObb(candidate, patchSize);
+		bool overlapping = std::ranges::any_of(keptObbs, [&obb](const Obb& keptObb) {
+			return Sat::intersect(obb, keptObb);
+		});
+		if (overlapping)
+			continue;
+
+		kept.push_back(candidate);
+		keptObbs.push_back(obb);
+	}
+
+	candidates = std::move(kept);
+}
+
+// Candidates of the exhaustive search computed in tiles of offsets, so only a single tile of the response exists per thread.
+// The source window of a tile overlaps its neighbours by the patch size. With a count of 1 the best offset of every tile is
+// kept, otherwise the best non overlapping local optima of every tile. The result is suppressed like the exhaustive search
+static std::vector<MatchCandidate> computeTiledCandidates(const cv::Rect& targetPatch, cv::TemplateMatchModes metric, int count) {
+	std::vector<float> distribution(2);
+	distribution[FeatureIndex_Intensity] = settings.intensityWeight;
+	distribution[FeatureIndex_Edge] = settings.edgeWeight;
+
+	std::vector<cv::Mat> targetFeaturePatches;
+	for (FeatureIndex featureIndex = 0; featureIndex < settings.target.features.size(); featureIndex++)
+		targetFeaturePatches.push_back(settings.target[featureIndex].data(targetPatch));
+
+	// Every thread holds the response, the mask and the float copies of the source windows of a single tile
+	double bytesPerOffset = sizeof(float) * (targetFeaturePatches.size() + 1) + 1;
+	double threadBytes = settings.responseMemory * 1024.0 * 1024.0 / omp_get_max_threads();
+	int windowSide = static_cast<int>(std::sqrt(threadBytes / bytesPerOffset));
+	int tileSide = std::max(windowSide - std::max(targetPatch.width, targetPatch.height) + 1, 64);
+
+	struct Tile {
+		int rotationIndex;
+		cv::Rect offsets;
+	};
+
+	std::vector<Tile> tiles;
+	for (int rotationIndex = 0; rotationIndex < settings.source.rotations; rotationIndex++) {
+		const FeatureVector& features = settings.source.features[rotationIndex];
+		if (features.empty())
+			continue;
+
+		int cols = features.front().cols() - targetPatch.width + 1;
+		int rows = features.front().rows() - targetPatch.height + 1;
+		for (int y = 0; y < rows; y += tileSide)
+			for (int x = 0; x < cols; x += tileSide)
+				tiles.push_back(Tile { rotationIndex, cv::Rect(x, y, std::min(tileSide, cols - x), std::min(tileSide, rows - y)) });
+	}
+
+	std::vector<std::vector<MatchCandidate>> tileCandidates(tiles.size());
+#pragma omp parallel for schedule(dynamic)
+	for (int tileIndex = 0; tileIndex < static_cast<int>(tiles.size()); tileIndex++) {
+		const Tile& tile = tiles[tileIndex];
+
+		// Offsets where the patch lies within unreserved material
+		cv::Mat mask = settings.source.placement(tile.rotationIndex).mask(targetPatch.size(), tile.offsets);
+		if (mask.empty() || cv::countNonZero(mask) == 0)
+			continue;
+
+		std::vector<cv::Mat> sources;
+		cv::Rect sourceWindow(tile.offsets.x, tile.offsets.y, tile.offsets.width + targetPatch.width - 1, tile.offsets.height + targetPatch.height - 1);
+		for (const Texture& feature : settings.source.features[tile.rotationIndex])
+			sources.push_back(feature.data(sourceWindow));
+
+		cv::Mat response = PyramidMatcher::response(sources, targetFeaturePatches, distribution, metric);
+		std::vector<MatchCandidate>& candidates = tileCandidates[tileIndex];
+
+		if (count == 1) {
+			double value;
+			cv::Point point;
+			if (metric == cv::TM_SQDIFF || metric == cv::TM_SQDIFF_NORMED)
+				cv::minMaxLoc(response, &value, nullptr, &point, nullptr, mask);
+			else
+				cv::minMaxLoc(response, nullptr, &value, nullptr, &point, mask);
+
+			if (point.x != -1)
+				candidates.emplace_back(tile.rotationIndex, Vec2(tile.offsets.x + point.x, tile.offsets.y + point.y), value);
+
+			continue;
 		}
 
-		responses[rotationIndex] = weightedResponse;
+		collectLocalOptima(response, mask, tile.rotationIndex, metric, candidates);
+		for (MatchCandidate& candidate : candidates)
+			candidate.position += Vec2(tile.offsets.x, tile.offsets.y);
+		suppressOverlappingCandidates(candidates, targetPatch.size(), metric, count);
+	}
+
+	std::vector<MatchCandidate> candidates;
+	for (const std::vector<MatchCandidate>& candidatesOfTile : tileCandidates)
+		candidates.insert(candidates.end(), candidatesOfTile.begin(), candidatesOfTile.end());
+	suppressOverlappingCandidates(candidates, targetPatch.size(), metric, count);
+
+	return candidates;
+}
+
+std::vector<MatchCandidate> Utils::computeBestCandidates(const cv::Rect& targetPatch, cv::TemplateMatchModes metric, int count, const std::vector<MatchCandidate>& seeds) {
+	if (count <= 0 || targetPatch.empty())
+		return {};
+
+	MatchCache::Key key = MatchCache::key(targetPatch, metric, count);
+	std::vector<MatchCandidate> candidates;
+	if (settings.cacheMatches && settings.matchCache.find(key, candidates))
+		return candidates;
+
+	// A placement taken by another patch is searched again, so a single local placement suffices
+	std::vector<MatchCandidate> allSeeds = seeds;
+	MatchCandidate local = computeLocalCandidate(targetPatch, metric, allSeeds);
+	if (local.valid())
+		return { local };
+
+	candidates = searchBestCandidates(targetPatch, metric, count);
+	if (settings.cacheMatches)
+		settings.matchCache.insert(key, candidates);
+
+	return candidates;
+}
+
+std::vector<MatchCandidate> Utils::searchBestCandidates(const cv::Rect& targetPatch, cv::TemplateMatchModes metric, int count) {
+	bool pyramid = settings.matchingMethod == Settings::MatchingMethod_Pyramid && !settings.source.rotateTemplates;
+	bool index = settings.matchingMethod == Settings::MatchingMethod_Index && !settings.source.rotateTemplates && DescriptorIndex::supports(targetPatch.size());
+	bool ssda = settings.matchingMethod == Settings::MatchingMethod_Ssda && !settings.source.rotateTemplates && SsdaMatcher::supports(metric);
+	if (pyramid || index || ssda) {
+		std::vector<float> distribution(2);
+		distribution[FeatureIndex_Intensity] = settings.intensityWeight;
+		distribution[FeatureIndex_Edge] = settings.edgeWeight;
+
+		std::vector<cv::Mat> targetFeaturePatches;
+		for (FeatureIndex featureIndex = 0; featureIndex < settings.target.features.size(); featureIndex++)
+			targetFeaturePatches.push_back(settings.target[featureIndex].data(targetPatch));
+
+		std::vector<MatchCandidate> candidates;
+		if (ssda)
+			candidates = SsdaMatcher::match(settings.source,
+			                                targetFeaturePatches,
+			                                distribution,
+			                                metric,
+			                                count,
+			                                settings.source.pyramid.match(settings.source, targetFeaturePatches, distribution, metric, settings.pyramidLevels, count));
+		else if (pyramid)
+			candidates = settings.source.pyramid.match(settings.source,
+			                                           targetFeaturePatches,
+			                                           distribution,
+			                                           metric,
+			                                           settings.pyramidLevels,
+			                                           std::max(settings.pyramidCandidates, count));
+		else
+			candidates = settings.source.index.match(settings.source,
+			                                         targetFeaturePatches,
+			                                         distribution,
+			                                         metric,
+			                                         settings.indexChecks,
+			                                         std::max(settings.indexCandidates, count));
+		suppressOverlappingCandidates(candidates, targetPatch.size(), metric, count);
+
+		return candidates;
 	}
 
+	// Large sources are searched in tiles, the responses of all rotations would not fit in memory
+	if (!fitsResponseMemory(targetPatch))
+		return computeTiledCandidates(targetPatch, metric, count);
+
+	std::vector<cv::Mat> responses = computeExhaustiveResponses(targetPatch, metric);
+
+	// Every rotation keeps its own best non overlapping candidates, which are merged afterwards
+	std::vector<std::vector<MatchCandidate>> rotationCandidates(settings.source.rotations);
+#pragma omp parallel for schedule(dynamic)
+	for (int rotationIndex = 0; rotationIndex < settings.source.rotations; rotationIndex++) {
+		const cv::Mat& response = responses[rotationIndex];
+		if (response.empty())
+			continue;
+
+		// Offsets where the patch lies within unreserved material
+		cv::Mat mask = settings.source.placement(rotationIndex).mask(targetPatch.size());
+		if (mask.empty())
+			continue;
+
+		collectLocalOptima(response, mask(cv::Rect(0, 0, response.cols, response.rows)), rotationIndex, metric, rotationCandidates[rotationIndex]);
+		suppressOverlappingCandidates(rotationCandidates[rotationIndex], targetPatch.size(), metric, count);
+	}
+
+	std::vector<MatchCandidate> candidates;
+	for (const std::vector<MatchCandidate>& candidatesOfRotation : rotationCandidates)
+		candidates.insert(candidates.end(), candidatesOfRotation.begin(), candidatesOfRotation.end());
+	suppressOverlappingCandidates(candidates, targetPatch.size(), metric, count);
+
+	return candidates;
+}
+
+MatchCandidate Utils::computeIndexMatch(const cv::Rect& targetPatch, cv::TemplateMatchModes metric) {
+	if (!DescriptorIndex::supports(targetPatch.size()))
+		return computeExhaustiveMatch(targetPatch, metric);
+
+	std::vector<float> distribution(2);
+	distribution[FeatureIndex_Intensity] = settings.intensityWeight;
+	distribution[FeatureIndex_Edge] = settings.edgeWeight;
+
+	std::vector<cv::Mat> targetFeaturePatches;
+	for (FeatureIndex featureIndex = 0; featureIndex < settings.target.features.size(); featureIndex++)
+		targetFeaturePatches.push_back(settings.target[featureIndex].data(targetPatch));
+
+	std::vector<MatchCandidate> candidates = settings.source.index.match(settings.source,
+	                                                                     targetFeaturePatches,
+	                                                                     distribution,
+	                                                                     metric,
+	                                                                     settings.indexChecks,
+	                                                                     settings.indexCandidates);
+
+	if (candidates.empty())
+		return MatchCandidate();
+
+	return candidates.front();
+}
+
+MatchCandidate Utils::computeSsdaMatch(const cv::Rect& targetPatch, cv::TemplateMatchModes metric, const std::vector<MatchCandidate>& seeds) {
+	std::vector<float> distribution(2);
+	distribution[FeatureIndex_Intensity] = settings.intensityWeight;
+	distribution[FeatureIndex_Edge] = settings.edgeWeight;
+
+	std::vector<cv::Mat> targetFeaturePatches;
+	for (FeatureIndex featureIndex = 0; featureIndex < settings.target.features.size(); featureIndex++)
+		targetFeaturePatches.push_back(settings.target[featureIndex].data(targetPatch));
+
+	// The coarse winner of the pyramid joins the given seeds
+	std::vector<MatchCandidate> allSeeds = seeds;
+	std::vector<MatchCandidate> coarseSeeds = settings.source.pyramid.match(settings.source, targetFeaturePatches, distribution, metric, settings.pyramidLevels, 1);
+	allSeeds.insert(allSeeds.end(), coarseSeeds.begin(), coarseSeeds.end());
+
+	std::vector<MatchCandidate> candidates = SsdaMatcher::match(settings.source, targetFeaturePatches, distribution, metric, 1, allSeeds);
+	if (candidates.empty())
+		return MatchCandidate();
+
+	return candidates.front();
+}
+
+MatchCandidate Utils::computeExhaustiveMatch(const cv::Rect& targetPatch, cv::TemplateMatchModes metric) {
+	// Large sources are searched in tiles, the responses of all rotations would not fit in memory
+	if (!fitsResponseMemory(targetPatch)) {
+		std::vector<MatchCandidate> candidates = computeTiledCandidates(targetPatch, metric, 1);
+
+		return candidates.empty() ? MatchCandidate() : candidates.front();
+	}
+
+	std::vector<cv::Mat> responses = computeExhaustiveResponses(targetPatch, metric);
+
 	/*cv::imshow("patch", settings.target->data(targetPatch));
 	for (auto& r : responses) {
 		cv::imshow("Response", r);
@@ -190,20 +569,17 @@ std::pair<int, Vec2> Utils::computeBestMatch(const cv::Rect& targetPatch, cv::Te
 
 	bool masking = true;
 	double bestValue;
-	cv::Point bestPoint;
+	cv::Point bestPoint(-1, -1);
 	int bestRotationIndex = 0;
 	for (int rotationIndex = 0; rotationIndex < settings.source.rotations; rotationIndex++) {
+		// Patch does not fit in this rotation
+		if (responses[rotationIndex].empty())
+			continue;
+
+		// Offsets where the patch lies within unreserved material
 		cv::Mat mask;
-		if (masking) {
-			cv::boxFilter(settings.source.masks[rotationIndex].data,
-				mask,
-				-1,
-				cv::Size(targetPatch.width, targetPatch.height),
-				cv::Point(0, 0),
-				true,
-				cv::BORDER_ISOLATED);
-			cv::threshold(mask, mask, 254, 255, cv::THRESH_BINARY);
-		}
+		if (masking)
+			mask = settings.source.placement(rotationIndex).mask(targetPatch.size());
 		double value;
 		cv::Point point;
 		if (metric == cv::TM_SQDIFF || metric == cv::TM_SQDIFF_NORMED) {
@@ -230,7 +606,7 @@ std::pair<int, Vec2> Utils::computeBestMatch(const cv::Rect& targetPatch, cv::Te
 			cv::imshow("s", s);
 			cv::waitKey();*/
 
-			if (rotationIndex == 0 || value < bestValue) {
+			if (point.x != -1 && (bestPoint.x == -1 || value < bestValue)) {
 				bestValue = value;
 				bestPoint = point;
 				bestRotationIndex = rotationIndex;
@@ -244,7 +620,7 @@ std::pair<int, Vec2> Utils::computeBestMatch(const cv::Rect& targetPatch, cv::Te
 			              masking ? mask(cv::Rect(0, 0, responses[rotationIndex].cols, responses[rotationIndex].rows)) : cv::noArray()
 			);
 
-			if (rotationIndex == 0 || value > bestValue) {
+			if (point.x != -1 && (bestPoint.x == -1 || value > bestValue)) {
 				bestValue = value;
 				bestPoint = point;
 				bestRotationIndex = rotationIndex;
@@ -252,11 +628,8 @@ std::pair<int, Vec2> Utils::computeBestMatch(const cv::Rect& targetPatch, cv::Te
 		}
 	}
 
-	if (bestPoint.x == -1 && bestPoint.y == -1) {
-		Log::error("No patches available");
-
-		return std::make_pair(0, Vec2(0, 0));
-	}
+	if (bestPoint.x == -1 && bestPoint.y == -1)
+		return MatchCandidate();
 
 	/*cv::Point transformedPoint = Utils::warp(bestPoint, settings.source.inverseTransformations[bestRotationIndex]);
 
@@ -271,7 +644,7 @@ std::pair<int, Vec2> Utils::computeBestMatch(const cv::Rect& targetPatch, cv::Te
 	}*/
 
 	// Move seedpoint
-	return std::make_pair(bestRotationIndex, Vec2(bestPoint.x, bestPoint.y));
+	return MatchCandidate(bestRotationIndex, Vec2(bestPoint.x, bestPoint.y), bestValue);
 }
 
 cv::Mat Utils::computeTransformationMatrix(const cv::Size& originalSize, double degrees) {
@@ -5,10 +5,57 @@
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
 
+#include "matching/matchCandidate.h"
+
+struct Obb;
+
 namespace Utils {
 
 std::pair<int, Vec2> computeBestMatch(const cv::Rect& patch, cv::TemplateMatchModes metric);
+// Best placement using the matching method of the settings, seeds are likely placements that speed up the early terminated search.
+// Placements found before are reused from the match cache of the settings. With the local search enabled, a placement around
+// the first seed that is good enough is returned without the global search
+MatchCandidate computeBestCandidate(const cv::Rect& patch, cv::TemplateMatchModes metric, const std::vector<MatchCandidate>& seeds = {});
+// At most count placements over all rotations, best first. Every candidate is the best offset in its neighbourhood
+// and no two candidates overlap in the source, so a caller can fall back to the next one when a placement is taken.
+// Placements found before are reused from the match cache of the settings. With the local search enabled, a placement
+// around the first seed that is good enough is the only candidate
+std::vector<MatchCandidate> computeBestCandidates(const cv::Rect& patch, cv::TemplateMatchModes metric, int count, const std::vector<MatchCandidate>& seeds = {});
+// Like computeBestCandidate and computeBestCandidates, without the match cache
+MatchCandidate searchBestCandidate(const cv::Rect& patch, cv::TemplateMatchModes metric, const std::vector<MatchCandidate>& seeds = {});
+std::vector<MatchCandidate> searchBestCandidates(const cv::Rect& patch, cv::TemplateMatchModes metric, int count);
+// Oriented box of a placement in the unrotated source, spanned by the centers of its outer pixels
+Obb computeCandidateObb(const MatchCandidate& candidate, const cv::Size& patchSize);
+// Best placement over every offset of every rotation
+MatchCandidate computeExhaustiveMatch(const cv::Rect& patch, cv::TemplateMatchModes metric);
+// Best placement of the coarse to fine search
+MatchCandidate computePyramidMatch(const cv::Rect& patch, cv::TemplateMatchModes metric);
+// Best placement of the nearest neighbour search, patches too small for the index are matched exhaustively
+MatchCandidate computeIndexMatch(const cv::Rect& patch, cv::TemplateMatchModes metric);
+// Best placement of the squared difference search that abandons placements once they are worse than the best one so far,
+// starting from the given seeds and the coarse winner of the pyramid
+MatchCandidate computeSsdaMatch(const cv::Rect& patch, cv::TemplateMatchModes metric, const std::vector<MatchCandidate>& seeds = {});
+// Largest magnitude of the values of quantized 16 bit planes, their products are accumulated in 32 bit integers
+constexpr int quantizedMaximum = 2047;
+// Largest magnitude of the components of quantized gradients after steering, rotating a gradient whose components are both
+// quantizedMaximum puts up to √2 times that magnitude in one of them
+constexpr int steeredMaximum = 2895;
+// Quantizes a plane to 16 bit integers within quantizedMaximum, returns the scale that was applied to the values
+double quantize(const cv::Mat& plane, cv::Mat& quantized);
+// Masked template matching of 8 bit, quantized 16 bit or float planes with any cv::TemplateMatchModes method. Integer planes
+// are correlated exactly with integer arithmetic. The channels of multi channel planes are combined like cv::matchTemplate
+// does. Template pixels where templMask is zero are ignored and offsets covering a zero pixel of globalMask are aborted
+// with the worst score
 void matchTemplate(const cv::Mat& image, const cv::Mat& templ, cv::Mat& result, int method, const cv::Mat& templMask, const cv::Mat& globalMask);
+// Weighted sum of the masked responses of every image and template pair, computed in a single pass over the offsets
+// without a response per feature. The result is only reallocated if its size changes.
+void matchTemplate(const std::vector<cv::Mat>& images,
+                   const std::vector<cv::Mat>& templs,
+                   const std::vector<float>& weights,
+                   cv::Mat& result,
+                   int method,
+                   const cv::Mat& templMask,
+                   const cv::Mat& globalMask);
 
 cv::Mat computeTransformationMatrix(const cv::Size& originalSize, double degrees);
 cv::Mat computeTransformationMatrix(const cv::Size& originalSize, const cv::Size& rotatedSize, double degrees);
@@ -2,6 +2,7 @@
 
 #include <set>
 #include "util/list.h"
+#include "util/looseQuadtree.h"
 #include "util/sat.h"
 #include "graphics/mondriaanPatch.h"
 
@@ -52,72 +53,14 @@ public:
 };
 
 
-template <std::size_t Rows, std::size_t Cols = Rows>
+// Tree of all patches and their parent patches, the leafs are indexed in source and target space
 struct RegularTree {
-	typedef Vector<std::size_t, 2> GridCell;
-
-	struct GridRange {
-		std::size_t start;
-		std::size_t end;
-
-		GridRange() = default;
-
-		GridRange(std::size_t start, std::size_t end)
-			: start(start)
-			, end(end) {}
-
-		bool contains(std::size_t position) const {
-			return start <= position && position <= end;
-		}
-
-		bool contains(const GridRange& other) const {
-			return contains(other.start) && contains(other.end);
-		}
-
-		bool overlaps(const GridRange& other) const {
-			return contains(other.start) || contains(other.end);
-		}
-
-		GridRange operator+(const GridRange& other) const {
-			return GridRange(Utils::min(start, other.start), Utils::max(end, other.end));
-		}
-	};
-
-	struct GridRegion {
-		GridRange cols;
-		GridRange rows;
-
-		GridRegion() = default;
-
-		GridRegion(const GridRange& cols, const GridRange& rows)
-			: cols(cols)
-			, rows(rows) {}
-
-		bool contains(const GridCell& gridCell) const {
-			return cols.contains(gridCell.x) && rows.contains(gridCell.y);
-		}
-
-		bool overlaps(const GridRegion& other) const {
-			return cols.overlaps(other.cols) && rows.overlaps(other.rows);
-		}
-
-		bool outside() const {
-			return !GridRange(0, Cols - 1).contains(cols) || !GridRange(0, Rows - 1).contains(rows);
-		}
-
-		GridRegion operator+(const GridRegion& other) const {
-			return GridRegion(cols + other.cols, rows + other.rows);
-		}
-	};
-
-	std::size_t cols = Cols;
-	std::size_t rows = Rows;
-
 	Vec2i sourceDimension;
 	Vec2i targetDimension;
 
-	std::array<std::set<std::size_t>, Rows * Cols> targetCells;
-	std::array<std::set<std::size_t>, Rows * Cols> sourceCells;
+	// Leafs by their rotated source bounds and target bounds
+	LooseQuadtree sourceIndex;
+	LooseQuadtree targetIndex;
 
 	// All patches and their parent patches
 	std::vector<TreeNode<MondriaanPatch>> patches;
@@ -127,59 +70,15 @@ public:
 	~RegularTree() = default;
 
 	RegularTree(const Vec2i& sourceDimension, const Vec2i& targetDimension) {
-		this->sourceDimension = sourceDimension;
-		this->targetDimension = targetDimension;
-
-		clear();
-	}
-
-	RegularTree(const RegularTree& other) {
-		this->patches = other.patches;
-
-		this->sourceDimension = other.sourceDimension;
-		this->targetDimension = other.targetDimension;
-
-		this->sourceCells = other.sourceCells;
-		this->targetCells = other.targetCells;
-	}
-
-	RegularTree(RegularTree&& other) noexcept {
-		this->patches = std::move(other.patches);
-
-		this->sourceDimension = std::move(other.sourceDimension);
-		this->targetDimension = std::move(other.targetDimension);
-
-		this->sourceCells = std::move(other.sourceCells);
-		this->targetCells = std::move(other.targetCells);
-
-		return *this;
-	}
-
-	RegularTree& operator=(const RegularTree& other) {
-		this->patches = other.patches;
-
-		this->sourceDimension = other.sourceDimension;
-		this->targetDimension = other.targetDimension;
-
-		this->sourceCells = other.sourceCells;
-		this->targetCells = other.targetCells;
-
-		return *this;
+		reload(sourceDimension, targetDimension);
 	}
 
-	RegularTree& operator=(RegularTree&& other) {
-		this->patches = std::move(other.patches);
-
-		this->sourceDimension = std::move(other.sourceDimension);
-		this->targetDimension = std::move(other.targetDimension);
-
-		this->sourceCells = std::move(other.sourceCells);
-		this->targetCells = std::move(other.targetCells);
+	RegularTree(const RegularTree& other) = default;
+	RegularTree(RegularTree&& other) noexcept = default;
+	RegularTree& operator=(const RegularTree& other) = default;
+	RegularTree& operator=(RegularTree&& other) noexcept = default;
 
-		return *this;
-	}
-
-	// Returns the amount of patches in the regular grids
+	// Returns the amount of patches in the tree
 	std::size_t size() const {
 		return patches.size();
 	}
@@ -198,7 +97,7 @@ public:
 		std::vector<TreeNode<MondriaanPatch>> result;
 		std::copy_if(patches.begin(),
 		             patches.end(),
-		             result.begin(),
+		             std::back_inserter(result),
 		             [](const TreeNode<MondriaanPatch>& node) {
 			             return node.leaf();
 		             });
@@ -206,92 +105,22 @@ public:
 		return result;
 	}
 
+	// Resizes the indices to the given dimensions and reinserts all leafs
 	void reload(const Vec2i& sourceDimension, const Vec2i& targetDimension) {
 		this->sourceDimension = sourceDimension;
 		this->targetDimension = targetDimension;
 
-		clear(Type_Target);
-		clear(Type_Source);
+		sourceIndex.reset(Bounds(0, 0, sourceDimension.x, sourceDimension.y));
+		targetIndex.reset(Bounds(0, 0, targetDimension.x, targetDimension.y));
 		for (std::size_t patchIndex = 0; patchIndex < patches.size(); patchIndex++)
 			insert(patchIndex);
 	}
 
-	// Returns the set of patches in the regular grid cell of Type type at index
-	std::set<std::size_t>& operator()(std::size_t index, Type type, bool onlyLeafs) {
-		std::set<std::size_t> result = (type == Type_Source ? sourceCells : targetCells)[index];
-		if (onlyLeafs) {
-			std::erase_if(result,
-			              [this](std::size_t index) {
-				              return !patches[index].leaf();
-			              });
-		}
-
-		return result;
-	}
-
-	// Returns the set of patches in the regular grid cell of Type type at (col, row)
-	std::set<std::size_t>& operator()(std::size_t row, std::size_t col, Type type, bool onlyLeafs) {
-		std::set<std::size_t> result = (type == Type_Source ? sourceCells : targetCells)[index(row, col)];
-
-		if (onlyLeafs) {
-			std::erase_if(result,
-			              [this](std::size_t index) {
-				              return !patches[index].leaf();
-			              });
-		}
-
-		return result;
-	}
-
-	// Returns all neighbours in the grid tiles covered by the given patch's index
-	std::set<std::size_t> neighbours(std::size_t patchIndex, Type type, bool onlyLeafs) {
-		std::set<std::size_t> result;
-
-		Bounds bounds = type == Type_Source ? patches[patchIndex].patch.sourceRotatedBounds() : patches[patchIndex].patch.targetBounds();
-		GridRegion region = this->region(bounds, type);
-		if (region.outside())
-			return std::set<std::size_t>();
-
-		for (std::size_t col = region.cols.start; col <= region.cols.end; ++col) {
-			for (std::size_t row = region.rows.start; row <= region.rows.end; ++row) {
-				std::size_t index = this->index(row, col);
-				if (type & Type_Source) {
-					result.insert(sourceCells[index].begin(), sourceCells[index].end());
-				}
-				if (type & Type_Target)
-					result.insert(targetCells[index].begin(), targetCells[index].end());
-			}
-		}
-
-		if (onlyLeafs) {
-			std::erase_if(result,
-			              [this](std::size_t index) {
-				              return !patches[index].leaf();
-			              });
-		}
-
-		// Remove patchIndex
-		auto iterator = result.find(patchIndex);
-		if (iterator != result.end())
-			result.erase(iterator);
-
-		return result;
-	}
-
-	// Clears the regular grid of Type type
-	void clear(Type type = Type_Source | Type_Target) {
-		for (std::size_t row = 0; row < rows; row++) {
-			for (std::size_t col = 0; col < cols; col++) {
-				std::size_t index = this->index(row, col);
-				if (type & Type_Target)
-					targetCells[index] = std::set<std::size_t>();
-				if (type & Type_Source)
-					sourceCells[index] = std::set<std::size_t>();
-			}
-		}
-
-		if (type & (Type_Source | Type_Target))
-			patches.clear();
+	// Removes all patches
+	void clear() {
+		sourceIndex.reset(Bounds(0, 0, sourceDimension.x, sourceDimension.y));
+		targetIndex.reset(Bounds(0, 0, targetDimension.x, targetDimension.y));
+		patches.clear();
 	}
 
 	// Sets the root node
@@ -301,9 +130,11 @@ public:
 
 		TreeNode<MondriaanPatch>& root = this->patches.emplace_back(patch);
 		root.index = 0;
+
+		insert(0);
 	}
 
-	// Emplaces a new patch in the patch list and inserts it into the regular grids
+	// Splits a leaf into two new leafs, the parent leaves the indices and the children enter them
 	std::pair<std::size_t, std::size_t> add(std::size_t parentIndex, const MondriaanPatch& left, const MondriaanPatch& right) {
 		if (!this->patches[parentIndex].leaf())
 			return std::make_pair(TreeNode<MondriaanPatch>::null_node, TreeNode<MondriaanPatch>::null_node);
@@ -334,217 +165,130 @@ public:
 		this->patches[parentIndex].next = leftIndex;
 		this->patches[leftIndex].next = rightIndex;
 
-		return std::make_pair(leftIndex, rightIndex);
-	}
+		erase(parentIndex);
+		insert(leftIndex);
+		insert(rightIndex);
 
-
-	// Removes a patch index from the regular grid region of Type type
-	void erase(std::size_t patchIndex, const GridRegion& region, Type type) {
-		for (std::size_t col = region.cols.start; col <= region.cols.end; ++col) {
-			for (std::size_t row = region.rows.start; row <= region.rows.end; ++row) {
-				std::size_t index = this->index(row, col);
-				if (type & Type_Source)
-					sourceCells[index].erase(patchIndex);
-				if (type & Type_Target)
-					targetCells[index].erase(patchIndex);
-			}
-		}
+		return std::make_pair(leftIndex, rightIndex);
 	}
 
-	// Inserts a patch index into the regular grid region of Type type
-	void insert(std::size_t patchIndex, const GridRegion& region, Type type) {
-		if (region.outside()) {
-			Log::debug("Region outside borders: (%d -> %d, %d -> %d)", region.cols.start, region.cols.end, region.rows.start, region.rows.end);
+	// Inserts a leaf into the indices of both types
+	void insert(std::size_t patchIndex) {
+		if (!patches[patchIndex].leaf())
 			return;
-		}
 
-		for (std::size_t col = region.cols.start; col <= region.cols.end; ++col) {
-			for (std::size_t row = region.rows.start; row <= region.rows.end; ++row) {
-				std::size_t index = this->index(row, col);
-				if (type & Type_Source)
-					sourceCells[index].insert(patchIndex);
-				if (type & Type_Target)
-					targetCells[index].insert(patchIndex);
-			}
-		}
+		sourceIndex.insert(patchIndex, patches[patchIndex].patch.sourceRotatedBounds());
+		targetIndex.insert(patchIndex, patches[patchIndex].patch.targetBounds());
 	}
 
-	// Inserts a patch index into the regular grid of both types
-	void insert(std::size_t patchIndex) {
-		GridRegion targetRegion = region(patches[patchIndex].patch.targetBounds(), Type_Target);
-		GridRegion sourceRegion = region(patches[patchIndex].patch.sourceRotatedBounds(), Type_Source);
-
-		insert(patchIndex, sourceRegion, Type_Source);
-		insert(patchIndex, targetRegion, Type_Target);
+	// Removes a patch from the indices of both types
+	void erase(std::size_t patchIndex) {
+		sourceIndex.erase(patchIndex);
+		targetIndex.erase(patchIndex);
 	}
 
-	// Updates the regular grid of Type type after a patch's regions change
-	void swap(std::size_t patchIndex, const GridRegion& oldRegion, const GridRegion& newRegion, Type type) {
-		GridRegion totalRegion = oldRegion + newRegion;
-
-		for (std::size_t col = totalRegion.cols.start; col <= totalRegion.cols.end; ++col) {
-			for (std::size_t row = totalRegion.rows.start; row <= totalRegion.rows.end; ++row) {
-				GridCell currentCell(col, row);
-				std::set<std::size_t>& patches = (type == Type_Source ? sourceCells : targetCells)[index(row, col)];
-
-				bool inOldRegion = oldRegion.contains(currentCell);
-				bool inNewRegion = newRegion.contains(currentCell);
+	// Updates the indices of Type type after a patch's bounds change
+	void update(std::size_t patchIndex, Type type) {
+		if (!patches[patchIndex].leaf())
+			return;
 
-				if (inOldRegion && !inNewRegion)
-					patches.erase(patchIndex);
+		if (type & Type_Source)
+			sourceIndex.update(patchIndex, patches[patchIndex].patch.sourceRotatedBounds());
+		if (type & Type_Target)
+			targetIndex.update(patchIndex, patches[patchIndex].patch.targetBounds());
+	}
 
-				if (inNewRegion && !inOldRegion)
-					patches.insert(patchIndex);
-			}
-		}
+	// Calls visitor(patchIndex) for every leaf whose bounds of Type type overlap the given bounds, stops when the visitor returns true
+	template <typename Visitor>
+	bool query(const Bounds& bounds, Type type, Visitor&& visitor) const {
+		return (type == Type_Source ? sourceIndex : targetIndex).query(bounds, visitor);
 	}
 
-	// Updates the regular grid of Type type after a patch's regions change
-	void update(std::size_t patchIndex, const Boundsi& oldBounds, const Boundsi& newBounds, Type type) {
-		GridRegion oldRegion = region(oldBounds, type);
-		GridRegion newRegion = region(newBounds, type);
+	// Returns the first leaf whose bounds of Type type contain the point, or null_node
+	std::size_t find(const Vec2& point, Type type) const {
+		std::size_t result = TreeNode<MondriaanPatch>::null_node;
+		query(Bounds(point.x, point.y, 0, 0), type, [&](std::size_t patchIndex) {
+			const MondriaanPatch& patch = patches[patchIndex].patch;
+			Bounds bounds = type == Type_Source ? patch.sourceRotatedBounds() : patch.targetBounds();
+			if (patchIndex < result && bounds.econtains(point))
+				result = patchIndex;
 
-		if (oldRegion.overlaps(newRegion)) {
-			swap(patchIndex, oldRegion, newRegion, type);
-		} else {
-			erase(patchIndex, oldRegion, type);
-			insert(patchIndex, newRegion, type);
-		}
-	}
+			return false;
+		});
 
-	// Returns the grid cell of Type type that covers point
-	GridCell cell(const Vec2i& point, Type type) const {
-		return GridCell(
-			cvFloor(static_cast<double>(point.x * cols) / static_cast<double>(type == Type_Source ? sourceDimension.x : targetDimension.x)),
-			cvFloor(static_cast<double>(point.y * rows) / static_cast<double>(type == Type_Source ? sourceDimension.y : targetDimension.y)));
+		return result;
 	}
 
-	// Returns the grid region of Type type that is covered by bounds
-	GridRegion region(const Boundsi& bounds, Type type) const {
-		GridCell min = cell(bounds.min(), type);
-		GridCell max = cell(bounds.imax(), type);
+	// Returns all leafs whose bounds of Type type overlap the bounds of the given patch's index
+	std::set<std::size_t> neighbours(std::size_t patchIndex, Type type) const {
+		std::set<std::size_t> result;
 
-		return GridRegion(GridRange(Utils::max<int>(0, min.x), Utils::min<int>(max.x, cols - 1)),
-		                  GridRange(Utils::max<int>(0, min.y), Utils::min<int>(max.y, rows - 1)));
-	}
+		Bounds bounds = type == Type_Source ? patches[patchIndex].patch.sourceRotatedBounds() : patches[patchIndex].patch.targetBounds();
+		query(bounds, type, [&](std::size_t index) {
+			if (index != patchIndex)
+				result.insert(index);
 
-	// Converts a row and column index to a list index
-	constexpr std::size_t index(std::size_t row, std::size_t col) const {
-		return row * cols + col;
+			return false;
+		});
+
+		return result;
 	}
 
-	//// Return whether bounds overlap any patch in the regular grid of Type type
-	//bool overlaps(std::size_t patchIndex, const std::size_t ignore, Type type, bool onlyLeafs) const {
-	//	if (type & Type_Target) {
-	//		if (overlaps(patches[patchIndex].value.targetBounds(), type, onlyLeafs, &this->patches[ignore]))
-	//			return true;
-	//	}
-	//	if (type & Type_Source) { }
-	//	return false;
-	//}
-
-	// Return whether the patch overlaps any other patch in the regular grid of Type type
-	bool overlaps(const MondriaanPatch& patch, Type type, bool onlyLeafs, const MondriaanPatch* ignore = nullptr) const {
+	// Return whether the patch overlaps any leaf in the indices of Type type
+	bool overlaps(const MondriaanPatch& patch, Type type, const MondriaanPatch* ignore = nullptr) const {
 		// Check for source overlap
 		if (type & Type_Source) {
-			std::vector<Vec2> patchSourcePoints = patch.sourceRotatedPoints();
-			GridRegion cellRegion = region(patch.sourceRotatedBounds(), type);
-
-			// Collect all unique patches
-			std::set<std::size_t> uniquePatches;
-			for (std::size_t row = cellRegion.rows.start; row <= cellRegion.rows.end; ++row) {
-				for (std::size_t col = cellRegion.cols.start; col <= cellRegion.cols.end; ++col) {
-					const std::set<std::size_t>& patches = sourceCells[index(row, col)];
-
-					uniquePatches.insert(patches.begin(), patches.end());
-				}
-			}
-
-			if (onlyLeafs) {
-				std::erase_if(uniquePatches,
-				              [this](std::size_t index) {
-					              return !this->patches[index].leaf();
-				              });
-			}
-
-			for (std::size_t patchIndex : uniquePatches) {
+			Obb patchObb = patch.sourceRotatedObb();
+
+			// Candidates are tested a batch at a time
+			ObbBatch batch;
+			bool overlap = query(patch.sourceRotatedBounds(), Type_Source, [&](std::size_t patchIndex) {
 				const MondriaanPatch& currentPatch = this->patches[patchIndex].patch;
 				if (&currentPatch == &patch || &currentPatch == ignore)
-					continue;
+					return false;
+
+				batch.push(currentPatch.sourceRotatedObb());
+				if (!batch.full())
+					return false;
 
-				std::vector<Vec2> currenPatchSourcePoints = currentPatch.sourceRotatedPoints();
-				if (Sat::separating_axis_intersect(patchSourcePoints, currenPatchSourcePoints))
-					return true;
-			}
+				bool intersects = Sat::intersect(patchObb, batch) != 0;
+				batch.clear();
+
+				return intersects;
+			});
+
+			if (overlap || Sat::intersect(patchObb, batch) != 0)
+				return true;
 		}
 
 		// Check for target overlap
 		if (type & Type_Target) {
 			Bounds patchTargetBounds = patch.targetBounds();
-			GridRegion cellRegion = region(patch.sourceRotatedBounds(), type);
-
-			// Collect all unique patches
-			std::set<std::size_t> uniquePatches;
-			for (std::size_t row = cellRegion.rows.start; row <= cellRegion.rows.end; ++row) {
-				for (std::size_t col = cellRegion.cols.start; col <= cellRegion.cols.end; ++col) {
-					const std::set<std::size_t>& patches = targetCells[index(row, col)];
-
-					uniquePatches.insert(patches.begin(), patches.end());
-				}
-			}
-
-			if (onlyLeafs) {
-				std::erase_if(uniquePatches,
-				              [this](std::size_t index) {
-					              return !this->patches[index].leaf();
-				              });
-			}
-
-			for (std::size_t patchIndex : uniquePatches) {
+
+			bool overlap = query(patchTargetBounds, Type_Target, [&](std::size_t patchIndex) {
 				const MondriaanPatch& currentPatch = this->patches[patchIndex].patch;
 				if (&currentPatch == &patch || &currentPatch == ignore)
-					continue;
+					return false;
 
-				Bounds currentPatchTargetBounds = currentPatch.targetBounds();
-				if (patchTargetBounds.ioverlaps(currentPatchTargetBounds))
-					return true;
-			}
+				return patchTargetBounds.ioverlaps(currentPatch.targetBounds());
+			});
+
+			if (overlap)
+				return true;
 		}
 
 		return false;
 	}
 
-	// Renders the regular grid
-	void render(Canvas& canvas, Type type, bool onlyLeafs) {
-		for (std::size_t col = 0; col < cols; ++col) {
-			ImGui::GetWindowDrawList()->AddLine(canvas.offset + Utils::transform(Vec2(col, 0), Vec2(cols, rows), canvas.screenDimension()).iv(),
-			                                    canvas.offset + Utils::transform(Vec2(col, rows), Vec2(cols, rows), canvas.screenDimension()).iv(),
-			                                    Colors::WHITE.u32());
-		}
-
-		for (std::size_t row = 0; row < rows; ++row) {
-			ImGui::GetWindowDrawList()->AddLine(canvas.offset + Utils::transform(Vec2(0, row), Vec2(cols, rows), canvas.screenDimension()).iv(),
-			                                    canvas.offset + Utils::transform(Vec2(cols, row), Vec2(cols, rows), canvas.screenDimension()).iv(),
-			                                    Colors::WHITE.u32());
-		}
-
-		for (std::size_t col = 0; col < cols; ++col) {
-			for (std::size_t row = 0; row < rows; ++row) {
-				std::set result = (type == Type_Source ? sourceCells : targetCells)[index(row, col)];
-				if (onlyLeafs) {
-					std::erase_if(result,
-					              [this](std::size_t index) {
-						              return !this->patches[index].leaf();
-					              });
-				}
-				Color color = Colors::RGB_R.withOpacity(0.5 * Utils::min(1.0, static_cast<double>(result.size()) / 4.0));
-
-				ImGui::GetWindowDrawList()->AddRectFilled(
-					canvas.offset + Utils::transform(Vec2(col, row), Vec2(cols, rows), canvas.screenDimension()).iv(),
-					canvas.offset + Utils::transform(Vec2(col + 1, row + 1), Vec2(cols, rows), canvas.screenDimension()).iv(),
-					color.u32());
-			}
-		}
+	// Renders the occupied cells of the index of Type type
+	void render(Canvas& canvas, Type type) const {
+		(type == Type_Source ? sourceIndex : targetIndex).cells([&](const Bounds& bounds, std::size_t count) {
+			Color color = Colors::RGB_R.withOpacity(0.5 * Utils::min(1.0, static_cast<double>(count) / 4.0));
 
+			ImGui::GetWindowDrawList()->AddRectFilled(canvas.toAbsoluteScreenSpace(bounds.min()).iv(),
+			                                          canvas.toAbsoluteScreenSpace(bounds.emax()).iv(),
+			                                          color.u32());
+			bounds.render(canvas);
+		});
 	}
 };
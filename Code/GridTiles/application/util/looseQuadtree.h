@@ -0,0 +1,209 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <vector>
+
+#include "graphics/bounds.h"
+
+// Loose quadtree over axis aligned bounds, stored as a flat grid per level where level l has 2^l x 2^l cells.
+// An item lives in the cell of its center at the deepest level where it is at most one cell large,
+// so it always lies within its cell expanded by half a cell on every side.
+// Updates only touch the old and the new cell and queries do not allocate.
+class LooseQuadtree {
+public:
+	static constexpr int maxLevel = 7;
+
+private:
+	struct Box {
+		double minX;
+		double minY;
+		double maxX;
+		double maxY;
+
+		bool overlaps(const Box& other) const {
+			return minX <= other.maxX && maxX >= other.minX && minY <= other.maxY && maxY >= other.minY;
+		}
+	};
+
+	struct Location {
+		int level = -1;
+		int cell = 0;
+		std::size_t slot = 0;
+	};
+
+	struct Level {
+		int size = 0;
+		double cellWidth = 0.0;
+		double cellHeight = 0.0;
+		std::size_t count = 0;
+		std::vector<std::vector<std::size_t>> cells;
+	};
+
+	Bounds world;
+	std::array<Level, maxLevel + 1> levels;
+
+	// Location and bounds of every item, indexed by item
+	std::vector<Location> locations;
+	std::vector<Box> boxes;
+
+public:
+	LooseQuadtree() = default;
+
+	explicit LooseQuadtree(const Bounds& world) {
+		reset(world);
+	}
+
+	// Removes all items and covers the given world bounds, items outside the world are kept in the border cells
+	void reset(const Bounds& world) {
+		this->world = world;
+
+		for (int level = 0; level <= maxLevel; level++) {
+			Level& current = levels[level];
+			current.size = 1 << level;
+			current.cellWidth = Utils::max(world.width(), 1.0) / current.size;
+			current.cellHeight = Utils::max(world.height(), 1.0) / current.size;
+			current.count = 0;
+			current.cells.resize(current.size * current.size);
+			for (std::vector<std::size_t>& cell : current.cells)
+				cell.clear();
+		}
+
+		locations.clear();
+		boxes.clear();
+	}
+
+	bool contains(std::size_t item) const {
+		return item < locations.size() && locations[item].level != -1;
+	}
+
+	void insert(std::size_t item, const Bounds& bounds) {
+		if (item >= locations.size()) {
+			locations.resize(item + 1);
+			boxes.resize(item + 1);
+		}
+
+		if (contains(item))
+			erase(item);
+
+		Box box = toBox(bounds);
+		Location location = locate(box);
+
+		std::vector<std::size_t>& cell = levels[location.level].cells[location.cell];
+		location.slot = cell.size();
+		cell.push_back(item);
+		levels[location.level].count++;
+
+		locations[item] = location;
+		boxes[item] = box;
+	}
+
+	void erase(std::size_t item) {
+		if (!contains(item))
+			return;
+
+		Location& location = locations[item];
+		std::vector<std::size_t>& cell = levels[location.level].cells[location.cell];
+
+		// Move the last item of the cell into the free slot
+		std::size_t last = cell.back();
+		cell[location.slot] = last;
+		locations[last].slot = location.slot;
+		cell.pop_back();
+
+		levels[location.level].count--;
+		location = Location();
+	}
+
+	void update(std::size_t item, const Bounds& bounds) {
+		if (!contains(item)) {
+			insert(item, bounds);
+
+			return;
+		}
+
+		Box box = toBox(bounds);
+		Location location = locate(box);
+		if (location.level == locations[item].level && location.cell == locations[item].cell) {
+			boxes[item] = box;
+
+			return;
+		}
+
+		erase(item);
+		insert(item, bounds);
+	}
+
+	// Calls visitor(item) for every item whose bounds overlap the given bounds, the query stops when the visitor returns true
+	template <typename Visitor>
+	bool query(const Bounds& bounds, Visitor&& visitor) const {
+		Box box = toBox(bounds);
+
+		for (const Level& level : levels) {
+			if (level.count == 0)
+				continue;
+
+			// Cells whose loose bounds overlap the query
+			int minCol = clampCell(std::ceil((box.minX - world.minX()) / level.cellWidth - 0.5) - 1.0, level.size);
+			int maxCol = clampCell(std::floor((box.maxX - world.minX()) / level.cellWidth + 0.5), level.size);
+			int minRow = clampCell(std::ceil((box.minY - world.minY()) / level.cellHeight - 0.5) - 1.0, level.size);
+			int maxRow = clampCell(std::floor((box.maxY - world.minY()) / level.cellHeight + 0.5), level.size);
+
+			for (int row = minRow; row <= maxRow; row++) {
+				for (int col = minCol; col <= maxCol; col++) {
+					for (std::size_t item : level.cells[row * level.size + col]) {
+						if (boxes[item].overlaps(box) && visitor(item))
+							return true;
+					}
+				}
+			}
+		}
+
+		return false;
+	}
+
+	// Calls visitor(bounds, count) for every non empty cell
+	template <typename Visitor>
+	void cells(Visitor&& visitor) const {
+		for (const Level& level : levels) {
+			if (level.count == 0)
+				continue;
+
+			for (int row = 0; row < level.size; row++) {
+				for (int col = 0; col < level.size; col++) {
+					std::size_t count = level.cells[row * level.size + col].size();
+					if (count > 0)
+						visitor(Bounds(world.minX() + col * level.cellWidth, world.minY() + row * level.cellHeight, level.cellWidth, level.cellHeight), count);
+				}
+			}
+		}
+	}
+
+private:
+	static Box toBox(const Bounds& bounds) {
+		return Box { bounds.minX(), bounds.minY(), bounds.emaxX(), bounds.emaxY() };
+	}
+
+	static int clampCell(double cell, int size) {
+		return static_cast<int>(Utils::clamp<double>(cell, 0.0, size - 1.0));
+	}
+
+	Location locate(const Box& box) const {
+		double width = box.maxX - box.minX;
+		double height = box.maxY - box.minY;
+
+		int level = 0;
+		while (level < maxLevel && width <= levels[level + 1].cellWidth && height <= levels[level + 1].cellHeight)
+			level++;
+
+		const Level& current = levels[level];
+		int col = clampCell(std::floor((0.5 * (box.minX + box.maxX) - world.minX()) / current.cellWidth), current.size);
+		int row = clampCell(std::floor((0.5 * (box.minY + box.maxY) - world.minY()) / current.cellHeight), current.size);
+
+		Location location;
+		location.level = level;
+		location.cell = row * current.size + col;
+
+		return location;
+	}
+};
@@ -0,0 +1,100 @@
+#include <core.h>
+#include "mappedFile.h"
+
+#ifdef _MSC_VER
+
+#define NOMINMAX
+#include <Windows.h>
+
+URef<MappedFile> MappedFile::open(const std::string& path) {
+	// Deleting is shared so a newer cache can be renamed over a mapped file
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return nullptr;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+		CloseHandle(file);
+
+		return nullptr;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+	if (mapping == nullptr) {
+		CloseHandle(file);
+
+		return nullptr;
+	}
+
+	void* address = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	if (address == nullptr) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+
+		return nullptr;
+	}
+
+	URef<MappedFile> result(new MappedFile());
+	result->address = address;
+	result->length = static_cast<std::size_t>(size.QuadPart);
+	result->file = file;
+	result->mapping = mapping;
+
+	return result;
+}
+
+MappedFile::~MappedFile() {
+	if (address != nullptr)
+		UnmapViewOfFile(address);
+	if (mapping != nullptr)
+		CloseHandle(mapping);
+	if (file != nullptr)
+		CloseHandle(file);
+}
+
+#else
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+URef<MappedFile> MappedFile::open(const std::string& path) {
+	int descriptor = ::open(path.c_str(), O_RDONLY);
+	if (descriptor == -1)
+		return nullptr;
+
+	struct stat status;
+	if (fstat(descriptor, &status) == -1 || status.st_size == 0) {
+		close(descriptor);
+
+		return nullptr;
+	}
+
+	// The mapping stays valid after closing the descriptor
+	void* address = mmap(nullptr, status.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0);
+	close(descriptor);
+	if (address == MAP_FAILED)
+		return nullptr;
+
+	URef<MappedFile> result(new MappedFile());
+	result->address = address;
+	result->length = static_cast<std::size_t>(status.st_size);
+
+	return result;
+}
+
+MappedFile::~MappedFile() {
+	if (address != nullptr)
+		munmap(address, length);
+}
+
+#endif
+
+unsigned char* MappedFile::data() const {
+	return static_cast<unsigned char*>(address);
+}
+
+std::size_t MappedFile::size() const {
+	return length;
+}
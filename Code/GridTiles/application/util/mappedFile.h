@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+
+// Copy on write memory mapping of a whole file. Pages are shared with every other process mapping the same file,
+// writes through the mapping only touch private copies and never reach the file.
+class MappedFile {
+private:
+	void* address = nullptr;
+	std::size_t length = 0;
+
+#ifdef _MSC_VER
+	void* file = nullptr;
+	void* mapping = nullptr;
+#endif
+
+	MappedFile() = default;
+
+public:
+	~MappedFile();
+
+	MappedFile(const MappedFile& other) = delete;
+	MappedFile& operator=(const MappedFile& other) = delete;
+
+	// Returns nullptr if the file does not exist or can not be mapped
+	static URef<MappedFile> open(const std::string& path);
+
+	unsigned char* data() const;
+	std::size_t size() const;
+};
@@ -0,0 +1,100 @@
+#include "core.h"
+#include "pipelineGraph.h"
+
+PipelineGraph::Stage PipelineGraph::add(const std::string& name, const std::vector<Stage>& inputs, const Key& key, const Compute& compute) {
+	Node& node = nodes.emplace_back();
+	node.name = name;
+	node.inputs = inputs;
+	node.key = key;
+	node.compute = compute;
+	node.inputVersions.resize(inputs.size(), 0);
+
+	for (Stage input : inputs) {
+		assert(input < nodes.size() - 1);
+		node.depth = Utils::max(node.depth, nodes[input].depth + 1);
+	}
+
+	return nodes.size() - 1;
+}
+
+int PipelineGraph::evaluate() {
+	int maxDepth = 0;
+	for (const Node& node : nodes)
+		maxDepth = Utils::max(maxDepth, node.depth);
+
+	int ran = 0;
+	std::vector<Stage> stale;
+	for (int depth = 0; depth <= maxDepth; depth++) {
+		// Collect the stages of this depth whose output is out of date
+		stale.clear();
+		for (Stage stage = 0; stage < nodes.size(); stage++) {
+			Node& node = nodes[stage];
+			if (node.depth != depth)
+				continue;
+
+			node.changed = false;
+
+			std::uint64_t key = node.key ? node.key() : 0;
+			bool outdated = node.version == 0 || node.invalid || key != node.outputKey;
+			for (std::size_t inputIndex = 0; inputIndex < node.inputs.size() && !outdated; inputIndex++)
+				outdated = nodes[node.inputs[inputIndex]].version != node.inputVersions[inputIndex];
+
+			if (outdated) {
+				node.outputKey = key;
+				stale.push_back(stage);
+			}
+		}
+
+		// Stages of the same depth are independent
+		std::vector<std::string> errors(stale.size());
+		#pragma omp parallel for schedule(dynamic) if(stale.size() > 1)
+		for (int staleIndex = 0; staleIndex < static_cast<int>(stale.size()); staleIndex++) {
+			Node& node = nodes[stale[staleIndex]];
+
+			std::vector<cv::Mat> inputs;
+			inputs.reserve(node.inputs.size());
+			for (Stage input : node.inputs)
+				inputs.push_back(nodes[input].output);
+
+			try {
+				node.output = node.compute(inputs);
+			} catch (const cv::Exception& exception) {
+				node.output = cv::Mat();
+				errors[staleIndex] = exception.what();
+			}
+		}
+
+		for (std::size_t staleIndex = 0; staleIndex < stale.size(); staleIndex++) {
+			Node& node = nodes[stale[staleIndex]];
+			if (!errors[staleIndex].empty())
+				Log::error("Pipeline stage %s failed: %s", node.name.c_str(), errors[staleIndex].c_str());
+
+			for (std::size_t inputIndex = 0; inputIndex < node.inputs.size(); inputIndex++)
+				node.inputVersions[inputIndex] = nodes[node.inputs[inputIndex]].version;
+
+			node.version++;
+			node.invalid = false;
+			node.changed = true;
+		}
+
+		ran += static_cast<int>(stale.size());
+	}
+
+	return ran;
+}
+
+void PipelineGraph::invalidate(Stage stage) {
+	nodes[stage].invalid = true;
+}
+
+const cv::Mat& PipelineGraph::output(Stage stage) const {
+	return nodes[stage].output;
+}
+
+std::uint64_t PipelineGraph::version(Stage stage) const {
+	return nodes[stage].version;
+}
+
+bool PipelineGraph::changed(Stage stage) const {
+	return nodes[stage].changed;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+// Dependency graph of named image processing stages. Every stage caches its output together with the versions of its inputs
+// and the key of its parameters, so evaluating the graph only reruns the stages whose parameters or inputs changed.
+// Stages are added after their inputs, stages at the same depth never depend on each other and run in parallel.
+class PipelineGraph {
+public:
+	typedef std::size_t Stage;
+
+	// Computes the output of a stage from the outputs of its inputs, in the order the inputs were added
+	typedef std::function<cv::Mat(const std::vector<cv::Mat>& inputs)> Compute;
+	// Returns a key of the parameters of a stage, the stage reruns whenever the key changes
+	typedef std::function<std::uint64_t()> Key;
+
+private:
+	struct Node {
+		std::string name;
+		std::vector<Stage> inputs;
+		Key key;
+		Compute compute;
+
+		// Longest path from a stage without inputs
+		int depth = 0;
+
+		cv::Mat output;
+		// Increased whenever the output is recomputed, 0 if it never was
+		std::uint64_t version = 0;
+		// Key and input versions the output was computed with
+		std::uint64_t outputKey = 0;
+		std::vector<std::uint64_t> inputVersions;
+
+		bool invalid = false;
+		bool changed = false;
+	};
+
+	std::vector<Node> nodes;
+
+public:
+	// Adds a stage computed from the given earlier stages, a stage without key only depends on its inputs
+	Stage add(const std::string& name, const std::vector<Stage>& inputs, const Key& key, const Compute& compute);
+
+	// Reruns every stage whose key or inputs changed, returns the amount of stages that ran
+	int evaluate();
+
+	// Reruns the stage and everything downstream of it on the next evaluation
+	void invalidate(Stage stage);
+
+	const cv::Mat& output(Stage stage) const;
+	std::uint64_t version(Stage stage) const;
+
+	// Whether the stage reran during the last evaluation
+	bool changed(Stage stage) const;
+
+	// Combines the given arithmetic parameters into a key
+	template <typename... Args>
+	static std::uint64_t key(const Args&... args) {
+		std::uint64_t result = 0xcbf29ce484222325ull;
+		auto mix = [&result](double value) {
+			std::uint64_t bits;
+			std::memcpy(&bits, &value, sizeof(bits));
+			result = ((result << 5 | result >> 59) ^ bits) * 0x9e3779b97f4a7c15ull;
+		};
+
+		(mix(static_cast<double>(args)), ...);
+
+		return result;
+	}
+};
@@ -0,0 +1,105 @@
+#include "core.h"
+#include "sat.h"
+
+#include <opencv2/core/utility.hpp>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define GRIDTILES_X86
+#include <immintrin.h>
+#endif
+
+// GCC and Clang only emit vector instructions in functions that target them, MSVC always does
+#if defined(GRIDTILES_X86) && !defined(_MSC_VER)
+#define TARGET_AVX __attribute__((target("avx")))
+#else
+#define TARGET_AVX
+#endif
+
+// Same test as Sat::intersect with the boxes of the batch in the lanes
+static std::uint32_t intersectScalar(const Obb& a, const ObbBatch& batch) {
+	std::uint32_t result = 0;
+	for (std::size_t lane = 0; lane < batch.size; lane++) {
+		Obb b { Vec2(batch.centerX[lane], batch.centerY[lane]), Vec2(batch.axisX[lane], batch.axisY[lane]), Vec2(batch.extentX[lane], batch.extentY[lane]) };
+		if (Sat::intersect(a, b))
+			result |= 1u << lane;
+	}
+
+	return result;
+}
+
+#ifdef GRIDTILES_X86
+TARGET_AVX static __m256d abs4(__m256d value) {
+	return _mm256_andnot_pd(_mm256_set1_pd(-0.0), value);
+}
+
+TARGET_AVX static __m256d dot4(__m256d ax, __m256d ay, __m256d bx, __m256d by) {
+	return _mm256_add_pd(_mm256_mul_pd(ax, bx), _mm256_mul_pd(ay, by));
+}
+
+// Returns the lanes where the projected distance exceeds the sum of the projected extents
+TARGET_AVX static __m256d separated4(__m256d distance, __m256d extentA, __m256d extentB) {
+	return _mm256_cmp_pd(abs4(distance), _mm256_add_pd(extentA, extentB), _CMP_GT_OQ);
+}
+
+TARGET_AVX static std::uint32_t intersectAvx(const Obb& a, const ObbBatch& batch) {
+	const __m256d aCenterX = _mm256_set1_pd(a.center.x);
+	const __m256d aCenterY = _mm256_set1_pd(a.center.y);
+	const __m256d aAxisX = _mm256_set1_pd(a.axis.x);
+	const __m256d aAxisY = _mm256_set1_pd(a.axis.y);
+	const __m256d aNormalX = _mm256_set1_pd(-a.axis.y);
+	const __m256d aNormalY = _mm256_set1_pd(a.axis.x);
+	const __m256d aExtentX = _mm256_set1_pd(a.extents.x);
+	const __m256d aExtentY = _mm256_set1_pd(a.extents.y);
+	const __m256d zero = _mm256_setzero_pd();
+
+	std::uint32_t result = 0;
+	for (std::size_t lane = 0; lane < batch.size; lane += 4) {
+		__m256d bAxisX = _mm256_load_pd(batch.axisX + lane);
+		__m256d bAxisY = _mm256_load_pd(batch.axisY + lane);
+		__m256d bNormalX = _mm256_sub_pd(zero, bAxisY);
+		__m256d bNormalY = bAxisX;
+		__m256d bExtentX = _mm256_load_pd(batch.extentX + lane);
+		__m256d bExtentY = _mm256_load_pd(batch.extentY + lane);
+
+		__m256d deltaX = _mm256_sub_pd(_mm256_load_pd(batch.centerX + lane), aCenterX);
+		__m256d deltaY = _mm256_sub_pd(_mm256_load_pd(batch.centerY + lane), aCenterY);
+
+		// Absolute cosines between the sides of both boxes
+		__m256d axisAxis = abs4(dot4(aAxisX, aAxisY, bAxisX, bAxisY));
+		__m256d axisNormal = abs4(dot4(aAxisX, aAxisY, bNormalX, bNormalY));
+		__m256d normalAxis = abs4(dot4(aNormalX, aNormalY, bAxisX, bAxisY));
+		__m256d normalNormal = abs4(dot4(aNormalX, aNormalY, bNormalX, bNormalY));
+
+		__m256d separated = separated4(dot4(deltaX, deltaY, aAxisX, aAxisY),
+		                               aExtentX,
+		                               dot4(bExtentX, bExtentY, axisAxis, axisNormal));
+		separated = _mm256_or_pd(separated,
+		                         separated4(dot4(deltaX, deltaY, aNormalX, aNormalY),
+		                                    aExtentY,
+		                                    dot4(bExtentX, bExtentY, normalAxis, normalNormal)));
+		separated = _mm256_or_pd(separated,
+		                         separated4(dot4(deltaX, deltaY, bAxisX, bAxisY),
+		                                    bExtentX,
+		                                    dot4(aExtentX, aExtentY, axisAxis, normalAxis)));
+		separated = _mm256_or_pd(separated,
+		                         separated4(dot4(deltaX, deltaY, bNormalX, bNormalY),
+		                                    bExtentY,
+		                                    dot4(aExtentX, aExtentY, axisNormal, normalNormal)));
+
+		result |= static_cast<std::uint32_t>(~_mm256_movemask_pd(separated) & 0xF) << lane;
+	}
+
+	// Lanes past the size of the batch are unused
+	return result & ((1u << batch.size) - 1u);
+}
+#endif
+
+std::uint32_t Sat::intersect(const Obb& a, const ObbBatch& batch) {
+#ifdef GRIDTILES_X86
+	static const bool avx = cv::checkHardwareSupport(CV_CPU_AVX);
+	if (avx)
+		return intersectAvx(a, batch);
+#endif
+
+	return intersectScalar(a, batch);
+}
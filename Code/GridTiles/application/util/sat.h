@@ -1,13 +1,90 @@
 #pragma once
 
-//#include <algorithm>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
 #include <vector>
 #include "math/vec.h"
 
 // https://github.com/winstxnhdw/2d-separating-axis-theorem
 
+// Oriented bounding box of a rectangle, the axis is the unit direction of its first side and the second side is perpendicular to it
+struct Obb {
+	Vec2 center;
+	Vec2 axis;
+	Vec2 extents;
+};
+
+// Up to capacity boxes stored as a structure of arrays, so one box can be tested against all of them in SIMD lanes
+struct ObbBatch {
+	static constexpr std::size_t capacity = 16;
+
+	alignas(32) double centerX[capacity] = {};
+	alignas(32) double centerY[capacity] = {};
+	alignas(32) double axisX[capacity] = {};
+	alignas(32) double axisY[capacity] = {};
+	alignas(32) double extentX[capacity] = {};
+	alignas(32) double extentY[capacity] = {};
+
+	std::size_t size = 0;
+
+	bool full() const {
+		return size == capacity;
+	}
+
+	void clear() {
+		size = 0;
+	}
+
+	void push(const Obb& obb) {
+		centerX[size] = obb.center.x;
+		centerY[size] = obb.center.y;
+		axisX[size] = obb.axis.x;
+		axisY[size] = obb.axis.y;
+		extentX[size] = obb.extents.x;
+		extentY[size] = obb.extents.y;
+		size++;
+	}
+};
+
 struct Sat {
 
+	// Unit axis of every rotation index, matching the rotations of Vec2::rotated in steps of 360 / rotations degrees
+	static std::vector<Vec2> rotationAxes(int rotations) {
+		std::vector<Vec2> result(rotations);
+		for (int rotationIndex = 0; rotationIndex < rotations; rotationIndex++)
+			result[rotationIndex] = Vec2(1, 0).rotated(360.0 / rotations * rotationIndex);
+
+		return result;
+	}
+
+	// Check if two oriented boxes intersect, touching boxes intersect just like in separating_axis_intersect
+	static bool intersect(const Obb& a, const Obb& b) {
+		const Vec2 a_normal(-a.axis.y, a.axis.x);
+		const Vec2 b_normal(-b.axis.y, b.axis.x);
+		const Vec2 delta = b.center - a.center;
+
+		// Absolute cosines between the sides of both boxes
+		const double axis_axis = std::abs(dot(a.axis, b.axis));
+		const double axis_normal = std::abs(dot(a.axis, b_normal));
+		const double normal_axis = std::abs(dot(a_normal, b.axis));
+		const double normal_normal = std::abs(dot(a_normal, b_normal));
+
+		if (std::abs(dot(delta, a.axis)) > a.extents.x + b.extents.x * axis_axis + b.extents.y * axis_normal)
+			return false;
+		if (std::abs(dot(delta, a_normal)) > a.extents.y + b.extents.x * normal_axis + b.extents.y * normal_normal)
+			return false;
+		if (std::abs(dot(delta, b.axis)) > b.extents.x + a.extents.x * axis_axis + a.extents.y * normal_axis)
+			return false;
+		if (std::abs(dot(delta, b_normal)) > b.extents.y + a.extents.x * axis_normal + a.extents.y * normal_normal)
+			return false;
+
+		return true;
+	}
+
+	// Bitmask of the boxes in the batch that intersect the given box
+	static std::uint32_t intersect(const Obb& a, const ObbBatch& batch);
+
 	// Linear transform to find the orthogonal vector of the edge
 	static Vec2 calculate_normalised_projection_axis(const Vec2& current_point, const Vec2& next_point) {
 		const double axis_x = -(next_point.y - current_point.y);
@@ -21,25 +98,24 @@ struct Sat {
 		return axis_normalised;
 	}
 
-	// Project the vertices of each polygon onto a axis
-	static void compute_projections(const std::vector<Vec2>& bounds_a, const std::vector<Vec2>& bounds_b, const Vec2& axis_normalised, std::vector<double>& projections_a, std::vector<double>& projections_b) {
-		projections_a.reserve(bounds_a.size());
-		projections_b.reserve(bounds_b.size());
+	// Project the vertices of a polygon onto a axis
+	static void compute_projection(const std::vector<Vec2>& bounds, const Vec2& axis_normalised, double& min_projection, double& max_projection) {
+		min_projection = std::numeric_limits<double>::max();
+		max_projection = std::numeric_limits<double>::lowest();
 
-		for (size_t j = 0; j < bounds_a.size(); j++) {
-			const double projection_a = dot(axis_normalised, bounds_a[j]);
-			const double projection_b = dot(axis_normalised, bounds_b[j]);
-			projections_a.push_back(projection_a);
-			projections_b.push_back(projection_b);
+		for (const Vec2& point : bounds) {
+			const double projection = dot(axis_normalised, point);
+			min_projection = std::min(min_projection, projection);
+			max_projection = std::max(max_projection, projection);
 		}
 	}
 
-	// Check if the projections of two polygons overlap
-	static bool is_overlapping(const std::vector<double>& projections_a, const std::vector<double>& projections_b) {
-		const double max_projection_a = *std::ranges::max_element(projections_a);
-		const double min_projection_a = *std::ranges::min_element(projections_a);
-		const double max_projection_b = *std::ranges::max_element(projections_b);
-		const double min_projection_b = *std::ranges::min_element(projections_b);
+	// Check if the projections of two polygons onto a axis overlap
+	static bool is_overlapping(const std::vector<Vec2>& bounds_a, const std::vector<Vec2>& bounds_b, const Vec2& axis_normalised) {
+		double min_projection_a, max_projection_a;
+		double min_projection_b, max_projection_b;
+		compute_projection(bounds_a, axis_normalised, min_projection_a, max_projection_a);
+		compute_projection(bounds_b, axis_normalised, min_projection_b, max_projection_b);
 
 		// Does not intersect
 		if (max_projection_a < min_projection_b || max_projection_b < min_projection_a)
@@ -62,11 +138,7 @@ struct Sat {
 
 			Vec2 axis_normalised = calculate_normalised_projection_axis(current_point, next_point);
 
-			std::vector<double> projections_a;
-			std::vector<double> projections_b;
-			compute_projections(bounds_a, bounds_b, axis_normalised, projections_a, projections_b);
-
-			if (!is_overlapping(projections_a, projections_b)) 
+			if (!is_overlapping(bounds_a, bounds_b, axis_normalised))
 				return false;
 		}
 
@@ -81,11 +153,7 @@ struct Sat {
 
 			Vec2 axis_normalised = calculate_normalised_projection_axis(current_point, next_point);
 
-			std::vector<double> projections_a;
-			std::vector<double> projections_b;
-			compute_projections(bounds_a, bounds_b, axis_normalised, projections_a, projections_b);
-
-			if (!is_overlapping(projections_a, projections_b))
+			if (!is_overlapping(bounds_a, bounds_b, axis_normalised))
 				return false;
 		}
 
@@ -15,6 +15,10 @@
 #include "omp.h"
 #include "graphics/mondriaanPatch.h"
 #include "fade2D/Fade_2D.h"
+#include "matching/localSearch.h"
+#include "matching/matchScheduler.h"
+#include "matching/patchMatcher.h"
+#include "matching/ssdaMatcher.h"
 
 void EditorView::init() {
 	generator = std::mt19937(std::random_device()());
@@ -32,6 +36,8 @@ void EditorView::init() {
 }
 
 void EditorView::update() {
+	applyPlacements();
+
 	ImVec2 relativeOffset = ImGui::GetMousePos() - (source.hover ? source : target).offset;
 
 	// Mouse move
@@ -39,28 +45,9 @@ void EditorView::update() {
 		intersectedIndex = -1;
 		intersectedPoint = relativeOffset;
 
-		for (int index = 0; index < grid.size(); index++) {
-			if (!grid[index].leaf())
-				continue;
-
-			MondriaanPatch& patch = grid[index].patch;
-
-			Bounds sourceBounds = patch.sourceRotatedBounds();
-			Bounds targetBounds = patch.targetBounds();
-
-			Vec2 sourceIntersection = source.toTextureSpace(intersectedPoint);
-			Vec2 targetIntersection = target.toTextureSpace(intersectedPoint);
-
-			if (source.hover && sourceBounds.econtains(sourceIntersection)) {
-				intersectedIndex = index;
-				break;
-			}
-
-			if (target.hover && targetBounds.econtains(targetIntersection)) {
-				intersectedIndex = index;
-				break;
-			}
-		}
+		std::size_t index = source.hover ? grid.find(source.toTextureSpace(intersectedPoint), Type_Source) : grid.find(target.toTextureSpace(intersectedPoint), Type_Target);
+		if (index != TreeNode<MondriaanPatch>::null_node)
+			intersectedIndex = static_cast<int>(index);
 	} else {
 		source.drag = false;
 		target.drag = false;
@@ -85,12 +72,10 @@ void EditorView::update() {
 		Vec2 delta = relativeOffset - selectedPoint;
 		if (source.drag) {
 			Vec2 sourceDelta = source.toTextureSpace(delta);
-			Bounds oldSourceBounds = grid[selectedIndex].patch.sourceRotatedBounds();
 			grid[selectedIndex].patch.sourceOffset += sourceDelta;
 			// Check location
 			if (checkPatchSourceLocation(grid[selectedIndex].patch)) {
-				Bounds newSourceBounds = grid[selectedIndex].patch.sourceRotatedBounds();
-				grid.update(selectedIndex, oldSourceBounds, newSourceBounds, Type_Source);
+				grid.update(selectedIndex, Type_Source);
 			} else {
 				// Undo change
 				grid[selectedIndex].patch.sourceOffset -= sourceDelta;
@@ -99,12 +84,10 @@ void EditorView::update() {
 
 		if (target.drag) {
 			Vec2 targetDelta = target.toTextureSpace(delta);
-			Bounds oldTargetBounds = grid[selectedIndex].patch.targetBounds();
 			grid[selectedIndex].patch.targetOffset += targetDelta;
 			// Check location
 			if (checkPatchTargetLocation(grid[selectedIndex].patch)) {
-				Bounds newTargetBounds = grid[selectedIndex].patch.targetBounds();
-				grid.update(selectedIndex, oldTargetBounds, newTargetBounds, Type_Target);
+				grid.update(selectedIndex, Type_Target);
 			} else {
 				// Undo change
 				grid[selectedIndex].patch.targetOffset -= targetDelta;
@@ -127,7 +110,9 @@ void EditorView::update() {
 void EditorView::renderCursor() {
 	// Cursor
 	if (source.hover || target.hover) {
+#ifndef GRIDTILES_HEADLESS
 		glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_HIDDEN);
+#endif
 
 		double size = 7;
 		float thickness = 3;
@@ -210,7 +195,7 @@ void EditorView::renderTooltip() {
 		ImGui::Text("Y: %.0f", patch.sourceOffset.y);
 		ImGui::Text("W: %d mm", patch.dimension_mm.x);
 		ImGui::Text("H: %d mm", patch.dimension_mm.y);
-		ImGui::image("Source", settings.source.textures[patch.rotationIndex].it(), ImVec2(80, 80), sourceUV.min().iv(), sourceUV.emax().iv());
+		ImGui::image("Source", settings.source.texture(patch.rotationIndex).it(), ImVec2(80, 80), sourceUV.min().iv(), sourceUV.emax().iv());
 
 		ImGui::NextColumn();
 		ImGui::SetColumnWidth(-1, 95);
@@ -297,7 +282,7 @@ void EditorView::renderPatchViewer() {
 		// Source
 		ImGui::TextColored(Colors::BLUE.iv4(), "Source");
 		ImVec2 sourcePos = ImGui::GetCursorScreenPos();
-		ImGuiUtils::ImageNoSpacing(settings.source->it(), sourceSize, rotatedSourceUV.min().iv(), rotatedSourceUV.emax().iv());
+		ImGuiUtils::ImageNoSpacing(settings.viewedSource().it(), sourceSize, rotatedSourceUV.min().iv(), rotatedSourceUV.emax().iv());
 		drawRotatedQuad(sourcePos);
 
 		ImGui::NextColumn();
@@ -355,8 +340,8 @@ void EditorView::renderPatches() {
 	std::set<std::size_t> targetNeighbours;
 	std::set<std::size_t> sourceNeighbours;
 	if (selectedIndex != -1) {
-		targetNeighbours = grid.neighbours(selectedIndex, Type_Target, true);
-		sourceNeighbours = grid.neighbours(selectedIndex, Type_Source, true);
+		targetNeighbours = grid.neighbours(selectedIndex, Type_Target);
+		sourceNeighbours = grid.neighbours(selectedIndex, Type_Source);
 	}
 
 	// Render seedpoints
@@ -383,10 +368,10 @@ void EditorView::renderPatches() {
 		if (sourceNeighbours.find(patchIndex) != sourceNeighbours.end())
 			sourceColor = Colors::RGB_B;
 
-		if (grid.overlaps(grid[patchIndex].patch, Type_Target, true))
+		if (grid.overlaps(grid[patchIndex].patch, Type_Target))
 			targetColor = Colors::RGB_G;
 
-		if (grid.overlaps(grid[patchIndex].patch, Type_Source, true))
+		if (grid.overlaps(grid[patchIndex].patch, Type_Source))
 			sourceColor = Colors::RGB_G;
 
 		grid[patchIndex].patch.render(source,
@@ -425,7 +410,7 @@ void EditorView::renderSettings() {
 	//
 
 	// Source image
-	ImGui::image("Source", settings.source->it(), source.dimension.iv());
+	ImGui::image("Source", settings.viewedSource().it(), source.dimension.iv());
 	source.offset = ImGui::GetItemRectMin();
 	source.hover = ImGui::IsItemHovered();
 
@@ -437,6 +422,7 @@ void EditorView::renderSettings() {
 	// Clear mask
 	if (ImGui::Button("Clear mask", ImVec2(target.dimension.x, height))) {
 		settings.mask.data = cv::Mat(settings.mask.rows(), settings.mask.cols(), CV_8UC1, cv::Scalar(255));
+		settings.source.clearReservations();
 		settings.mask.reloadGL();
 	}
 
@@ -494,9 +480,13 @@ void EditorView::renderSettings() {
 	// Reload mask
 	if (ImGui::Button("Reload mask", ImVec2(target.dimension.x, height))) {
 		settings.mask.data = cv::Mat(settings.mask.rows(), settings.mask.cols(), CV_8UC1, cv::Scalar(255));
-		for (const TreeNode<MondriaanPatch>& node : grid.patches) {
-			node.patch.addToGlobalMask();
-		}
+		// The mask only shows the source, patches cut from a board of the library are left out
+		for (const TreeNode<MondriaanPatch>& node : grid.patches)
+			if (node.patch.boardIndex == -1)
+				node.patch.addToGlobalMask();
+
+		// The matchers only see the reservations of the placement masks
+		reserveMatchedLeafs();
 		settings.mask.reloadGL();
 	}
 
@@ -533,9 +523,9 @@ void EditorView::renderSettings() {
 		cv::imwrite("../res/overview/wood_edge_3.png", settings.source.features[2][1].data*2);
 		cv::imwrite("../res/overview/levels.png", screen.pipeline.cannyLevels.data * 2);
 		cv::imwrite("../res/overview/dilated.png", screen.pipeline.dilatedLevels.data * 2);
-		cv::imwrite("../res/overview/mask_1.png", settings.source.masks[0].data);
-		cv::imwrite("../res/overview/mask_2.png", settings.source.masks[1].data);
-		cv::imwrite("../res/overview/mask_3.png", settings.source.masks[2].data);
+		cv::imwrite("../res/overview/mask_1.png", settings.source.materialMask(0));
+		cv::imwrite("../res/overview/mask_2.png", settings.source.materialMask(1));
+		cv::imwrite("../res/overview/mask_3.png", settings.source.materialMask(2));
 	}
 
 	ImGui::Checkbox("Show mondrian grid", &showMondrianGrid);
@@ -560,7 +550,7 @@ void EditorView::renderSettings() {
 	//// SSP generation method
 	//ImGui::TextColored(Colors::BLUE.iv4(), "Source seedpoints");
 	//{
-	//	static std::array methods = {"Random", "Template Match", "SIFT"};
+	//	static std::array methods = {"Random", "Template Match", "SIFT", "Patch Match"};
 
 	//	ImGui::Combo("SSPG method", &sspGenerationMethod, methods.data(), methods.size());
 
@@ -661,8 +651,8 @@ void EditorView::render() {
 	renderVoronoi();
 
 	if (showRegularGrid) {
-		grid.render(target, Type_Target, true);
-		grid.render(source, Type_Source, true);
+		grid.render(target, Type_Target);
+		grid.render(source, Type_Source);
 	}
 
 	ImGui::End();
@@ -753,15 +743,11 @@ void EditorView::mutatePatches() {
 		}
 
 		if (bestPatch.match != std::numeric_limits<double>::max()) {
-			Boundsi oldTargetBounds = currentPatch.targetBounds();
-			Boundsi oldSourceRotatedBounds = currentPatch.sourceRotatedBounds();
-
 			currentPatch.removeFromGlobalMask();
 			currentPatch = bestPatch;
 			currentPatch.addToGlobalMask();
 
-			grid.update(patchIndex, oldTargetBounds, currentPatch.targetBounds(), Type_Target);
-			grid.update(patchIndex, oldSourceRotatedBounds, currentPatch.sourceRotatedBounds(), Type_Source);
+			grid.update(patchIndex, Type_Target | Type_Source);
 		}
 	}
 
@@ -797,10 +783,9 @@ void EditorView::mutatePatchesRandom() {
 		}
 
 		if (bestPatch.match != std::numeric_limits<double>::max()) {
-			Boundsi oldBounds = currentPatch.targetBounds();
 			currentPatch = bestPatch;
 
-			grid.update(patchIndex, oldBounds, currentPatch.targetBounds(), Type_Target);
+			grid.update(patchIndex, Type_Target);
 		}
 	}*/
 }
@@ -942,7 +927,7 @@ void EditorView::splitPatchesRollingGuidance(std::size_t patchToSplit) {
 	} else if (pdfChoice == PDFChoice_Linear) {
 		// 2(1 - x)
 		pdf = [](float x) {
-			return 1.0f - std::sqrtf(1.0f - x);
+			return 1.0f - std::sqrt(1.0f - x);
 		};
 	} else if (pdfChoice == PDFChoice_Quadratic) {
 		// 3(x - 1)^2
@@ -1080,8 +1065,11 @@ void EditorView::splitPatchesRollingGuidance(std::size_t patchToSplit) {
 			Vec2 newTargetOffsetA = currentPatch.targetOffset;
 			Vec2 newTargetOffsetB = currentPatch.targetOffset + Vec2(newWidthA_px, 0);
 
+			// Both halves keep the material they covered as part of the parent, the local search starts from there
 			MondriaanPatch newPatchA = MondriaanPatch(currentPatch.sourceOffset, newTargetOffsetA, Vec2(newWidthA_mm, currentPatch.dimension_mm.y));
-			MondriaanPatch newPatchB = MondriaanPatch(currentPatch.sourceOffset, newTargetOffsetB, Vec2(newWidthB_mm, currentPatch.dimension_mm.y));
+			MondriaanPatch newPatchB = MondriaanPatch(currentPatch.sourceOffset + Vec2f(newWidthA_px, 0), newTargetOffsetB, Vec2(newWidthB_mm, currentPatch.dimension_mm.y));
+			newPatchA.rotationIndex = currentPatch.rotationIndex;
+			newPatchB.rotationIndex = currentPatch.rotationIndex;
 
 			if (checkPatch(newPatchB, currentPatch) && checkPatch(newPatchA, currentPatch)) {
 				grid.add(characteristics.patchIndex, newPatchA, newPatchB);
@@ -1099,7 +1087,9 @@ void EditorView::splitPatchesRollingGuidance(std::size_t patchToSplit) {
 			Vec2 newTargetOffsetB = currentPatch.targetOffset + Vec2(0, newHeightA_px);
 
 			MondriaanPatch newPatchA = MondriaanPatch(currentPatch.sourceOffset, newTargetOffsetA, Vec2(currentPatch.dimension_mm.x, newHeightA_mm));
-			MondriaanPatch newPatchB = MondriaanPatch(currentPatch.sourceOffset, newTargetOffsetB, Vec2(currentPatch.dimension_mm.x, newHeightB_mm));
+			MondriaanPatch newPatchB = MondriaanPatch(currentPatch.sourceOffset + Vec2f(0, newHeightA_px), newTargetOffsetB, Vec2(currentPatch.dimension_mm.x, newHeightB_mm));
+			newPatchA.rotationIndex = currentPatch.rotationIndex;
+			newPatchB.rotationIndex = currentPatch.rotationIndex;
 			if (checkPatch(newPatchB, currentPatch) && checkPatch(newPatchA, currentPatch)) {
 				grid.add(characteristics.patchIndex, newPatchA, newPatchB);
 				continue;
@@ -1322,7 +1312,7 @@ void EditorView::generateRegularPatches() {
 				cv::Rect sourcePatch(sourcePosition.x, sourcePosition.y, patch.width, patch.height);
 
 
-				settings.source.textures[rotationIndex].data(sourcePatch).copyTo(settings.puzzle.data(patch));
+				settings.sourcePatch(rotationIndex, sourcePatch).copyTo(settings.puzzle.data(patch));
 			}
 		}
 	});
@@ -1332,30 +1322,174 @@ void EditorView::matchPatches(std::size_t selectedIndex) {
 	if (settings.puzzle.data.rows == 0)
 		settings.puzzle = Texture(cv::Mat(settings.target->data.rows, settings.target->data.cols, settings.target->data.type(), cv::Scalar(0)));
 	pool.push_task([this, selectedIndex]() {
-		auto match = [](TreeNode<MondriaanPatch>& node) {
-			MondriaanPatch& patch = node.patch;
-			cv::Rect patchBounds = patch.targetBounds().cv();
+		computeMatches(selectedIndex);
+	});
+}
 
-			auto [rotationIndex, sourcePosition] = Utils::computeBestMatch(patchBounds, cv::TM_SQDIFF_NORMED);
-			cv::Rect sourcePatch(sourcePosition.x, sourcePosition.y, patchBounds.width, patchBounds.height);
-			patch.sourceOffset = sourcePosition;
-			patch.rotationIndex = rotationIndex;
-			Log::debug("%f, %f, %d", patch.sourceOffset.x, patch.sourceOffset.y, patch.rotationIndex);
+MatchCandidate EditorView::parentSeed(std::size_t patchIndex) const {
+	std::size_t parentIndex = grid.patches[patchIndex].parent;
+	if (parentIndex == TreeNode<MondriaanPatch>::null_node)
+		return MatchCandidate();
 
-			settings.source.textures[rotationIndex].data(sourcePatch).copyTo(settings.puzzle.data(patchBounds));
-		};
+	// Parents that were never placed have no source offset to start from
+	const MondriaanPatch& parent = grid.patches[parentIndex].patch;
+	if (!parent.matched)
+		return MatchCandidate();
+
+	Vec2f offset = grid.patches[patchIndex].patch.targetOffset - parent.targetOffset;
+
+	return MatchCandidate(parent.rotationIndex, parent.sourceOffset + offset, 0.0);
+}
+
+void EditorView::reserveMatchedLeafs() {
+	settings.source.clearReservations();
+	settings.library.clearReservations();
+	for (const TreeNode<MondriaanPatch>& node : grid.patches) {
+		const MondriaanPatch& patch = node.patch;
+		if (!node.leaf() || !patch.matched)
+			continue;
+
+		cv::Rect targetBounds = patch.targetBounds().cv();
+		cv::Rect placement(static_cast<int>(patch.sourceOffset.x), static_cast<int>(patch.sourceOffset.y), targetBounds.width, targetBounds.height);
+		if (patch.boardIndex == -1)
+			settings.source.reserve(patch.rotationIndex, placement);
+		else if (patch.boardIndex < static_cast<int>(settings.library.boards.size()))
+			settings.library.boards[patch.boardIndex]->source.reserve(patch.rotationIndex, placement);
+	}
+}
+
+void EditorView::applyPlacements() {
+	std::vector<PendingPlacement> placements;
+	{
+		std::scoped_lock lock(placementMutex);
+		placements.swap(pendingPlacements);
+	}
+
+	// A rematched patch releases its previous material and reserves the new one
+	bool rematched = false;
+	for (const PendingPlacement& placement : placements) {
+		if (!placement.candidate.valid()) {
+			Log::error("No patches available");
+
+			continue;
+		}
+
+		// The grid may have been reset since the match task started
+		if (placement.patchIndex >= grid.patches.size())
+			continue;
+
+		MondriaanPatch& patch = grid.patches[placement.patchIndex].patch;
+		if (patch.targetBounds().cv() != placement.patchBounds)
+			continue;
+
+		const MatchCandidate& candidate = placement.candidate;
+		cv::Rect sourcePatch(candidate.position.x, candidate.position.y, placement.patchBounds.width, placement.patchBounds.height);
+		patch.sourceOffset = candidate.position;
+		patch.rotationIndex = candidate.rotationIndex;
+		patch.matched = true;
+		patch.boardIndex = placement.boardIndex;
+		rematched |= placement.rematch;
+		grid.update(placement.patchIndex, Type_Source);
+		Log::debug("%f, %f, %d", patch.sourceOffset.x, patch.sourceOffset.y, patch.rotationIndex);
+
+		// The library may have been cleared since the match task started
+		if (placement.boardIndex >= static_cast<int>(settings.library.boards.size()))
+			continue;
+
+		// A tiled source is cut from its pyramid
+		cv::Mat material = placement.boardIndex == -1 ? settings.sourcePatch(candidate.rotationIndex, sourcePatch) : settings.library.boards[placement.boardIndex]->source.patch(candidate.rotationIndex, sourcePatch);
+		material.copyTo(settings.puzzle.data(placement.patchBounds));
+	}
+
+	if (rematched)
+		reserveMatchedLeafs();
+}
+
+void EditorView::computeMatches(std::size_t selectedIndex) {
+	// Runs on the pool, the placements are applied by the UI thread on its next update
+	auto apply = [this, selectedIndex](std::size_t patchIndex, const cv::Rect& patchBounds, const MatchCandidate& candidate, int boardIndex = -1) {
+		std::scoped_lock lock(placementMutex);
+		pendingPlacements.push_back(PendingPlacement { patchIndex, patchBounds, candidate, boardIndex, selectedIndex != -1 });
+	};
 
+	if (!settings.library.empty()) {
+		// Patches are cut from the boards of the library instead of the source, like the batch does
 		if (selectedIndex != -1) {
-			match(grid.patches[selectedIndex]);
+			cv::Rect patchBounds = grid.patches[selectedIndex].patch.targetBounds().cv();
+			MaterialLibrary::Placement placement = settings.library.match(patchBounds, cv::TM_SQDIFF_NORMED);
+			apply(selectedIndex, patchBounds, placement.candidate, placement.boardIndex);
 		} else {
-			for (auto& node : grid.patches) {
-				if (!node.leaf())
+			std::vector<std::size_t> leafs;
+			std::vector<cv::Rect> leafBounds;
+			for (std::size_t index = 0; index < grid.patches.size(); index++) {
+				if (!grid.patches[index].leaf())
 					continue;
 
-				match(node);
+				leafs.push_back(index);
+				leafBounds.push_back(grid.patches[index].patch.targetBounds().cv());
 			}
+
+			settings.library.clearReservations();
+			std::vector<MaterialLibrary::Placement> placements = settings.library.match(leafBounds, cv::TM_SQDIFF_NORMED);
+			for (std::size_t leafIndex = 0; leafIndex < leafs.size(); leafIndex++)
+				apply(leafs[leafIndex], leafBounds[leafIndex], placements[leafIndex].candidate, placements[leafIndex].boardIndex);
 		}
-	});
+
+		settings.library.report();
+	} else if (selectedIndex != -1) {
+		cv::Rect patchBounds = grid.patches[selectedIndex].patch.targetBounds().cv();
+
+		// The placement of the parent, shifted to the part it covers, seeds the local and the early terminated search
+		std::vector<MatchCandidate> seeds;
+		MatchCandidate seed = parentSeed(selectedIndex);
+		if (seed.valid())
+			seeds.push_back(seed);
+
+		apply(selectedIndex, patchBounds, Utils::computeBestCandidate(patchBounds, cv::TM_SQDIFF_NORMED, seeds));
+	} else {
+		// All leafs are matched in parallel, their material is either assigned at once or reserved in leaf order
+		std::vector<std::size_t> leafs;
+		std::vector<cv::Rect> leafBounds;
+		std::vector<MatchCandidate> leafSeeds;
+		for (std::size_t index = 0; index < grid.patches.size(); index++) {
+			if (!grid.patches[index].leaf())
+				continue;
+
+			leafs.push_back(index);
+			leafBounds.push_back(grid.patches[index].patch.targetBounds().cv());
+			leafSeeds.push_back(parentSeed(index));
+		}
+
+		settings.source.clearReservations();
+		std::vector<MatchCandidate> placements;
+		if (settings.placementMethod == Settings::PlacementMethod_Global) {
+			placements = MatchScheduler::assign(leafBounds, cv::TM_SQDIFF_NORMED, leafSeeds);
+		} else if (settings.placementMethod == Settings::PlacementMethod_PatchMatch) {
+			PatchMatcher::Parameters parameters;
+			parameters.iterations = settings.patchMatchIterations;
+			parameters.candidates = settings.placementCandidates;
+			placements = PatchMatcher::match(leafBounds, cv::TM_SQDIFF_NORMED, parameters, leafSeeds);
+		} else {
+			placements = MatchScheduler::match(leafBounds, cv::TM_SQDIFF_NORMED, leafSeeds);
+		}
+
+		for (std::size_t leafIndex = 0; leafIndex < leafs.size(); leafIndex++)
+			apply(leafs[leafIndex], leafBounds[leafIndex], placements[leafIndex]);
+	}
+
+	if (settings.matchingMethod == Settings::MatchingMethod_Ssda)
+		SsdaMatcher::report();
+
+	LocalSearch::report();
+	settings.responseCache.report();
+
+	if (settings.cacheMatches) {
+		settings.matchCache.report();
+
+		std::uint64_t stateHash = MatchCache::stateHash();
+		if (!settings.cacheDirectory.empty() && stateHash != 0)
+			settings.matchCache.save(MatchCache::path(settings.cacheDirectory, stateHash), stateHash);
+	}
 }
 
 void EditorView::sortPatches() {
@@ -1,11 +1,13 @@
 #pragma once
 
+#include <mutex>
 #include <random>
 
 #include "generation/TSPG/TSPG.h"
 #include "generation/SSPG/SSPG.h"
 #include "graphics/canvas.h"
 #include "graphics/mondriaanPatch.h"
+#include "matching/matchCandidate.h"
 #include "thread_pool/thread_pool.hpp"
 #include "util/RegularTree.h"
 
@@ -97,11 +99,25 @@ private:
 	ImVec2 puzzlePos;
 
 	std::mt19937 generator;
+
+	// Placement found by a match task, the grid is only changed on the UI thread
+	struct PendingPlacement {
+		std::size_t patchIndex;
+		cv::Rect patchBounds;
+		MatchCandidate candidate;
+		// Board of the material library, -1 for the source
+		int boardIndex = -1;
+		// Replaces the placement of a single patch, which the schedulers did not reserve
+		bool rematch = false;
+	};
+
+	std::mutex placementMutex;
+	std::vector<PendingPlacement> pendingPlacements;
 public:
 	Canvas source;
 	Canvas target;
 
-	RegularTree<10, 10> grid;
+	RegularTree grid;
 
 	int intersectedIndex = -1;
 	int selectedIndex = -1;
@@ -135,6 +151,13 @@ public:
 	void splitPatchesRollingGuidance(std::size_t patchToSplit = -1);
 	void generateRegularPatches();
 	void matchPatches(std::size_t selectedIndex);
+	// Placement of the parent of the patch shifted to the part the patch covers, invalid for an unmatched parent
+	MatchCandidate parentSeed(std::size_t patchIndex) const;
+	// Rebuilds the reservations of the source and the library from the placements of the matched leafs
+	void reserveMatchedLeafs();
+	void computeMatches(std::size_t selectedIndex);
+	// Moves the patches to the placements the match tasks found since the last frame
+	void applyPlacements();
 	void sortPatches();
 	void exportImage();
 
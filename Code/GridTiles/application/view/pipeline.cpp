@@ -6,15 +6,17 @@
 #include "graphics/textures/sourceTexture.h"
 #include "rolling_guidance/RollingGuidanceFilter.h"
 #include "util/imageUtils.h"
+#include "graphics/textures/sourceCache.h"
 
 static int pipeline = 0;
 static std::vector pipelines = {"Default", "Histogram", "CDF", "Blur", "Saliency"};
 
-PipelineView::PipelineView() = default;
+PipelineView::PipelineView() {
+	build();
+}
 
 void PipelineView::init() {
 	reload();
-	reloadLevels();
 }
 
 void PipelineView::update() {
@@ -48,7 +50,7 @@ void PipelineView::render() {
 		ImGui::SameLine();
 		ImGui::image("Weighted equalization", wequalized->it(), targetSize);
 		ImGui::NewLine();
-		ImGui::image("Source", settings.source->it(), sourceSize);
+		ImGui::image("Source", settings.viewedSource().it(), sourceSize);
 		ImGui::SameLine();
 		ImGui::arrow();
 		ImGui::SameLine();
@@ -157,125 +159,240 @@ void PipelineView::render() {
 
 }
 
-void PipelineView::reloadLevels() {
-	// Rolling guidance
-	this->rollingGuidance = Texture(RollingGuidanceFilter::filter(settings.target->data, 9, 25.5, 1));
-
-	// Canny levels
-	cv::Mat cannyLevels(targetGrayscale->data.rows, targetGrayscale->data.cols, CV_32FC1, cv::Scalar(0));
-	for (int i = 0; i < 10; i++) {
-		double sigma = 11.0 - i * 1.0;
-		cv::Mat guidance = RollingGuidanceFilter::filter(settings.target->data, sigma, 10, 4);
+void PipelineView::build() {
+	auto equalize = [](cv::Mat texture) {
+		if (settings.equalize)
+			cv::normalize(texture, texture, 0, 255, cv::NORM_MINMAX);
+
+		return texture;
+	};
+
+	// Inputs, hashed so a reload with the same textures reruns nothing
+	stages.source = graph.add("Source", {}, [] {
+		return SourceCache::hash({ settings.source->data });
+	}, [](const std::vector<cv::Mat>&) {
+		return settings.source->data;
+	});
+	stages.target = graph.add("Target", {}, [] {
+		return SourceCache::hash({ settings.target->data });
+	}, [](const std::vector<cv::Mat>&) {
+		return settings.target->data;
+	});
+
+	// Source chain
+	stages.sourceHistogram = graph.add("Source histogram", { stages.source }, nullptr, [](const std::vector<cv::Mat>& inputs) {
+		return Histogram(inputs[0]).drawLines();
+	});
+	stages.sourceCDF = graph.add("Source cdf", { stages.source }, nullptr, [](const std::vector<cv::Mat>& inputs) {
+		return CDF(Histogram(inputs[0])).draw();
+	});
+	stages.sourceGrayscale = graph.add("Source grayscale", { stages.source }, [] {
+		return PipelineGraph::key(settings.equalize);
+	}, [equalize](const std::vector<cv::Mat>& inputs) {
+		return equalize(Grayscale(inputs[0]).grayscale);
+	});
+	stages.sourceBlur = graph.add("Source blur", { stages.sourceGrayscale }, nullptr, [](const std::vector<cv::Mat>& inputs) {
+		return Blur(inputs[0]).blur;
+	});
+
+	// Target chain
+	stages.targetGrayscale = graph.add("Target grayscale", { stages.target }, nullptr, [](const std::vector<cv::Mat>& inputs) {
+		return Grayscale(inputs[0]).grayscale;
+	});
+	stages.equalized = graph.add("Equalized", { stages.targetGrayscale, stages.sourceGrayscale }, nullptr, [](const std::vector<cv::Mat>& inputs) {
+		return Equalization(inputs[0], inputs[1]).equalization;
+	});
+	stages.wequalized = graph.add("Weight equalized", { stages.targetGrayscale, stages.equalized }, [] {
+		return PipelineGraph::key(settings.equalizationWeight, settings.equalize);
+	}, [equalize](const std::vector<cv::Mat>& inputs) {
+		cv::Mat wequalized;
+		cv::addWeighted(inputs[0], 1.0f - settings.equalizationWeight, inputs[1], settings.equalizationWeight, 0.0, wequalized);
+
+		return equalize(wequalized);
+	});
+	stages.targetBlur = graph.add("Target blur", { stages.targetGrayscale }, nullptr, [](const std::vector<cv::Mat>& inputs) {
+		return Blur(inputs[0]).blur;
+	});
+
+	// Edges of both chains
+	auto sobelKey = [] {
+		return PipelineGraph::key(settings.sobelType, settings.sobelDerivative, settings.sobelSize, settings.equalize);
+	};
+	auto sobel = [equalize](const std::vector<cv::Mat>& inputs) {
+		SobelType sobelTypes[] = { SobelType::X, SobelType::Y, SobelType::XY, SobelType::MAGNITUDE };
+
+		return equalize(Sobel(inputs[0], sobelTypes[settings.sobelType], settings.sobelDerivative, settings.sobelSize).sobel);
+	};
+	auto cannyKey = [] {
+		return PipelineGraph::key(settings.cannyThreshold1, settings.cannyThreshold2, settings.cannyAperture, settings.cannyL2gradient);
+	};
+	auto canny = [](const std::vector<cv::Mat>& inputs) {
+		return Canny(inputs[0], settings.cannyThreshold1, settings.cannyThreshold2, settings.cannyAperture, settings.cannyL2gradient).canny;
+	};
+	// Signed derivatives are not equalized, their rotations are linear combinations of both channels
+	auto gradientKey = [] {
+		return PipelineGraph::key(settings.sobelSize);
+	};
+	auto gradient = [](const std::vector<cv::Mat>& inputs) {
+		return Sobel(inputs[0], SobelType::GRADIENT, 1, settings.sobelSize).sobel;
+	};
+	stages.sourceSobel = graph.add("Source Sobel", { stages.sourceBlur }, sobelKey, sobel);
+	stages.sourceCanny = graph.add("Source Canny", { stages.sourceBlur }, cannyKey, canny);
+	stages.sourceGradient = graph.add("Source gradient", { stages.sourceBlur }, gradientKey, gradient);
+	stages.targetSobel = graph.add("Target Sobel", { stages.targetBlur }, sobelKey, sobel);
+	stages.targetCanny = graph.add("Target Canny", { stages.targetBlur }, cannyKey, canny);
+	stages.targetGradient = graph.add("Target gradient", { stages.targetBlur }, gradientKey, gradient);
+
+	// Saliency and levels
+	stages.saliencyMap = graph.add("Saliency", { stages.target }, nullptr, [](const std::vector<cv::Mat>& inputs) {
+		cv::Mat saliency;
+		ImageUtils::saliency->computeSaliency(inputs[0], saliency);
+		saliency.convertTo(saliency, CV_8UC1, 255.0);
+
+		return saliency;
+	});
+	stages.rollingGuidance = graph.add("Rolling guidance", { stages.target }, nullptr, [](const std::vector<cv::Mat>& inputs) {
+		return RollingGuidanceFilter::filter(inputs[0], 9, 25.5, 1);
+	});
+	stages.cannyLevels = graph.add("Canny levels", { stages.target }, nullptr, [](const std::vector<cv::Mat>& inputs) {
+		cv::Mat cannyLevels(inputs[0].rows, inputs[0].cols, CV_32FC1, cv::Scalar(0));
+		for (int i = 0; i < 10; i++) {
+			double sigma = 11.0 - i * 1.0;
+			cv::Mat guidance = RollingGuidanceFilter::filter(inputs[0], sigma, 10, 4);
+
+			cv::Mat guidanceCanny;
+			cv::Canny(guidance, guidanceCanny, 50, 150, 3);
+			guidanceCanny.convertTo(guidanceCanny, CV_32FC1, 1.0 / (i + 1.0));
+
+			cv::max(cannyLevels, guidanceCanny, cannyLevels);
+		}
+		cv::convertScaleAbs(cannyLevels, cannyLevels);
+
+		return cannyLevels;
+	});
+	stages.dilatedLevels = graph.add("Dilated levels", { stages.cannyLevels }, [] {
+		return PipelineGraph::key(settings.dilation);
+	}, [](const std::vector<cv::Mat>& inputs) {
+		cv::Mat dilated1;
+		cv::Mat dilated2;
+		cv::Mat element1 = cv::getStructuringElement(
+			cv::MORPH_RECT,
+			cv::Size(2 * (settings.dilation - 1) + 1, 2 * (settings.dilation - 1) + 1),
+			cv::Point(settings.dilation, settings.dilation));
+		cv::Mat element2 = cv::getStructuringElement(
+			cv::MORPH_RECT,
+			cv::Size(2 * settings.dilation + 1, 2 * settings.dilation + 1),
+			cv::Point(settings.dilation, settings.dilation));
+		cv::dilate(inputs[0], dilated1, element1);
+		cv::dilate(inputs[0], dilated2, element2);
+
+		return cv::Mat(dilated2 - dilated1);
+	});
+}
 
-		cv::Mat guidanceCanny;
-		cv::Canny(guidance, guidanceCanny, 50, 150, 3);
-		guidanceCanny.convertTo(guidanceCanny, CV_32FC1, 1.0 / (i + 1.0));
+void PipelineView::reloadLevels() {
+	graph.invalidate(stages.rollingGuidance);
+	graph.invalidate(stages.cannyLevels);
 
-		//canny += guidanceCanny;
-		cv::max(cannyLevels, guidanceCanny, cannyLevels);
-	}
-	cv::convertScaleAbs(cannyLevels, cannyLevels);
-	this->cannyLevels = Texture(cannyLevels);
-
-	cv::Mat dilated1;
-	cv::Mat dilated2;
-	cv::Mat element1 = cv::getStructuringElement(
-		cv::MORPH_RECT,
-		cv::Size(2 * (settings.dilation - 1) + 1, 2 * (settings.dilation - 1) + 1),
-		cv::Point(settings.dilation, settings.dilation));
-	cv::Mat element2 = cv::getStructuringElement(
-		cv::MORPH_RECT,
-		cv::Size(2 * settings.dilation + 1, 2 * settings.dilation + 1),
-		cv::Point(settings.dilation, settings.dilation));
-	cv::dilate(cannyLevels, dilated1, element1);
-	cv::dilate(cannyLevels, dilated2, element2);
-	cv::Mat dilated = dilated2 - dilated1;
-	this->dilatedLevels = Texture(dilated);
+	reload();
 }
 
 void PipelineView::reload() {
-	// Source histogram and cdf
-	ImageUtils::renderHistogram(*settings.source, &sourceHistogram);
-	ImageUtils::renderCDF(*settings.source, &sourceCDF);
-
-	// Source grayscale
-	Grayscale sourceGrayscale(*settings.source);
-	if (settings.equalize)
-		cv::normalize(sourceGrayscale.grayscale, sourceGrayscale.grayscale, 0, 255, cv::NORM_MINMAX);
-	this->sourceGrayscale = ExtendedTexture("Source grayscale", sourceGrayscale.grayscale.clone());
-
-	// Target grayscale
-	Grayscale targetGrayscale(*settings.target);
-	this->targetGrayscale = ExtendedTexture("Target grayscale", targetGrayscale.grayscale.clone());
-
-	// Saliency
-	ImageUtils::renderSalience(*settings.target, &saliencyMap);
-
-	// Calculate equalization
-	Equalization equalization(*this->targetGrayscale, *this->sourceGrayscale);
-	this->equalized = ExtendedTexture("Equalized", equalization.equalization.clone());
-
-	// Weighted equalization
-	cv::Mat wequalized;
-	cv::addWeighted(this->targetGrayscale->data, 1.0f - settings.equalizationWeight, this->equalized->data, settings.equalizationWeight, 0.0, wequalized);
-	if (settings.equalize)
-		cv::normalize(wequalized, wequalized, 0, 255, cv::NORM_MINMAX);
-
-	this->wequalized = ExtendedTexture("Weight Equalized", wequalized.clone());
-
-	// Target Blur, Sobel and Canny
-	ImageUtils::renderBlur(*this->targetGrayscale, &this->targetBlur);
-	//ImageUtils::renderBlur(*this->wequalized, &this->targetBlur);
-	ImageUtils::renderSobel(&this->targetBlur, &this->targetSobel);
-	if (settings.equalize) {
-		cv::normalize(targetSobel.data, targetSobel.data, 0, 255, cv::NORM_MINMAX);
-		targetSobel.reloadGL();
+	int ran = graph.evaluate();
+	Log::debug("Pipeline reran %d stages", ran);
+
+	// Upload the outputs that changed, textures are only touched on this thread
+	auto upload = [this](PipelineGraph::Stage stage, Texture& texture, bool linear = false) {
+		if (!graph.changed(stage))
+			return;
+
+		texture.data = graph.output(stage);
+		texture.reloadGL(linear);
+	};
+
+	upload(stages.sourceHistogram, sourceHistogram, true);
+	upload(stages.sourceCDF, sourceCDF, true);
+	if (graph.changed(stages.sourceGrayscale))
+		this->sourceGrayscale = ExtendedTexture("Source grayscale", graph.output(stages.sourceGrayscale));
+	upload(stages.sourceBlur, sourceBlur);
+	upload(stages.sourceSobel, sourceSobel);
+	upload(stages.sourceCanny, sourceCanny);
+
+	if (graph.changed(stages.targetGrayscale))
+		this->targetGrayscale = ExtendedTexture("Target grayscale", graph.output(stages.targetGrayscale));
+	if (graph.changed(stages.equalized))
+		this->equalized = ExtendedTexture("Equalized", graph.output(stages.equalized));
+	if (graph.changed(stages.wequalized))
+		this->wequalized = ExtendedTexture("Weight Equalized", graph.output(stages.wequalized));
+	upload(stages.targetBlur, targetBlur);
+	upload(stages.targetSobel, targetSobel);
+	upload(stages.targetCanny, targetCanny);
+
+	if (graph.changed(stages.saliencyMap)) {
+		saliencyMap.data = graph.output(stages.saliencyMap);
+		saliencyMap.reloadGL(false, GL_UNSIGNED_BYTE, GL_LUMINANCE, GL_FLOAT);
 	}
-	ImageUtils::renderCanny(&this->targetBlur, &this->targetCanny);
-
-	// Source Blur, Sobel and Canny
-	ImageUtils::renderBlur(*this->sourceGrayscale, &this->sourceBlur);
-	//ImageUtils::renderBlur(*this->sourceGrayscale, &this->sourceBlur);
-	ImageUtils::renderSobel(&this->sourceBlur, &this->sourceSobel);
-	if (settings.equalize) {
-		cv::normalize(sourceSobel.data, sourceSobel.data, 0, 255, cv::NORM_MINMAX);
-		sourceSobel.reloadGL();
+	upload(stages.rollingGuidance, rollingGuidance);
+	upload(stages.cannyLevels, cannyLevels);
+	upload(stages.dilatedLevels, dilatedLevels);
+
+	// Set source features, the rotated features are only recomputed if their inputs changed or the source was replaced
+	PipelineGraph::Stage sourceIntensity = settings.useRGB ? stages.source : stages.sourceGrayscale;
+	PipelineGraph::Stage sourceEdges[] = { stages.sourceSobel, stages.sourceCanny, stages.sourceGradient };
+	PipelineGraph::Stage sourceEdge = sourceEdges[settings.edgeMethod];
+	std::uint64_t sourceFeatureKey = PipelineGraph::key(sourceIntensity, graph.version(sourceIntensity), sourceEdge, graph.version(sourceEdge));
+	bool featuresChanged = false;
+	if (sourceFeatureKey != this->sourceFeatureKey || settings.source.features.size() != settings.source.featureRotations() || settings.source.featureHash != sourceFeatureHash) {
+		FeatureVector sourceFeatures;
+		sourceFeatures.add(graph.output(sourceIntensity));
+		sourceFeatures.add(graph.output(sourceEdge));
+		settings.source.setFeatures(sourceFeatures);
+
+		this->sourceFeatureKey = sourceFeatureKey;
+		this->sourceFeatureHash = settings.source.featureHash;
+		featuresChanged = true;
 	}
-	ImageUtils::renderCanny(&this->sourceBlur, &this->sourceCanny);
-
-	// Set source features
-	FeatureVector sourceFeatures;
-	if (settings.useRGB)
-		sourceFeatures.add(settings.source->data.clone());
-	else
-		sourceFeatures.add(this->sourceGrayscale->data.clone());
-	sourceFeatures.add(settings.edgeMethod == Settings::EdgeMethod_Sobel ? this->sourceSobel.data.clone() : this->sourceCanny.data.clone());
-	settings.source.setFeatures(sourceFeatures);
-
-	// Set target features
+
+	// Set target features, they share the outputs of the stages so an unchanged feature still points to its stage
+	const cv::Mat& targetIntensity = graph.output(settings.useRGB ? stages.target : stages.wequalized);
 	if (settings.target.features.size() == 0) {
-		if (settings.useRGB)
-			settings.target.features.add(settings.target->data.clone());
-		else
-			settings.target.features.add(this->wequalized->data.clone());
+		settings.target.features.add(targetIntensity);
 		if (settings.edgeMethod == Settings::EdgeMethod_Sobel)
-			settings.target.features.add(this->targetSobel.data.clone());
+			settings.target.features.add(graph.output(stages.targetSobel));
 		else if (settings.edgeMethod == Settings::EdgeMethod_Canny)
-			settings.target.features.add(this->targetCanny.data.clone());
+			settings.target.features.add(graph.output(stages.targetCanny));
+		else if (settings.edgeMethod == Settings::EdgeMethod_Gradient)
+			settings.target.features.add(graph.output(stages.targetGradient));
+		featuresChanged = true;
 	} else {
-		if (settings.useRGB)
-			settings.target.features[FeatureIndex_Intensity].data = settings.target->data.clone();
-		else
-			settings.target.features[FeatureIndex_Intensity].data = this->wequalized->data.clone();
+		if (settings.target.features[FeatureIndex_Intensity].data.data != targetIntensity.data) {
+			settings.target.features[FeatureIndex_Intensity].data = targetIntensity;
+			settings.target.features[FeatureIndex_Intensity].reloadGL();
+			featuresChanged = true;
+		}
 
+		const cv::Mat* targetEdge = nullptr;
 		if (settings.edgeMethod == Settings::EdgeMethod_Sobel)
-			settings.target.features[FeatureIndex_Edge].data = targetCanny.data.clone();
+			targetEdge = &graph.output(stages.targetSobel);
 		else if (settings.edgeMethod == Settings::EdgeMethod_Canny)
-			settings.target.features[FeatureIndex_Edge].data = targetCanny.data.clone();
+			targetEdge = &graph.output(stages.targetCanny);
+		else if (settings.edgeMethod == Settings::EdgeMethod_Gradient)
+			targetEdge = &graph.output(stages.targetGradient);
+
+		if (targetEdge != nullptr && settings.target.features[FeatureIndex_Edge].data.data != targetEdge->data) {
+			settings.target.features[FeatureIndex_Edge].data = *targetEdge;
+			settings.target.features[FeatureIndex_Edge].reloadGL();
+			featuresChanged = true;
+		}
 	}
 
-	// Reload target and source features
-	settings.source.reloadTextures();
-	settings.target.features[FeatureIndex_Intensity].reloadGL();
-	settings.target.features[FeatureIndex_Edge].reloadGL();
-}
\ No newline at end of file
+	// Cached placements and correlations belong to the previous features, placements of these features may be stored from an earlier session
+	if (featuresChanged) {
+		settings.matchCache.clear();
+		settings.responseCache.clear();
+
+		std::uint64_t stateHash = MatchCache::stateHash();
+		if (!settings.cacheDirectory.empty() && stateHash != 0 && settings.matchCache.load(MatchCache::path(settings.cacheDirectory, stateHash), stateHash))
+			Log::info("Loaded cached matches");
+	}
+}
@@ -1,6 +1,7 @@
 #pragma once
 #include "graphics/textures/extendedTexture.h"
 #include "graphics/textures/texture.h"
+#include "util/pipelineGraph.h"
 
 class PipelineView {
 public:
@@ -26,6 +27,39 @@ public:
 	Texture cannyLevels;
 	Texture dilatedLevels;
 
+	// Preprocessing stages, a reload only reruns the stages whose settings or inputs changed
+	PipelineGraph graph;
+
+	struct Stages {
+		PipelineGraph::Stage source;
+		PipelineGraph::Stage target;
+
+		PipelineGraph::Stage sourceHistogram;
+		PipelineGraph::Stage sourceCDF;
+		PipelineGraph::Stage sourceGrayscale;
+		PipelineGraph::Stage sourceBlur;
+		PipelineGraph::Stage sourceSobel;
+		PipelineGraph::Stage sourceCanny;
+		PipelineGraph::Stage sourceGradient;
+
+		PipelineGraph::Stage targetGrayscale;
+		PipelineGraph::Stage equalized;
+		PipelineGraph::Stage wequalized;
+		PipelineGraph::Stage targetBlur;
+		PipelineGraph::Stage targetSobel;
+		PipelineGraph::Stage targetCanny;
+		PipelineGraph::Stage targetGradient;
+
+		PipelineGraph::Stage saliencyMap;
+		PipelineGraph::Stage rollingGuidance;
+		PipelineGraph::Stage cannyLevels;
+		PipelineGraph::Stage dilatedLevels;
+	} stages;
+
+	// Stages and feature hash the source features were last set from
+	std::uint64_t sourceFeatureKey = 0;
+	std::uint64_t sourceFeatureHash = 0;
+
 	PipelineView();
 
 	void init();
@@ -34,4 +68,7 @@ public:
 
 	void reload();
 	void reloadLevels();
+
+private:
+	void build();
 };
@@ -3,10 +3,16 @@
 
 #include <opencv2/imgproc.hpp>
 
+// Longest side of the texture shown of a tiled source
+static constexpr int sourceViewDimension = 4096;
 
 Settings::Settings() = default;
 
 void Settings::init() {
+	init("../res/wood_3.png", "../res/beethoven-drawing.jpeg");
+}
+
+void Settings::init(const std::string& sourcePath, const std::string& targetPath) {
 	actualSourceDimension_mm = Vec2i(1000, 1000);
 	actualTargetDimension_mm = Vec2i(500, 500);
 	preferredPatchCountRange = Vec2(4, 100);
@@ -16,6 +22,8 @@ void Settings::init() {
 	postscale = 0.8;
 
 	rotations = 30;
+	rotateTemplates = false;
+	cacheDirectory = "../cache";
 
 	sobelDerivative = 1;
 	sobelSize = 3;
@@ -31,13 +39,29 @@ void Settings::init() {
 	intensityWeight = 0.9f;
 	equalizationWeight = 1.0f;
 
+	matchingMethod = MatchingMethod_Exhaustive;
+	responseMemory = 4096;
+	library.setCapacity(static_cast<std::size_t>(responseMemory) << 20);
+	pyramidLevels = 2;
+	pyramidCandidates = 8;
+	indexChecks = 64;
+	indexCandidates = 8;
+	placementCandidates = 4;
+	placementMethod = PlacementMethod_Greedy;
+	patchMatchIterations = 8;
+	localSearch = false;
+	localSearchRadius = 16;
+	localSearchRotations = 1;
+	localSearchThreshold = 0.1f;
+	cacheMatches = true;
+	responseCacheSize = 1024;
+	responseCache.setCapacity(static_cast<std::size_t>(responseCacheSize) << 20);
+	libraryBoards = 4;
+
 	useRGB = false;
 	equalize = true;
 
-	std::string sourcePath = "../res/wood_3.png";
-	std::string targetPath = "../res/beethoven-drawing.jpeg";
-
-	originalSource = Texture(sourcePath);
+	loadSource(sourcePath);
 	originalTarget = Texture(targetPath);
 
 	// Validate texture settings againt original source and target
@@ -47,8 +71,76 @@ void Settings::init() {
 	reloadPrescaledTextures();
 }
 
+void Settings::loadSource(const std::string& path) {
+	if (TiledImage::is(path)) {
+		tiledSource = TiledImage::open(path);
+		if (tiledSource == nullptr)
+			Log::error("Failed to open tiled image %s", path.c_str());
+
+		originalSource = Texture();
+	} else {
+		tiledSource = nullptr;
+		originalSource = Texture(path);
+	}
+}
+
+Vec2 Settings::originalSourceDimension() const {
+	if (tiledSource != nullptr)
+		return Vec2(tiledSource->cols(), tiledSource->rows());
+
+	return originalSource.dimension();
+}
+
+cv::Mat Settings::prescaleSource(const Vec2i& dimension) {
+	prescaledSourceDimension = dimension;
+	if (tiledSource != nullptr)
+		return tiledSource->resized(dimension.cv());
+
+	cv::Mat resizedSource;
+	cv::resize(originalSource.data, resizedSource, dimension.cv());
+
+	return resizedSource;
+}
+
+Texture& Settings::viewedSource() {
+	if (tiledSource != nullptr)
+		return sourceView;
+
+	return source.textures.front();
+}
+
+cv::Mat Settings::sourcePatch(int rotationIndex, const cv::Rect& rect) {
+	if (tiledSource == nullptr)
+		return source.patch(rotationIndex, rect);
+
+	cv::Mat transformation = tiledSourceTransformation(rotationIndex);
+	transformation.at<double>(0, 2) -= rect.x;
+	transformation.at<double>(1, 2) -= rect.y;
+
+	return tiledSource->warped(transformation, rect.size());
+}
+
+cv::Mat Settings::tiledSourceTransformation(int rotationIndex, double scale) const {
+	// Pixel centers are aligned like cv::resize does, both for the prescaling and the scale
+	double scaleX = static_cast<double>(prescaledSourceDimension.x) / tiledSource->cols();
+	double scaleY = static_cast<double>(prescaledSourceDimension.y) / tiledSource->rows();
+	const cv::Mat& rotation = source.transformations[rotationIndex];
+
+	cv::Mat result(2, 3, CV_64F);
+	for (int row = 0; row < 2; row++) {
+		const double* rotated = rotation.ptr<double>(row);
+		double* transformation = result.ptr<double>(row);
+		transformation[0] = scale * rotated[0] * scaleX;
+		transformation[1] = scale * rotated[1] * scaleY;
+		transformation[2] = scale * (rotated[0] * (0.5 * scaleX - 0.5) + rotated[1] * (0.5 * scaleY - 0.5) + rotated[2]) + 0.5 * scale - 0.5;
+	}
+
+	return result;
+}
+
 void Settings::reloadPrescaledTextures() {
-	float sourceSurface = originalSource.surface();
+	Vec2 originalSourceDimension = this->originalSourceDimension();
+	float sourceSurface = originalSourceDimension.x * originalSourceDimension.y;
 	float targetSurface = originalTarget.surface();
 
 	if (sourceSurface < targetSurface) {
@@ -60,21 +152,21 @@ void Settings::reloadPrescaledTextures() {
 		validateTextureSettings(SettingValidation_TargetMillimeterToPixelRatio);
 
 		// Load prescaled source and recalculate ratio
-		cv::Mat resizedSource;
 		Vec2i newSourceDimension = actualSourceDimension_mm / targetMillimeterToPixelRatio;
-		cv::resize(originalSource.data, resizedSource, newSourceDimension.cv());
+		cv::Mat resizedSource = prescaleSource(newSourceDimension);
 
 		// Load prescaled source and recalculate ratio
-		source = SourceTexture(resizedSource, rotations);
+		source = SourceTexture(resizedSource, rotations, cacheDirectory, rotateTemplates, tiledSource == nullptr);
+		source.matcher.setCapacity(static_cast<std::size_t>(responseMemory) << 20);
 		validateTextureSettings(SettingValidation_SourceMillimeterToPixelRatio);
 	} else {
 		// Load source and recalculate ratio
-		cv::Mat resizedSource;
-		Vec2i newSourceDimension = originalSource.dimension() * postscale;
-		cv::resize(originalSource.data, resizedSource, newSourceDimension.cv());
+		Vec2i newSourceDimension = originalSourceDimension * postscale;
+		cv::Mat resizedSource = prescaleSource(newSourceDimension);
 
 		// Load prescaled source and recalculate ratio
-		source = SourceTexture(resizedSource, rotations);
+		source = SourceTexture(resizedSource, rotations, cacheDirectory, rotateTemplates, tiledSource == nullptr);
+		source.matcher.setCapacity(static_cast<std::size_t>(responseMemory) << 20);
 		validateTextureSettings(SettingValidation_SourceMillimeterToPixelRatio);
 
 		// Load prescaled target and recalculate ratio
@@ -84,7 +176,17 @@ void Settings::reloadPrescaledTextures() {
 		target = ExtendedFeatureTexture("Target", resizedTarget, false);
 		validateTextureSettings(SettingValidation_TargetMillimeterToPixelRatio);
 	}
-	
+
+	// The canvases show a tiled source through a downsampled first rotation read from its pyramid
+	sourceView = Texture();
+	if (tiledSource != nullptr) {
+		cv::Size size = source.sizes.front();
+		double scale = std::min(1.0, static_cast<double>(sourceViewDimension) / std::max(size.width, size.height));
+		cv::Size viewSize(std::max(static_cast<int>(std::lround(size.width * scale)), 1), std::max(static_cast<int>(std::lround(size.height * scale)), 1));
+		sourceView.data = tiledSource->warped(tiledSourceTransformation(0, scale), viewSize);
+		sourceView.reloadGL();
+	}
+
 	// Reset mask
 	mask.data = cv::Mat(source->rows(), source->cols(), CV_8UC1, cv::Scalar(255));
 	mask.reloadGL();
@@ -101,7 +203,7 @@ void Settings::validateTextureSettings(SettingValidation settingValidation) {
 		float minimumPatchSurface = minimumPatchDimension_mm.x * minimumPatchDimension_mm.y;
 		float minimumTargetSurface = minimumPatchSurface * preferredPatchCountRange.x;
 
-		float minHeight = std::sqrtf(minimumTargetSurface / targetAspectRatio);
+		float minHeight = std::sqrt(minimumTargetSurface / targetAspectRatio);
 		float minWidth = targetAspectRatio * minHeight;
 
 		float currentTargetSurface = actualTargetDimension_mm.x * actualTargetDimension_mm.y;
@@ -113,7 +215,8 @@ void Settings::validateTextureSettings(SettingValidation settingValidation) {
 	}
 
 	if (settingValidation & SettingValidation_ActualSourceDimension) {
-		float sourceAspectRatio = originalSource.aspect();
+		Vec2 originalSourceDimension = this->originalSourceDimension();
+		float sourceAspectRatio = originalSourceDimension.x / originalSourceDimension.y;
 
 		this->actualSourceDimension_mm = Vec2f(actualSourceDimension_mm.x, actualSourceDimension_mm.x / sourceAspectRatio);
 	}
@@ -3,6 +3,10 @@
 #include "graphics/textures/extendedTexture.h"
 #include "graphics/textures/rotatedTexture.h"
 #include "graphics/textures/sourceTexture.h"
+#include "graphics/textures/tiledImage.h"
+#include "matching/materialLibrary.h"
+#include "matching/matchCache.h"
+#include "matching/responseCache.h"
 
 struct Settings {
 
@@ -19,16 +23,38 @@ struct Settings {
 	typedef int EdgeMethod;
 	enum EdgeMethod_ {
 		EdgeMethod_Sobel,
-		EdgeMethod_Canny
+		EdgeMethod_Canny,
+		EdgeMethod_Gradient
 	};
 
-	// The original non prescaled source image
+	typedef int MatchingMethod;
+	enum MatchingMethod_ {
+		MatchingMethod_Exhaustive,
+		MatchingMethod_Pyramid,
+		MatchingMethod_Index,
+		MatchingMethod_Ssda
+	};
+
+	typedef int PlacementMethod;
+	enum PlacementMethod_ {
+		PlacementMethod_Greedy,
+		PlacementMethod_Global,
+		PlacementMethod_PatchMatch
+	};
+
+	// The original non prescaled source image, empty when the source is a tiled image
 	Texture originalSource;
+	// The original source stored as tiled pyramid, decoded tile by tile when it is prescaled, shown or cut into patches
+	SRef<TiledImage> tiledSource;
+	// Dimension the original source was prescaled to, before it is rotated
+	Vec2i prescaledSourceDimension;
 	// The original non prescaled target image
 	Texture originalTarget;
 
 	// Array of `rotations` rotated source material textures
 	SourceTexture source;
+	// Downsampled unrotated source shown instead of the prescaled planes of a tiled source, which are not uploaded
+	Texture sourceView;
 	// The target texture
 	ExtendedFeatureTexture target;
 	// The puzzle
@@ -57,6 +83,10 @@ struct Settings {
 	float postscale;
 	// Number of rotations
 	int rotations;
+	// Match the rotations by rotating the target patches, only the planes of the unrotated source are stored
+	bool rotateTemplates;
+	// Directory of the memory mapped cache of the rotated source, empty disables the cache
+	std::string cacheDirectory;
 
 	int sobelDerivative;
 	int sobelSize;
@@ -70,6 +100,48 @@ struct Settings {
 
 	EdgeMethod edgeMethod;
 
+	// Placement search used for matching patches against the source
+	MatchingMethod matchingMethod;
+	// Memory in megabytes for the responses of the exhaustive search, larger sources are searched in tiles. Bounds the
+	// cached source spectra as well
+	int responseMemory;
+	// Number of downsampled levels of the pyramid search, 2 matches at a quarter of the resolution
+	int pyramidLevels;
+	// Number of coarse candidates refined at full resolution
+	int pyramidCandidates;
+	// Leafs of the descriptor index visited per query, trades recall for speed
+	int indexChecks;
+	// Number of nearest placements verified with the exact metric
+	int indexCandidates;
+	// Number of non overlapping placements kept per patch, the next one is used when a placement is taken
+	int placementCandidates;
+	// How the placements of all leafs share the source material
+	PlacementMethod placementMethod;
+	// Upper bound on the propagation and random search iterations of the patch match placement
+	int patchMatchIterations;
+	// Search split patches around the placement of their parent first, the global search only runs if the best local
+	// placement is worse than the threshold
+	bool localSearch;
+	// Distance in pixels from the parent placement that is searched
+	int localSearchRadius;
+	// Number of neighbouring rotations searched on both sides of the parent rotation
+	int localSearchRotations;
+	// Worst weighted score of a local placement that is accepted, in the units of the metric
+	float localSearchThreshold;
+	// Reuse the placements of target patches that were matched before with the same settings and features
+	bool cacheMatches;
+	// Placements of matched target patches, cleared whenever the target features change
+	MatchCache matchCache;
+	// Memory in megabytes for the correlations of matched target patches, the correlations of their halves are derived
+	// from them after a split. 0 disables the cache
+	int responseCacheSize;
+	// Correlations of matched target patches, cleared whenever the target features change
+	ResponseCache responseCache;
+	// Boards the puzzle can be cut from besides the source
+	MaterialLibrary library;
+	// Number of boards closest to a patch in the coarse index of the library that are searched exactly
+	int libraryBoards;
+
 	float intensityWeight;
 	float edgeWeight;
 	float equalizationWeight;
@@ -78,6 +150,20 @@ struct Settings {
 	Settings();
 
 	void init();
+	void init(const std::string& sourcePath, const std::string& targetPath);
+
+	// Loads the original source, tiled images are opened without decoding them
+	void loadSource(const std::string& path);
+	// Dimension of the original source in pixels, zero if none is loaded
+	Vec2 originalSourceDimension() const;
+	// The original source resized to the given dimension
+	cv::Mat prescaleSource(const Vec2i& dimension);
+	// Texture of the unrotated source for the canvases
+	Texture& viewedSource();
+	// Material of the rectangle of the given rotation of the prescaled source, a tiled source is cut from its pyramid
+	cv::Mat sourcePatch(int rotationIndex, const cv::Rect& rect);
+	// From the pixels of the tiled source to those of the given rotation of the prescaled source, scaled by the given factor
+	cv::Mat tiledSourceTransformation(int rotationIndex, double scale = 1.0) const;
 
 	void validateTextureSettings(SettingValidation settingValidation);
 	float validateTextureAspect(float* width, float* height, float aspect);
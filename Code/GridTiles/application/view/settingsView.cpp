@@ -10,6 +10,7 @@
 
 static ImGui::TexturePicker sourceTexture("Source texture");
 static ImGui::TexturePicker targetTexture("Target texture");
+static ImGui::TexturePicker boardTexture("Board");
 
 SettingsView::SettingsView() = default;
 
@@ -67,7 +68,7 @@ void SettingsView::render() {
 		ImGui::Spacing();
 
 		{
-			static std::array edgeMethods = { "Sobel", "Canny" };
+			static std::array edgeMethods = { "Sobel", "Canny", "Gradient" };
 			ImGui::Combo("Edge method", &settings.edgeMethod, edgeMethods.data(), edgeMethods.size());
 		}
 
@@ -112,12 +113,64 @@ void SettingsView::render() {
 		ImGui::SliderInt("Dilation", &settings.dilation, 1, 20);
 	}
 
+	if (ImGui::CollapsingHeader("Matching settings")) {
+		{
+			static std::array matchingMethods = { "Exhaustive", "Pyramid", "Index", "SSDA" };
+			ImGui::Combo("Matching method", &settings.matchingMethod, matchingMethods.data(), matchingMethods.size());
+		}
+
+		if (ImGui::SliderInt("Response memory (MB)", &settings.responseMemory, 64, 65536)) {
+			settings.source.matcher.setCapacity(static_cast<std::size_t>(settings.responseMemory) << 20);
+			settings.library.setCapacity(static_cast<std::size_t>(settings.responseMemory) << 20);
+		}
+		ImGui::SliderInt("Pyramid levels", &settings.pyramidLevels, 1, 4);
+		ImGui::SliderInt("Pyramid candidates", &settings.pyramidCandidates, 1, 64);
+		ImGui::SliderInt("Index checks", &settings.indexChecks, 1, 1024);
+		ImGui::SliderInt("Index candidates", &settings.indexCandidates, 1, 64);
+		ImGui::SliderInt("Placement candidates", &settings.placementCandidates, 1, 32);
+		{
+			static std::array placementMethods = { "Greedy", "Global", "PatchMatch" };
+			ImGui::Combo("Placement method", &settings.placementMethod, placementMethods.data(), placementMethods.size());
+		}
+		ImGui::SliderInt("PatchMatch iterations", &settings.patchMatchIterations, 1, 32);
+		ImGui::Checkbox("Local search", &settings.localSearch);
+		ImGui::SliderInt("Local search radius", &settings.localSearchRadius, 1, 128);
+		ImGui::SliderInt("Local search rotations", &settings.localSearchRotations, 0, 5);
+		ImGui::SliderFloat("Local search threshold", &settings.localSearchThreshold, 0.0f, 1.0f);
+		ImGui::Checkbox("Cache matches", &settings.cacheMatches);
+		ImGui::SameLine();
+		if (ImGui::Button("Clear##matchCache"))
+			settings.matchCache.clear();
+		if (ImGui::SliderInt("Response cache (MB)", &settings.responseCacheSize, 0, 8192))
+			settings.responseCache.setCapacity(static_cast<std::size_t>(settings.responseCacheSize) << 20);
+	}
+
+	if (ImGui::CollapsingHeader("Material library")) {
+		ImGui::SliderInt("Searched boards", &settings.libraryBoards, 1, 32);
+
+		for (const URef<MaterialLibrary::Board>& board : settings.library.boards)
+			ImGui::TextDisabled("%s (%d x %d px)", board->path.c_str(), board->image.cols, board->image.rows);
+
+		// Boards are prescaled like the source, so they are added after the source is loaded. Once a board is added the
+		// editor cuts its patches from the library only, add the source as a board to keep cutting from it
+		if (boardTexture.render(nullptr))
+			settings.library.add(boardTexture.path);
+
+		if (ImGui::Button("Clear##library"))
+			settings.library.clear();
+	}
+
 	if (ImGui::CollapsingHeader("Texture settings")) {
 		// Postscale
 		ImGui::DragFloat("Postscale", &settings.postscale, 0.01f, 0.05f, 1.5);
 
 		// Rotations
-		ImGui::DragInt("Rotations", &settings.rotations, 1, 1, 10);
+		ImGui::DragInt("Rotations", &settings.rotations, 1, 1, settings.rotateTemplates ? 180 : 10);
+
+		// The pipeline recomputes the source features for the new number of stored rotations, the rotated textures and
+		// masks follow on the next reload
+		if (ImGui::Checkbox("Rotate templates", &settings.rotateTemplates))
+			settings.source.rotateTemplates = settings.rotateTemplates;
 
 		// Source to target pixel ratio
 		ImGui::Text("Source to target pixel ratio: %.2f", settings.sourceToTargetPixelRatio);
@@ -146,9 +199,9 @@ void SettingsView::render() {
 		ImGui::Spacing();
 
 		// Source texture
-		if (sourceTexture.render(*settings.source)) {
+		if (sourceTexture.render(&settings.viewedSource())) {
 			// Load new source and validate actual source dimension
-			settings.originalSource = Texture(sourceTexture.path);
+			settings.loadSource(sourceTexture.path);
 			settings.validateTextureSettings(Settings::SettingValidation_ActualSourceDimension);
 
 			// Reload prescaled textures
@@ -232,11 +285,11 @@ void SettingsView::render() {
 
 			if (!settings.source.features.empty()) {
 				for (int f = 0; f < Feature::get.size(); f++) {
-					for (int r = 0; r < settings.source.rotations; r++) {
+					for (int r = 0; r < settings.source.features.size(); r++) {
 						ImVec2 size(Globals::imageWidth, Globals::imageWidth / settings.source.features[r][f].aspect());
 						ImGui::image(std::to_string(settings.source.features[r][f].id).c_str(), settings.source.features[r][f].it(), size);
 
-						if (r != settings.source.textures.size() - 1)
+						if (r != settings.source.features.size() - 1)
 							ImGui::SameLine();
 					}
 				}
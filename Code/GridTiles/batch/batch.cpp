@@ -0,0 +1,440 @@
+#include "core.h"
+#include "batch.h"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+#include <opencv2/imgcodecs.hpp>
+
+#include "main.h"
+#include "generation/TSPG/TSPG.h"
+#include "matching/matchScheduler.h"
+#include "matching/patchMatcher.h"
+#include "matching/ssdaMatcher.h"
+
+// Parses the whole value as a number, std::stoi and std::stof alone accept trailing characters and throw on bad input
+template<typename T>
+static bool parseNumber(const std::string& argument, const std::string& value, T& result) {
+	try {
+		std::size_t length = 0;
+		if constexpr (std::is_floating_point_v<T>)
+			result = std::stof(value, &length);
+		else
+			result = std::stoi(value, &length);
+
+		if (length == value.size())
+			return true;
+	} catch (const std::logic_error&) {}
+
+	Log::error("Invalid value %s for %s", value.c_str(), argument.c_str());
+
+	return false;
+}
+
+bool Batch::parse(int argc, char** argv, BatchJob& job) {
+	std::vector<std::string> arguments(argv + 1, argv + argc);
+
+	for (std::size_t index = 0; index < arguments.size(); index++) {
+		const std::string& argument = arguments[index];
+		bool hasValue = index + 1 < arguments.size();
+
+		if (argument == "--help" || argument == "-h")
+			return false;
+
+		if (argument == "--compare") {
+			job.compare = true;
+
+			continue;
+		}
+
+		if (argument == "--rotate-templates") {
+			job.rotateTemplates = true;
+
+			continue;
+		}
+
+		if (!hasValue) {
+			Log::error("Missing value for %s", argument.c_str());
+
+			return false;
+		}
+
+		const std::string& value = arguments[++index];
+		if (argument == "--source") {
+			job.sourcePath = value;
+		} else if (argument == "--target") {
+			job.targetPath = value;
+		} else if (argument == "--output") {
+			job.outputPath = value;
+		} else if (argument == "--layout") {
+			job.layoutPath = value;
+		} else if (argument == "--tile") {
+			job.tilePath = value;
+		} else if (argument == "--board") {
+			job.boardPaths.push_back(value);
+		} else if (argument == "--cache") {
+			job.cacheDirectory = value;
+		} else if (argument == "--splits") {
+			if (!parseNumber(argument, value, job.splits))
+				return false;
+		} else if (argument == "--rotations") {
+			if (!parseNumber(argument, value, job.rotations))
+				return false;
+		} else if (argument == "--postscale") {
+			if (!parseNumber(argument, value, job.postscale))
+				return false;
+		} else if (argument == "--generator") {
+			if (value == "tree")
+				job.generator = -1;
+			else if (value == "jittered")
+				job.generator = TSPGIndex_Jittered;
+			else if (value == "greedy")
+				job.generator = TSPGIndex_Greedy;
+			else {
+				Log::error("Unknown generator %s", value.c_str());
+
+				return false;
+			}
+		} else if (argument == "--matching") {
+			if (value == "exhaustive")
+				job.matching = Settings::MatchingMethod_Exhaustive;
+			else if (value == "pyramid")
+				job.matching = Settings::MatchingMethod_Pyramid;
+			else if (value == "index")
+				job.matching = Settings::MatchingMethod_Index;
+			else if (value == "ssda")
+				job.matching = Settings::MatchingMethod_Ssda;
+			else {
+				Log::error("Unknown matching method %s", value.c_str());
+
+				return false;
+			}
+		} else if (argument == "--placement") {
+			if (value == "greedy")
+				job.placement = Settings::PlacementMethod_Greedy;
+			else if (value == "global")
+				job.placement = Settings::PlacementMethod_Global;
+			else if (value == "patchmatch")
+				job.placement = Settings::PlacementMethod_PatchMatch;
+			else {
+				Log::error("Unknown placement method %s", value.c_str());
+
+				return false;
+			}
+		} else if (argument == "--levels") {
+			if (!parseNumber(argument, value, job.levels))
+				return false;
+		} else if (argument == "--candidates") {
+			if (!parseNumber(argument, value, job.candidates))
+				return false;
+		} else if (argument == "--checks") {
+			if (!parseNumber(argument, value, job.checks))
+				return false;
+		} else if (argument == "--memory") {
+			if (!parseNumber(argument, value, job.memory))
+				return false;
+		} else {
+			Log::error("Unknown argument %s", argument.c_str());
+
+			return false;
+		}
+	}
+
+	if (job.sourcePath.empty() || job.targetPath.empty()) {
+		Log::error("Both a source and a target are required");
+
+		return false;
+	}
+
+	return true;
+}
+
+void Batch::usage() {
+	Log::print("Usage: batch --source <path> --target <path> [options]\n");
+	Log::print("  --output <path>       Puzzle image, default puzzle.png\n");
+	Log::print("  --layout <path>       Patch layout, default layout.csv\n");
+	Log::print("  --tile <path>         Converts the source once to a tiled pyramid (.gtti) and reads it on demand\n");
+	Log::print("  --board <path>        Adds a board to the material library next to the source, repeatable\n");
+	Log::print("  --generator <name>    tree, jittered or greedy, default tree\n");
+	Log::print("  --splits <n>          Split rounds of the patch tree, default 50\n");
+	Log::print("  --rotations <n>       Number of source rotations\n");
+	Log::print("  --postscale <factor>  Prescale factor of the largest texture\n");
+	Log::print("  --cache <directory>   Rotated source cache, none disables it, default ../cache\n");
+	Log::print("  --matching <name>     exhaustive, pyramid, index or ssda, default exhaustive\n");
+	Log::print("  --placement <name>    greedy, global or patchmatch, default greedy\n");
+	Log::print("  --levels <n>          Downsampled levels of the pyramid search, default 2\n");
+	Log::print("  --candidates <n>      Candidates verified by the pyramid or index search, default 8\n");
+	Log::print("  --checks <n>          Leafs visited per index query, higher is slower with better recall, default 64\n");
+	Log::print("  --memory <megabytes>  Responses kept by the exhaustive search, larger sources are searched in tiles, default 4096\n");
+	Log::print("  --rotate-templates    Rotate the target patches instead of storing the features of every source rotation\n");
+	Log::print("  --compare             Report latency and placement quality of the pyramid, index or SSDA search against the exhaustive search\n");
+}
+
+int Batch::run(const BatchJob& job) {
+	using Clock = std::chrono::steady_clock;
+	auto elapsed = [](Clock::time_point start) {
+		return std::chrono::duration<double>(Clock::now() - start).count();
+	};
+
+	Clock::time_point start = Clock::now();
+
+	// Load source and target
+	Clock::time_point stage = Clock::now();
+	std::string sourcePath = job.sourcePath;
+	if (!job.tilePath.empty() && !TiledImage::is(sourcePath)) {
+		if (!TiledImage::is(job.tilePath)) {
+			Log::error("Tiled images require the .gtti extension, got %s", job.tilePath.c_str());
+
+			return 1;
+		}
+
+		// The scan is decoded once, later runs only decode the tiles they read
+		if (!std::filesystem::exists(job.tilePath) && !TiledImage::build(cv::imread(sourcePath), job.tilePath)) {
+			Log::error("Failed to convert %s to %s", sourcePath.c_str(), job.tilePath.c_str());
+
+			return 1;
+		}
+
+		sourcePath = job.tilePath;
+	}
+
+	settings.init(sourcePath, job.targetPath);
+	if (settings.originalSourceDimension().x == 0 || settings.originalTarget.data.empty()) {
+		Log::error("Failed to load %s or %s", sourcePath.c_str(), job.targetPath.c_str());
+
+		return 1;
+	}
+
+	if (!job.cacheDirectory.empty())
+		settings.cacheDirectory = job.cacheDirectory == "none" ? "" : job.cacheDirectory;
+
+	// The features are computed by the pipeline, the source only stores the planes of the rotations it matches against
+	bool storedRotationsChanged = settings.source.rotateTemplates != job.rotateTemplates;
+	settings.rotateTemplates = job.rotateTemplates;
+
+	if (storedRotationsChanged || job.rotations > 0 || job.postscale > 0.0f || settings.source.cacheDirectory != settings.cacheDirectory) {
+		if (job.rotations > 0)
+			settings.rotations = job.rotations;
+		if (job.postscale > 0.0f)
+			settings.postscale = job.postscale;
+
+		settings.reloadPrescaledTextures();
+	}
+
+	if (job.matching >= 0)
+		settings.matchingMethod = job.matching;
+	if (job.placement >= 0)
+		settings.placementMethod = job.placement;
+	if (job.levels > 0)
+		settings.pyramidLevels = job.levels;
+	if (job.candidates > 0) {
+		settings.pyramidCandidates = job.candidates;
+		settings.indexCandidates = job.candidates;
+	}
+	if (job.checks > 0)
+		settings.indexChecks = job.checks;
+	if (job.memory > 0) {
+		settings.responseMemory = job.memory;
+		settings.source.matcher.setCapacity(static_cast<std::size_t>(settings.responseMemory) << 20);
+		settings.library.setCapacity(static_cast<std::size_t>(settings.responseMemory) << 20);
+	}
+	Log::info("Loaded textures in %.3fs", elapsed(stage));
+
+	// Preprocessing, features and patch tree root
+	stage = Clock::now();
+	screen.init();
+	Log::info("Preprocessed in %.3fs", elapsed(stage));
+
+	// Material library, boards are prescaled like the source so they are added once the source is loaded
+	if (!job.boardPaths.empty()) {
+		stage = Clock::now();
+		settings.library.clear();
+		if (!settings.library.add(sourcePath))
+			return 1;
+
+		for (const std::string& boardPath : job.boardPaths)
+			if (!settings.library.add(boardPath))
+				return 1;
+		Log::info("Loaded %d boards in %.3fs", static_cast<int>(settings.library.boards.size()), elapsed(stage));
+	}
+
+	// Target patches
+	stage = Clock::now();
+	std::vector<MondriaanPatch> patches = job.generator == -1 ? generateTree(job.splits) : generatePatches(job.generator);
+	Log::info("Generated %d patches in %.3fs", static_cast<int>(patches.size()), elapsed(stage));
+
+	// Matching
+	stage = Clock::now();
+	MatchComparison comparison;
+	settings.puzzle = Texture(cv::Mat(settings.target->rows(), settings.target->cols(), settings.target->data.type(), cv::Scalar(0)));
+
+	std::vector<cv::Rect> patchBounds;
+	for (MondriaanPatch& patch : patches)
+		patchBounds.push_back(patch.targetBounds().cv() & cv::Rect(0, 0, settings.target->cols(), settings.target->rows()));
+
+	// Comparing both searches requires the same reservations for every patch, so nothing is reserved
+	std::vector<MatchCandidate> placements;
+	std::vector<int> boardIndices;
+	if (job.compare) {
+		for (const cv::Rect& bounds : patchBounds)
+			placements.push_back(bounds.empty() ? MatchCandidate() : match(bounds, &comparison));
+	} else if (!settings.library.empty()) {
+		settings.library.clearReservations();
+		for (const MaterialLibrary::Placement& placement : settings.library.match(patchBounds, cv::TM_SQDIFF_NORMED)) {
+			placements.push_back(placement.candidate);
+			boardIndices.push_back(placement.boardIndex);
+		}
+	} else {
+		settings.source.clearReservations();
+		if (settings.placementMethod == Settings::PlacementMethod_Global) {
+			placements = MatchScheduler::assign(patchBounds, cv::TM_SQDIFF_NORMED);
+		} else if (settings.placementMethod == Settings::PlacementMethod_PatchMatch) {
+			PatchMatcher::Parameters parameters;
+			parameters.iterations = settings.patchMatchIterations;
+			parameters.candidates = settings.placementCandidates;
+			placements = PatchMatcher::match(patchBounds, cv::TM_SQDIFF_NORMED, parameters);
+		} else {
+			placements = MatchScheduler::match(patchBounds, cv::TM_SQDIFF_NORMED);
+		}
+	}
+
+	for (std::size_t patchIndex = 0; patchIndex < patches.size(); patchIndex++) {
+		const MatchCandidate& candidate = placements[patchIndex];
+		if (patchBounds[patchIndex].empty())
+			continue;
+
+		if (!candidate.valid()) {
+			Log::error("No patches available");
+
+			continue;
+		}
+
+		MondriaanPatch& patch = patches[patchIndex];
+		patch.sourceOffset = candidate.position;
+		patch.rotationIndex = candidate.rotationIndex;
+
+		// A tiled source is cut from its pyramid
+		cv::Rect sourcePatch(candidate.position.x, candidate.position.y, patchBounds[patchIndex].width, patchBounds[patchIndex].height);
+		cv::Mat material = boardIndices.empty() ? settings.sourcePatch(candidate.rotationIndex, sourcePatch) : settings.library.boards[boardIndices[patchIndex]]->source.patch(candidate.rotationIndex, sourcePatch);
+		material.copyTo(settings.puzzle.data(patchBounds[patchIndex]));
+	}
+	Log::info("Matched in %.3fs", elapsed(stage));
+
+	if (job.compare)
+		comparison.report();
+	if (settings.matchingMethod == Settings::MatchingMethod_Ssda)
+		SsdaMatcher::report();
+	settings.responseCache.report();
+	settings.library.report();
+	if (settings.cacheMatches) {
+		settings.matchCache.report();
+
+		std::uint64_t stateHash = MatchCache::stateHash();
+		if (!settings.cacheDirectory.empty() && stateHash != 0)
+			settings.matchCache.save(MatchCache::path(settings.cacheDirectory, stateHash), stateHash);
+	}
+
+	// Output
+	if (!cv::imwrite(job.outputPath, settings.puzzle.data)) {
+		Log::error("Failed to write %s", job.outputPath.c_str());
+
+		return 1;
+	}
+
+	if (!writeLayout(job.layoutPath, patches, boardIndices)) {
+		Log::error("Failed to write %s", job.layoutPath.c_str());
+
+		return 1;
+	}
+
+	Log::info("Finished %s in %.3fs", job.targetPath.c_str(), elapsed(start));
+
+	return 0;
+}
+
+MatchCandidate Batch::match(const cv::Rect& patchBounds, MatchComparison* comparison) {
+	if (comparison == nullptr)
+		return Utils::computeBestCandidate(patchBounds, cv::TM_SQDIFF_NORMED);
+
+	using Clock = std::chrono::steady_clock;
+
+	Clock::time_point start = Clock::now();
+	MatchCandidate exhaustive = Utils::computeExhaustiveMatch(patchBounds, cv::TM_SQDIFF_NORMED);
+	comparison->exhaustiveTime += std::chrono::duration<double>(Clock::now() - start).count();
+
+	bool index = settings.matchingMethod == Settings::MatchingMethod_Index;
+	bool ssda = settings.matchingMethod == Settings::MatchingMethod_Ssda;
+	comparison->method = index ? "Index" : ssda ? "SSDA" : "Pyramid";
+
+	start = Clock::now();
+	MatchCandidate approximate;
+	if (index)
+		approximate = Utils::computeIndexMatch(patchBounds, cv::TM_SQDIFF_NORMED);
+	else if (ssda)
+		approximate = Utils::computeSsdaMatch(patchBounds, cv::TM_SQDIFF_NORMED);
+	else
+		approximate = Utils::computePyramidMatch(patchBounds, cv::TM_SQDIFF_NORMED);
+	comparison->approximateTime += std::chrono::duration<double>(Clock::now() - start).count();
+
+	if (exhaustive.valid() && approximate.valid()) {
+		comparison->compared++;
+		comparison->scoreDifference += std::abs(approximate.score - exhaustive.score);
+		if (approximate.rotationIndex == exhaustive.rotationIndex && approximate.position == exhaustive.position)
+			comparison->identical++;
+	}
+
+	return settings.matchingMethod == Settings::MatchingMethod_Exhaustive ? exhaustive : approximate;
+}
+
+void MatchComparison::report() const {
+	if (compared == 0)
+		return;
+
+	Log::info("Compared %d patches", compared);
+	Log::info("Exhaustive search %.3fms per patch", 1000.0 * exhaustiveTime / compared);
+	Log::info("%s search %.3fms per patch", method, 1000.0 * approximateTime / compared);
+	Log::info("Mean score difference %.6f, identical placements %.1f%%", scoreDifference / compared, 100.0 * identical / compared);
+}
+
+std::vector<MondriaanPatch> Batch::generateTree(int splits) {
+	for (int split = 0; split < splits; split++)
+		screen.editor.splitPatchesRollingGuidance();
+
+	std::vector<MondriaanPatch> patches;
+	for (const TreeNode<MondriaanPatch>& node : screen.editor.grid.patches)
+		if (node.leaf())
+			patches.push_back(node.patch);
+
+	return patches;
+}
+
+std::vector<MondriaanPatch> Batch::generatePatches(int generator) {
+	return TSPG::get[generator]->generate();
+}
+
+bool Batch::writeLayout(const std::string& path, const std::vector<MondriaanPatch>& patches, const std::vector<int>& boardIndices) {
+	std::ofstream file(path);
+	if (!file.is_open())
+		return false;
+
+	// Target rectangle in pixels, source offset in the rotated source, the rotation in degrees and the board when cut from the library
+	file << "targetX,targetY,width,height,sourceX,sourceY,rotationIndex,rotation";
+	if (!boardIndices.empty())
+		file << ",board";
+	file << '\n';
+	for (std::size_t patchIndex = 0; patchIndex < patches.size(); patchIndex++) {
+		const MondriaanPatch& patch = patches[patchIndex];
+		cv::Rect targetBounds = patch.targetBounds().cv();
+		double rotation = 360.0 / settings.source.rotations * patch.rotationIndex;
+
+		file << targetBounds.x << ',' << targetBounds.y << ',' << targetBounds.width << ',' << targetBounds.height << ','
+			<< patch.sourceOffset.x << ',' << patch.sourceOffset.y << ',' << patch.rotationIndex << ',' << rotation;
+		if (!boardIndices.empty())
+			file << ',' << boardIndices[patchIndex];
+		file << '\n';
+	}
+
+	return file.good();
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "graphics/mondriaanPatch.h"
+#include "matching/matchCandidate.h"
+
+// A single headless run of the full pipeline
+struct BatchJob {
+	std::string sourcePath;
+	std::string targetPath;
+	std::string outputPath = "puzzle.png";
+	std::string layoutPath = "layout.csv";
+	// Tiled image the source is converted to once and loaded from, an existing one is reused. Empty loads the source as is
+	std::string tilePath;
+	// Boards of the material library, the source is added as the first board. Empty cuts every patch from the source
+	std::vector<std::string> boardPaths;
+
+	// Number of split rounds of the patch tree, every round splits up to `nSplits` leafs
+	int splits = 50;
+	// Target space patch generator, -1 uses tree splitting
+	int generator = -1;
+	// Overrides of the default settings, ignored when negative
+	int rotations = -1;
+	float postscale = -1.0f;
+	// Directory of the rotated source cache, empty keeps the default and `none` disables caching
+	std::string cacheDirectory;
+	// Placement search, -1 keeps the default of the settings
+	int matching = -1;
+	int levels = -1;
+	int candidates = -1;
+	int checks = -1;
+	// Assignment of the material to the patches, -1 keeps the default of the settings
+	int placement = -1;
+	// Memory in megabytes for the responses of the exhaustive search, -1 keeps the default of the settings
+	int memory = -1;
+
+	// Matches the rotations by rotating the target patches against the unrotated source features
+	bool rotateTemplates = false;
+
+	// Runs both the exhaustive and the approximate search for every patch and reports their difference
+	bool compare = false;
+};
+
+// Latency and placement quality of the pyramid, index or SSDA search relative to the exhaustive search
+struct MatchComparison {
+	const char* method = "Pyramid";
+	int compared = 0;
+	int identical = 0;
+	double exhaustiveTime = 0.0;
+	double approximateTime = 0.0;
+	double scoreDifference = 0.0;
+
+	void report() const;
+};
+
+// Runs the pipeline from preprocessing up to matching without an OpenGL context or window
+class Batch {
+public:
+	static bool parse(int argc, char** argv, BatchJob& job);
+	static void usage();
+
+	static int run(const BatchJob& job);
+
+private:
+	static std::vector<MondriaanPatch> generateTree(int splits);
+	static std::vector<MondriaanPatch> generatePatches(int generator);
+
+	static MatchCandidate match(const cv::Rect& patchBounds, MatchComparison* comparison);
+
+	static bool writeLayout(const std::string& path, const std::vector<MondriaanPatch>& patches, const std::vector<int>& boardIndices);
+};
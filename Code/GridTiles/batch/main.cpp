@@ -0,0 +1,19 @@
+#include "core.h"
+#include "main.h"
+
+#include "batch.h"
+
+std::mutex MUTEX_RENDER;
+Screen screen;
+Settings settings;
+
+int main(int argc, char** argv) {
+	BatchJob job;
+	if (!Batch::parse(argc, argv, job)) {
+		Batch::usage();
+
+		return 1;
+	}
+
+	return Batch::run(job);
+}
@@ -1,17 +1,208 @@
-
-#include <opencv2/highgui.hpp>
+#include <cfloat>
+#include <cstdio>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc.hpp>
 
+#include "core.h"
 #include "math/utils.h"
+#include "graphics/opencv/sobel.h"
+
+static int failures = 0;
+
+// Reports a comparison and counts it as a failure when the difference exceeds the tolerance
+static void check(const char* name, int method, double difference, double tolerance) {
+	bool passed = difference <= tolerance;
+	if (!passed)
+		failures++;
+
+	printf("%s %d: relative difference %g %s\n", name, method, difference, passed ? "ok" : "FAILED");
+}
 
 int main() {
-	cv::Mat image(10, 10, CV_8UC1, cv::Scalar(255));
-	cv::Mat templ(3, 3, CV_8UC1, cv::Scalar(0));
+	cv::Mat image(120, 160, CV_8UC1);
+	cv::Mat templ(15, 20, CV_8UC1);
+	cv::randu(image, cv::Scalar(0), cv::Scalar(256));
+	cv::randu(templ, cv::Scalar(0), cv::Scalar(256));
+
+	// Only use the pixels of an ellipse, like a rotated patch
+	cv::Mat templMask(templ.rows, templ.cols, CV_8UC1, cv::Scalar(0));
+	cv::ellipse(templMask, cv::Point(templ.cols / 2, templ.rows / 2), cv::Size(templ.cols / 2, templ.rows / 2), 0, 0, 360, cv::Scalar(255), cv::FILLED);
+
+	// Compare against OpenCV for every method
+	for (int method = cv::TM_SQDIFF; method <= cv::TM_CCOEFF_NORMED; method++) {
+		cv::Mat result;
+		cv::Mat expected;
+		Utils::matchTemplate(image, templ, result, method, templMask, cv::Mat());
+		cv::matchTemplate(image, templ, expected, method, templMask);
+
+		double maximum;
+		cv::minMaxLoc(cv::abs(expected), nullptr, &maximum);
+		double difference = cv::norm(result, expected, cv::NORM_INF) / std::max(1.0, maximum);
+		check("Method", method, difference, 1e-4);
+	}
+
+	// Color planes combine their channels like OpenCV, as the intensity feature does with the RGB setting
+	cv::Mat colorImage(image.size(), CV_8UC3);
+	cv::Mat colorTempl(templ.size(), CV_8UC3);
+	cv::randu(colorImage, cv::Scalar::all(0), cv::Scalar::all(256));
+	cv::randu(colorTempl, cv::Scalar::all(0), cv::Scalar::all(256));
+	for (int method = cv::TM_SQDIFF; method <= cv::TM_CCOEFF_NORMED; method++) {
+		cv::Mat result;
+		cv::Mat expected;
+		Utils::matchTemplate(colorImage, colorTempl, result, method, templMask, cv::Mat());
+		cv::matchTemplate(colorImage, colorTempl, expected, method, templMask);
+
+		double maximum;
+		cv::minMaxLoc(cv::abs(expected), nullptr, &maximum);
+		double difference = cv::norm(result, expected, cv::NORM_INF) / std::max(1.0, maximum);
+		check("Color method", method, difference, 1e-4);
+	}
+
+	// The fused response of several features equals the weighted sum of their single responses
+	cv::Mat edges;
+	cv::Mat templEdges;
+	cv::Canny(image, edges, 50, 150);
+	cv::Canny(templ, templEdges, 50, 150);
+	std::vector<float> weights = { 0.7f, 0.3f };
+	for (int method = cv::TM_SQDIFF; method <= cv::TM_CCOEFF_NORMED; method++) {
+		cv::Mat fused;
+		Utils::matchTemplate({ image, edges }, { templ, templEdges }, weights, fused, method, templMask, cv::Mat());
+
+		cv::Mat intensityResponse;
+		cv::Mat edgeResponse;
+		Utils::matchTemplate(image, templ, intensityResponse, method, templMask, cv::Mat());
+		Utils::matchTemplate(edges, templEdges, edgeResponse, method, templMask, cv::Mat());
+		cv::Mat expected = weights[0] * intensityResponse + weights[1] * edgeResponse;
+
+		double maximum;
+		cv::minMaxLoc(cv::abs(expected), nullptr, &maximum);
+		double difference = cv::norm(fused, expected, cv::NORM_INF) / std::max(1.0, maximum);
+		check("Fused method", method, difference, 1e-4);
+	}
+
+	// Gradient features are fused with both components combined, like OpenCV combines the channels of a plane
+	cv::Mat gradientField = Sobel(image, SobelType::GRADIENT, 1, 3).sobel;
+	cv::Rect gradientCrop(37, 41, templ.cols, templ.rows);
+	cv::Mat intensityTempl = image(gradientCrop).clone();
+	cv::Mat gradientTempl = gradientField(gradientCrop).clone();
+	cv::Mat floatField;
+	cv::Mat floatGradientTempl;
+	gradientField.convertTo(floatField, CV_32F);
+	gradientTempl.convertTo(floatGradientTempl, CV_32F);
+	for (int method = cv::TM_SQDIFF; method <= cv::TM_CCOEFF_NORMED; method++) {
+		cv::Mat fused;
+		Utils::matchTemplate({ image, gradientField }, { intensityTempl, gradientTempl }, weights, fused, method, templMask, cv::Mat());
+
+		cv::Mat intensityResponse;
+		cv::Mat gradientResponse;
+		cv::matchTemplate(image, intensityTempl, intensityResponse, method, templMask);
+		cv::matchTemplate(floatField, floatGradientTempl, gradientResponse, method, templMask);
+		cv::Mat expected = weights[0] * intensityResponse + weights[1] * gradientResponse;
+
+		double maximum;
+		cv::minMaxLoc(cv::abs(expected), nullptr, &maximum);
+		double difference = cv::norm(fused, expected, cv::NORM_INF) / std::max(1.0, maximum);
+		check("Gradient feature method", method, difference, 1e-4);
+	}
+
+	// Calibration of quantized gradient planes against float, templates are noisy crops of the image so the best offset is known
+	cv::Mat smooth;
+	cv::Mat gradient;
+	cv::Mat quantizedGradient;
+	cv::GaussianBlur(image, smooth, cv::Size(5, 5), 1.5);
+	cv::Sobel(smooth, gradient, CV_32F, 1, 0);
+	double scale = Utils::quantize(gradient, quantizedGradient);
+
+	cv::RNG random(7);
+	double worstDifference = 0.0;
+	int agreements = 0;
+	int trials = 64;
+	for (int trial = 0; trial < trials; trial++) {
+		cv::Rect crop(random.uniform(0, image.cols - templ.cols), random.uniform(0, image.rows - templ.rows), templ.cols, templ.rows);
+		cv::Mat noise(templ.size(), CV_32F);
+		cv::randn(noise, 0.0, 8.0);
+		cv::Mat floatTempl = gradient(crop) + noise;
+		cv::Mat quantizedTempl;
+		floatTempl.convertTo(quantizedTempl, CV_16S, scale);
+
+		cv::Mat floatResult;
+		cv::Mat quantizedResult;
+		Utils::matchTemplate(gradient, floatTempl, floatResult, cv::TM_SQDIFF_NORMED, templMask, cv::Mat());
+		Utils::matchTemplate(quantizedGradient, quantizedTempl, quantizedResult, cv::TM_SQDIFF_NORMED, templMask, cv::Mat());
+		worstDifference = std::max(worstDifference, cv::norm(floatResult, quantizedResult, cv::NORM_INF));
+
+		cv::Point floatBest;
+		cv::Point quantizedBest;
+		cv::minMaxLoc(floatResult, nullptr, nullptr, &floatBest);
+		cv::minMaxLoc(quantizedResult, nullptr, nullptr, &quantizedBest);
+		if (floatBest == quantizedBest)
+			agreements++;
+	}
+	printf("Quantized gradient: worst difference %g, identical placements %.1f%%\n", worstDifference, 100.0 * agreements / trials);
+	if (worstDifference > 1e-2 || agreements < trials * 95 / 100) {
+		printf("Quantized gradient FAILED\n");
+		failures++;
+	}
+
+	// Steered gradients of saturated edges exceed quantizedMaximum, the integer sums of a large template must not overflow
+	cv::Mat saturated(96, 128, CV_16SC2);
+	cv::randu(saturated, cv::Scalar::all(0), cv::Scalar::all(2));
+	saturated = saturated * (2 * 255 * 8) - cv::Scalar(255 * 8, 255 * 8);
+	cv::Mat steered = Sobel::steer(saturated, cv::getRotationMatrix2D(cv::Point2f(64.0f, 48.0f), 45.0, 1.0));
+
+	double steeredMaximum;
+	cv::minMaxLoc(steered.reshape(1), nullptr, &steeredMaximum);
+	std::vector<cv::Mat> steeredChannels;
+	cv::split(steered, steeredChannels);
+	for (int method = cv::TM_SQDIFF; method <= cv::TM_CCORR_NORMED; method++) {
+		cv::Rect crop(30, 20, 48, 48);
+		cv::Mat integerResult;
+		cv::Mat floatResult;
+		cv::Mat floatImage;
+		cv::Mat floatTempl;
+		steeredChannels[0].convertTo(floatImage, CV_32F);
+		floatImage(crop).copyTo(floatTempl);
+		Utils::matchTemplate(steeredChannels[0], steeredChannels[0](crop).clone(), integerResult, method, cv::Mat(), cv::Mat());
+		Utils::matchTemplate(floatImage, floatTempl, floatResult, method, cv::Mat(), cv::Mat());
+
+		double maximum;
+		cv::minMaxLoc(cv::abs(floatResult), nullptr, &maximum);
+		double difference = cv::norm(integerResult, floatResult, cv::NORM_INF) / std::max(1.0, maximum);
+		check("Steered gradient method", method, difference, 1e-4);
+	}
+	printf("Steered gradient: largest component %g %s\n", steeredMaximum, steeredMaximum > Utils::quantizedMaximum ? "ok" : "FAILED");
+	if (steeredMaximum <= Utils::quantizedMaximum)
+		failures++;
+
+	// Offsets covering unavailable pixels are aborted, the others keep their unmasked score
+	cv::Mat globalMask(image.rows, image.cols, CV_8UC1, cv::Scalar(255));
+	cv::rectangle(globalMask, cv::Rect(40, 40, 60, 30), cv::Scalar(0), cv::FILLED);
 
 	cv::Mat result;
-	Utils::matchTemplate(image, templ, result, 0, cv::Mat(), cv::Mat());
+	cv::Mat unmasked;
+	Utils::matchTemplate(image, templ, result, cv::TM_SQDIFF, templMask, globalMask);
+	Utils::matchTemplate(image, templ, unmasked, cv::TM_SQDIFF, templMask, cv::Mat());
+
+	// Number of used template pixels on unavailable material at every offset
+	cv::Mat unavailable;
+	cv::Mat covered;
+	cv::Mat templWeights;
+	cv::compare(globalMask, 0, unavailable, cv::CMP_EQ);
+	unavailable.convertTo(unavailable, CV_32F, 1.0 / 255.0);
+	templMask.convertTo(templWeights, CV_32F, 1.0 / 255.0);
+	cv::matchTemplate(unavailable, templWeights, covered, cv::TM_CCORR);
+
+	int mismatches = 0;
+	for (int row = 0; row < result.rows; row++) {
+		for (int col = 0; col < result.cols; col++) {
+			float value = result.at<float>(row, col);
+			if (covered.at<float>(row, col) > 0.5f ? value != FLT_MAX : value != unmasked.at<float>(row, col))
+				mismatches++;
+		}
+	}
+	printf("Global mask: %d mismatching offsets %s\n", mismatches, mismatches == 0 ? "ok" : "FAILED");
+	if (mismatches > 0)
+		failures++;
 
-	cv::imshow("result", result);
-	cv::waitKey();
+	return failures == 0 ? 0 : 1;
 }